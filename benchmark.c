@@ -0,0 +1,919 @@
+// Microbenchmarks for the List ADT, ThreadSafeList, MessageQueue, the compression codec and the timer wheel,
+// the latency of a handoff between threads, and a throughput benchmark of the relay
+// Results are written to stdout as one JSON object per line, so runs can be compared between builds
+// Usage: ./benchmark [suite...], where each suite is one of list, threadsafelist, messagequeue, compression,
+// timerwheel, handoff, relay
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "list.h"
+#include "threadsafelist.h"
+#include "messagequeue.h"
+#include "message.h"
+#include "messagepool.h"
+#include "relay.h"
+#include "compression.h"
+#include "timerwheel.h"
+#include "histogram.h"
+#include "lowlatency.h"
+
+// Number of items each list benchmark processes in total, spread over repetitions
+#define LIST_OPS_PER_CASE 4000000
+
+// Number of items each producer thread passes through a shared queue
+#define QUEUE_ITEMS_PER_PRODUCER 200000
+
+// Latency of every n-th item is recorded, to bound the memory used for samples
+#define LATENCY_SAMPLE_INTERVAL 16
+
+// Latency is measured in a run of its own, with a fraction of the items, each producer waiting for its last item
+// to be dequeued before enqueueing the next, so it is the time to hand an item over rather than to wait behind
+// a backlog built up by producers outrunning the consumers
+#define QUEUE_LATENCY_ITEMS_DIVISOR 4
+
+// Largest number of producer threads, with as many consumer threads
+#define MAX_NUM_THREADS 16
+
+// Number of log lines each compression benchmark compresses, one at a time as separate messages
+#define COMPRESSION_NUM_LINES 20000
+
+// Number of timers of the first timer wheel benchmark, and of the last, each run having 4 times more
+#define TIMER_MIN_TIMERS 1024
+#define TIMER_MAX_TIMERS 65536
+
+// Timers are scheduled up to this far ahead, the longest retransmission timeout
+#define TIMER_SPAN_NANOSECONDS 2000000000ULL
+
+// Time the timer wheel benchmarks start at, as if the program had been running a while
+#define TIMER_START_NANOSECONDS 1000000000000ULL
+
+// Number of items handed from one thread to another in each handoff benchmark, one at a time
+#define HANDOFF_NUM_ITEMS 5000
+
+// Time the producer of a handoff benchmark sleeps between items, so the consumer finds the queue empty each time
+#define HANDOFF_INTERVAL_NANOSECONDS 20000
+
+// Number of members sending to the relay, each message being forwarded to all the others
+#define RELAY_NUM_CLIENTS 16
+
+// Time each relay benchmark sends messages for
+#define RELAY_DURATION_NANOSECONDS 1000000000ULL
+
+// Datagrams each member passes to the kernel in one system call
+#define RELAY_SEND_BATCH_SIZE 32
+
+// Bytes of text in each message sent to the relay
+#define RELAY_MESSAGE_LENGTH 64
+
+// Port the relay benchmark binds on the loopback address
+#define RELAY_PORT 47000
+
+// Item passed through queues, carrying the time it was enqueued and the producer that enqueued it
+typedef struct {
+  uint64_t enqueueNanoseconds;
+  int isLatencySample;
+  int producerIndex;
+} QueueItem;
+
+// Number of items of one producer in a queue, on a cache line of its own as its producer and the consumers write it
+typedef struct {
+  int count;
+  char padding[60];
+} QueueInFlight;
+
+// Shared state of a multi-threaded queue benchmark
+typedef struct {
+  ThreadSafeList* pList;
+  MessageQueue* pQueue;
+  QueueItem* pItems;
+  int numProducers;
+  int itemsPerProducer;
+
+  // Most items of a producer in the queue at once, 0 for no limit
+  int maxInFlight;
+
+  // Items of each producer enqueued and not yet dequeued
+  QueueInFlight inFlight[MAX_NUM_THREADS];
+
+  // Total number of items consumed, shared by the consumers
+  int numConsumed;
+  int numToConsume;
+} QueueBenchmark;
+
+// Per-thread arguments and results of a multi-threaded queue benchmark
+typedef struct {
+  QueueBenchmark* pBenchmark;
+  int threadIndex;
+  uint64_t* pLatencies;
+  int numLatencies;
+} QueueThread;
+
+static int s_items[16];
+
+// Returns the current time of the monotonic clock in nanoseconds
+static uint64_t nowNanoseconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+// Items in benchmark lists are not owned by the lists, but by the benchmark that made them
+static void keepItem(void* pItem) {
+  (void) pItem;
+  return;
+}
+
+// Matches no item, so a search visits every node
+static bool matchNothing(void* pItem, void* pComparisonArg) {
+  return pItem == pComparisonArg;
+}
+
+// Orders latencies for qsort
+static int compareLatencies(const void* pFirst, const void* pSecond) {
+  uint64_t first = *(const uint64_t*) pFirst;
+  uint64_t second = *(const uint64_t*) pSecond;
+  return (first > second) - (first < second);
+}
+
+// Creates a list, exiting if no list head is available
+static List* createList() {
+  List* pList = List_create();
+
+  if (pList == NULL) {
+    fputs("[Error]: could not create list\n", stderr);
+    exit(1);
+  }
+
+  return pList;
+}
+
+// Fills pList with size items
+static void fillList(List* pList, int size) {
+  for (int i = 0; i < size; i++) {
+    if (List_append(pList, &s_items[i & 15]) == -1) {
+      fputs("[Error]: could not add item to list\n", stderr);
+      exit(1);
+    }
+  }
+
+  return;
+}
+
+// Prints the result of a single-threaded list benchmark
+static void printListResult(char* benchmarkName, int size, uint64_t numOps, uint64_t elapsedNanoseconds) {
+  double nanosecondsPerOp = (double) elapsedNanoseconds / (double) numOps;
+
+  printf(
+    "{\"benchmark\": \"%s\", \"size\": %d, \"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}\n",
+    benchmarkName, size, (unsigned long long) numOps, nanosecondsPerOp, 1e9 / nanosecondsPerOp
+  );
+  fflush(stdout);
+  return;
+}
+
+// Benchmarks each List operation on lists of the given size
+static void benchmarkListSize(int size) {
+  int repetitions = LIST_OPS_PER_CASE / size;
+  uint64_t numOps = (uint64_t) repetitions * size;
+  uint64_t elapsed[7] = {0, 0, 0, 0, 0, 0, 0};
+  uint64_t start = 0;
+
+  for (int r = 0; r < repetitions; r++) {
+    List* pList = createList();
+
+    // Append size items
+    start = nowNanoseconds();
+    fillList(pList, size);
+    elapsed[0] += nowNanoseconds() - start;
+
+    // Search every node without finding a match
+    start = nowNanoseconds();
+    List_first(pList);
+    List_search(pList, matchNothing, NULL);
+    elapsed[1] += nowNanoseconds() - start;
+
+    // Trim every item
+    start = nowNanoseconds();
+    while (List_trim(pList) != NULL) {
+    }
+    elapsed[2] += nowNanoseconds() - start;
+
+    // Prepend size items
+    start = nowNanoseconds();
+    for (int i = 0; i < size; i++) {
+      List_prepend(pList, &s_items[i & 15]);
+    }
+    elapsed[3] += nowNanoseconds() - start;
+
+    // Remove every item from the front
+    start = nowNanoseconds();
+    List_first(pList);
+    while (List_remove(pList) != NULL) {
+    }
+    elapsed[4] += nowNanoseconds() - start;
+
+    // Concatenate two halves, counted as one operation per concatenation, as it relinks the lists in constant time
+    List* pSecondHalf = createList();
+    fillList(pList, size / 2);
+    fillList(pSecondHalf, size - size / 2);
+    start = nowNanoseconds();
+    List_concat(pList, pSecondHalf);
+    elapsed[5] += nowNanoseconds() - start;
+
+    // Free every node
+    start = nowNanoseconds();
+    List_free(pList, keepItem);
+    elapsed[6] += nowNanoseconds() - start;
+  }
+
+  printListResult("list_append", size, numOps, elapsed[0]);
+  printListResult("list_search", size, numOps, elapsed[1]);
+  printListResult("list_trim", size, numOps, elapsed[2]);
+  printListResult("list_prepend", size, numOps, elapsed[3]);
+  printListResult("list_remove", size, numOps, elapsed[4]);
+  printListResult("list_concat", size, (uint64_t) repetitions, elapsed[5]);
+  printListResult("list_free", size, numOps, elapsed[6]);
+  return;
+}
+
+// Benchmarks the List ADT at several sizes
+static void benchmarkList() {
+  int sizes[] = {16, 256, 4096, 65536, 1048576};
+
+  for (int i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+    benchmarkListSize(sizes[i]);
+  }
+
+  return;
+}
+
+// Pushes this producer's share of the items, stamping each with the time it was enqueued,
+// and waiting while the most items it may have in the queue are still there
+static void* queueProducerThread(void* args) {
+  QueueThread* pThread = args;
+  QueueBenchmark* pBenchmark = pThread->pBenchmark;
+  QueueItem* pItems = pBenchmark->pItems + (size_t) pThread->threadIndex * pBenchmark->itemsPerProducer;
+  int* pInFlight = &pBenchmark->inFlight[pThread->threadIndex].count;
+
+  for (int i = 0; i < pBenchmark->itemsPerProducer; i++) {
+    // Wait for the consumers to take enough of this producer's items, when their number is limited
+    if (pBenchmark->maxInFlight > 0) {
+      while (__atomic_load_n(pInFlight, __ATOMIC_ACQUIRE) >= pBenchmark->maxInFlight) {
+        sched_yield();
+      }
+
+      __atomic_fetch_add(pInFlight, 1, __ATOMIC_RELAXED);
+    }
+
+    pItems[i].producerIndex = pThread->threadIndex;
+    pItems[i].enqueueNanoseconds = pItems[i].isLatencySample ? nowNanoseconds() : 0;
+
+    // Retry while the queue is full
+    while (1) {
+      int status = (pBenchmark->pList != NULL)
+        ? ThreadSafeList_prepend(pBenchmark->pList, &pItems[i])
+        : MessageQueue_push(pBenchmark->pQueue, &pItems[i]);
+
+      if (status == 0) {
+        break;
+      }
+
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+// Records the latency of a consumed item if it is a sample, and lets its producer enqueue another
+static void recordItem(QueueThread* pThread, QueueItem* pItem) {
+  if (pItem->isLatencySample) {
+    pThread->pLatencies[pThread->numLatencies] = nowNanoseconds() - pItem->enqueueNanoseconds;
+    pThread->numLatencies++;
+  }
+
+  if (pThread->pBenchmark->maxInFlight > 0) {
+    __atomic_fetch_sub(&pThread->pBenchmark->inFlight[pItem->producerIndex].count, 1, __ATOMIC_RELEASE);
+  }
+
+  return;
+}
+
+// Takes items until every produced item has been consumed by some consumer
+static void* queueConsumerThread(void* args) {
+  QueueThread* pThread = args;
+  QueueBenchmark* pBenchmark = pThread->pBenchmark;
+  void* ppItems[64];
+
+  while (__atomic_load_n(&pBenchmark->numConsumed, __ATOMIC_RELAXED) < pBenchmark->numToConsume) {
+    int count = 0;
+
+    if (pBenchmark->pList != NULL) {
+      ppItems[0] = ThreadSafeList_trim(pBenchmark->pList);
+      count = (ppItems[0] != NULL) ? 1 : 0;
+    } else {
+      count = MessageQueue_popBatch(pBenchmark->pQueue, ppItems, 64, 1);
+    }
+
+    if (count == 0) {
+      sched_yield();
+      continue;
+    }
+
+    for (int i = 0; i < count; i++) {
+      recordItem(pThread, ppItems[i]);
+    }
+
+    __atomic_fetch_add(&pBenchmark->numConsumed, count, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+// Runs numProducers producers and numConsumers consumers over pBenchmark's queue, recording the latency of every
+// LATENCY_SAMPLE_INTERVAL-th item into pLatencies unless it is NULL
+// Returns the nanoseconds the run took, and stores the number of latencies recorded in pNumLatencies
+static uint64_t runQueueThreads(QueueBenchmark* pBenchmark, int numProducers, int numConsumers, uint64_t* pLatencies, int* pNumLatencies) {
+  int numItems = numProducers * pBenchmark->itemsPerProducer;
+  pthread_t producers[MAX_NUM_THREADS];
+  pthread_t consumers[MAX_NUM_THREADS];
+  QueueThread producerThreads[MAX_NUM_THREADS];
+  QueueThread consumerThreads[MAX_NUM_THREADS];
+
+  pBenchmark->numProducers = numProducers;
+  pBenchmark->numConsumed = 0;
+  pBenchmark->numToConsume = numItems;
+  memset(pBenchmark->inFlight, 0, sizeof(pBenchmark->inFlight));
+  pBenchmark->pItems = calloc(numItems, sizeof(QueueItem));
+
+  if (pBenchmark->pItems == NULL) {
+    fputs("[Error]: could not allocate benchmark items\n", stderr);
+    exit(1);
+  }
+
+  for (int i = 0; i < numItems && pLatencies != NULL; i += LATENCY_SAMPLE_INTERVAL) {
+    pBenchmark->pItems[i].isLatencySample = 1;
+  }
+
+  for (int i = 0; i < numConsumers; i++) {
+    consumerThreads[i].pBenchmark = pBenchmark;
+    consumerThreads[i].threadIndex = i;
+    consumerThreads[i].numLatencies = 0;
+    consumerThreads[i].pLatencies = malloc(sizeof(uint64_t) * (numItems / LATENCY_SAMPLE_INTERVAL + 1));
+
+    if (consumerThreads[i].pLatencies == NULL) {
+      fputs("[Error]: could not allocate latency samples\n", stderr);
+      exit(1);
+    }
+  }
+
+  uint64_t start = nowNanoseconds();
+
+  for (int i = 0; i < numConsumers; i++) {
+    pthread_create(&consumers[i], NULL, queueConsumerThread, &consumerThreads[i]);
+  }
+
+  for (int i = 0; i < numProducers; i++) {
+    producerThreads[i].pBenchmark = pBenchmark;
+    producerThreads[i].threadIndex = i;
+    pthread_create(&producers[i], NULL, queueProducerThread, &producerThreads[i]);
+  }
+
+  for (int i = 0; i < numProducers; i++) {
+    pthread_join(producers[i], NULL);
+  }
+
+  for (int i = 0; i < numConsumers; i++) {
+    pthread_join(consumers[i], NULL);
+  }
+
+  uint64_t elapsed = nowNanoseconds() - start;
+
+  // Gather every consumer's samples
+  *pNumLatencies = 0;
+
+  for (int i = 0; i < numConsumers; i++) {
+    if (pLatencies != NULL) {
+      memcpy(pLatencies + *pNumLatencies, consumerThreads[i].pLatencies, sizeof(uint64_t) * consumerThreads[i].numLatencies);
+      *pNumLatencies += consumerThreads[i].numLatencies;
+    }
+
+    free(consumerThreads[i].pLatencies);
+  }
+
+  free(pBenchmark->pItems);
+  pBenchmark->pItems = NULL;
+  return elapsed;
+}
+
+// Runs numProducers producers and numConsumers consumers over pBenchmark's queue, then prints the throughput
+// with the producers enqueueing as fast as they can, and the percentiles of the time from enqueueing an item
+// to dequeueing it with one item of each producer in the queue at a time
+static void runQueueBenchmark(QueueBenchmark* pBenchmark, char* benchmarkName, int numProducers, int numConsumers) {
+  int itemsPerProducer = pBenchmark->itemsPerProducer;
+  int numItems = numProducers * itemsPerProducer;
+  int numLatencies = 0;
+
+  pBenchmark->maxInFlight = 0;
+  uint64_t elapsed = runQueueThreads(pBenchmark, numProducers, numConsumers, NULL, &numLatencies);
+
+  pBenchmark->maxInFlight = 1;
+  pBenchmark->itemsPerProducer = itemsPerProducer / QUEUE_LATENCY_ITEMS_DIVISOR;
+  uint64_t* pLatencies = malloc(sizeof(uint64_t) * (numItems / LATENCY_SAMPLE_INTERVAL + 1));
+
+  if (pLatencies == NULL) {
+    fputs("[Error]: could not allocate latency samples\n", stderr);
+    exit(1);
+  }
+
+  runQueueThreads(pBenchmark, numProducers, numConsumers, pLatencies, &numLatencies);
+  pBenchmark->itemsPerProducer = itemsPerProducer;
+
+  qsort(pLatencies, numLatencies, sizeof(uint64_t), compareLatencies);
+
+  printf(
+    "{\"benchmark\": \"%s\", \"producers\": %d, \"consumers\": %d, \"ops\": %d, \"ops_per_sec\": %.0f, "
+    "\"handoff_p50_ns\": %llu, \"handoff_p99_ns\": %llu, \"handoff_p999_ns\": %llu, \"handoff_max_ns\": %llu}\n",
+    benchmarkName, numProducers, numConsumers, numItems, numItems * 1e9 / (double) elapsed,
+    (unsigned long long) pLatencies[numLatencies / 2],
+    (unsigned long long) pLatencies[(int) (numLatencies * 0.99)],
+    (unsigned long long) pLatencies[(int) (numLatencies * 0.999)],
+    (unsigned long long) pLatencies[numLatencies - 1]
+  );
+  fflush(stdout);
+
+  free(pLatencies);
+  return;
+}
+
+// Benchmarks ThreadSafeList shared by 1 to 16 producers and as many consumers
+static void benchmarkThreadSafeList() {
+  QueueBenchmark benchmark;
+  benchmark.pQueue = NULL;
+
+  for (int numThreads = 1; numThreads <= MAX_NUM_THREADS; numThreads *= 2) {
+    benchmark.pList = ThreadSafeList_create();
+    benchmark.itemsPerProducer = QUEUE_ITEMS_PER_PRODUCER / numThreads;
+    runQueueBenchmark(&benchmark, "threadsafelist_mpmc", numThreads, numThreads);
+    ThreadSafeList_free(benchmark.pList, keepItem);
+  }
+
+  return;
+}
+
+// Benchmarks MessageQueue with each backend between one producer and one consumer
+static void benchmarkMessageQueue() {
+  QueueBenchmark benchmark;
+  benchmark.pList = NULL;
+  benchmark.itemsPerProducer = QUEUE_ITEMS_PER_PRODUCER * 4;
+
+  benchmark.pQueue = MessageQueue_create(MESSAGE_QUEUE_LIST);
+  runQueueBenchmark(&benchmark, "messagequeue_spsc_list", 1, 1);
+  MessageQueue_free(benchmark.pQueue, keepItem);
+
+  benchmark.pQueue = MessageQueue_create(MESSAGE_QUEUE_RING);
+  runQueueBenchmark(&benchmark, "messagequeue_spsc_ring", 1, 1);
+  MessageQueue_free(benchmark.pQueue, keepItem);
+
+  return;
+}
+
+// Fills pLine with a line like those of a service's log, and returns its length
+static int makeLogLine(char* pLine, int size, int index) {
+  static char* levels[] = {"INFO", "INFO", "WARN", "DEBUG", "ERROR"};
+  static char* modules[] = {"scheduler", "net.http", "db.pool", "auth", "cache"};
+
+  return snprintf(
+    pLine, size, "2026-10-16T09:%02d:%02d.%03dZ %s [%s] request id=%d user=user%d latency_ms=%d status=%d",
+    index / 60 % 60, index % 60, rand() % 1000, levels[rand() % 5], modules[rand() % 5],
+    1000 + rand() % 99000, 1 + rand() % 40, 1 + rand() % 900, (rand() % 4 == 0) ? 500 : 200
+  );
+}
+
+// Measures the compression of log lines sent one per datagram, each alone or with a dictionary of the lines before it
+static void runCompressionBenchmark(bool isUsingDictionary) {
+  static char buffer[COMPRESSION_DICTIONARY_SIZE + MESSAGE_DATAGRAM_MAX_SIZE];
+  static char decompressed[COMPRESSION_DICTIONARY_SIZE + MESSAGE_DATAGRAM_MAX_SIZE];
+  static char compressed[MESSAGE_DATAGRAM_MAX_SIZE];
+  char line[256];
+  CompressionTable table;
+  CompressionHistory* pHistory = CompressionHistory_create();
+  unsigned long long numBytesBefore = 0;
+  unsigned long long numBytesAfter = 0;
+  uint64_t compressionTime = 0;
+  uint64_t decompressionTime = 0;
+  int numIncompressible = 0;
+
+  if (pHistory == NULL) {
+    fputs("Could not create compression history\n", stderr);
+    exit(1);
+  }
+
+  srand(1);
+
+  for (int i = 0; i < COMPRESSION_NUM_LINES; i++) {
+    int length = makeLogLine(line, sizeof(line), i);
+
+    // Taking the dictionary and preparing it are part of the cost, as the sender does both
+    uint64_t start = nowNanoseconds();
+    int dictionaryLength = isUsingDictionary ? CompressionHistory_copyDictionary(pHistory, pHistory->numBytes, buffer) : 0;
+    memcpy(buffer + dictionaryLength, line, length);
+    Compression_prepare(&table, buffer, dictionaryLength);
+    int compressedLength = Compression_compress(&table, buffer, dictionaryLength, length, compressed, length - 1);
+    compressionTime += nowNanoseconds() - start;
+
+    numBytesBefore += length;
+
+    if (compressedLength == -1) {
+      numIncompressible++;
+      numBytesAfter += length;
+    } else {
+      start = nowNanoseconds();
+      memcpy(decompressed, buffer, dictionaryLength);
+
+      if (Compression_decompress(compressed, compressedLength, decompressed, dictionaryLength, length) == -1 ||
+          memcmp(decompressed, buffer, dictionaryLength + length) != 0) {
+        fputs("Compressed line did not decompress to itself\n", stderr);
+        exit(1);
+      }
+
+      decompressionTime += nowNanoseconds() - start;
+      numBytesAfter += compressedLength;
+    }
+
+    CompressionHistory_add(pHistory, buffer + dictionaryLength, length);
+  }
+
+  printf(
+    "{\"benchmark\": \"compression_log_lines\", \"dictionary\": %s, \"messages\": %d, \"incompressible\": %d, "
+    "\"bytes_before\": %llu, \"bytes_after\": %llu, \"ratio\": %.2f, \"compress_ns_per_message\": %.0f, \"decompress_ns_per_message\": %.0f}\n",
+    isUsingDictionary ? "true" : "false", COMPRESSION_NUM_LINES, numIncompressible, numBytesBefore, numBytesAfter,
+    (double) numBytesBefore / numBytesAfter, (double) compressionTime / COMPRESSION_NUM_LINES,
+    (double) decompressionTime / COMPRESSION_NUM_LINES
+  );
+  fflush(stdout);
+
+  CompressionHistory_free(pHistory);
+  return;
+}
+
+// Benchmarks the compression of log lines without and with a dictionary
+static void benchmarkCompression() {
+  runCompressionBenchmark(false);
+  runCompressionBenchmark(true);
+  return;
+}
+
+// Counts a timer expiring
+static void countExpiry(void* pContext) {
+  int* pNumExpired = pContext;
+  (*pNumExpired)++;
+  return;
+}
+
+// Measures a timer wheel with numTimers timers as the reliability layer uses it: every timer is scheduled
+// at most 2 seconds ahead, moved once as if its message were sent again, and every other one cancelled as if
+// acknowledged, then the wheel is advanced a tick at a time, asking for the next timeout each time, until
+// the rest expire
+static void runTimerWheelBenchmark(int numTimers) {
+  TimerWheel* pWheel = malloc(sizeof(TimerWheel));
+  Timer* pTimers = malloc(sizeof(Timer) * numTimers);
+  uint64_t* pDeadlines = malloc(sizeof(uint64_t) * numTimers);
+  uint64_t now = TIMER_START_NANOSECONDS;
+  int numExpired = 0;
+  int numTicks = 0;
+
+  if (pWheel == NULL || pTimers == NULL || pDeadlines == NULL) {
+    fputs("Could not allocate timers\n", stderr);
+    exit(1);
+  }
+
+  srand(1);
+  TimerWheel_init(pWheel, now);
+
+  for (int i = 0; i < numTimers; i++) {
+    Timer_init(&pTimers[i], countExpiry, &numExpired);
+    pDeadlines[i] = now + (uint64_t) rand() % TIMER_SPAN_NANOSECONDS;
+  }
+
+  uint64_t start = nowNanoseconds();
+
+  for (int i = 0; i < numTimers; i++) {
+    TimerWheel_schedule(pWheel, &pTimers[i], pDeadlines[i]);
+  }
+
+  uint64_t scheduleTime = nowNanoseconds() - start;
+  start = nowNanoseconds();
+
+  for (int i = 0; i < numTimers; i++) {
+    TimerWheel_schedule(pWheel, &pTimers[i], pDeadlines[numTimers - 1 - i]);
+  }
+
+  uint64_t rescheduleTime = nowNanoseconds() - start;
+  start = nowNanoseconds();
+
+  for (int i = 0; i < numTimers; i += 2) {
+    TimerWheel_cancel(pWheel, &pTimers[i]);
+  }
+
+  uint64_t cancelTime = nowNanoseconds() - start;
+  start = nowNanoseconds();
+
+  while (TimerWheel_getTimeout(pWheel, now) != -1) {
+    now += TIMER_WHEEL_TICK;
+    TimerWheel_advance(pWheel, now);
+    numTicks++;
+  }
+
+  uint64_t advanceTime = nowNanoseconds() - start;
+
+  printf(
+    "{\"benchmark\": \"timer_wheel\", \"timers\": %d, \"schedule_ns\": %.1f, \"reschedule_ns\": %.1f, \"cancel_ns\": %.1f, "
+    "\"ticks\": %d, \"expired\": %d, \"advance_ns_per_tick\": %.1f, \"advance_ns_per_expiry\": %.1f}\n",
+    numTimers, (double) scheduleTime / numTimers, (double) rescheduleTime / numTimers,
+    (double) cancelTime / ((numTimers + 1) / 2), numTicks, numExpired, (double) advanceTime / numTicks,
+    (double) advanceTime / numExpired
+  );
+  fflush(stdout);
+
+  free(pDeadlines);
+  free(pTimers);
+  free(pWheel);
+  return;
+}
+
+// Benchmarks timer wheels from TIMER_MIN_TIMERS to TIMER_MAX_TIMERS timers, whose costs should not grow with the number
+static void benchmarkTimerWheel() {
+  for (int numTimers = TIMER_MIN_TIMERS; numTimers <= TIMER_MAX_TIMERS; numTimers *= 4) {
+    runTimerWheelBenchmark(numTimers);
+  }
+
+  return;
+}
+
+// Binds a socket to port on the loopback address, shared with the other sockets on it, or to any free port for 0
+static int bindLoopbackSocket(int port) {
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int socketDescriptor = socket(PF_INET, SOCK_DGRAM, 0);
+  int isEnabled = 1;
+
+  if (socketDescriptor == -1 || setsockopt(socketDescriptor, SOL_SOCKET, SO_REUSEPORT, &isEnabled, sizeof(isEnabled)) == -1
+    || bind(socketDescriptor, (struct sockaddr*) &address, sizeof(address)) == -1) {
+    fputs("Could not bind benchmark socket\n", stderr);
+    exit(1);
+  }
+
+  return socketDescriptor;
+}
+
+// Measures the messages a relay with numWorkers workers forwards per second, while every member sends
+// unreliable messages to it as fast as it can
+static void runRelayBenchmark(int numWorkers) {
+  RelayArguments arguments;
+  int clientDescriptors[RELAY_NUM_CLIENTS];
+
+  arguments.numWorkers = numWorkers;
+  arguments.isReliable = false;
+  arguments.isQuiet = true;
+
+  for (int i = 0; i < numWorkers; i++) {
+    arguments.socketDescriptors[i] = bindLoopbackSocket(RELAY_PORT);
+  }
+
+  for (int i = 0; i < RELAY_NUM_CLIENTS; i++) {
+    clientDescriptors[i] = bindLoopbackSocket(0);
+  }
+
+  // Every datagram is the same single-fragment message, as the relay does not look at the text
+  Message* pMessage = MessagePool_alloc();
+  MessageHeader header;
+  char text[RELAY_MESSAGE_LENGTH];
+  memset(text, 'x', sizeof(text));
+
+  pMessage->length = RELAY_MESSAGE_LENGTH;
+  pMessage->flags = MESSAGE_FLAG_FIRST_SEGMENT | MESSAGE_FLAG_LAST_SEGMENT;
+  pMessage->sequence = 0;
+  pMessage->messageId = 0;
+  pMessage->fragmentIndex = 0;
+  pMessage->fragmentCount = 1;
+  Message_encodeHeader(pMessage, &header);
+  MessagePool_recycle(pMessage);
+
+  struct sockaddr_in relayAddress;
+  memset(&relayAddress, 0, sizeof(relayAddress));
+  relayAddress.sin_family = AF_INET;
+  relayAddress.sin_port = htons(RELAY_PORT);
+  relayAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  struct iovec parts[2] = {{&header, MESSAGE_HEADER_SIZE}, {text, RELAY_MESSAGE_LENGTH}};
+  struct mmsghdr datagrams[RELAY_SEND_BATCH_SIZE];
+  memset(datagrams, 0, sizeof(datagrams));
+
+  for (int i = 0; i < RELAY_SEND_BATCH_SIZE; i++) {
+    datagrams[i].msg_hdr.msg_name = &relayAddress;
+    datagrams[i].msg_hdr.msg_namelen = sizeof(relayAddress);
+    datagrams[i].msg_hdr.msg_iov = parts;
+    datagrams[i].msg_hdr.msg_iovlen = 2;
+  }
+
+  Relay_start(&arguments);
+
+  // Each member joins with one message, then waits for every other to join
+  for (int i = 0; i < RELAY_NUM_CLIENTS; i++) {
+    sendmmsg(clientDescriptors[i], datagrams, 1, 0);
+  }
+
+  struct timespec joinDelay = {0, 50000000};
+  nanosleep(&joinDelay, NULL);
+
+  uint64_t numSent = 0;
+  uint64_t start = nowNanoseconds();
+  uint64_t elapsed = 0;
+
+  while (elapsed < RELAY_DURATION_NANOSECONDS) {
+    for (int i = 0; i < RELAY_NUM_CLIENTS; i++) {
+      int status = sendmmsg(clientDescriptors[i], datagrams, RELAY_SEND_BATCH_SIZE, 0);
+
+      if (status > 0) {
+        numSent += status;
+      }
+    }
+
+    elapsed = nowNanoseconds() - start;
+  }
+
+  Relay_stop();
+
+  RelayStatistics statistics;
+  Relay_getStatistics(&statistics);
+  double seconds = (double) elapsed / 1e9;
+
+  printf("{\"benchmark\": \"relay_forward\", \"workers\": %d, \"clients\": %d, \"messages_sent\": %llu, "
+    "\"messages_received\": %lu, \"messages_forwarded\": %lu, \"forwarded_per_sec\": %.0f, \"datagrams_per_send_call\": %.2f}\n",
+    numWorkers, RELAY_NUM_CLIENTS, (unsigned long long) numSent, statistics.numMessagesReceived - RELAY_NUM_CLIENTS,
+    statistics.numMessagesForwarded, (double) statistics.numMessagesForwarded / seconds,
+    (statistics.numSendCalls == 0) ? 0.0 : (double) statistics.numDatagramsSent / statistics.numSendCalls);
+  fflush(stdout);
+
+  for (int i = 0; i < numWorkers; i++) {
+    close(arguments.socketDescriptors[i]);
+  }
+
+  for (int i = 0; i < RELAY_NUM_CLIENTS; i++) {
+    close(clientDescriptors[i]);
+  }
+
+  return;
+}
+
+// Pushes the handoff benchmark's items one at a time, stamping each with the time it was enqueued
+static void* handoffProducerThread(void* args) {
+  QueueBenchmark* pBenchmark = args;
+  struct timespec interval = {0, HANDOFF_INTERVAL_NANOSECONDS};
+
+  for (int i = 0; i < HANDOFF_NUM_ITEMS; i++) {
+    nanosleep(&interval, NULL);
+    pBenchmark->pItems[i].enqueueNanoseconds = nowNanoseconds();
+    MessageQueue_push(pBenchmark->pQueue, &pBenchmark->pItems[i]);
+  }
+
+  return NULL;
+}
+
+// Measures the latency of handing items one at a time from a producer to a consumer waiting for each,
+// as the receiver thread does to the output thread, and the CPU time the consumer takes per item
+static void runHandoffBenchmark(MessageQueueType type, uint64_t spinTime) {
+  static QueueItem items[HANDOFF_NUM_ITEMS];
+  static Histogram latencies;
+  QueueBenchmark benchmark;
+  pthread_t producer;
+  struct timespec cpuStart;
+  struct timespec cpuEnd;
+  void* ppItems[64];
+  int numConsumed = 0;
+
+  benchmark.pQueue = MessageQueue_create(type);
+  benchmark.pItems = items;
+  MessageQueue_setSpinTime(benchmark.pQueue, spinTime);
+  Histogram_init(&latencies);
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+  pthread_create(&producer, NULL, handoffProducerThread, &benchmark);
+
+  while (numConsumed < HANDOFF_NUM_ITEMS) {
+    int count = MessageQueue_popBatch(benchmark.pQueue, ppItems, 64, MESSAGE_QUEUE_WAIT_FOREVER);
+    uint64_t now = nowNanoseconds();
+
+    for (int i = 0; i < count; i++) {
+      Histogram_record(&latencies, now - ((QueueItem*) ppItems[i])->enqueueNanoseconds);
+    }
+
+    numConsumed += count;
+  }
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+  pthread_join(producer, NULL);
+
+  uint64_t cpuTime = (uint64_t) (cpuEnd.tv_sec - cpuStart.tv_sec) * 1000000000 + cpuEnd.tv_nsec - cpuStart.tv_nsec;
+
+  printf(
+    "{\"benchmark\": \"handoff_%s\", \"spin_ns\": %llu, \"items\": %d, \"spins\": %lu, \"spins_succeeded\": %lu, "
+    "\"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"consumer_cpu_ns_per_item\": %.0f}\n",
+    (type == MESSAGE_QUEUE_RING) ? "ring" : "list", (unsigned long long) spinTime, HANDOFF_NUM_ITEMS,
+    MessageQueue_spinCount(benchmark.pQueue), MessageQueue_spinSuccessCount(benchmark.pQueue),
+    (unsigned long long) Histogram_getPercentile(&latencies, 0.5), (unsigned long long) Histogram_getPercentile(&latencies, 0.99),
+    (unsigned long long) latencies.max, (double) cpuTime / HANDOFF_NUM_ITEMS
+  );
+  fflush(stdout);
+
+  MessageQueue_free(benchmark.pQueue, keepItem);
+  return;
+}
+
+// Benchmarks handing items over with each backend, with the consumer sleeping straight away and spinning first
+static void benchmarkHandoff() {
+  runHandoffBenchmark(MESSAGE_QUEUE_LIST, 0);
+  runHandoffBenchmark(MESSAGE_QUEUE_LIST, LOW_LATENCY_SPIN_TIME);
+  runHandoffBenchmark(MESSAGE_QUEUE_RING, 0);
+  runHandoffBenchmark(MESSAGE_QUEUE_RING, LOW_LATENCY_SPIN_TIME);
+  return;
+}
+
+// Benchmarks the relay with 1 worker, doubling up to one per core
+static void benchmarkRelay() {
+  long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+  int maxWorkers = (numCores < 1) ? 1 : (numCores > RELAY_MAX_WORKERS) ? RELAY_MAX_WORKERS : (int) numCores;
+
+  MessagePool_init(MESSAGE_DATA_MAX_SIZE);
+
+  for (int numWorkers = 1; numWorkers < maxWorkers; numWorkers *= 2) {
+    runRelayBenchmark(numWorkers);
+  }
+
+  runRelayBenchmark(maxWorkers);
+  MessagePool_cleanup();
+  return;
+}
+
+// Returns true if suiteName was requested, or if no suites were named
+static bool suiteRequested(int argc, char* argv[], char* suiteName) {
+  if (argc < 2) {
+    return true;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], suiteName) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Main program
+int main(int argc, char* argv[]) {
+  if (suiteRequested(argc, argv, "list")) {
+    benchmarkList();
+  }
+
+  if (suiteRequested(argc, argv, "threadsafelist")) {
+    benchmarkThreadSafeList();
+  }
+
+  if (suiteRequested(argc, argv, "messagequeue")) {
+    benchmarkMessageQueue();
+  }
+
+  if (suiteRequested(argc, argv, "compression")) {
+    benchmarkCompression();
+  }
+
+  if (suiteRequested(argc, argv, "timerwheel")) {
+    benchmarkTimerWheel();
+  }
+
+  if (suiteRequested(argc, argv, "handoff")) {
+    benchmarkHandoff();
+  }
+
+  if (suiteRequested(argc, argv, "relay")) {
+    benchmarkRelay();
+  }
+
+  ThreadSafeList_cleanup();
+  return 0;
+}
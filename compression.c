@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <string.h>
+#include "compression.h"
+
+// Number of bits of an entry of the table, COMPRESSION_TABLE_SIZE being 2 to that power
+#define TABLE_INDEX_BITS 12
+
+// A length of 15 or more is carried partly in the token, and the rest in the bytes after it
+#define LENGTH_IN_TOKEN_MAX 15
+
+// Reads 4 bytes from pBytes, which may not be aligned
+static uint32_t read32(const uint8_t* pBytes) {
+  uint32_t value;
+  memcpy(&value, pBytes, sizeof(value));
+  return value;
+}
+
+// Returns the entry of the table for 4 bytes
+static int getTableIndex(uint32_t sequence) {
+  return (int) ((sequence * 2654435761U) >> (32 - TABLE_INDEX_BITS));
+}
+
+// Stores the part of a length beyond the token at pOutput, as bytes of 255 followed by the rest
+// Returns the number of bytes stored
+static int writeLength(uint8_t* pOutput, int length) {
+  int size = 0;
+
+  while (length >= 255) {
+    pOutput[size] = 255;
+    size++;
+    length -= 255;
+  }
+
+  pOutput[size] = (uint8_t) length;
+  return size + 1;
+}
+
+// Adds a sequence of literals and a match to the output, which has size bytes of capacity used
+// A match of length 0 ends the data, with literals only
+// Returns the new size of the output, or -1 if the sequence does not fit
+static int writeSequence(uint8_t* pOutput, int size, int capacity, const uint8_t* pLiterals, int numLiterals, int offset, int matchLength) {
+  int extraMatchLength = (matchLength > 0) ? matchLength - COMPRESSION_MIN_MATCH : 0;
+
+  // The most the sequence can take, with a byte for every 255 of a long length
+  if (size + 1 + numLiterals / 255 + 1 + numLiterals + 2 + extraMatchLength / 255 + 1 > capacity) {
+    return -1;
+  }
+
+  uint8_t* pToken = &pOutput[size];
+  int literalsInToken = (numLiterals < LENGTH_IN_TOKEN_MAX) ? numLiterals : LENGTH_IN_TOKEN_MAX;
+  int matchInToken = (extraMatchLength < LENGTH_IN_TOKEN_MAX) ? extraMatchLength : LENGTH_IN_TOKEN_MAX;
+
+  *pToken = (uint8_t) (literalsInToken << 4 | matchInToken);
+  size++;
+
+  if (literalsInToken == LENGTH_IN_TOKEN_MAX) {
+    size += writeLength(&pOutput[size], numLiterals - LENGTH_IN_TOKEN_MAX);
+  }
+
+  memcpy(&pOutput[size], pLiterals, numLiterals);
+  size += numLiterals;
+
+  if (matchLength == 0) {
+    return size;
+  }
+
+  pOutput[size] = (uint8_t) (offset & 0xff);
+  pOutput[size + 1] = (uint8_t) (offset >> 8);
+  size += 2;
+
+  if (matchInToken == LENGTH_IN_TOKEN_MAX) {
+    size += writeLength(&pOutput[size], extraMatchLength - LENGTH_IN_TOKEN_MAX);
+  }
+
+  return size;
+}
+
+// Reads the part of a length beyond the token, adding it to *pLength
+// Returns the new position in the input, or -1 if the input ends first
+static int readLength(const uint8_t* pInput, int position, int inputLength, int* pLength) {
+  uint8_t byte;
+
+  do {
+    if (position >= inputLength) {
+      return -1;
+    }
+
+    byte = pInput[position];
+    position++;
+    *pLength += byte;
+  } while (byte == 255);
+
+  return position;
+}
+
+// Fills pTable with the positions in the dictionary, the first dictionaryLength bytes of pBuffer.
+void Compression_prepare(CompressionTable* pTable, char* pBuffer, int dictionaryLength) {
+  const uint8_t* pBytes = (const uint8_t*) pBuffer;
+
+  memset(pTable, 0, sizeof(CompressionTable));
+
+  for (int position = 0; position + COMPRESSION_MIN_MATCH <= dictionaryLength; position++) {
+    pTable->positions[getTableIndex(read32(pBytes + position))] = (uint16_t) (position + 1);
+  }
+
+  return;
+}
+
+// Compresses the length bytes of pBuffer after its dictionary into pOutput, which has room for capacity bytes,
+// using pTable as filled by Compression_prepare for that dictionary, and changing it.
+// Returns the number of bytes stored, or -1 if the compressed data does not fit.
+int Compression_compress(CompressionTable* pTable, char* pBuffer, int dictionaryLength, int length, char* pOutput, int capacity) {
+  const uint8_t* pBytes = (const uint8_t*) pBuffer;
+  uint8_t* pOutputBytes = (uint8_t*) pOutput;
+  int end = dictionaryLength + length;
+  int position = dictionaryLength;
+  int literalStart = position;
+  int size = 0;
+
+  // Positions are kept in 16 bits
+  if (capacity <= 0 || end >= UINT16_MAX) {
+    return -1;
+  }
+
+  while (position + COMPRESSION_MIN_MATCH <= end) {
+    uint32_t sequence = read32(pBytes + position);
+    int index = getTableIndex(sequence);
+    int candidate = pTable->positions[index] - 1;
+
+    pTable->positions[index] = (uint16_t) (position + 1);
+
+    if (candidate < 0 || position - candidate > COMPRESSION_MAX_OFFSET || read32(pBytes + candidate) != sequence) {
+      position++;
+      continue;
+    }
+
+    int matchLength = COMPRESSION_MIN_MATCH;
+
+    while (position + matchLength < end && pBytes[candidate + matchLength] == pBytes[position + matchLength]) {
+      matchLength++;
+    }
+
+    size = writeSequence(pOutputBytes, size, capacity, pBytes + literalStart, position - literalStart, position - candidate, matchLength);
+
+    if (size == -1) {
+      return -1;
+    }
+
+    position += matchLength;
+    literalStart = position;
+
+    // Remember a position inside the match as well, which later repeats of it often start at
+    if (position + 2 <= end) {
+      pTable->positions[getTableIndex(read32(pBytes + position - 2))] = (uint16_t) (position - 1);
+    }
+  }
+
+  // The data always ends with a sequence of literals only, possibly none
+  return writeSequence(pOutputBytes, size, capacity, pBytes + literalStart, end - literalStart, 0, 0);
+}
+
+// Decompresses the inputLength bytes of pInput into pBuffer after its dictionary, its first dictionaryLength bytes.
+// Returns 0 if the data decompressed into exactly length bytes, or -1 if it is malformed.
+int Compression_decompress(char* pInput, int inputLength, char* pBuffer, int dictionaryLength, int length) {
+  const uint8_t* pInputBytes = (const uint8_t*) pInput;
+  uint8_t* pBytes = (uint8_t*) pBuffer;
+  int end = dictionaryLength + length;
+  int position = dictionaryLength;
+  int inputPosition = 0;
+
+  while (inputPosition < inputLength) {
+    uint8_t token = pInputBytes[inputPosition];
+    int numLiterals = token >> 4;
+    inputPosition++;
+
+    if (numLiterals == LENGTH_IN_TOKEN_MAX) {
+      inputPosition = readLength(pInputBytes, inputPosition, inputLength, &numLiterals);
+
+      if (inputPosition == -1) {
+        return -1;
+      }
+    }
+
+    if (numLiterals > inputLength - inputPosition || numLiterals > end - position) {
+      return -1;
+    }
+
+    memcpy(&pBytes[position], &pInputBytes[inputPosition], numLiterals);
+    position += numLiterals;
+    inputPosition += numLiterals;
+
+    // The last sequence has literals only
+    if (inputPosition == inputLength) {
+      break;
+    }
+
+    if (inputLength - inputPosition < 2) {
+      return -1;
+    }
+
+    int offset = pInputBytes[inputPosition] | pInputBytes[inputPosition + 1] << 8;
+    int matchLength = (token & 0x0f) + COMPRESSION_MIN_MATCH;
+    inputPosition += 2;
+
+    if ((token & 0x0f) == LENGTH_IN_TOKEN_MAX) {
+      inputPosition = readLength(pInputBytes, inputPosition, inputLength, &matchLength);
+
+      if (inputPosition == -1) {
+        return -1;
+      }
+    }
+
+    if (offset == 0 || offset > position || matchLength > end - position) {
+      return -1;
+    }
+
+    // Byte by byte, as a match may overlap the bytes it produces
+    for (int i = 0; i < matchLength; i++) {
+      pBytes[position + i] = pBytes[position - offset + i];
+    }
+
+    position += matchLength;
+  }
+
+  return (position == end) ? 0 : -1;
+}
+
+// Makes a new empty history, and returns its reference on success.
+// Returns a NULL pointer on failure.
+CompressionHistory* CompressionHistory_create() {
+  CompressionHistory* pHistory = malloc(sizeof(CompressionHistory));
+
+  if (pHistory == NULL) {
+    return NULL;
+  }
+
+  pHistory->numBytes = 0;
+  return pHistory;
+}
+
+// Adds length bytes of traffic from pData to pHistory.
+void CompressionHistory_add(CompressionHistory* pHistory, char* pData, int length) {
+  // Only the bytes the history holds matter of data longer than it
+  if (length > COMPRESSION_HISTORY_SIZE) {
+    pHistory->numBytes += length - COMPRESSION_HISTORY_SIZE;
+    pData += length - COMPRESSION_HISTORY_SIZE;
+    length = COMPRESSION_HISTORY_SIZE;
+  }
+
+  int start = (int) (pHistory->numBytes % COMPRESSION_HISTORY_SIZE);
+  int firstPart = (length < COMPRESSION_HISTORY_SIZE - start) ? length : COMPRESSION_HISTORY_SIZE - start;
+
+  memcpy(&pHistory->bytes[start], pData, firstPart);
+  memcpy(pHistory->bytes, pData + firstPart, length - firstPart);
+  pHistory->numBytes += length;
+  return;
+}
+
+// Copies into pDictionary the bytes of pHistory before position end, counted from its first byte ever added,
+// at most COMPRESSION_DICTIONARY_SIZE of them.
+// Returns the number of bytes copied, or -1 if end is beyond the history or its dictionary is no longer held.
+int CompressionHistory_copyDictionary(CompressionHistory* pHistory, uint64_t end, char* pDictionary) {
+  int length = (end < COMPRESSION_DICTIONARY_SIZE) ? (int) end : COMPRESSION_DICTIONARY_SIZE;
+  uint64_t start = end - length;
+
+  if (end > pHistory->numBytes || pHistory->numBytes - start > COMPRESSION_HISTORY_SIZE) {
+    return -1;
+  }
+
+  int offset = (int) (start % COMPRESSION_HISTORY_SIZE);
+  int firstPart = (length < COMPRESSION_HISTORY_SIZE - offset) ? length : COMPRESSION_HISTORY_SIZE - offset;
+
+  memcpy(pDictionary, &pHistory->bytes[offset], firstPart);
+  memcpy(pDictionary + firstPart, pHistory->bytes, length - firstPart);
+  return length;
+}
+
+// Delete pHistory.
+void CompressionHistory_free(CompressionHistory* pHistory) {
+  free(pHistory);
+  return;
+}
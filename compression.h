@@ -0,0 +1,73 @@
+// A small LZ77 codec for the data of datagrams, in the style of LZ4, with no dependency beyond the C library
+// Data is encoded as sequences, each of literal bytes followed by a match copying earlier bytes
+// Matches may reach into a dictionary placed just before the data, such as the recent traffic both users
+// have seen, so a short line can refer to the lines before it
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+#include <stdint.h>
+
+// Shortest match encoded, and furthest back a match may start
+#define COMPRESSION_MIN_MATCH 4
+#define COMPRESSION_MAX_OFFSET 65535
+
+// Number of entries in the table finding earlier occurrences of 4 bytes, a power of 2
+#define COMPRESSION_TABLE_SIZE 4096
+
+// Most bytes of recent traffic used as a dictionary
+#define COMPRESSION_DICTIONARY_SIZE 4096
+
+// Bytes of recent traffic kept to take dictionaries from, well beyond a dictionary, so one that ends before
+// traffic still in flight is held on both ends
+#define COMPRESSION_HISTORY_SIZE 262144
+
+// Size of the position of its dictionary's end, sent before compressed data that uses a dictionary
+#define COMPRESSION_DICTIONARY_PREFIX_SIZE 4
+
+// How datagrams are compressed, set with --compress or --compress=dictionary
+typedef enum {
+  COMPRESSION_OFF,
+  COMPRESSION_ON,
+  COMPRESSION_DICTIONARY
+} CompressionMode;
+
+// Positions of earlier occurrences of 4 bytes in the buffer being compressed, plus 1, 0 for none
+typedef struct {
+    uint16_t positions[COMPRESSION_TABLE_SIZE];
+} CompressionTable;
+
+// The latest bytes of traffic exchanged in order with one user, to take dictionaries from
+typedef struct {
+    char bytes[COMPRESSION_HISTORY_SIZE];
+
+    // Number of bytes ever added, whose last COMPRESSION_HISTORY_SIZE are held
+    uint64_t numBytes;
+} CompressionHistory;
+
+// Fills pTable with the positions in the dictionary, the first dictionaryLength bytes of pBuffer.
+void Compression_prepare(CompressionTable* pTable, char* pBuffer, int dictionaryLength);
+
+// Compresses the length bytes of pBuffer after its dictionary into pOutput, which has room for capacity bytes,
+// using pTable as filled by Compression_prepare for that dictionary, and changing it.
+// Returns the number of bytes stored, or -1 if the compressed data does not fit.
+int Compression_compress(CompressionTable* pTable, char* pBuffer, int dictionaryLength, int length, char* pOutput, int capacity);
+
+// Decompresses the inputLength bytes of pInput into pBuffer after its dictionary, its first dictionaryLength bytes.
+// Returns 0 if the data decompressed into exactly length bytes, or -1 if it is malformed.
+int Compression_decompress(char* pInput, int inputLength, char* pBuffer, int dictionaryLength, int length);
+
+// Makes a new empty history, and returns its reference on success.
+// Returns a NULL pointer on failure.
+CompressionHistory* CompressionHistory_create();
+
+// Adds length bytes of traffic from pData to pHistory.
+void CompressionHistory_add(CompressionHistory* pHistory, char* pData, int length);
+
+// Copies into pDictionary the bytes of pHistory before position end, counted from its first byte ever added,
+// at most COMPRESSION_DICTIONARY_SIZE of them.
+// Returns the number of bytes copied, or -1 if end is beyond the history or its dictionary is no longer held.
+int CompressionHistory_copyDictionary(CompressionHistory* pHistory, uint64_t end, char* pDictionary);
+
+// Delete pHistory.
+void CompressionHistory_free(CompressionHistory* pHistory);
+
+#endif
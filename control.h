@@ -3,8 +3,9 @@
 #define _CONTROL_H_
 
 #define TERMINATE "!\n"
-#define MESSAGE_MAX_SIZE 512
-#define HOSTNAME_MAX_SIZE 256
+
+// Prints the status of the link to each remote user rather than being sent
+#define STATUS "?\n"
 
 // Wait for the program to be terminated by the local or remote user
 void Control_waitForTermination(void);
@@ -0,0 +1,1112 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "eventloop.h"
+#include "uring.h"
+#include "control.h"
+#include "list.h"
+#include "messagepool.h"
+#include "input.h"
+#include "output.h"
+
+// Bytes read from the terminal at once, and held until they are split into messages
+#define EVENT_LOOP_INPUT_BUFFER_SIZE 65536
+
+// Most received messages written to the terminal in one system call
+#define EVENT_LOOP_MAX_OUTPUT_MESSAGES 64
+
+// Received messages waiting to be written above which the loop stops receiving until the terminal catches up
+#define EVENT_LOOP_MAX_OUTPUT_BACKLOG 4096
+
+// Submissions the ring has room for, enough for a full batch of datagrams along with the other requests
+#define EVENT_LOOP_RING_ENTRIES 256
+
+// Buffers registered with the ring to receive datagrams into, a power of 2
+#define EVENT_LOOP_RECEIVE_BUFFERS 256
+
+// Indexes of the files registered with the ring
+#define EVENT_LOOP_FILE_INPUT 0
+#define EVENT_LOOP_FILE_OUTPUT 1
+#define EVENT_LOOP_FILE_SOCKET 2
+#define EVENT_LOOP_NUM_FILES 3
+
+// Kinds of request posted to the ring, in the low byte of their user data
+#define EVENT_LOOP_REQUEST_RECEIVE 1
+#define EVENT_LOOP_REQUEST_READ 2
+#define EVENT_LOOP_REQUEST_WRITE 3
+#define EVENT_LOOP_REQUEST_SEND 4
+
+// A file descriptor watched by the loop
+typedef struct {
+  int fileDescriptor;
+
+  // Events asked of epoll, 0 while the descriptor is not watched, and left out of epoll as it would
+  // still report a hang up, as at the end of the input
+  uint32_t events;
+
+  // Set if epoll cannot watch the descriptor, as for a regular file, which is then always ready
+  bool isAlwaysReady;
+
+  // Set when epoll reported the descriptor ready in the current iteration
+  bool isReady;
+} WatchedDescriptor;
+
+typedef struct {
+  int epollDescriptor;
+  WatchedDescriptor terminalInput;
+  WatchedDescriptor terminalOutput;
+  WatchedDescriptor socket;
+
+  // Bytes read from the terminal but not yet split into messages, from inputStart to inputEnd
+  char inputBuffer[EVENT_LOOP_INPUT_BUFFER_SIZE];
+  int inputStart;
+  int inputEnd;
+  bool isEndOfInput;
+
+  // Message being split from the input, its length so far, and how many of its fragments the sender took
+  // once it is complete
+  InputMessage inputMessage;
+  int inputLength;
+  bool isInputMessageComplete;
+  int numFragmentsSent;
+
+  // Received messages not yet written, oldest first, with the number of bytes of the first already written
+  List* pOutputBacklog;
+  int outputOffset;
+
+  // Remote users the received messages come from, whose labels are written before their lines
+  PeerTable* pPeers;
+
+  // Number of remote users whose exit command was written
+  int numPeersLeft;
+
+  // Set once the user sent the exit command, and once every remote user's exit command was written
+  bool isInputDone;
+  bool isOutputDone;
+
+  // Flags of the terminal output before it was made non-blocking, restored when the loop ends or the
+  // program exits
+  int originalOutputFlags;
+  bool isOutputNonBlocking;
+
+  // Set if the loop runs on io_uring rather than epoll
+  bool isUsingUring;
+  Uring uring;
+
+  // Buffers the multishot receive picks from, and the message header it was posted with
+  UringBufferRing receiveBuffers;
+  struct msghdr receiveHeader;
+
+  // Buffers holding datagrams received while the output backlog was full, in a ring from firstHeldBuffer,
+  // with the number of bytes the kernel stored in each
+  unsigned heldBufferIds[EVENT_LOOP_RECEIVE_BUFFERS];
+  int heldBufferLengths[EVENT_LOOP_RECEIVE_BUFFERS];
+  int firstHeldBuffer;
+  int numHeldBuffers;
+
+  // Requests posted and not yet completed
+  bool isReceivePosted;
+  bool isReadPosted;
+  bool isWritePosted;
+  int numSendsPosted;
+
+  // Parts of the write posted, which the kernel may read until it completes, and the number of messages in it
+  struct iovec outputParts[EVENT_LOOP_MAX_OUTPUT_MESSAGES * 3];
+  int numOutputMessages;
+
+  // Results of the datagrams sent, in the order they were posted
+  int sendResults[SENDER_MAX_BATCH_SIZE];
+
+  // Completions of other requests that came while waiting for datagrams to be sent, handled afterwards
+  // Each receive completion holds a buffer, so there are never more than the buffers and one of each other request
+  struct io_uring_cqe deferredCqes[EVENT_LOOP_RECEIVE_BUFFERS + EVENT_LOOP_NUM_FILES];
+  int numDeferredCqes;
+} EventLoop;
+
+// Large, so kept off the stack
+static EventLoop s_loop;
+static EventLoopStatistics s_statistics;
+
+// Free a message left in the output backlog
+static void freeMessage(void* pItem) {
+  MessagePool_recycle((Message*) pItem);
+  return;
+}
+
+// Gives the terminal output back its flags if the loop made it non-blocking
+// On a terminal the flag is shared with the input and the shell, so it is also restored when the program exits
+// from anywhere, before the error it prints is flushed
+static void restoreOutputFlags() {
+  if (s_loop.isOutputNonBlocking) {
+    fcntl(STDOUT_FILENO, F_SETFL, s_loop.originalOutputFlags);
+    s_loop.isOutputNonBlocking = false;
+  }
+
+  return;
+}
+
+// Prepares to watch a descriptor, without events until setEvents is called, or notes that epoll cannot watch it
+static void watchDescriptor(WatchedDescriptor* pDescriptor, int fileDescriptor) {
+  pDescriptor->fileDescriptor = fileDescriptor;
+  pDescriptor->events = 0;
+  pDescriptor->isReady = false;
+
+  struct epoll_event event;
+  event.events = 0;
+  event.data.ptr = pDescriptor;
+
+  // Add the descriptor without events, to learn whether epoll supports it
+  pDescriptor->isAlwaysReady = (epoll_ctl(s_loop.epollDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event) == -1);
+
+  if (pDescriptor->isAlwaysReady && errno != EPERM) {
+    fputs("[Error]: could not watch file descriptor\n", stdout);
+    exit(1);
+  }
+
+  if (!pDescriptor->isAlwaysReady) {
+    epoll_ctl(s_loop.epollDescriptor, EPOLL_CTL_DEL, fileDescriptor, &event);
+  }
+
+  return;
+}
+
+// Changes the events epoll watches a descriptor for, 0 to ignore it
+static void setEvents(WatchedDescriptor* pDescriptor, uint32_t events) {
+  if (pDescriptor->isAlwaysReady || pDescriptor->events == events) {
+    return;
+  }
+
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = pDescriptor;
+
+  int operation = EPOLL_CTL_MOD;
+
+  if (pDescriptor->events == 0) {
+    operation = EPOLL_CTL_ADD;
+  } else if (events == 0) {
+    operation = EPOLL_CTL_DEL;
+  }
+
+  if (epoll_ctl(s_loop.epollDescriptor, operation, pDescriptor->fileDescriptor, &event) == -1) {
+    fputs("[Error]: could not watch file descriptor\n", stdout);
+    exit(1);
+  }
+
+  pDescriptor->events = events;
+  return;
+}
+
+// Returns true if the descriptor can be used without blocking
+static bool isReady(WatchedDescriptor* pDescriptor) {
+  return pDescriptor->isAlwaysReady || pDescriptor->isReady;
+}
+
+// Adds received messages to the end of the output backlog, in place of the received messages queue
+static void deliverMessages(Message** ppMessages, int count) {
+  for (int i = 0; i < count; i++) {
+    // Like the output thread, print nothing once every remote user has exited
+    if (s_loop.isOutputDone) {
+      MessagePool_recycle(ppMessages[i]);
+    } else if (List_append(s_loop.pOutputBacklog, ppMessages[i]) == -1) {
+      fputs("[Error]: could not add message to received messages queue\n", stdout);
+      MessagePool_recycle(ppMessages[i]);
+    }
+  }
+
+  return;
+}
+
+// Adds a notice to the end of the output backlog, as a message without a label
+static void addNotice(char* notice) {
+  Message* pMessage = MessagePool_alloc();
+
+  if (pMessage == NULL) {
+    fputs("[Error]: could not allocate memory for input message\n", stdout);
+    exit(1);
+  }
+
+  pMessage->length = strlen(notice);
+  pMessage->flags = 0;
+  pMessage->fragmentIndex = 0;
+  pMessage->fragmentCount = 1;
+  memcpy(pMessage->data, notice, pMessage->length);
+  deliverMessages(&pMessage, 1);
+  return;
+}
+
+// Describes what is printed for a received message as parts of a write: the label of its sender if it
+// starts a line, its data, and a notice if it is the exit command
+// Returns the number of parts, at most 3
+static int describeOutput(Message* pMessage, struct iovec* pParts) {
+  int numParts = 0;
+
+  if (pMessage->flags & MESSAGE_FLAG_FIRST_SEGMENT) {
+    char* label = PeerTable_get(s_loop.pPeers, pMessage->peerIndex)->label;
+    pParts[numParts].iov_base = label;
+    pParts[numParts].iov_len = strlen(label);
+    numParts++;
+  }
+
+  pParts[numParts].iov_base = pMessage->data;
+  pParts[numParts].iov_len = pMessage->length;
+  numParts++;
+
+  if (pMessage->flags & MESSAGE_FLAG_CONTROL) {
+    pParts[numParts].iov_base = OUTPUT_EXIT_NOTICE;
+    pParts[numParts].iov_len = strlen(OUTPUT_EXIT_NOTICE);
+    numParts++;
+  }
+
+  return numParts;
+}
+
+// Describes the start of the output backlog as parts of one write, up to EVENT_LOOP_MAX_OUTPUT_MESSAGES messages
+// and without what was already written of the first, storing the number of messages in pNumMessages
+// Returns the number of parts
+static int describeBacklog(struct iovec* pParts, int* pNumMessages) {
+  int numParts = 0;
+  int numMessages = 0;
+  Message* pMessage = List_first(s_loop.pOutputBacklog);
+
+  while (pMessage != NULL && numMessages < EVENT_LOOP_MAX_OUTPUT_MESSAGES) {
+    numParts += describeOutput(pMessage, pParts + numParts);
+    numMessages++;
+
+    // A write ends with an exit command, as nothing after the last one is printed
+    if (pMessage->flags & MESSAGE_FLAG_CONTROL) {
+      break;
+    }
+
+    pMessage = List_next(s_loop.pOutputBacklog);
+  }
+
+  // Skip what was already written of the first message
+  int skip = s_loop.outputOffset;
+  int firstPart = 0;
+
+  while (skip >= pParts[firstPart].iov_len) {
+    skip -= pParts[firstPart].iov_len;
+    firstPart++;
+  }
+
+  pParts[firstPart].iov_base = (char*) pParts[firstPart].iov_base + skip;
+  pParts[firstPart].iov_len -= skip;
+
+  if (firstPart > 0) {
+    memmove(pParts, pParts + firstPart, sizeof(struct iovec) * (numParts - firstPart));
+  }
+
+  *pNumMessages = numMessages;
+  return numParts - firstPart;
+}
+
+// Recycles the messages of the output backlog written whole by a write of numMessages messages,
+// keeping the offset into the first one written in part
+// Returns true if all of them were written
+static bool consumeOutput(ssize_t numWritten, int numMessages) {
+  numWritten += s_loop.outputOffset;
+  s_loop.outputOffset = 0;
+
+  for (int i = 0; i < numMessages; i++) {
+    struct iovec messageParts[3];
+    int numMessageParts = describeOutput(List_first(s_loop.pOutputBacklog), messageParts);
+    ssize_t size = 0;
+
+    for (int j = 0; j < numMessageParts; j++) {
+      size += messageParts[j].iov_len;
+    }
+
+    if (numWritten < size) {
+      s_loop.outputOffset = numWritten;
+      return false;
+    }
+
+    Message* pMessage = List_remove(s_loop.pOutputBacklog);
+    numWritten -= size;
+
+    if (pMessage->flags & MESSAGE_FLAG_CONTROL) {
+      s_loop.numPeersLeft++;
+    }
+
+    if (s_loop.numPeersLeft == PeerTable_count(s_loop.pPeers)) {
+      s_loop.isOutputDone = true;
+      MessagePool_recycle(pMessage);
+
+      // Drop whatever was received after the last exit command
+      while ((pMessage = List_first(s_loop.pOutputBacklog)) != NULL) {
+        MessagePool_recycle(List_remove(s_loop.pOutputBacklog));
+      }
+
+      return true;
+    }
+
+    MessagePool_recycle(pMessage);
+  }
+
+  return true;
+}
+
+// Writes as much of the output backlog to the terminal as it takes without blocking,
+// gathering up to EVENT_LOOP_MAX_OUTPUT_MESSAGES messages per system call
+static void writeOutput() {
+  struct iovec parts[EVENT_LOOP_MAX_OUTPUT_MESSAGES * 3];
+
+  while (List_count(s_loop.pOutputBacklog) > 0) {
+    int numMessages = 0;
+    int numParts = describeBacklog(parts, &numMessages);
+    ssize_t numWritten = writev(s_loop.terminalOutput.fileDescriptor, parts, numParts);
+
+    if (numWritten == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return;
+      }
+
+      fputs("[Error]: could not write output\n", stdout);
+      exit(1);
+    }
+
+    if (!consumeOutput(numWritten, numMessages)) {
+      return;
+    }
+  }
+
+  return;
+}
+
+// Makes room in the input buffer by moving the bytes not yet split to the front
+static void compactInput() {
+  if (s_loop.inputStart > 0) {
+    memmove(s_loop.inputBuffer, s_loop.inputBuffer + s_loop.inputStart, s_loop.inputEnd - s_loop.inputStart);
+    s_loop.inputEnd -= s_loop.inputStart;
+    s_loop.inputStart = 0;
+  }
+
+  return;
+}
+
+// Reads what the terminal has ready into the input buffer, noting the end of the input
+static void readInput() {
+  compactInput();
+
+  ssize_t numRead = read(s_loop.terminalInput.fileDescriptor, s_loop.inputBuffer + s_loop.inputEnd, EVENT_LOOP_INPUT_BUFFER_SIZE - s_loop.inputEnd);
+
+  if (numRead == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    }
+
+    fputs("[Error]: could not read input\n", stdout);
+    exit(1);
+  }
+
+  if (numRead == 0) {
+    s_loop.isEndOfInput = true;
+  }
+
+  s_loop.inputEnd += numRead;
+  return;
+}
+
+// Takes a fragment from the pool and adds it to the end of the input message
+static Message* addInputFragment() {
+  Message* pFragment = MessagePool_alloc();
+
+  if (pFragment == NULL) {
+    fputs("[Error]: could not allocate memory for input message\n", stdout);
+    exit(1);
+  }
+
+  pFragment->length = 0;
+  s_loop.inputMessage.fragments[s_loop.inputMessage.count] = pFragment;
+  s_loop.inputMessage.count++;
+  return pFragment;
+}
+
+// Completes the input message, and notes if it is the exit command
+static void completeInputMessage(bool isEndOfLine) {
+  // A fragment taken for bytes that never came is not sent
+  Message* pLast = s_loop.inputMessage.fragments[s_loop.inputMessage.count - 1];
+
+  if (pLast->length == 0 && s_loop.inputMessage.count > 1) {
+    MessagePool_recycle(pLast);
+    s_loop.inputMessage.count--;
+  }
+
+  // The status command is answered with a notice for each remote user rather than sent, leaving nothing to send
+  if (Input_isStatusCommand(&s_loop.inputMessage, isEndOfLine)) {
+    char status[INPUT_STATUS_MAX_LENGTH];
+
+    Input_discardMessage(&s_loop.inputMessage);
+
+    for (int i = 0; i < PeerTable_count(s_loop.pPeers); i++) {
+      Input_formatStatus(PeerTable_get(s_loop.pPeers, i), status);
+      addNotice(status);
+    }
+
+    s_loop.isInputMessageComplete = true;
+    s_loop.numFragmentsSent = 0;
+    return;
+  }
+
+  if (Input_finishMessage(&s_loop.inputMessage, isEndOfLine)) {
+    s_loop.isInputDone = true;
+    addNotice(INPUT_EXIT_NOTICE);
+  }
+
+  uint64_t queuedTime = Message_getTimestamp();
+
+  for (int i = 0; i < s_loop.inputMessage.count; i++) {
+    s_loop.inputMessage.fragments[i]->queuedTime = queuedTime;
+  }
+
+  s_loop.isInputMessageComplete = true;
+  s_loop.numFragmentsSent = 0;
+  return;
+}
+
+// Splits the input buffer into the input message, in fragments as the input thread reads them,
+// stopping at the end of a line or once the message holds MESSAGE_MAX_LENGTH bytes
+// Returns true if the message is complete
+static bool splitInput() {
+  int maxFragmentLength = Message_getMaxDataSize() - 1;
+
+  while (s_loop.inputStart < s_loop.inputEnd) {
+    if (s_loop.inputLength == MESSAGE_MAX_LENGTH) {
+      completeInputMessage(false);
+      return true;
+    }
+
+    Message* pFragment = NULL;
+
+    if (s_loop.inputMessage.count > 0 && s_loop.inputMessage.fragments[s_loop.inputMessage.count - 1]->length < maxFragmentLength) {
+      pFragment = s_loop.inputMessage.fragments[s_loop.inputMessage.count - 1];
+    } else {
+      pFragment = addInputFragment();
+    }
+
+    int size = maxFragmentLength - pFragment->length;
+
+    if (size > MESSAGE_MAX_LENGTH - s_loop.inputLength) {
+      size = MESSAGE_MAX_LENGTH - s_loop.inputLength;
+    }
+
+    if (size > s_loop.inputEnd - s_loop.inputStart) {
+      size = s_loop.inputEnd - s_loop.inputStart;
+    }
+
+    char* pStart = s_loop.inputBuffer + s_loop.inputStart;
+    char* pNewline = memchr(pStart, '\n', size);
+
+    if (pNewline != NULL) {
+      size = pNewline - pStart + 1;
+    }
+
+    memcpy(pFragment->data + pFragment->length, pStart, size);
+    pFragment->length += size;
+    s_loop.inputLength += size;
+    s_loop.inputStart += size;
+
+    if (pNewline != NULL) {
+      completeInputMessage(true);
+      return true;
+    }
+  }
+
+  if (!s_loop.isEndOfInput) {
+    return false;
+  }
+
+  // The rest of a line without a newline at the end of the input is sent as it is, and if the input
+  // ends without a !<enter>, the exit command is sent anyways
+  if (s_loop.inputLength == 0) {
+    Message* pFragment = (s_loop.inputMessage.count > 0) ? s_loop.inputMessage.fragments[0] : addInputFragment();
+    pFragment->length = strlen(TERMINATE);
+    memcpy(pFragment->data, TERMINATE, pFragment->length);
+  }
+
+  completeInputMessage(true);
+  return true;
+}
+
+// Passes the fragments of complete input messages to the sender, as many as it has room for,
+// along with any message found lost or held for coalescing that is due
+static void sendInput() {
+  Message* newMessages[SENDER_MAX_PENDING_MESSAGES];
+  int room = 0;
+  int count = 0;
+
+  // The sender only recycles acknowledged messages when it sends, so once it took all it had room for,
+  // it is asked again, as it may have made more room for messages already waiting
+  do {
+    room = Sender_getRoom();
+    count = 0;
+
+    while (count < room) {
+      if (!s_loop.isInputMessageComplete && (s_loop.isInputDone || !splitInput())) {
+        break;
+      }
+
+      InputMessage* pInput = &s_loop.inputMessage;
+      int numFragments = pInput->count - s_loop.numFragmentsSent;
+
+      if (numFragments > room - count) {
+        numFragments = room - count;
+      }
+
+      memcpy(newMessages + count, pInput->fragments + s_loop.numFragmentsSent, sizeof(Message*) * numFragments);
+      count += numFragments;
+      s_loop.numFragmentsSent += numFragments;
+
+      if (s_loop.numFragmentsSent == pInput->count) {
+        pInput->count = 0;
+        s_loop.inputLength = 0;
+        s_loop.isInputMessageComplete = false;
+      }
+    }
+
+    Sender_send(newMessages, count);
+  } while (count == room && Sender_getRoom() > 0);
+
+  return;
+}
+
+// Returns the earlier of two timeouts in milliseconds, either of which may be -1 to wait forever
+static int earliestTimeout(int first, int second) {
+  if (first == -1) {
+    return second;
+  }
+
+  if (second == -1) {
+    return first;
+  }
+
+  return (first < second) ? first : second;
+}
+
+// Returns the milliseconds until the loop must run again without new events: the sender's deadlines,
+// and the end of lingering once either user sent the exit command, which starts it
+static int getTimeout(uint64_t* pLingerDeadline) {
+  int timeout = Sender_getTimeout();
+
+  if ((s_loop.isInputDone || s_loop.isOutputDone) && *pLingerDeadline == 0) {
+    *pLingerDeadline = Message_getTimestamp() + (uint64_t) EVENT_LOOP_LINGER_TIME * 1000000;
+  }
+
+  if (*pLingerDeadline != 0) {
+    uint64_t now = Message_getTimestamp();
+    int lingerTimeout = (*pLingerDeadline > now) ? (int) ((*pLingerDeadline - now + 999999) / 1000000) : 0;
+    timeout = earliestTimeout(timeout, lingerTimeout);
+  }
+
+  return timeout;
+}
+
+// Returns true if the loop needs more of the terminal's input: it is not lingering, nor waiting for the sender
+// to take a complete message, and has room for it
+static bool isWantingInput() {
+  return (
+    !s_loop.isInputDone && !s_loop.isOutputDone && !s_loop.isInputMessageComplete && !s_loop.isEndOfInput &&
+    s_loop.inputEnd - s_loop.inputStart < EVENT_LOOP_INPUT_BUFFER_SIZE
+  );
+}
+
+// Runs the loop on epoll, making the system calls for what it reports ready
+static void runWithEpoll(EventLoopArguments* pArguments) {
+  struct epoll_event events[3];
+  uint64_t lingerDeadline = 0;
+
+  s_loop.epollDescriptor = epoll_create1(0);
+
+  if (s_loop.epollDescriptor == -1) {
+    fputs("[Error]: could not create event loop\n", stdout);
+    exit(1);
+  }
+
+  // Everything printed from here on goes through the loop, so the output never blocks it
+  s_loop.originalOutputFlags = fcntl(STDOUT_FILENO, F_GETFL);
+
+  if (s_loop.originalOutputFlags != -1 && fcntl(STDOUT_FILENO, F_SETFL, s_loop.originalOutputFlags | O_NONBLOCK) == 0) {
+    s_loop.isOutputNonBlocking = true;
+    atexit(restoreOutputFlags);
+  }
+
+  watchDescriptor(&s_loop.terminalInput, STDIN_FILENO);
+  watchDescriptor(&s_loop.terminalOutput, STDOUT_FILENO);
+  watchDescriptor(&s_loop.socket, pArguments->pReceiverArguments->socketDescriptor);
+
+  while (1) {
+    bool isReading = isWantingInput();
+    int backlog = List_count(s_loop.pOutputBacklog);
+
+    // Watch only what the loop can act on, so a descriptor it is not ready for does not wake it
+    setEvents(&s_loop.terminalInput, isReading ? EPOLLIN : 0);
+    setEvents(&s_loop.terminalOutput, (backlog > 0) ? EPOLLOUT : 0);
+    setEvents(&s_loop.socket, (backlog < EVENT_LOOP_MAX_OUTPUT_BACKLOG) ? EPOLLIN : 0);
+
+    // Wake up in time for the sender's deadlines and the end of lingering,
+    // and not at all if a regular file can be read or written right away
+    int timeout = getTimeout(&lingerDeadline);
+
+    if ((isReading && s_loop.terminalInput.isAlwaysReady) || (backlog > 0 && s_loop.terminalOutput.isAlwaysReady)) {
+      timeout = 0;
+    }
+
+    int numEvents = epoll_wait(s_loop.epollDescriptor, events, 3, timeout);
+    s_statistics.numIterations++;
+
+    if (numEvents == -1 && errno != EINTR) {
+      fputs("[Error]: could not wait for events\n", stdout);
+      exit(1);
+    }
+
+    s_loop.terminalInput.isReady = false;
+    s_loop.terminalOutput.isReady = false;
+    s_loop.socket.isReady = false;
+
+    for (int i = 0; i < numEvents; i++) {
+      ((WatchedDescriptor*) events[i].data.ptr)->isReady = true;
+    }
+
+    // Receive everything that arrived, delivering it to the output backlog and applying acknowledgements
+    if (s_loop.socket.isReady) {
+      while (List_count(s_loop.pOutputBacklog) < EVENT_LOOP_MAX_OUTPUT_BACKLOG && Receiver_receive(false) > 0) {
+      }
+    }
+
+    if (isReading && isReady(&s_loop.terminalInput)) {
+      readInput();
+    }
+
+    // Send new input and anything due, even without new input, as acknowledgements and timeouts need it
+    sendInput();
+
+    if (List_count(s_loop.pOutputBacklog) > 0) {
+      writeOutput();
+    }
+
+    if (lingerDeadline != 0 && Message_getTimestamp() >= lingerDeadline) {
+      break;
+    }
+  }
+
+  // Give the terminal back as it was
+  close(s_loop.epollDescriptor);
+  restoreOutputFlags();
+  return;
+}
+
+// Gives the receiver a datagram received into a buffer of the ring, and returns the buffer to the kernel
+static void receiveBuffer(unsigned bufferId, int length) {
+  char* pBuffer = Uring_getBuffer(&s_loop.receiveBuffers, bufferId);
+  struct io_uring_recvmsg_out result;
+  struct sockaddr_in remoteSocket;
+
+  // The kernel stores the result, then the address the datagram came from, then the datagram itself
+  int offset = sizeof(result) + s_loop.receiveHeader.msg_namelen + s_loop.receiveHeader.msg_controllen;
+
+  memcpy(&result, pBuffer, sizeof(result));
+  memcpy(&remoteSocket, pBuffer + sizeof(result), sizeof(remoteSocket));
+
+  // A datagram longer than the buffer was truncated, and is dropped by the receiver
+  int payloadLength = (int) result.payloadlen;
+  bool isTruncated = (result.flags & MSG_TRUNC) != 0;
+
+  if (payloadLength > length - offset) {
+    payloadLength = length - offset;
+    isTruncated = true;
+  }
+
+  Receiver_handleDatagram(pBuffer + offset, payloadLength, isTruncated, &remoteSocket);
+  Uring_returnBuffer(&s_loop.receiveBuffers, bufferId);
+  return;
+}
+
+// Gives the receiver the datagrams held while the output backlog was full, oldest first, as long as it has room
+static void receiveHeldBuffers() {
+  while (s_loop.numHeldBuffers > 0 && List_count(s_loop.pOutputBacklog) < EVENT_LOOP_MAX_OUTPUT_BACKLOG) {
+    int index = s_loop.firstHeldBuffer;
+
+    receiveBuffer(s_loop.heldBufferIds[index], s_loop.heldBufferLengths[index]);
+    s_loop.firstHeldBuffer = (index + 1) % EVENT_LOOP_RECEIVE_BUFFERS;
+    s_loop.numHeldBuffers--;
+  }
+
+  return;
+}
+
+// Handles a completed request of the ring, identified by the kind of request and an index in its user data
+static void handleCompletion(struct io_uring_cqe* pCqe) {
+  int kind = (int) (pCqe->user_data & 0xff);
+  int index = (int) (pCqe->user_data >> 8);
+
+  if (kind == EVENT_LOOP_REQUEST_RECEIVE) {
+    // A multishot receive stays posted until the kernel says otherwise, as when it ran out of buffers
+    if (!(pCqe->flags & IORING_CQE_F_MORE)) {
+      s_loop.isReceivePosted = false;
+    }
+
+    if (pCqe->res < 0 && pCqe->res != -ENOBUFS && pCqe->res != -EINTR) {
+      fputs("[Error]: could not receive message\n", stdout);
+      exit(1);
+    }
+
+    if (pCqe->res < 0 || !(pCqe->flags & IORING_CQE_F_BUFFER)) {
+      return;
+    }
+
+    unsigned bufferId = pCqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    // While the terminal catches up, datagrams are held in their buffers, so once the kernel runs out of them
+    // it leaves the next datagrams in the socket, as epoll does by not watching it
+    if (s_loop.numHeldBuffers > 0 || List_count(s_loop.pOutputBacklog) >= EVENT_LOOP_MAX_OUTPUT_BACKLOG) {
+      int heldIndex = (s_loop.firstHeldBuffer + s_loop.numHeldBuffers) % EVENT_LOOP_RECEIVE_BUFFERS;
+
+      s_loop.heldBufferIds[heldIndex] = bufferId;
+      s_loop.heldBufferLengths[heldIndex] = pCqe->res;
+      s_loop.numHeldBuffers++;
+    } else {
+      receiveBuffer(bufferId, pCqe->res);
+    }
+  } else if (kind == EVENT_LOOP_REQUEST_READ) {
+    s_loop.isReadPosted = false;
+
+    if (pCqe->res < 0 && pCqe->res != -EINTR && pCqe->res != -EAGAIN) {
+      fputs("[Error]: could not read input\n", stdout);
+      exit(1);
+    }
+
+    if (pCqe->res == 0) {
+      s_loop.isEndOfInput = true;
+    } else if (pCqe->res > 0) {
+      s_loop.inputEnd += pCqe->res;
+    }
+  } else if (kind == EVENT_LOOP_REQUEST_WRITE) {
+    s_loop.isWritePosted = false;
+
+    if (pCqe->res < 0 && pCqe->res != -EINTR && pCqe->res != -EAGAIN) {
+      fputs("[Error]: could not write output\n", stdout);
+      exit(1);
+    }
+
+    if (pCqe->res >= 0) {
+      consumeOutput(pCqe->res, s_loop.numOutputMessages);
+    }
+  } else if (kind == EVENT_LOOP_REQUEST_SEND) {
+    s_loop.sendResults[index] = pCqe->res;
+    s_loop.numSendsPosted--;
+  }
+
+  return;
+}
+
+// Handles every completed request of the ring, starting with those deferred while sending
+static void handleCompletions() {
+  struct io_uring_cqe* pCqe;
+
+  for (int i = 0; i < s_loop.numDeferredCqes; i++) {
+    handleCompletion(&s_loop.deferredCqes[i]);
+  }
+
+  s_loop.numDeferredCqes = 0;
+
+  while ((pCqe = Uring_peekCqe(&s_loop.uring)) != NULL) {
+    handleCompletion(pCqe);
+    Uring_consumeCqe(&s_loop.uring);
+  }
+
+  return;
+}
+
+// Returns a submission entry to fill for a request on one of the registered files, or exits if the ring failed
+static struct io_uring_sqe* getSqe(int opcode, int file, int kind, int index) {
+  struct io_uring_sqe* pSqe = Uring_getSqe(&s_loop.uring);
+
+  if (pSqe == NULL) {
+    fputs("[Error]: could not submit to io_uring\n", stdout);
+    exit(1);
+  }
+
+  pSqe->opcode = opcode;
+  pSqe->fd = file;
+  pSqe->flags = IOSQE_FIXED_FILE;
+  pSqe->user_data = (uint64_t) kind | ((uint64_t) index << 8);
+  return pSqe;
+}
+
+// Sends datagrams in place of sendmmsg, as linked requests of the ring so the kernel sends them in order,
+// waiting until they all completed, as the sender reuses the datagrams once it returns
+// Completions of other requests that come in the meantime are deferred, so acknowledgements are applied
+// before the sender next runs, as they are with epoll
+static int sendWithUring(int socketDescriptor, struct mmsghdr* pDatagrams, int count) {
+  // Like sendmmsg, take what fits and report it, the caller sending the rest with another call
+  count = (count < SENDER_MAX_BATCH_SIZE) ? count : SENDER_MAX_BATCH_SIZE;
+
+  for (int i = 0; i < count; i++) {
+    struct io_uring_sqe* pSqe = getSqe(IORING_OP_SENDMSG, EVENT_LOOP_FILE_SOCKET, EVENT_LOOP_REQUEST_SEND, i);
+
+    pSqe->addr = (uint64_t) (uintptr_t) &pDatagrams[i].msg_hdr;
+    pSqe->len = 1;
+
+    if (i < count - 1) {
+      pSqe->flags |= IOSQE_IO_LINK;
+    }
+  }
+
+  s_loop.numSendsPosted = count;
+
+  while (s_loop.numSendsPosted > 0) {
+    if (Uring_enter(&s_loop.uring, 1, -1) == -1) {
+      return -1;
+    }
+
+    struct io_uring_cqe* pCqe;
+
+    while ((pCqe = Uring_peekCqe(&s_loop.uring)) != NULL) {
+      if ((pCqe->user_data & 0xff) == EVENT_LOOP_REQUEST_SEND) {
+        handleCompletion(pCqe);
+      } else {
+        s_loop.deferredCqes[s_loop.numDeferredCqes] = *pCqe;
+        s_loop.numDeferredCqes++;
+      }
+
+      Uring_consumeCqe(&s_loop.uring);
+    }
+  }
+
+  // Like sendmmsg, report the datagrams sent before the first that failed, and the error if that was the first
+  // The kernel cancels the requests linked after a failed one
+  int numSent = 0;
+
+  while (numSent < count && s_loop.sendResults[numSent] >= 0) {
+    pDatagrams[numSent].msg_len = s_loop.sendResults[numSent];
+    numSent++;
+  }
+
+  if (numSent == 0) {
+    errno = -s_loop.sendResults[0];
+    return -1;
+  }
+
+  return numSent;
+}
+
+// Posts a multishot receive on the socket, into the buffers registered with the ring
+static void postReceive() {
+  struct io_uring_sqe* pSqe = getSqe(IORING_OP_RECVMSG, EVENT_LOOP_FILE_SOCKET, EVENT_LOOP_REQUEST_RECEIVE, 0);
+
+  pSqe->addr = (uint64_t) (uintptr_t) &s_loop.receiveHeader;
+  pSqe->ioprio = IORING_RECV_MULTISHOT;
+  pSqe->flags |= IOSQE_BUFFER_SELECT;
+  pSqe->buf_group = s_loop.receiveBuffers.groupId;
+  s_loop.isReceivePosted = true;
+  return;
+}
+
+// Posts a read of the terminal into the input buffer
+static void postRead() {
+  compactInput();
+
+  struct io_uring_sqe* pSqe = getSqe(IORING_OP_READ, EVENT_LOOP_FILE_INPUT, EVENT_LOOP_REQUEST_READ, 0);
+
+  // Read from the current position, for a regular file as for a terminal or pipe
+  pSqe->addr = (uint64_t) (uintptr_t) (s_loop.inputBuffer + s_loop.inputEnd);
+  pSqe->len = EVENT_LOOP_INPUT_BUFFER_SIZE - s_loop.inputEnd;
+  pSqe->off = (uint64_t) -1;
+  s_loop.isReadPosted = true;
+  return;
+}
+
+// Posts a write of the start of the output backlog to the terminal
+static void postWrite() {
+  int numParts = describeBacklog(s_loop.outputParts, &s_loop.numOutputMessages);
+  struct io_uring_sqe* pSqe = getSqe(IORING_OP_WRITEV, EVENT_LOOP_FILE_OUTPUT, EVENT_LOOP_REQUEST_WRITE, 0);
+
+  pSqe->addr = (uint64_t) (uintptr_t) s_loop.outputParts;
+  pSqe->len = numParts;
+  pSqe->off = (uint64_t) -1;
+  s_loop.isWritePosted = true;
+  return;
+}
+
+// Sets up the ring, registering the terminal and the socket with it, along with the buffers received into
+// Returns 0 on success, -1 if the kernel lacks anything the loop needs from io_uring
+static int setupUring(int socketDescriptor) {
+  int fileDescriptors[EVENT_LOOP_NUM_FILES];
+  Uring* pUring = &s_loop.uring;
+
+  if (Uring_init(pUring, EVENT_LOOP_RING_ENTRIES) == -1) {
+    return -1;
+  }
+
+  // Waiting with a timeout came in 5.11, and provided buffer rings in 5.19, whose registration fails before
+  bool isSupported = (
+    (pUring->features & IORING_FEAT_EXT_ARG) &&
+    Uring_isOperationSupported(pUring, IORING_OP_RECVMSG) &&
+    Uring_isOperationSupported(pUring, IORING_OP_SENDMSG) &&
+    Uring_isOperationSupported(pUring, IORING_OP_READ) &&
+    Uring_isOperationSupported(pUring, IORING_OP_WRITEV)
+  );
+
+  fileDescriptors[EVENT_LOOP_FILE_INPUT] = STDIN_FILENO;
+  fileDescriptors[EVENT_LOOP_FILE_OUTPUT] = STDOUT_FILENO;
+  fileDescriptors[EVENT_LOOP_FILE_SOCKET] = socketDescriptor;
+
+  // Each buffer holds the result of the receive and the address of the sender ahead of the datagram,
+  // which may be as large as any peer's path carries
+  int bufferSize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + MESSAGE_DATAGRAM_MAX_SIZE;
+
+  if (!isSupported ||
+      Uring_registerFiles(pUring, fileDescriptors, EVENT_LOOP_NUM_FILES) == -1 ||
+      Uring_registerBufferRing(pUring, &s_loop.receiveBuffers, 0, EVENT_LOOP_RECEIVE_BUFFERS, bufferSize) == -1) {
+    Uring_free(pUring);
+    return -1;
+  }
+
+  // The kernel only reads the lengths of the address and control data of a multishot receive,
+  // and stores them in each buffer rather than where this points
+  memset(&s_loop.receiveHeader, 0, sizeof(s_loop.receiveHeader));
+  s_loop.receiveHeader.msg_namelen = sizeof(struct sockaddr_in);
+
+  // Multishot receives came in 6.0, and have no operation of their own to probe for, so the first is posted
+  // here: a kernel without them fails it straight away, while one with them keeps it posted for the loop
+  postReceive();
+
+  bool isSubmitted = (Uring_enter(pUring, 0, 0) != -1);
+  struct io_uring_cqe* pCqe = isSubmitted ? Uring_peekCqe(pUring) : NULL;
+
+  if (!isSubmitted || (pCqe != NULL && pCqe->res == -EINVAL)) {
+    s_loop.isReceivePosted = false;
+    Uring_freeBufferRing(pUring, &s_loop.receiveBuffers);
+    Uring_free(pUring);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Runs the loop on io_uring, keeping requests posted for the terminal and the socket, and submitting them
+// along with waiting for the next to complete
+static void runWithUring() {
+  uint64_t lingerDeadline = 0;
+
+  while (1) {
+    // Give the receiver what it was held from, now the terminal may have caught up
+    receiveHeldBuffers();
+    Receiver_flush();
+
+    int backlog = List_count(s_loop.pOutputBacklog);
+
+    if (isWantingInput() && !s_loop.isReadPosted) {
+      postRead();
+    }
+
+    if (backlog > 0 && !s_loop.isWritePosted) {
+      postWrite();
+    }
+
+    if (backlog < EVENT_LOOP_MAX_OUTPUT_BACKLOG && s_loop.numHeldBuffers == 0 && !s_loop.isReceivePosted) {
+      postReceive();
+    }
+
+    // Submit the requests posted, and wait in the same system call for one to complete,
+    // or for the sender's deadlines and the end of lingering, unless completions were deferred while sending
+    int timeout = getTimeout(&lingerDeadline);
+
+    if (Uring_enter(&s_loop.uring, 1, (s_loop.numDeferredCqes > 0) ? 0 : timeout) == -1) {
+      fputs("[Error]: could not wait for events\n", stdout);
+      exit(1);
+    }
+
+    s_statistics.numIterations++;
+
+    handleCompletions();
+
+    // Deliver what arrived and apply acknowledgements, and send new input and anything due
+    Receiver_flush();
+    sendInput();
+
+    if (lingerDeadline != 0 && Message_getTimestamp() >= lingerDeadline) {
+      break;
+    }
+  }
+
+  // Closing the ring cancels the requests still posted, but a write is left to finish so no output is lost
+  while (s_loop.isWritePosted) {
+    if (Uring_enter(&s_loop.uring, 1, -1) == -1) {
+      break;
+    }
+
+    handleCompletions();
+  }
+
+  s_statistics.numUringEnterCalls = s_loop.uring.numEnterCalls;
+  Uring_freeBufferRing(&s_loop.uring, &s_loop.receiveBuffers);
+  Uring_free(&s_loop.uring);
+  return;
+}
+
+// Reads messages from the terminal and sends them, and prints the messages received, until either user
+// sends the exit command. The receiver's deliver function, and the sender's send function with io_uring,
+// are set by the loop.
+void EventLoop_run(EventLoopArguments* pArguments) {
+  memset(&s_loop, 0, sizeof(s_loop));
+  Input_initMessage(&s_loop.inputMessage);
+  s_loop.pOutputBacklog = List_create();
+
+  if (s_loop.pOutputBacklog == NULL) {
+    fputs("[Error]: could not create event loop\n", stdout);
+    exit(1);
+  }
+
+  if (pArguments->isUsingIoUring) {
+    s_loop.isUsingUring = (setupUring(pArguments->pReceiverArguments->socketDescriptor) == 0);
+
+    if (!s_loop.isUsingUring) {
+      fputs("[io_uring is unavailable, using epoll instead]\n", stdout);
+    }
+  }
+
+  // Everything printed from here on goes through the loop
+  fflush(stdout);
+
+  s_loop.pPeers = pArguments->pReceiverArguments->pPeers;
+  pArguments->pReceiverArguments->deliver = deliverMessages;
+  pArguments->pReceiverArguments->pSendingMessagesQueue = NULL;
+  pArguments->pSenderArguments->send = s_loop.isUsingUring ? sendWithUring : NULL;
+  Sender_prepare(pArguments->pSenderArguments);
+  Receiver_prepare(pArguments->pReceiverArguments);
+
+  s_statistics.isUsingIoUring = s_loop.isUsingUring;
+
+  if (s_loop.isUsingUring) {
+    runWithUring();
+  } else {
+    runWithEpoll(pArguments);
+  }
+
+  // Recycle what is left
+  Sender_release();
+  Receiver_release();
+
+  for (int i = 0; i < s_loop.inputMessage.count; i++) {
+    MessagePool_recycle(s_loop.inputMessage.fragments[i]);
+  }
+
+  List_free(s_loop.pOutputBacklog, freeMessage);
+  return;
+}
+
+// Fills pStatistics with the counters of the event loop
+void EventLoop_getStatistics(EventLoopStatistics* pStatistics) {
+  *pStatistics = s_statistics;
+  return;
+}
@@ -0,0 +1,43 @@
+// Runs the whole program on the main thread, in place of the input, output, sender and receiver threads
+// The terminal and the socket are watched with epoll, so messages pass from one to the other
+// without crossing a queue or waking another thread
+// With io_uring, the loop instead keeps requests posted for each of them: a multishot receive into buffers
+// registered with the ring, a read of the terminal, a write of the received messages, and the datagrams
+// to send, so most iterations take a single system call whatever the number of messages
+#ifndef _EVENTLOOP_H_
+#define _EVENTLOOP_H_
+#include "sender.h"
+#include "receiver.h"
+
+// Milliseconds the loop keeps running after either user sent the exit command, so the last messages
+// are sent and acknowledged, as the threads are given before they are shut down
+#define EVENT_LOOP_LINGER_TIME 1000
+
+// Arguments for the event loop, which sends and receives with the same arguments as the threads
+typedef struct {
+  SenderThreadArguments* pSenderArguments;
+  ReceiverThreadArguments* pReceiverArguments;
+
+  // Run on io_uring rather than epoll, if the kernel supports everything the loop needs from it
+  bool isUsingIoUring;
+} EventLoopArguments;
+
+// Counters of the event loop
+typedef struct {
+  // Number of times the loop waited for events
+  unsigned long numIterations;
+
+  // Set if the loop ran on io_uring, and the number of io_uring_enter system calls it made, sending included
+  bool isUsingIoUring;
+  unsigned long numUringEnterCalls;
+} EventLoopStatistics;
+
+// Reads messages from the terminal and sends them, and prints the messages received, until either user
+// sends the exit command. The receiver's deliver function, and the sender's send function with io_uring,
+// are set by the loop.
+void EventLoop_run(EventLoopArguments* pArguments);
+
+// Fills pStatistics with the counters of the event loop
+void EventLoop_getStatistics(EventLoopStatistics* pStatistics);
+
+#endif
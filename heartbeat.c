@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "heartbeat.h"
+
+// Most heartbeats skipped by one echo that are counted into the smoothed loss rate, after which it is all but 1
+#define HEARTBEAT_MAX_LOSS_UPDATES 64
+
+// Returns true if sequence number first comes before second, allowing for wraparound
+static bool isBefore(uint32_t first, uint32_t second) {
+  return (int32_t) (first - second) < 0;
+}
+
+static void lockHeartbeat(Heartbeat* pHeartbeat) {
+  int status = pthread_mutex_lock(&pHeartbeat->mutex);
+
+  if (status) {
+    fputs("[Error]: could not lock heartbeat mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+static void unlockHeartbeat(Heartbeat* pHeartbeat) {
+  int status = pthread_mutex_unlock(&pHeartbeat->mutex);
+
+  if (status) {
+    fputs("[Error]: could not unlock heartbeat mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Moves the smoothed loss rate an eighth of the way towards the outcome of one heartbeat, 1 if it was lost
+static void updateLossRate(HeartbeatStatistics* pStatistics, double outcome) {
+  pStatistics->lossRate += (outcome - pStatistics->lossRate) / 8;
+  return;
+}
+
+// Updates the round-trip time estimates and the jitter with a new sample
+static void updateRtt(HeartbeatStatistics* pStatistics, uint64_t rtt) {
+  if (pStatistics->numRttSamples == 0) {
+    pStatistics->smoothedRtt = rtt;
+    pStatistics->minRtt = rtt;
+    pStatistics->maxRtt = rtt;
+  } else {
+    int64_t difference = (rtt > pStatistics->latestRtt) ? (int64_t) (rtt - pStatistics->latestRtt) : (int64_t) (pStatistics->latestRtt - rtt);
+    pStatistics->jitter = (uint64_t) ((int64_t) pStatistics->jitter + (difference - (int64_t) pStatistics->jitter) / 16);
+    pStatistics->smoothedRtt = (7 * pStatistics->smoothedRtt + rtt) / 8;
+    pStatistics->minRtt = (rtt < pStatistics->minRtt) ? rtt : pStatistics->minRtt;
+    pStatistics->maxRtt = (rtt > pStatistics->maxRtt) ? rtt : pStatistics->maxRtt;
+  }
+
+  pStatistics->latestRtt = rtt;
+  pStatistics->numRttSamples++;
+  return;
+}
+
+// Makes new heartbeats for one peer, and returns its reference on success.
+// Returns a NULL pointer on failure.
+Heartbeat* Heartbeat_create() {
+  Heartbeat* pHeartbeat = calloc(1, sizeof(Heartbeat));
+
+  if (pHeartbeat == NULL) {
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&pHeartbeat->mutex, NULL)) {
+    free(pHeartbeat);
+    return NULL;
+  }
+
+  return pHeartbeat;
+}
+
+// Fills pHeader and pData, which must have room for HEARTBEAT_DATA_SIZE bytes, with the next heartbeat,
+// sent at the given time.
+void Heartbeat_encode(Heartbeat* pHeartbeat, MessageHeader* pHeader, char* pData, uint64_t now) {
+  lockHeartbeat(pHeartbeat);
+  uint32_t sequence = pHeartbeat->nextSequence;
+  pHeartbeat->nextSequence++;
+  pHeartbeat->statistics.numHeartbeatsSent++;
+  unlockHeartbeat(pHeartbeat);
+
+  memset(pHeader, 0, sizeof(MessageHeader));
+  pHeader->type = MESSAGE_TYPE_HEARTBEAT;
+  pHeader->length = htons(HEARTBEAT_DATA_SIZE);
+  pHeader->sequence = htonl(sequence);
+
+  // Only this program reads the time back, so it is sent in its own byte order
+  memcpy(pData, &now, HEARTBEAT_DATA_SIZE);
+  return;
+}
+
+// Fills pEchoHeader and pEchoData with the echo of a heartbeat received from the peer, with the length bytes
+// of data at pData after its header pHeader.
+// Returns 0 on success, -1 if the heartbeat is malformed.
+int Heartbeat_encodeEcho(Heartbeat* pHeartbeat, MessageHeader* pHeader, char* pData, int length, MessageHeader* pEchoHeader, char* pEchoData) {
+  if (length < HEARTBEAT_DATA_SIZE || ntohs(pHeader->length) != HEARTBEAT_DATA_SIZE) {
+    return -1;
+  }
+
+  memset(pEchoHeader, 0, sizeof(MessageHeader));
+  pEchoHeader->type = MESSAGE_TYPE_HEARTBEAT_ECHO;
+  pEchoHeader->length = htons(HEARTBEAT_DATA_SIZE);
+  pEchoHeader->sequence = pHeader->sequence;
+  memcpy(pEchoData, pData, HEARTBEAT_DATA_SIZE);
+
+  lockHeartbeat(pHeartbeat);
+  pHeartbeat->statistics.numEchoesSent++;
+  unlockHeartbeat(pHeartbeat);
+
+  return 0;
+}
+
+// Applies an echo received from the peer at the given time, with the length bytes of data after its header.
+void Heartbeat_processEcho(Heartbeat* pHeartbeat, MessageHeader* pHeader, char* pData, int length, uint64_t now) {
+  HeartbeatStatistics* pStatistics = &pHeartbeat->statistics;
+  uint32_t sequence = ntohl(pHeader->sequence);
+  uint64_t sentTime;
+
+  if (length < HEARTBEAT_DATA_SIZE) {
+    return;
+  }
+
+  memcpy(&sentTime, pData, HEARTBEAT_DATA_SIZE);
+
+  lockHeartbeat(pHeartbeat);
+
+  // Ignore echoes of heartbeats never sent, and times that cannot have been sent by this program
+  if (!isBefore(sequence, pHeartbeat->nextSequence) || sentTime == 0 || sentTime > now) {
+    unlockHeartbeat(pHeartbeat);
+    return;
+  }
+
+  pStatistics->numEchoesReceived++;
+
+  if (isBefore(sequence, pHeartbeat->echoEnd)) {
+    // A late echo of a heartbeat counted lost when a later one was echoed
+    if (pStatistics->numHeartbeatsLost > 0) {
+      pStatistics->numHeartbeatsLost--;
+    }
+  } else {
+    uint32_t numSkipped = sequence - pHeartbeat->echoEnd;
+    pStatistics->numHeartbeatsLost += numSkipped;
+
+    for (uint32_t i = 0; i < numSkipped && i < HEARTBEAT_MAX_LOSS_UPDATES; i++) {
+      updateLossRate(pStatistics, 1);
+    }
+
+    updateLossRate(pStatistics, 0);
+    pHeartbeat->echoEnd = sequence + 1;
+  }
+
+  updateRtt(pStatistics, now - sentTime);
+  unlockHeartbeat(pHeartbeat);
+  return;
+}
+
+// Records that a datagram arrived from the peer at the given time.
+void Heartbeat_markHeard(Heartbeat* pHeartbeat, uint64_t now) {
+  __atomic_store_n(&pHeartbeat->statistics.lastHeardTime, now, __ATOMIC_RELAXED);
+  return;
+}
+
+// Returns true if the latest HEARTBEAT_MAX_UNANSWERED heartbeats or more were sent without an echo.
+bool Heartbeat_isUnanswered(HeartbeatStatistics* pStatistics) {
+  unsigned long numAnswered = pStatistics->numEchoesReceived + pStatistics->numHeartbeatsLost;
+  return pStatistics->numHeartbeatsSent >= numAnswered + HEARTBEAT_MAX_UNANSWERED;
+}
+
+// Fills pStatistics with the counters and estimates of pHeartbeat.
+void Heartbeat_getStatistics(Heartbeat* pHeartbeat, HeartbeatStatistics* pStatistics) {
+  lockHeartbeat(pHeartbeat);
+  *pStatistics = pHeartbeat->statistics;
+  unlockHeartbeat(pHeartbeat);
+
+  pStatistics->lastHeardTime = __atomic_load_n(&pHeartbeat->statistics.lastHeardTime, __ATOMIC_RELAXED);
+  return;
+}
+
+// Delete pHeartbeat.
+void Heartbeat_free(Heartbeat* pHeartbeat) {
+  pthread_mutex_destroy(&pHeartbeat->mutex);
+  free(pHeartbeat);
+  return;
+}
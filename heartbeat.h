@@ -0,0 +1,93 @@
+// Keepalive heartbeats exchanged with one peer, measuring the link while no one types
+// A heartbeat carries the time it was sent, which the peer sends straight back in an echo, so the time it
+// took to come back is a round-trip time sample taken with this program's clock alone
+// Heartbeats are numbered, and one whose echo does not come before the echo of a later one counts as lost
+#ifndef _HEARTBEAT_H_
+#define _HEARTBEAT_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "message.h"
+
+// Milliseconds between heartbeats unless set with --heartbeat=MS, and the value that sends none
+#define HEARTBEAT_DEFAULT_INTERVAL 1000
+#define HEARTBEAT_DISABLED 0
+
+// Size of the data of a heartbeat and of its echo: the time the heartbeat was sent
+#define HEARTBEAT_DATA_SIZE 8
+
+// Number of heartbeats in a row without an echo after which the peer is said not to respond
+#define HEARTBEAT_MAX_UNANSWERED 3
+
+// Counters and estimates of the link to one peer
+typedef struct {
+    // Number of heartbeats sent, echoes of them received, and heartbeats lost
+    unsigned long numHeartbeatsSent;
+    unsigned long numEchoesReceived;
+    unsigned long numHeartbeatsLost;
+
+    // Number of heartbeats of the peer echoed back to it
+    unsigned long numEchoesSent;
+
+    // Round-trip times of heartbeats in nanoseconds
+    unsigned long numRttSamples;
+    uint64_t latestRtt;
+    uint64_t smoothedRtt;
+    uint64_t minRtt;
+    uint64_t maxRtt;
+
+    // Smoothed difference between consecutive round-trip times in nanoseconds, as RFC 3550 measures jitter
+    uint64_t jitter;
+
+    // Smoothed fraction of heartbeats lost, from 0 to 1
+    double lossRate;
+
+    // Time any datagram last arrived from the peer, 0 if none did
+    uint64_t lastHeardTime;
+} HeartbeatStatistics;
+
+typedef struct Heartbeat_s Heartbeat;
+struct Heartbeat_s {
+    // Guards the heartbeat, which the sender thread sends from, the receiver thread applies echoes to,
+    // and the input thread reads for the status command
+    pthread_mutex_t mutex;
+
+    // Sequence number of the next heartbeat sent
+    uint32_t nextSequence;
+
+    // One past the sequence number of the latest heartbeat echoed, those before it without an echo being lost
+    uint32_t echoEnd;
+
+    // Its lastHeardTime is set for every datagram received, so it is written atomically rather than under the mutex
+    HeartbeatStatistics statistics;
+};
+
+// Makes new heartbeats for one peer, and returns its reference on success.
+// Returns a NULL pointer on failure.
+Heartbeat* Heartbeat_create();
+
+// Fills pHeader and pData, which must have room for HEARTBEAT_DATA_SIZE bytes, with the next heartbeat,
+// sent at the given time.
+void Heartbeat_encode(Heartbeat* pHeartbeat, MessageHeader* pHeader, char* pData, uint64_t now);
+
+// Fills pEchoHeader and pEchoData with the echo of a heartbeat received from the peer, with the length bytes
+// of data at pData after its header pHeader.
+// Returns 0 on success, -1 if the heartbeat is malformed.
+int Heartbeat_encodeEcho(Heartbeat* pHeartbeat, MessageHeader* pHeader, char* pData, int length, MessageHeader* pEchoHeader, char* pEchoData);
+
+// Applies an echo received from the peer at the given time, with the length bytes of data after its header.
+void Heartbeat_processEcho(Heartbeat* pHeartbeat, MessageHeader* pHeader, char* pData, int length, uint64_t now);
+
+// Records that a datagram arrived from the peer at the given time.
+void Heartbeat_markHeard(Heartbeat* pHeartbeat, uint64_t now);
+
+// Returns true if the latest HEARTBEAT_MAX_UNANSWERED heartbeats or more were sent without an echo.
+bool Heartbeat_isUnanswered(HeartbeatStatistics* pStatistics);
+
+// Fills pStatistics with the counters and estimates of pHeartbeat.
+void Heartbeat_getStatistics(Heartbeat* pHeartbeat, HeartbeatStatistics* pStatistics);
+
+// Delete pHeartbeat.
+void Heartbeat_free(Heartbeat* pHeartbeat);
+
+#endif
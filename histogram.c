@@ -0,0 +1,74 @@
+// A histogram of latencies, giving percentiles without keeping every sample
+#include <string.h>
+#include <assert.h>
+#include "histogram.h"
+
+// Returns the bucket a value falls in
+static int getBucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return (int) value;
+  }
+
+  int exponent = 63 - __builtin_clzll(value);
+  int subBucket = (int) ((value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+
+  return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+// Returns the middle of the values a bucket holds
+static uint64_t getBucketValue(int bucket) {
+  if (bucket < HISTOGRAM_SUB_BUCKETS) {
+    return (uint64_t) bucket;
+  }
+
+  int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+  uint64_t lowest = (uint64_t) (HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+
+  return lowest + ((1ULL << shift) >> 1);
+}
+
+// Makes pHistogram empty.
+void Histogram_init(Histogram* pHistogram) {
+  memset(pHistogram, 0, sizeof(Histogram));
+  return;
+}
+
+// Adds a sample to pHistogram.
+void Histogram_record(Histogram* pHistogram, uint64_t value) {
+  assert(pHistogram != NULL);
+
+  pHistogram->counts[getBucket(value)]++;
+  pHistogram->count++;
+  pHistogram->max = (value > pHistogram->max) ? value : pHistogram->max;
+  return;
+}
+
+// Returns the value below which the given fraction of the samples fall, from 0 to 1, or 0 if there are none.
+uint64_t Histogram_getPercentile(Histogram* pHistogram, double fraction) {
+  assert(pHistogram != NULL);
+
+  if (pHistogram->count == 0) {
+    return 0;
+  }
+
+  // The rank of the sample wanted, counting from 1
+  unsigned long rank = (unsigned long) (fraction * pHistogram->count + 0.5);
+  unsigned long numBelow = 0;
+
+  if (rank >= pHistogram->count) {
+    return pHistogram->max;
+  }
+
+  rank = (rank < 1) ? 1 : rank;
+
+  for (int bucket = 0; bucket < HISTOGRAM_NUM_BUCKETS; bucket++) {
+    numBelow += pHistogram->counts[bucket];
+
+    if (numBelow >= rank) {
+      uint64_t value = getBucketValue(bucket);
+      return (value < pHistogram->max) ? value : pHistogram->max;
+    }
+  }
+
+  return pHistogram->max;
+}
@@ -0,0 +1,31 @@
+// A histogram of latencies, giving percentiles without keeping every sample
+// Buckets are log-linear: each power of two is split into HISTOGRAM_SUB_BUCKETS buckets of equal width,
+// so a percentile is off by at most 1 part in HISTOGRAM_SUB_BUCKETS of its value, whatever its magnitude
+// A histogram is not thread safe; one thread records into it, and others read it once that thread is done
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+#include <stdint.h>
+
+// Number of buckets each power of two is split into, 2 to the power of HISTOGRAM_SUB_BUCKET_BITS
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+// Number of buckets reaching every 64 bit value
+#define HISTOGRAM_NUM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    unsigned long counts[HISTOGRAM_NUM_BUCKETS];
+    unsigned long count;
+    uint64_t max;
+} Histogram;
+
+// Makes pHistogram empty.
+void Histogram_init(Histogram* pHistogram);
+
+// Adds a sample to pHistogram.
+void Histogram_record(Histogram* pHistogram, uint64_t value);
+
+// Returns the value below which the given fraction of the samples fall, from 0 to 1, or 0 if there are none.
+uint64_t Histogram_getPercentile(Histogram* pHistogram, double fraction);
+
+#endif
@@ -2,23 +2,210 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <arpa/inet.h>
 #include "input.h"
 #include "control.h"
-#include "sender.h"
-#include "threadsafelist.h"
+#include "messagequeue.h"
+#include "messagepool.h"
+#include "heartbeat.h"
+#include "lowlatency.h"
 
 static pthread_t s_threadInput;
 static bool s_threadHasExited = false;
 
 // Free any remaining memory
 static void cleanup(void* args) {
-  char** inputMessageAddress = args;
-  char* inputMessage = *inputMessageAddress;
+  Input_discardMessage(args);
+  return;
+}
+
+// Moves the data of the last fragment of pInput beyond what a message now holds into fragments of its own,
+// as the datagram size may have been lowered while the terminal was read, once a remote user said it takes no larger
+static void splitLastFragment(InputMessage* pInput) {
+  int maxLength = Message_getMaxDataSize() - 1;
+  Message* pFragment = pInput->fragments[pInput->count - 1];
+
+  while (pFragment->length > maxLength) {
+    Message* pRest = MessagePool_alloc();
+
+    if (pRest == NULL) {
+      fputs("[Error]: could not allocate memory for input message\n", stdout);
+      exit(1);
+    }
+
+    pRest->length = pFragment->length - maxLength;
+    memcpy(pRest->data, pFragment->data + maxLength, pRest->length);
+    pFragment->length = maxLength;
+
+    pInput->fragments[pInput->count] = pRest;
+    pInput->count++;
+    pFragment = pRest;
+  }
+
+  return;
+}
+
+// Reads the next message from the terminal into pInput, one fragment per message buffer,
+// stopping at the end of the line or once the message holds MESSAGE_MAX_LENGTH bytes
+// Returns true if the message ends its line
+static bool readMessage(InputMessage* pInput) {
+  int length = 0;
+
+  while (length < MESSAGE_MAX_LENGTH) {
+    int maxDataSize = Message_getMaxDataSize();
+    Message* pFragment = MessagePool_alloc();
+
+    if (pFragment == NULL) {
+      fputs("[Error]: could not allocate memory for input message\n", stdout);
+      exit(1);
+    }
+
+    pInput->fragments[pInput->count] = pFragment;
+    pInput->count++;
+
+    // Get keyboard input from the user, never reading past the longest message
+    int size = MESSAGE_MAX_LENGTH - length + 1;
+
+    if (size > maxDataSize) {
+      size = maxDataSize;
+    }
+
+    // If EOF has been reached from a piped file without a !<enter>, send the exit command anyways,
+    // after the rest of the line already read
+    if (fgets(pFragment->data, size, stdin) == NULL) {
+      if (pInput->count > 1) {
+        pInput->count--;
+        MessagePool_recycle(pFragment);
+        return true;
+      }
+
+      strcpy(pFragment->data, TERMINATE);
+    }
+
+    // The only scan of the input; every later hop uses the length and flags set here
+    pFragment->length = strlen(pFragment->data);
+    length += pFragment->length;
+
+    splitLastFragment(pInput);
+    pFragment = pInput->fragments[pInput->count - 1];
+
+    if (pFragment->length > 0 && pFragment->data[pFragment->length - 1] == '\n') {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Empties pInput, ready to read the first message
+void Input_initMessage(InputMessage* pInput) {
+  pInput->count = 0;
+  pInput->isFirstSegment = true;
+  pInput->nextSequence = 0;
+  pInput->nextMessageId = 0;
+  return;
+}
+
+// Numbers the fragments read into pInput so the receiver can put them back together, and flags
+// whether the message starts and ends its line
+// Returns true if the message is the exit command
+bool Input_finishMessage(InputMessage* pInput, bool isEndOfLine) {
+  bool isExitCommand = false;
+  uint64_t createdTime = Message_getTimestamp();
 
-  if (inputMessage != NULL) {
-    free(inputMessage);
+  for (int i = 0; i < pInput->count; i++) {
+    Message* pFragment = pInput->fragments[i];
+    pFragment->flags = 0;
+    pFragment->sequence = pInput->nextSequence;
+    pFragment->messageId = pInput->nextMessageId;
+    pFragment->fragmentIndex = i;
+    pFragment->fragmentCount = pInput->count;
+    pFragment->createdTime = createdTime;
+    pInput->nextSequence++;
   }
 
+  pInput->nextMessageId++;
+
+  Message* pFirst = pInput->fragments[0];
+  Message* pLast = pInput->fragments[pInput->count - 1];
+
+  // Detect if the program should be terminated, and if the current message is the
+  // start of a new line (the first segment), or continues a line longer than a message
+  if (pInput->isFirstSegment) {
+    pFirst->flags |= MESSAGE_FLAG_FIRST_SEGMENT;
+  }
+
+  if (pInput->isFirstSegment && pInput->count == 1 && pFirst->length == strlen(TERMINATE) &&
+      memcmp(pFirst->data, TERMINATE, pFirst->length) == 0) {
+    pFirst->flags |= MESSAGE_FLAG_LAST_SEGMENT | MESSAGE_FLAG_CONTROL;
+    isExitCommand = true;
+  } else if (isEndOfLine) {
+    pLast->flags |= MESSAGE_FLAG_LAST_SEGMENT;
+  }
+
+  pInput->isFirstSegment = isEndOfLine;
+  return isExitCommand;
+}
+
+// Returns true if the message read into pInput, ending its line if isEndOfLine is set, is the status command
+bool Input_isStatusCommand(InputMessage* pInput, bool isEndOfLine) {
+  Message* pFirst = pInput->fragments[0];
+
+  return pInput->isFirstSegment && isEndOfLine && pInput->count == 1 && pFirst->length == strlen(STATUS) &&
+    memcmp(pFirst->data, STATUS, pFirst->length) == 0;
+}
+
+// Recycles the fragments read into pInput without sending them
+void Input_discardMessage(InputMessage* pInput) {
+  for (int i = 0; i < pInput->count; i++) {
+    MessagePool_recycle(pInput->fragments[i]);
+  }
+
+  pInput->count = 0;
+  return;
+}
+
+// Writes the status line of the link to pPeer, from its heartbeats, into pBuffer of INPUT_STATUS_MAX_LENGTH bytes
+void Input_formatStatus(Peer* pPeer, char* pBuffer) {
+  HeartbeatStatistics statistics;
+  char address[INET_ADDRSTRLEN];
+  char* state = "is responding";
+  uint64_t now = Message_getTimestamp();
+  int length = 0;
+
+  Heartbeat_getStatistics(pPeer->pHeartbeat, &statistics);
+  inet_ntop(AF_INET, &pPeer->address.sin_addr, address, sizeof(address));
+
+  if (statistics.numHeartbeatsSent > 0 && Heartbeat_isUnanswered(&statistics)) {
+    state = "is not responding";
+  } else if (statistics.lastHeardTime == 0) {
+    state = "has not been heard from yet";
+  }
+
+  length += snprintf(pBuffer, INPUT_STATUS_MAX_LENGTH, "[Status]: %s:%d %s", address, ntohs(pPeer->address.sin_port), state);
+
+  if (statistics.lastHeardTime > 0 && length < INPUT_STATUS_MAX_LENGTH) {
+    uint64_t silence = (now > statistics.lastHeardTime) ? now - statistics.lastHeardTime : 0;
+    length += snprintf(pBuffer + length, INPUT_STATUS_MAX_LENGTH - length, ", last heard %.1f s ago", silence / 1e9);
+  }
+
+  if (statistics.numRttSamples > 0 && length < INPUT_STATUS_MAX_LENGTH) {
+    length += snprintf(
+      pBuffer + length, INPUT_STATUS_MAX_LENGTH - length,
+      ", round-trip time %.3f ms (smoothed %.3f ms), jitter %.3f ms, heartbeats lost %.1f%% (%lu of %lu)",
+      statistics.latestRtt / 1e6, statistics.smoothedRtt / 1e6, statistics.jitter / 1e6,
+      100.0 * statistics.lossRate, statistics.numHeartbeatsLost, statistics.numHeartbeatsSent
+    );
+  } else if (statistics.numHeartbeatsSent > 0 && length < INPUT_STATUS_MAX_LENGTH) {
+    length += snprintf(pBuffer + length, INPUT_STATUS_MAX_LENGTH - length, ", no heartbeat echoed yet");
+  }
+
+  // A line cut short still ends with its newline
+  if (length > INPUT_STATUS_MAX_LENGTH - 2) {
+    length = INPUT_STATUS_MAX_LENGTH - 2;
+  }
+
+  strcpy(pBuffer + length, "\n");
   return;
 }
 
@@ -26,62 +213,58 @@ static void cleanup(void* args) {
 static void* inputThread(void* args) {
   int status = 0;
   InputThreadArguments* inputArguments = args;
-  List* pSendingMessagesList = inputArguments->pSendingMessagesList;
+  MessageQueue* pSendingMessagesQueue = inputArguments->pSendingMessagesQueue;
+  PeerTable* pPeers = inputArguments->pPeers;
+  char statusLine[INPUT_STATUS_MAX_LENGTH];
 
-  bool isFirstSegment = true;
-  char* input = NULL;
-  char* inputMessage = NULL;
-  char** inputMessageAddress = &inputMessage;
+  InputMessage input;
+  Input_initMessage(&input);
+  LowLatency_tuneThread(LOW_LATENCY_INPUT);
 
-  pthread_cleanup_push(cleanup, inputMessageAddress);
+  pthread_cleanup_push(cleanup, &input);
 
   while (1) {
-    inputMessage = malloc(MESSAGE_MAX_SIZE);
+    bool isEndOfLine = readMessage(&input);
 
-    if (inputMessage == NULL) {
-      fputs("[Error]: could not allocate memory for input message\n", stdout);
-      exit(1);
-    }
-
-    // Necessary to detect if received message is a new line or part of an existing line
-    memset(inputMessage, 0, MESSAGE_MAX_SIZE);
+    // The status command is answered here rather than sent
+    if (Input_isStatusCommand(&input, isEndOfLine)) {
+      Input_discardMessage(&input);
 
-    // Get keyboard input from the user
-    input = fgets(inputMessage, MESSAGE_MAX_SIZE, stdin);
+      for (int i = 0; i < PeerTable_count(pPeers); i++) {
+        Input_formatStatus(PeerTable_get(pPeers, i), statusLine);
+        fputs(statusLine, stdout);
+      }
 
-    // If EOF has been reached from a piped file without a !<enter>,
-    // send the exit command anyways
-    if (input == NULL) {
-      strcpy(inputMessage, TERMINATE);
-    } else {
-      input = NULL;
+      fflush(stdout);
+      continue;
     }
 
-    // Detect if the program should be terminated, and if the current input is the
-    // start of a new line (the first segment), or continues an existing line
-    if (isFirstSegment && strcmp(inputMessage, TERMINATE) == 0) {
+    if (Input_finishMessage(&input, isEndOfLine)) {
       s_threadHasExited = true;
-    } else if (inputMessage[MESSAGE_MAX_SIZE - 2] != 0 && inputMessage[MESSAGE_MAX_SIZE - 2] != '\n') {
-      isFirstSegment = false;
-    } else {
-      isFirstSegment = true;
     }
 
-    // Add input to the end of the sending messages queue
-    status = ThreadSafeList_prepend(pSendingMessagesList, inputMessage);
+    // Add every fragment to the end of the sending messages queue at once, waking the sender thread
+    uint64_t queuedTime = Message_getTimestamp();
 
-    if (status == -1) {
-      fputs("[Error]: could not add the message to sending messages list\n", stdout);
-      free(inputMessage);
-      s_threadHasExited = false;
+    for (int i = 0; i < input.count; i++) {
+      input.fragments[i]->queuedTime = queuedTime;
     }
-    inputMessage = NULL;
 
-    // Signal the sender thread that there is a message to send
-    Sender_signalMessageToSend();
+    status = MessageQueue_pushBatch(pSendingMessagesQueue, (void**) input.fragments, input.count);
+
+    if (status < input.count) {
+      fputs("[Error]: could not add the message to sending messages queue\n", stdout);
+
+      for (int i = status; i < input.count; i++) {
+        MessagePool_recycle(input.fragments[i]);
+      }
+
+      s_threadHasExited = false;
+    }
+    input.count = 0;
 
     if (s_threadHasExited) {
-      fputs("[You have sent the exit command]\n", stdout);
+      fputs(INPUT_EXIT_NOTICE, stdout);
       fflush(stdout);
       break;
     }
@@ -1,11 +1,36 @@
 // Manages the thread that handles keyboard input
 #ifndef _INPUT_H_
 #define _INPUT_H_
-#include "threadsafelist.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "messagequeue.h"
+#include "message.h"
+#include "peer.h"
+
+// Printed once the user has entered the exit command
+#define INPUT_EXIT_NOTICE "[You have sent the exit command]\n"
+
+// Longest status line printed for one remote user, with its newline and terminating null
+#define INPUT_STATUS_MAX_LENGTH 256
+
+// A message read from the terminal in fragments, with the numbering carried from one message to the next
+typedef struct {
+  Message* fragments[MESSAGE_MAX_FRAGMENTS];
+  int count;
+
+  // Set if the next message starts a new line
+  bool isFirstSegment;
+
+  uint32_t nextSequence;
+  uint32_t nextMessageId;
+} InputMessage;
 
 // Arguments for the input thread
 typedef struct {
-  List* pSendingMessagesList;
+  MessageQueue* pSendingMessagesQueue;
+
+  // Remote users whose links the status command reports on
+  PeerTable* pPeers;
 } InputThreadArguments;
 
 // Initializes the input thread
@@ -14,4 +39,21 @@ void Input_init(InputThreadArguments* pInputArguments);
 // Shutdowns the input thread and performs necessary cleanup
 void Input_shutdown(void);
 
+// Empties pInput, ready to read the first message
+void Input_initMessage(InputMessage* pInput);
+
+// Numbers the fragments read into pInput so the receiver can put them back together, and flags
+// whether the message starts and ends its line
+// Returns true if the message is the exit command
+bool Input_finishMessage(InputMessage* pInput, bool isEndOfLine);
+
+// Returns true if the message read into pInput, ending its line if isEndOfLine is set, is the status command
+bool Input_isStatusCommand(InputMessage* pInput, bool isEndOfLine);
+
+// Recycles the fragments read into pInput without sending them
+void Input_discardMessage(InputMessage* pInput);
+
+// Writes the status line of the link to pPeer, from its heartbeats, into pBuffer of INPUT_STATUS_MAX_LENGTH bytes
+void Input_formatStatus(Peer* pPeer, char* pBuffer);
+
 #endif
@@ -1,45 +1,435 @@
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 #include "list.h"
 
-// Statically allocated array of nodes for use in lists
-static Node s_nodeArray[LIST_MAX_NUM_NODES];
+// Nodes are allocated in slabs of 2^NODE_SLAB_SHIFT nodes
+// A node index is the index of its slab in s_slabTable, followed by NODE_SLAB_SHIFT bits
+// giving its position within the slab
+#define NODE_SLAB_SHIFT 10
+#define NODES_PER_SLAB (1 << NODE_SLAB_SHIFT)
+#define NODE_SLAB_MASK (NODES_PER_SLAB - 1)
+
+// Maximum number of slabs that can be allocated at once
+// Slot 0 of the slab table is never used, so no node has index 0 (NO_NODE)
+#define MAX_NUM_SLABS 65536
+
+// Size of a cache line, slabs are aligned to it
+#define CACHE_LINE_SIZE 64
+
+// Smallest number of slots in a key index
+// A key index is kept at most half full, so probe sequences stay short
+#define MIN_NUM_KEY_SLOTS 16
+
+// Number of available nodes each thread can cache in its magazine
+// A thread refills an empty magazine or spills a full one by moving half of this many nodes
+// to or from the slabs, so only one in NODE_MAGAZINE_SIZE / 2 node operations locks the pool
+#define NODE_MAGAZINE_SIZE 64
+
+// Number of completely unused slabs kept allocated, so a list that repeatedly
+// grows and shrinks does not allocate and release a slab every time
+#define NUM_SPARE_SLABS 1
+
+// The links of a node, kept apart from the node's item so walking a list only touches links
+typedef struct {
+    // If the node is in a list, this is the index of the next node in the list
+    // Set to NO_NODE if the node is the last node in the list
+    // If the node is available, this is the index of the next available node in its slab
+    // Set to NO_NODE if the node is the last available node in its slab
+    NodeIndex nextNode;
+
+    // Index of the previous node in the list
+    // Set to NO_NODE if the node is the first node in the list
+    NodeIndex prevNode;
+} NodeLinks;
+
+typedef struct NodeSlab_s NodeSlab;
+struct NodeSlab_s {
+    // Links of each node in the slab
+    NodeLinks links[NODES_PER_SLAB];
+
+    // Pointer to the item of each node in the slab
+    void* items[NODES_PER_SLAB];
+
+    // Pointers to the next and previous slabs in the linked chain of slabs with available nodes
+    // Only meaningful while the slab has an available node
+    NodeSlab* pNextSlab;
+    NodeSlab* pPrevSlab;
+
+    // Index of the next available node in this slab
+    // NO_NODE if every node of this slab is in a list
+    NodeIndex nextAvailableNode;
+
+    // Number of nodes in this slab that are not in a list
+    int numAvailableNodes;
+
+    // Position of this slab in s_slabTable
+    int slabIndex;
+};
+
+// Available nodes cached by a single thread
+typedef struct {
+    int numNodes;
+    NodeIndex nodes[NODE_MAGAZINE_SIZE];
+} NodeMagazine;
+
+// Table of allocated slabs, indexed by the upper bits of a node index
+// Entries are only changed with the pool locked, and a slab is only released once none of its
+// nodes are in a list, so any thread may read the entry for a node it holds without locking
+static NodeSlab* s_slabTable[MAX_NUM_SLABS];
+
+// A block of list heads allocated once every statically allocated list head is in use
+typedef struct HeadBlock_s HeadBlock;
+struct HeadBlock_s {
+    // Pointer to the previously allocated block, NULL for the first block allocated
+    HeadBlock* pNextBlock;
+
+    List heads[LIST_MAX_NUM_HEADS];
+};
 
 // Statically allocated array of list heads
 static List s_headArray[LIST_MAX_NUM_HEADS];
 
-// Pointer to the next available node that can be used in a list
-// NULL if there are no remaining available nodes
-static Node* s_pNextAvailableNode;
+// Linked chain of allocated blocks of list heads, newest first
+// Blocks are only released by List_cleanup, since a list head in use may be in any block
+static HeadBlock* s_pFirstHeadBlock;
+
+// Linked chain of slabs that have at least one available node
+// Partially used slabs are kept at the front and completely unused slabs at the back,
+// so nodes are taken from partially used slabs first and unused slabs can be released
+static NodeSlab* s_pFirstAvailableSlab;
+static NodeSlab* s_pLastAvailableSlab;
 
 // Pointer to the next available list head that can be used
 // NULL if there are no remaining list heads
 static List* s_pNextAvailableHead;
 
-// Dummy nodes
-static Node s_beforeListStartPlaceholder;
-static Node s_beyondListEndPlaceholder;
+// The magazine of the calling thread
+static __thread NodeMagazine s_magazine;
+
+// Key whose destructor returns a thread's cached nodes to the slabs when the thread exits
+static pthread_key_t s_magazineKey;
+static pthread_once_t s_magazineKeyOnce = PTHREAD_ONCE_INIT;
+
+// Counters describing the node pool, see ListPoolStatistics
+// Nodes cached in a thread's magazine count as in use
+static int s_numSlabs;
+static int s_numEmptySlabs;
+static int s_numNodesInUse;
+static int s_maxNodesInUse;
+static int s_maxNumNodes = LIST_MAX_NUM_NODES;
 
-// Constant node pointers to represent the current node of a list being
+// Number of list heads currently in a list
+static int s_numHeadsInUse;
+
+// Index meaning there is no node
+static const NodeIndex NO_NODE = 0;
+
+// Constant node indices to represent the current node of a list being
 // either before the start of the list or beyond the end of the list
-static Node* BEFORE_LIST_START = &s_beforeListStartPlaceholder;
-static Node* BEYOND_LIST_END = &s_beyondListEndPlaceholder;
+static const NodeIndex BEFORE_LIST_START = 0xFFFFFFFF;
+static const NodeIndex BEYOND_LIST_END = 0xFFFFFFFE;
 
 #define NOT_INITIALIZED 0
 
 // Tracks whether the global variables have been initialized
 static bool s_initializationIsDone = NOT_INITIALIZED;
 
+// Mutex guarding the node slabs and the chain of available list heads, which are shared by all lists
+// The contents of an individual list are not guarded, callers must synchronize access to each list
+static pthread_mutex_t s_poolMutex = PTHREAD_MUTEX_INITIALIZER;
 
-// Frees the node, allowing it to be available for another list
-// Note: does not free the item associated with the node
-static void freeNode(Node* pNode) {
-  assert(pNode != NULL);
+// Locks the shared pool of nodes and list heads
+static void lockPool() {
+  int status = pthread_mutex_lock(&s_poolMutex);
+
+  if (status) {
+    fputs("[Error]: could not lock list pool mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Unlocks the shared pool of nodes and list heads
+static void unlockPool() {
+  int status = pthread_mutex_unlock(&s_poolMutex);
+
+  if (status) {
+    fputs("[Error]: could not unlock list pool mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Returns the links of the node
+static inline NodeLinks* linksOf(NodeIndex node) {
+  return &s_slabTable[node >> NODE_SLAB_SHIFT]->links[node & NODE_SLAB_MASK];
+}
+
+// Returns the item of the node
+static inline void* itemOf(NodeIndex node) {
+  return s_slabTable[node >> NODE_SLAB_SHIFT]->items[node & NODE_SLAB_MASK];
+}
+
+// Returns the slot of a key index where probing for the key starts, before masking
+static inline uint32_t hashKey(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return (uint32_t) key;
+}
+
+// Stores the key and node in the first empty slot of the probe sequence for the key
+static void insertKeySlot(ListKeySlot* pSlots, uint32_t numSlots, uint64_t key, NodeIndex node) {
+  uint32_t mask = numSlots - 1;
+  uint32_t slot = hashKey(key) & mask;
+
+  while (pSlots[slot].node != NO_NODE) {
+    slot = (slot + 1) & mask;
+  }
+
+  pSlots[slot].key = key;
+  pSlots[slot].node = node;
+  return;
+}
+
+// Adds the node to the key index of pList, which must have room for it
+static void indexNode(List* pList, NodeIndex node) {
+  uint64_t key = (*pList->pKeyFn)(itemOf(node));
+  insertKeySlot(pList->pKeySlots, pList->numKeySlots, key, node);
+  return;
+}
+
+// Removes the node from the key index of pList
+static void unindexNode(List* pList, NodeIndex node) {
+  ListKeySlot* pSlots = pList->pKeySlots;
+  uint32_t mask = pList->numKeySlots - 1;
+  uint32_t hole = hashKey((*pList->pKeyFn)(itemOf(node))) & mask;
+
+  while (pSlots[hole].node != node) {
+    assert(pSlots[hole].node != NO_NODE);
+    hole = (hole + 1) & mask;
+  }
+
+  // Shift later slots of the probe sequence back into the hole, so no search stops early
+  uint32_t slot = (hole + 1) & mask;
+  while (pSlots[slot].node != NO_NODE) {
+    uint32_t homeSlot = hashKey(pSlots[slot].key) & mask;
+
+    // The slot may move back only if the hole lies between its home slot and the slot itself
+    if (((slot - homeSlot) & mask) >= ((slot - hole) & mask)) {
+      pSlots[hole] = pSlots[slot];
+      hole = slot;
+    }
+
+    slot = (slot + 1) & mask;
+  }
+
+  pSlots[hole].node = NO_NODE;
+  return;
+}
+
+// Returns the node holding an item with the key, using the key index of pList
+// Returns NO_NODE if there is no such item
+static NodeIndex findKey(List* pList, uint64_t key) {
+  ListKeySlot* pSlots = pList->pKeySlots;
+  uint32_t mask = pList->numKeySlots - 1;
+  uint32_t slot = hashKey(key) & mask;
+
+  while (pSlots[slot].node != NO_NODE) {
+    if (pSlots[slot].key == key) {
+      return pSlots[slot].node;
+    }
+
+    slot = (slot + 1) & mask;
+  }
+
+  return NO_NODE;
+}
+
+// Makes sure the key index of pList, if it has one, has room for count more items
+// Returns 0 on success, -1 on failure
+static int reserveKeySlots(List* pList, int count) {
+  if (pList->pKeyFn == NULL) {
+    return 0;
+  }
+
+  uint32_t numSlots = pList->numKeySlots;
+  uint32_t numNeededSlots = 2 * ((uint32_t) pList->size + (uint32_t) count);
+
+  if (numNeededSlots <= numSlots) {
+    return 0;
+  }
+
+  while (numSlots < numNeededSlots) {
+    numSlots <<= 1;
+  }
+
+  ListKeySlot* pSlots = calloc(numSlots, sizeof(ListKeySlot));
+
+  if (pSlots == NULL) {
+    return -1; // Failure, out of memory
+  }
+
+  // Move the existing keys over without asking for each item's key again
+  for (uint32_t i = 0; i < pList->numKeySlots; i++) {
+    if (pList->pKeySlots[i].node != NO_NODE) {
+      insertKeySlot(pSlots, numSlots, pList->pKeySlots[i].key, pList->pKeySlots[i].node);
+    }
+  }
+
+  free(pList->pKeySlots);
+  pList->pKeySlots = pSlots;
+  pList->numKeySlots = numSlots;
+  return 0;
+}
+
+// Adds the count nodes starting at firstNode to the key index of pList, if it has one, before they
+// are joined to pList
+static void indexJoinedNodes(List* pList, NodeIndex firstNode, int count) {
+  if (pList->pKeyFn == NULL || count == 0) {
+    return;
+  }
+
+  if (reserveKeySlots(pList, count) == -1) {
+    fputs("[Error]: could not grow list key index\n", stdout);
+    exit(1);
+  }
+
+  for (NodeIndex node = firstNode; node != NO_NODE; node = linksOf(node)->nextNode) {
+    indexNode(pList, node);
+  }
+
+  return;
+}
+
+// Removes the slab from the linked chain of slabs with available nodes
+static void unlinkSlab(NodeSlab* pSlab) {
+  if (pSlab->pPrevSlab == NULL) {
+    s_pFirstAvailableSlab = pSlab->pNextSlab;
+  } else {
+    pSlab->pPrevSlab->pNextSlab = pSlab->pNextSlab;
+  }
+
+  if (pSlab->pNextSlab == NULL) {
+    s_pLastAvailableSlab = pSlab->pPrevSlab;
+  } else {
+    pSlab->pNextSlab->pPrevSlab = pSlab->pPrevSlab;
+  }
+
+  pSlab->pNextSlab = NULL;
+  pSlab->pPrevSlab = NULL;
+  return;
+}
+
+// Adds the slab to the front of the linked chain of slabs with available nodes
+static void linkSlabAtFront(NodeSlab* pSlab) {
+  pSlab->pPrevSlab = NULL;
+  pSlab->pNextSlab = s_pFirstAvailableSlab;
+
+  if (s_pFirstAvailableSlab == NULL) {
+    s_pLastAvailableSlab = pSlab;
+  } else {
+    s_pFirstAvailableSlab->pPrevSlab = pSlab;
+  }
 
-  pNode->pItem = NULL;
-  pNode->pNextNode = s_pNextAvailableNode;
-  pNode->pPrevNode = NULL;
-  s_pNextAvailableNode = pNode;
+  s_pFirstAvailableSlab = pSlab;
+  return;
+}
+
+// Adds the slab to the back of the linked chain of slabs with available nodes
+static void linkSlabAtBack(NodeSlab* pSlab) {
+  pSlab->pNextSlab = NULL;
+  pSlab->pPrevSlab = s_pLastAvailableSlab;
+
+  if (s_pLastAvailableSlab == NULL) {
+    s_pFirstAvailableSlab = pSlab;
+  } else {
+    s_pLastAvailableSlab->pNextSlab = pSlab;
+  }
+
+  s_pLastAvailableSlab = pSlab;
+  return;
+}
+
+// Allocates a new slab of available nodes and adds it to the chain of slabs with available nodes
+// Must be called with the pool locked
+// Returns 0 on success, -1 on failure
+static int growPool() {
+  NodeSlab* pSlab = NULL;
+  int slabIndex = 1;
+
+  // Find an unused slot in the slab table
+  while (slabIndex < MAX_NUM_SLABS && s_slabTable[slabIndex] != NULL) {
+    slabIndex++;
+  }
+
+  if (slabIndex == MAX_NUM_SLABS) {
+    return -1; // Failure, every node index is taken
+  }
+
+  if (posix_memalign((void**) &pSlab, CACHE_LINE_SIZE, sizeof(NodeSlab))) {
+    return -1; // Failure, out of memory
+  }
+
+  // Chain the nodes of the slab together
+  NodeIndex firstNode = (NodeIndex) slabIndex << NODE_SLAB_SHIFT;
+  for (int i = 0; i < NODES_PER_SLAB; i++) {
+    pSlab->links[i].nextNode = (i < NODES_PER_SLAB - 1) ? firstNode + i + 1 : NO_NODE;
+    pSlab->links[i].prevNode = NO_NODE;
+    pSlab->items[i] = NULL;
+  }
+
+  pSlab->nextAvailableNode = firstNode;
+  pSlab->numAvailableNodes = NODES_PER_SLAB;
+  pSlab->slabIndex = slabIndex;
+  s_slabTable[slabIndex] = pSlab;
+  linkSlabAtBack(pSlab);
+
+  s_numSlabs++;
+  s_numEmptySlabs++;
+  return 0;
+}
+
+// Returns the node to the available nodes of its slab, releasing the slab if it is unused
+// and enough spare slabs are already kept
+// Must be called with the pool locked
+static void releaseNode(NodeIndex node) {
+  NodeSlab* pSlab = s_slabTable[node >> NODE_SLAB_SHIFT];
+  int position = node & NODE_SLAB_MASK;
+
+  pSlab->items[position] = NULL;
+  pSlab->links[position].prevNode = NO_NODE;
+  pSlab->links[position].nextNode = pSlab->nextAvailableNode;
+  pSlab->nextAvailableNode = node;
+  pSlab->numAvailableNodes++;
+  s_numNodesInUse--;
+
+  // A slab that was completely used has an available node again
+  if (pSlab->numAvailableNodes == 1) {
+    linkSlabAtFront(pSlab);
+  }
+
+  // The slab is completely unused, either keep it as a spare or shrink the pool
+  if (pSlab->numAvailableNodes == NODES_PER_SLAB) {
+    unlinkSlab(pSlab);
+
+    if (s_numEmptySlabs >= NUM_SPARE_SLABS) {
+      s_slabTable[pSlab->slabIndex] = NULL;
+      free(pSlab);
+      s_numSlabs--;
+    } else {
+      linkSlabAtBack(pSlab);
+      s_numEmptySlabs++;
+    }
+  }
 
   return;
 }
@@ -49,56 +439,236 @@ static void freeNode(Node* pNode) {
 static void freeHead(List* pList) {
   assert(pList != NULL);
 
-  pList->pNextHead = s_pNextAvailableHead;
   pList->size = 0;
-  pList->pCurrentNode = BEFORE_LIST_START;
-  pList->pHeadNode = NULL;
-  pList->pTailNode = NULL;
+  pList->currentNode = BEFORE_LIST_START;
+  pList->headNode = NO_NODE;
+  pList->tailNode = NO_NODE;
+
+  free(pList->pKeySlots);
+  pList->pKeyFn = NULL;
+  pList->pKeySlots = NULL;
+  pList->numKeySlots = 0;
+
+  lockPool();
+  pList->pNextHead = s_pNextAvailableHead;
   s_pNextAvailableHead = pList;
+  s_numHeadsInUse--;
+  unlockPool();
 
   return;
 }
 
-// Makes a new node with the provided item, and returns its reference on success
-// Returns a NULL pointer on failure
-static Node* createNode(void* pItem, Node* pPrevNode, Node* pNextNode) {
-  if (s_pNextAvailableNode == NULL) {
-    return NULL; // Failure, no more available nodes
+// Takes an available node out of the slabs, allocating another slab if every node is in use
+// Must be called with the pool locked
+// Returns NO_NODE on failure
+static NodeIndex takeNode() {
+  if (s_maxNumNodes > 0 && s_numNodesInUse >= s_maxNumNodes) {
+    return NO_NODE; // Failure, the pool has reached its hard cap
+  }
+
+  if (s_pFirstAvailableSlab == NULL && growPool() == -1) {
+    return NO_NODE; // Failure, no more available nodes
+  }
+
+  // Take the first available node of the first slab with available nodes
+  NodeSlab* pSlab = s_pFirstAvailableSlab;
+  NodeIndex node = pSlab->nextAvailableNode;
+  pSlab->nextAvailableNode = pSlab->links[node & NODE_SLAB_MASK].nextNode;
+
+  if (pSlab->numAvailableNodes == NODES_PER_SLAB) {
+    s_numEmptySlabs--;
   }
 
-  // Create new node from the first available node
-  Node* pNewNode = s_pNextAvailableNode;
-  s_pNextAvailableNode = s_pNextAvailableNode->pNextNode;
-  pNewNode->pItem = pItem;
-  pNewNode->pPrevNode = pPrevNode;
-  pNewNode->pNextNode = pNextNode;
+  pSlab->numAvailableNodes--;
+
+  if (pSlab->numAvailableNodes == 0) {
+    unlinkSlab(pSlab);
+  }
 
-  return pNewNode;
+  s_numNodesInUse++;
+
+  if (s_numNodesInUse > s_maxNodesInUse) {
+    s_maxNodesInUse = s_numNodesInUse;
+  }
+
+  return node;
 }
 
-// Sets up the data structures needed to create lists
-static void initialization() {
-  // Set up dummy nodes
-  s_beforeListStartPlaceholder.pNextNode = NULL;
-  s_beforeListStartPlaceholder.pPrevNode = NULL;
-  s_beforeListStartPlaceholder.pItem = NULL;
-  s_beyondListEndPlaceholder.pNextNode = NULL;
-  s_beyondListEndPlaceholder.pPrevNode = NULL;
-  s_beyondListEndPlaceholder.pItem = NULL;
+// Returns count nodes from the top of the magazine to their slabs
+static void spillMagazine(NodeMagazine* pMagazine, int count) {
+  lockPool();
+  while (count > 0 && pMagazine->numNodes > 0) {
+    pMagazine->numNodes--;
+    releaseNode(pMagazine->nodes[pMagazine->numNodes]);
+    count--;
+  }
+  unlockPool();
+
+  return;
+}
+
+// Returns every node of an exiting thread's magazine to the slabs
+static void flushMagazine(void* args) {
+  NodeMagazine* pMagazine = args;
+  spillMagazine(pMagazine, pMagazine->numNodes);
+  return;
+}
+
+// Creates the key that flushes each thread's magazine when it exits
+static void createMagazineKey() {
+  int status = pthread_key_create(&s_magazineKey, flushMagazine);
+
+  if (status) {
+    fputs("[Error]: could not create list node cache key\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Returns the magazine of the calling thread
+// The first time the thread uses it, makes sure its nodes are returned when the thread exits
+static NodeMagazine* getMagazine() {
+  NodeMagazine* pMagazine = &s_magazine;
+
+  pthread_once(&s_magazineKeyOnce, createMagazineKey);
+
+  if (pthread_getspecific(s_magazineKey) == NULL) {
+    int status = pthread_setspecific(s_magazineKey, pMagazine);
+
+    if (status) {
+      fputs("[Error]: could not register list node cache\n", stdout);
+      exit(1);
+    }
+  }
+
+  return pMagazine;
+}
+
+// Moves up to half a magazine of available nodes from the slabs into the magazine
+static void refillMagazine(NodeMagazine* pMagazine) {
+  lockPool();
+  while (pMagazine->numNodes < NODE_MAGAZINE_SIZE / 2) {
+    NodeIndex node = takeNode();
+
+    if (node == NO_NODE) {
+      break;
+    }
+
+    pMagazine->nodes[pMagazine->numNodes] = node;
+    pMagazine->numNodes++;
+  }
+  unlockPool();
+
+  return;
+}
+
+// Frees the node, allowing it to be available for another list
+// The node is cached by the calling thread, and only returned to its slab when the cache is full
+// Note: does not free the item associated with the node
+static void freeNode(NodeIndex node) {
+  assert(node != NO_NODE);
+
+  // With a hard cap, nodes go straight back to their slabs so cached nodes do not hold up the cap
+  if (__atomic_load_n(&s_maxNumNodes, __ATOMIC_RELAXED) > 0) {
+    lockPool();
+    releaseNode(node);
+    unlockPool();
+    return;
+  }
+
+  NodeMagazine* pMagazine = getMagazine();
+
+  if (pMagazine->numNodes == NODE_MAGAZINE_SIZE) {
+    spillMagazine(pMagazine, NODE_MAGAZINE_SIZE / 2);
+  }
+
+  pMagazine->nodes[pMagazine->numNodes] = node;
+  pMagazine->numNodes++;
+
+  return;
+}
+
+// Makes a new node with the provided item, and returns its index on success
+// The node is taken from the calling thread's cache, which is refilled from the slabs when empty
+// Returns NO_NODE on failure
+static NodeIndex createNode(void* pItem, NodeIndex prevNode, NodeIndex nextNode) {
+  NodeMagazine* pMagazine = getMagazine();
+
+  // With a hard cap, take nodes straight from the slabs so the cap is exact
+  // Any nodes this thread cached before the cap was set are returned first
+  if (__atomic_load_n(&s_maxNumNodes, __ATOMIC_RELAXED) > 0) {
+    if (pMagazine->numNodes > 0) {
+      spillMagazine(pMagazine, pMagazine->numNodes);
+    }
+
+    lockPool();
+    NodeIndex node = takeNode();
+    unlockPool();
+
+    if (node == NO_NODE) {
+      return NO_NODE; // Failure, no more available nodes
+    }
+
+    pMagazine->nodes[0] = node;
+    pMagazine->numNodes = 1;
+  }
 
-  // Set up up linked chain of available nodes and linked chain of available list heads
-  s_pNextAvailableNode = &s_nodeArray[0];
-  s_pNextAvailableHead = &s_headArray[0];
+  if (pMagazine->numNodes == 0) {
+    refillMagazine(pMagazine);
 
-  for (int i = 0; i < LIST_MAX_NUM_NODES - 1; i++) {
-    s_nodeArray[i].pNextNode = &s_nodeArray[i + 1];
+    if (pMagazine->numNodes == 0) {
+      return NO_NODE; // Failure, no more available nodes
+    }
   }
-  s_nodeArray[LIST_MAX_NUM_NODES - 1].pNextNode = NULL;
 
+  pMagazine->numNodes--;
+  NodeIndex newNode = pMagazine->nodes[pMagazine->numNodes];
+
+  NodeSlab* pSlab = s_slabTable[newNode >> NODE_SLAB_SHIFT];
+  int position = newNode & NODE_SLAB_MASK;
+  pSlab->items[position] = pItem;
+  pSlab->links[position].prevNode = prevNode;
+  pSlab->links[position].nextNode = nextNode;
+
+  return newNode;
+}
+
+// Adds the LIST_MAX_NUM_HEADS list heads of pHeads to the front of the chain of available list heads
+// Must be called with the pool locked
+static void chainHeads(List* pHeads) {
   for (int i = 0; i < LIST_MAX_NUM_HEADS - 1; i++) {
-    s_headArray[i].pNextHead = &s_headArray[i + 1];
+    pHeads[i].pNextHead = &pHeads[i + 1];
   }
-  s_headArray[LIST_MAX_NUM_HEADS - 1].pNextHead = NULL;
+  pHeads[LIST_MAX_NUM_HEADS - 1].pNextHead = s_pNextAvailableHead;
+
+  s_pNextAvailableHead = &pHeads[0];
+  return;
+}
+
+// Allocates a new block of list heads and adds them to the chain of available list heads
+// Must be called with the pool locked
+// Returns 0 on success, -1 on failure
+static int growHeads() {
+  HeadBlock* pBlock = malloc(sizeof(HeadBlock));
+
+  if (pBlock == NULL) {
+    return -1; // Failure, out of memory
+  }
+
+  pBlock->pNextBlock = s_pFirstHeadBlock;
+  s_pFirstHeadBlock = pBlock;
+  chainHeads(pBlock->heads);
+
+  return 0;
+}
+
+// Sets up the data structures needed to create lists
+static void initialization() {
+  // Set up linked chain of available list heads, more heads are allocated in blocks once these are used
+  // Nodes are allocated in slabs the first time one is needed
+  s_pNextAvailableHead = NULL;
+  chainHeads(s_headArray);
 
   // Set flag so initialization only happens once
   s_initializationIsDone = 1;
@@ -108,24 +678,32 @@ static void initialization() {
 // Makes a new, empty list, and returns its reference on success.
 // Returns a NULL pointer on failure.
 List* List_create() {
+  lockPool();
 
   // Initialize data structures when List_create is called for the first time
   if (!s_initializationIsDone) {
     initialization();
   }
 
-  if (s_pNextAvailableHead == NULL) {
+  if (s_pNextAvailableHead == NULL && growHeads() == -1) {
+    unlockPool();
     return NULL; // Failure, no more available list heads
   }
 
   // Create new list from the first available list head
   List* pNewList = s_pNextAvailableHead;
   s_pNextAvailableHead = s_pNextAvailableHead->pNextHead;
+  s_numHeadsInUse++;
+  unlockPool();
+
   pNewList->pNextHead = NULL;
   pNewList->size = 0;
-  pNewList->pCurrentNode = BEFORE_LIST_START;
-  pNewList->pHeadNode = NULL;
-  pNewList->pTailNode = NULL;
+  pNewList->currentNode = BEFORE_LIST_START;
+  pNewList->headNode = NO_NODE;
+  pNewList->tailNode = NO_NODE;
+  pNewList->pKeyFn = NULL;
+  pNewList->pKeySlots = NULL;
+  pNewList->numKeySlots = 0;
 
   return pNewList;
 }
@@ -144,13 +722,13 @@ void* List_first(List* pList) {
 
   // Handle empty list
   if (pList->size == 0) {
-    pList->pCurrentNode = BEFORE_LIST_START;
+    pList->currentNode = BEFORE_LIST_START;
     return NULL;
   }
 
-  assert(pList->pHeadNode != NULL);
-  pList->pCurrentNode = pList->pHeadNode;
-  return pList->pHeadNode->pItem;
+  assert(pList->headNode != NO_NODE);
+  pList->currentNode = pList->headNode;
+  return itemOf(pList->headNode);
 }
 
 // Returns a pointer to the last item in pList and makes the last item the current item.
@@ -160,13 +738,13 @@ void* List_last(List* pList) {
 
   // Handle empty list
   if (pList->size == 0) {
-    pList->pCurrentNode = BEYOND_LIST_END;
+    pList->currentNode = BEYOND_LIST_END;
     return NULL;
   }
 
-  assert(pList->pTailNode != NULL);
-  pList->pCurrentNode = pList->pTailNode;
-  return pList->pTailNode->pItem;
+  assert(pList->tailNode != NO_NODE);
+  pList->currentNode = pList->tailNode;
+  return itemOf(pList->tailNode);
 }
 
 // Advances pList's current item by one, and returns a pointer to the new current item.
@@ -176,23 +754,23 @@ void* List_next(List* pList) {
   assert(pList != NULL);
 
   // If list is empty, or the current node is beyond the end of list, or the current node is the last node
-  if (pList->size == 0 || pList->pCurrentNode == BEYOND_LIST_END || pList->pCurrentNode == pList->pTailNode) {
-    pList->pCurrentNode = BEYOND_LIST_END;
+  if (pList->size == 0 || pList->currentNode == BEYOND_LIST_END || pList->currentNode == pList->tailNode) {
+    pList->currentNode = BEYOND_LIST_END;
     return NULL;
   }
 
   // If current item is before the start of list, and list is nonempty
-  if (pList->pCurrentNode == BEFORE_LIST_START) {
-    assert(pList->pHeadNode != NULL);
-    pList->pCurrentNode = pList->pHeadNode;
-    return pList->pHeadNode->pItem;
+  if (pList->currentNode == BEFORE_LIST_START) {
+    assert(pList->headNode != NO_NODE);
+    pList->currentNode = pList->headNode;
+    return itemOf(pList->headNode);
   }
 
   // If current node is any non-last node
-  assert(pList->pCurrentNode != NULL);
-  assert(pList->pCurrentNode->pNextNode != NULL);
-  pList->pCurrentNode = pList->pCurrentNode->pNextNode;
-  return pList->pCurrentNode->pItem;
+  assert(pList->currentNode != NO_NODE);
+  assert(linksOf(pList->currentNode)->nextNode != NO_NODE);
+  pList->currentNode = linksOf(pList->currentNode)->nextNode;
+  return itemOf(pList->currentNode);
 }
 
 // Backs up pList's current item by one, and returns a pointer to the new current item.
@@ -202,23 +780,23 @@ void* List_prev(List* pList) {
   assert(pList != NULL);
 
   // If list is empty, or the current node is before the list, or the current node is the first node
-  if (pList->size == 0 || pList->pCurrentNode == BEFORE_LIST_START || pList->pCurrentNode == pList->pHeadNode) {
-    pList->pCurrentNode = BEFORE_LIST_START;
+  if (pList->size == 0 || pList->currentNode == BEFORE_LIST_START || pList->currentNode == pList->headNode) {
+    pList->currentNode = BEFORE_LIST_START;
     return NULL;
   }
 
   // If current item is beyond end of list, and list is nonempty
-  if (pList->pCurrentNode == BEYOND_LIST_END) {
-    assert(pList->pTailNode != NULL);
-    pList->pCurrentNode = pList->pTailNode;
-    return pList->pTailNode->pItem;
+  if (pList->currentNode == BEYOND_LIST_END) {
+    assert(pList->tailNode != NO_NODE);
+    pList->currentNode = pList->tailNode;
+    return itemOf(pList->tailNode);
   }
 
   // If current node is any non-first node
-  assert(pList->pCurrentNode != NULL);
-  assert(pList->pCurrentNode->pPrevNode != NULL);
-  pList->pCurrentNode = pList->pCurrentNode->pPrevNode;
-  return pList->pCurrentNode->pItem;
+  assert(pList->currentNode != NO_NODE);
+  assert(linksOf(pList->currentNode)->prevNode != NO_NODE);
+  pList->currentNode = linksOf(pList->currentNode)->prevNode;
+  return itemOf(pList->currentNode);
 }
 
 // Returns a pointer to the current item in pList.
@@ -227,12 +805,12 @@ void* List_curr(List* pList) {
   assert(pList != NULL);
 
   // If current item is before start of list or beyond end of list
-  if (pList->pCurrentNode == BEFORE_LIST_START || pList->pCurrentNode == BEYOND_LIST_END) {
+  if (pList->currentNode == BEFORE_LIST_START || pList->currentNode == BEYOND_LIST_END) {
     return NULL;
   }
 
-  assert(pList->pCurrentNode != NULL);
-  return pList->pCurrentNode->pItem;
+  assert(pList->currentNode != NO_NODE);
+  return itemOf(pList->currentNode);
 }
 
 // Adds the new item to pList directly after the current item, and makes item the current item.
@@ -243,29 +821,40 @@ int List_add(List* pList, void* pItem) {
   assert(pList != NULL);
 
   // Current item is before start of list
-  if (pList->pCurrentNode == BEFORE_LIST_START) {
+  if (pList->currentNode == BEFORE_LIST_START) {
     return List_prepend(pList, pItem);
   }
 
   // Current node is last node, or beyond end of list
-  if (pList->pCurrentNode == pList->pTailNode || pList->pCurrentNode == BEYOND_LIST_END) {
+  if (pList->currentNode == pList->tailNode || pList->currentNode == BEYOND_LIST_END) {
     return List_append(pList, pItem);
   }
 
   // Current node is any non-last node
   assert(pList->size != 0);
-  assert(pList->pCurrentNode != NULL);
-  assert(pList->pCurrentNode->pNextNode != NULL);
-  Node* pNewNode = createNode(pItem, pList->pCurrentNode, pList->pCurrentNode->pNextNode);
+  assert(pList->currentNode != NO_NODE);
+  NodeIndex nextNode = linksOf(pList->currentNode)->nextNode;
+  assert(nextNode != NO_NODE);
 
-  if (pNewNode == NULL) {
+  if (reserveKeySlots(pList, 1) == -1) {
+    return -1; // Failure, key index could not grow
+  }
+
+  NodeIndex newNode = createNode(pItem, pList->currentNode, nextNode);
+
+  if (newNode == NO_NODE) {
     return -1; // Failure, node could not be created
   }
 
-  pList->pCurrentNode->pNextNode->pPrevNode = pNewNode;
-  pList->pCurrentNode->pNextNode = pNewNode;
-  pList->pCurrentNode = pNewNode;
+  linksOf(nextNode)->prevNode = newNode;
+  linksOf(pList->currentNode)->nextNode = newNode;
+  pList->currentNode = newNode;
   pList->size++;
+
+  if (pList->pKeyFn != NULL) {
+    indexNode(pList, newNode);
+  }
+
   return 0;
 }
 
@@ -277,29 +866,40 @@ int List_insert(List* pList, void* pItem) {
   assert(pList != NULL);
 
   // Current node is beyond end of list
-  if (pList->pCurrentNode == BEYOND_LIST_END) {
+  if (pList->currentNode == BEYOND_LIST_END) {
     return List_append(pList, pItem);
   }
 
   // Current node is first node, or before start of list
-  if (pList->pCurrentNode == pList->pHeadNode || pList->pCurrentNode == BEFORE_LIST_START) {
+  if (pList->currentNode == pList->headNode || pList->currentNode == BEFORE_LIST_START) {
     return List_prepend(pList, pItem);
   }
 
   // Current node is any non-first node
   assert(pList->size != 0);
-  assert(pList->pCurrentNode != NULL);
-  assert(pList->pCurrentNode->pPrevNode != NULL);
-  Node* pNewNode = createNode(pItem, pList->pCurrentNode->pPrevNode, pList->pCurrentNode);
+  assert(pList->currentNode != NO_NODE);
+  NodeIndex prevNode = linksOf(pList->currentNode)->prevNode;
+  assert(prevNode != NO_NODE);
 
-  if (pNewNode == NULL) {
+  if (reserveKeySlots(pList, 1) == -1) {
+    return -1; // Failure, key index could not grow
+  }
+
+  NodeIndex newNode = createNode(pItem, prevNode, pList->currentNode);
+
+  if (newNode == NO_NODE) {
     return -1; // Failure, node could not be created
   }
 
-  pList->pCurrentNode->pPrevNode->pNextNode = pNewNode;
-  pList->pCurrentNode->pPrevNode = pNewNode;
-  pList->pCurrentNode = pNewNode;
+  linksOf(prevNode)->nextNode = newNode;
+  linksOf(pList->currentNode)->prevNode = newNode;
+  pList->currentNode = newNode;
   pList->size++;
+
+  if (pList->pKeyFn != NULL) {
+    indexNode(pList, newNode);
+  }
+
   return 0;
 }
 
@@ -308,21 +908,30 @@ int List_insert(List* pList, void* pItem) {
 int List_append(List* pList, void* pItem) {
   assert(pList != NULL);
 
-  Node* pNewNode = createNode(pItem, pList->pTailNode, NULL);
+  if (reserveKeySlots(pList, 1) == -1) {
+    return -1; // Failure, key index could not grow
+  }
+
+  NodeIndex newNode = createNode(pItem, pList->tailNode, NO_NODE);
 
-  if (pNewNode == NULL) {
+  if (newNode == NO_NODE) {
     return -1; // Failure, node could not be created
   }
 
   if (pList->size == 0) {
-    pList->pHeadNode = pNewNode;
+    pList->headNode = newNode;
   } else {
-    pList->pTailNode->pNextNode = pNewNode;
+    linksOf(pList->tailNode)->nextNode = newNode;
   }
 
-  pList->pTailNode = pNewNode;
+  pList->tailNode = newNode;
   pList->size++;
-  pList->pCurrentNode = pNewNode;
+  pList->currentNode = newNode;
+
+  if (pList->pKeyFn != NULL) {
+    indexNode(pList, newNode);
+  }
+
   return 0;
 }
 
@@ -331,21 +940,30 @@ int List_append(List* pList, void* pItem) {
 int List_prepend(List* pList, void* pItem) {
   assert(pList != NULL);
 
-  Node* pNewNode = createNode(pItem, NULL, pList->pHeadNode);
+  if (reserveKeySlots(pList, 1) == -1) {
+    return -1; // Failure, key index could not grow
+  }
 
-  if (pNewNode == NULL) {
+  NodeIndex newNode = createNode(pItem, NO_NODE, pList->headNode);
+
+  if (newNode == NO_NODE) {
     return -1; // Failure, node could not be created
   }
 
   if (pList->size == 0) {
-    pList->pTailNode = pNewNode;
+    pList->tailNode = newNode;
   } else {
-    pList->pHeadNode->pPrevNode = pNewNode;
+    linksOf(pList->headNode)->prevNode = newNode;
   }
 
-  pList->pHeadNode = pNewNode;
+  pList->headNode = newNode;
   pList->size++;
-  pList->pCurrentNode = pNewNode;
+  pList->currentNode = newNode;
+
+  if (pList->pKeyFn != NULL) {
+    indexNode(pList, newNode);
+  }
+
   return 0;
 }
 
@@ -356,42 +974,47 @@ void* List_remove(List* pList) {
   assert(pList != NULL);
 
   // List is empty or current item is before start of list or beyond end of list
-  if (pList->size == 0 || pList->pCurrentNode == BEFORE_LIST_START || pList->pCurrentNode == BEYOND_LIST_END) {
+  if (pList->size == 0 || pList->currentNode == BEFORE_LIST_START || pList->currentNode == BEYOND_LIST_END) {
     return NULL;
   }
 
-  assert(pList->pCurrentNode != NULL);
-  void* pCurrentItem = pList->pCurrentNode->pItem;
-  Node* pRemoveNode = pList->pCurrentNode;
+  assert(pList->currentNode != NO_NODE);
+  NodeIndex removeNode = pList->currentNode;
+  NodeLinks* pRemoveLinks = linksOf(removeNode);
+  void* pCurrentItem = itemOf(removeNode);
 
   if (pList->size == 1) {
     // Handle list with only one item
-    pList->pHeadNode = NULL;
-    pList->pTailNode = NULL;
-    pList->pCurrentNode = BEFORE_LIST_START;
+    pList->headNode = NO_NODE;
+    pList->tailNode = NO_NODE;
+    pList->currentNode = BEFORE_LIST_START;
 
-  } else if (pList->pCurrentNode == pList->pHeadNode) {
+  } else if (removeNode == pList->headNode) {
     // Handle current node is the first node
-    pList->pHeadNode = pList->pHeadNode->pNextNode;
-    pList->pHeadNode->pPrevNode = NULL;
-    pList->pCurrentNode = pList->pHeadNode;
+    pList->headNode = pRemoveLinks->nextNode;
+    linksOf(pList->headNode)->prevNode = NO_NODE;
+    pList->currentNode = pList->headNode;
 
-  } else if (pList->pCurrentNode == pList->pTailNode) {
+  } else if (removeNode == pList->tailNode) {
     // Handle current node is the last node
-    pList->pTailNode = pList->pTailNode->pPrevNode;
-    pList->pTailNode->pNextNode = NULL;
-    pList->pCurrentNode = BEYOND_LIST_END;
+    pList->tailNode = pRemoveLinks->prevNode;
+    linksOf(pList->tailNode)->nextNode = NO_NODE;
+    pList->currentNode = BEYOND_LIST_END;
 
   } else {
     // Handle current node is any non-first, non-last node
-    pList->pCurrentNode->pNextNode->pPrevNode = pList->pCurrentNode->pPrevNode;
-    pList->pCurrentNode->pPrevNode->pNextNode = pList->pCurrentNode->pNextNode;
-    pList->pCurrentNode = pList->pCurrentNode->pNextNode;
+    linksOf(pRemoveLinks->nextNode)->prevNode = pRemoveLinks->prevNode;
+    linksOf(pRemoveLinks->prevNode)->nextNode = pRemoveLinks->nextNode;
+    pList->currentNode = pRemoveLinks->nextNode;
 
   }
 
+  if (pList->pKeyFn != NULL) {
+    unindexNode(pList, removeNode);
+  }
+
   pList->size--;
-  freeNode(pRemoveNode);
+  freeNode(removeNode);
   return pCurrentItem;
 }
 
@@ -402,16 +1025,18 @@ void List_concat(List* pList1, List* pList2) {
   assert(pList2 != NULL);
   assert(pList1 != pList2);
 
+  indexJoinedNodes(pList1, pList2->headNode, pList2->size);
+
   // Concatenation is only necessary if second list is nonempty
   if (pList2->size > 0) {
     if (pList1->size > 0) {
-      pList1->pTailNode->pNextNode = pList2->pHeadNode;
-      pList2->pHeadNode->pPrevNode = pList1->pTailNode;
+      linksOf(pList1->tailNode)->nextNode = pList2->headNode;
+      linksOf(pList2->headNode)->prevNode = pList1->tailNode;
     } else {
-      pList1->pHeadNode = pList2->pHeadNode;
+      pList1->headNode = pList2->headNode;
     }
 
-    pList1->pTailNode = pList2->pTailNode;
+    pList1->tailNode = pList2->tailNode;
     pList1->size += pList2->size;
   }
 
@@ -428,14 +1053,30 @@ void List_free(List* pList, FREE_FN pItemFreeFn) {
   assert(pList != NULL);
   assert(pItemFreeFn != NULL);
 
-  // Iterate through the list from the start,
-  // freeing each node and its associated item
-  Node* pCurrentNode = pList->pHeadNode;
-  while (pCurrentNode != NULL) {
-    Node* pNextNode = pCurrentNode->pNextNode;
-    (*pItemFreeFn)(pCurrentNode->pItem);
-    freeNode(pCurrentNode);
-    pCurrentNode = pNextNode;
+  // Iterate through the list from the start, freeing each associated item
+  NodeIndex currentNode = pList->headNode;
+  while (currentNode != NO_NODE) {
+    (*pItemFreeFn)(itemOf(currentNode));
+    currentNode = linksOf(currentNode)->nextNode;
+  }
+
+  // Return every node to the pool, going straight to the slabs under a single lock
+  // when there are more nodes than the thread's cache could hold
+  currentNode = pList->headNode;
+  if (pList->size > NODE_MAGAZINE_SIZE) {
+    lockPool();
+    while (currentNode != NO_NODE) {
+      NodeIndex nextNode = linksOf(currentNode)->nextNode;
+      releaseNode(currentNode);
+      currentNode = nextNode;
+    }
+    unlockPool();
+  }
+
+  while (currentNode != NO_NODE) {
+    NodeIndex nextNode = linksOf(currentNode)->nextNode;
+    freeNode(currentNode);
+    currentNode = nextNode;
   }
 
   freeHead(pList);
@@ -452,28 +1093,32 @@ void* List_trim(List* pList) {
       return NULL;
   }
 
-  assert(pList->pTailNode != NULL);
-  Node* pLastNode = pList->pTailNode;
-  void* pLastItem = pList->pTailNode->pItem;
+  assert(pList->tailNode != NO_NODE);
+  NodeIndex lastNode = pList->tailNode;
+  void* pLastItem = itemOf(lastNode);
 
   if (pList->size == 1) {
     // Handle list with only one item
-    pList->pHeadNode = NULL;
-    pList->pTailNode = NULL;
-    pList->pCurrentNode = BEFORE_LIST_START;
+    pList->headNode = NO_NODE;
+    pList->tailNode = NO_NODE;
+    pList->currentNode = BEFORE_LIST_START;
     pList->size = 0;
 
   } else {
     // Handle list with more than one item
-    assert(pList->pTailNode->pPrevNode != NULL);
-    pList->pTailNode = pList->pTailNode->pPrevNode;
-    pList->pTailNode->pNextNode = NULL;
-    pList->pCurrentNode = pList->pTailNode;
+    assert(linksOf(lastNode)->prevNode != NO_NODE);
+    pList->tailNode = linksOf(lastNode)->prevNode;
+    linksOf(pList->tailNode)->nextNode = NO_NODE;
+    pList->currentNode = pList->tailNode;
     pList->size--;
 
   }
 
-  freeNode(pLastNode);
+  if (pList->pKeyFn != NULL) {
+    unindexNode(pList, lastNode);
+  }
+
+  freeNode(lastNode);
   return pLastItem;
 }
 
@@ -491,31 +1136,318 @@ void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg)
   assert(pList != NULL);
   assert(pComparator != NULL);
 
-  Node* pCurrentNode = pList->pCurrentNode;
+  NodeIndex currentNode = pList->currentNode;
 
   // If current item is beyond the end of the list, do not search
-  if (pCurrentNode == BEYOND_LIST_END) {
+  if (currentNode == BEYOND_LIST_END) {
     return NULL;
   }
 
   // If current item is before the start of the list, set it to the first item
-  if (pCurrentNode == BEFORE_LIST_START) {
-    pCurrentNode = pList->pHeadNode;
+  if (currentNode == BEFORE_LIST_START) {
+    currentNode = pList->headNode;
   }
 
-  assert(pList->size == 0 || (pCurrentNode != NULL && pCurrentNode != BEFORE_LIST_START));
+  assert(pList->size == 0 || currentNode != NO_NODE);
   // Iterate through the list starting from the current item,
   // comparing each item with a comparison function and argument
-  while (pCurrentNode != NULL) {
-    if ( (*pComparator)(pCurrentNode->pItem, pComparisonArg) ) {
-      pList->pCurrentNode = pCurrentNode;
-      return pCurrentNode->pItem;
+  while (currentNode != NO_NODE) {
+    NodeSlab* pSlab = s_slabTable[currentNode >> NODE_SLAB_SHIFT];
+    int position = currentNode & NODE_SLAB_MASK;
+
+    if ( (*pComparator)(pSlab->items[position], pComparisonArg) ) {
+      pList->currentNode = currentNode;
+      return pSlab->items[position];
     }
 
-    pCurrentNode = pCurrentNode->pNextNode;
+    currentNode = pSlab->links[position].nextNode;
   }
 
   // No matching item was found
-  pList->pCurrentNode = BEYOND_LIST_END;
+  pList->currentNode = BEYOND_LIST_END;
   return NULL;
 }
+
+// Takes the last count items out of pList, or every item if pList has fewer, and moves them to the
+// empty chain pChain in the same order. The nodes are detached as one chain rather than one at a time.
+// Returns the number of items taken.
+int List_trimBatch(List* pList, int count, ListChain* pChain) {
+  assert(pList != NULL);
+  assert(pChain != NULL && pChain->size == 0);
+  assert(count > 0);
+
+  if (pList->size == 0) {
+    return 0;
+  }
+
+  if (count > pList->size) {
+    count = pList->size;
+  }
+
+  if (pList->pKeyFn != NULL) {
+    // The chain has no key index, so drop its nodes from the index of pList
+    NodeIndex node = pList->tailNode;
+    for (int i = 0; i < count; i++) {
+      NodeIndex prevNode = linksOf(node)->prevNode;
+      unindexNode(pList, node);
+      node = prevNode;
+    }
+  }
+
+  pChain->tailNode = pList->tailNode;
+  pChain->size = count;
+
+  if (count == pList->size) {
+    // Move the whole chain
+    pChain->headNode = pList->headNode;
+
+    pList->headNode = NO_NODE;
+    pList->tailNode = NO_NODE;
+    pList->currentNode = BEFORE_LIST_START;
+    pList->size = 0;
+
+  } else {
+    // Find the first node of the batch, then cut the chain in front of it
+    NodeIndex firstBatchNode = pList->tailNode;
+    for (int i = 1; i < count; i++) {
+      firstBatchNode = linksOf(firstBatchNode)->prevNode;
+    }
+
+    NodeLinks* pFirstBatchLinks = linksOf(firstBatchNode);
+    assert(pFirstBatchLinks->prevNode != NO_NODE);
+    pChain->headNode = firstBatchNode;
+
+    pList->tailNode = pFirstBatchLinks->prevNode;
+    linksOf(pList->tailNode)->nextNode = NO_NODE;
+    pList->currentNode = pList->tailNode;
+    pList->size -= count;
+
+    pFirstBatchLinks->prevNode = NO_NODE;
+  }
+
+  return count;
+}
+
+// Adds the items of pChain to the front of pList, keeping their order. The current pointer of pList
+// is unchanged. pChain is empty after the operation.
+void List_prependChain(List* pList, ListChain* pChain) {
+  assert(pList != NULL);
+  assert(pChain != NULL);
+
+  // Splicing is only necessary if the chain is nonempty
+  if (pChain->size == 0) {
+    return;
+  }
+
+  indexJoinedNodes(pList, pChain->headNode, pChain->size);
+
+  if (pList->size > 0) {
+    linksOf(pChain->tailNode)->nextNode = pList->headNode;
+    linksOf(pList->headNode)->prevNode = pChain->tailNode;
+  } else {
+    pList->tailNode = pChain->tailNode;
+  }
+
+  pList->headNode = pChain->headNode;
+  pList->size += pChain->size;
+
+  pChain->headNode = NO_NODE;
+  pChain->tailNode = NO_NODE;
+  pChain->size = 0;
+  return;
+}
+
+// Adds item to the front of pChain, taking a node from the pool shared by all lists.
+// Returns 0 on success, -1 on failure.
+int ListChain_prepend(ListChain* pChain, void* pItem) {
+  assert(pChain != NULL);
+
+  NodeIndex newNode = createNode(pItem, NO_NODE, pChain->headNode);
+
+  if (newNode == NO_NODE) {
+    return -1; // Failure, node could not be created
+  }
+
+  if (pChain->size == 0) {
+    pChain->tailNode = newNode;
+  } else {
+    linksOf(pChain->headNode)->prevNode = newNode;
+  }
+
+  pChain->headNode = newNode;
+  pChain->size++;
+
+  return 0;
+}
+
+// Return last item and take it out of pChain, returning its node to the pool shared by all lists.
+// Return NULL if pChain is empty.
+void* ListChain_trim(ListChain* pChain) {
+  assert(pChain != NULL);
+
+  if (pChain->size == 0) {
+    return NULL;
+  }
+
+  NodeIndex lastNode = pChain->tailNode;
+  void* pLastItem = itemOf(lastNode);
+
+  pChain->tailNode = linksOf(lastNode)->prevNode;
+  pChain->size--;
+
+  if (pChain->size == 0) {
+    pChain->headNode = NO_NODE;
+  } else {
+    linksOf(pChain->tailNode)->nextNode = NO_NODE;
+  }
+
+  freeNode(lastNode);
+  return pLastItem;
+}
+
+// Gives pList a key index, so items can be found, checked for and removed by key in constant time.
+// Returns 0 on success, -1 on failure.
+int List_enableKeyIndex(List* pList, KEY_FN pKeyFn) {
+  assert(pList != NULL);
+  assert(pKeyFn != NULL);
+
+  uint32_t numSlots = MIN_NUM_KEY_SLOTS;
+  while (numSlots < 2 * (uint32_t) pList->size) {
+    numSlots <<= 1;
+  }
+
+  ListKeySlot* pSlots = calloc(numSlots, sizeof(ListKeySlot));
+
+  if (pSlots == NULL) {
+    return -1; // Failure, out of memory
+  }
+
+  free(pList->pKeySlots);
+  pList->pKeyFn = pKeyFn;
+  pList->pKeySlots = pSlots;
+  pList->numKeySlots = numSlots;
+
+  for (NodeIndex node = pList->headNode; node != NO_NODE; node = linksOf(node)->nextNode) {
+    indexNode(pList, node);
+  }
+
+  return 0;
+}
+
+// Search pList for the item with the given key, using its key index.
+// If a match is found, the current pointer is left at the matched item and the pointer to
+// that item is returned. If no match is found, the current pointer is left beyond the end of
+// the list and a NULL pointer is returned.
+void* List_searchKey(List* pList, uint64_t key) {
+  assert(pList != NULL);
+  assert(pList->pKeyFn != NULL);
+
+  NodeIndex node = findKey(pList, key);
+
+  if (node == NO_NODE) {
+    pList->currentNode = BEYOND_LIST_END;
+    return NULL;
+  }
+
+  pList->currentNode = node;
+  return itemOf(node);
+}
+
+// Returns true if pList, which must have a key index, holds an item with the given key.
+bool List_containsKey(List* pList, uint64_t key) {
+  assert(pList != NULL);
+  assert(pList->pKeyFn != NULL);
+
+  return findKey(pList, key) != NO_NODE;
+}
+
+// Take the item with the given key out of pList, which must have a key index, and return it.
+// Return NULL if no item has the key.
+void* List_removeKey(List* pList, uint64_t key) {
+  assert(pList != NULL);
+  assert(pList->pKeyFn != NULL);
+
+  NodeIndex node = findKey(pList, key);
+
+  if (node == NO_NODE) {
+    return NULL;
+  }
+
+  if (node == pList->currentNode) {
+    return List_remove(pList);
+  }
+
+  // Remove the node as if it were current, then put the current pointer back
+  NodeIndex currentNode = pList->currentNode;
+  pList->currentNode = node;
+  void* pItem = List_remove(pList);
+  pList->currentNode = currentNode;
+
+  return pItem;
+}
+
+// Sets the hard cap on the total number of nodes in use across all lists, 0 for no cap.
+void List_setMaxNumNodes(int maxNumNodes) {
+  assert(maxNumNodes >= 0);
+
+  lockPool();
+  __atomic_store_n(&s_maxNumNodes, maxNumNodes, __ATOMIC_RELAXED);
+  unlockPool();
+
+  return;
+}
+
+// Fills pStatistics with a snapshot of the counters describing the pool of nodes.
+void List_getPoolStatistics(ListPoolStatistics* pStatistics) {
+  assert(pStatistics != NULL);
+
+  lockPool();
+  pStatistics->numNodesInUse = s_numNodesInUse;
+  pStatistics->maxNodesInUse = s_maxNodesInUse;
+  pStatistics->numNodesAllocated = s_numSlabs * NODES_PER_SLAB;
+  pStatistics->numSlabs = s_numSlabs;
+  pStatistics->maxNumNodes = s_maxNumNodes;
+  unlockPool();
+
+  return;
+}
+
+// Cleans up internal variables
+void List_cleanup() {
+  // Return the nodes cached by this thread, other threads returned theirs when they exited
+  spillMagazine(&s_magazine, NODE_MAGAZINE_SIZE);
+
+  // Release the remaining unused slabs
+  lockPool();
+  while (s_pFirstAvailableSlab != NULL) {
+    NodeSlab* pSlab = s_pFirstAvailableSlab;
+    unlinkSlab(pSlab);
+
+    if (pSlab->numAvailableNodes == NODES_PER_SLAB) {
+      s_slabTable[pSlab->slabIndex] = NULL;
+      free(pSlab);
+      s_numSlabs--;
+      s_numEmptySlabs--;
+    }
+  }
+
+  // Release the allocated blocks of list heads once no list is left to use them
+  if (s_numHeadsInUse == 0) {
+    while (s_pFirstHeadBlock != NULL) {
+      HeadBlock* pBlock = s_pFirstHeadBlock;
+      s_pFirstHeadBlock = pBlock->pNextBlock;
+      free(pBlock);
+    }
+
+    s_initializationIsDone = NOT_INITIALIZED;
+  }
+  unlockPool();
+
+  int status = pthread_mutex_destroy(&s_poolMutex);
+
+  if (status) {
+    fputs("[Error]: could not destroy list pool mutex\n", stdout);
+  }
+
+  return;
+}
@@ -6,23 +6,24 @@
 #define _LIST_H_
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 
-typedef struct Node_s Node;
-struct Node_s {
-    // Pointer to an item of any type
-    void* pItem;
+// Index of a node in the pool of nodes shared by all lists
+// Nodes are linked by 32-bit indices rather than pointers, and each node's links are stored
+// apart from its item, so walking a list touches as few cache lines as possible
+typedef uint32_t NodeIndex;
 
-    // If the node is in a list, this is a pointer to the next node in the list
-    // Set to NULL if the node is the last node in the list
-    // If the node is available, this is a pointer to the next available node in the linked chain of available nodes
-    // Set to NULL if the node is the last node in the linked chain of available nodes
-    Node* pNextNode;
+// Returns the key identifying an item, for lists with a key index
+typedef uint64_t (*KEY_FN)(void* pItem);
 
-    // Pointer to the previous node in the list
-    // Set to NULL if the node is the first node in the list
-    Node* pPrevNode;
-};
+// A slot of a key index, mapping the key of an item to the node holding it
+typedef struct {
+    uint64_t key;
+
+    // Set to 0 if the slot is empty
+    NodeIndex node;
+} ListKeySlot;
 
 typedef struct List_s List;
 struct List_s {
@@ -33,27 +34,41 @@ struct List_s {
     // Number of items in the list
     int size;
 
-    // Pointer to the current node in the list
-    // Points to a special dummy node if the current item is before the start of the list
-    // Points to another special dummy node if the current item is beyond the end of the list
-    Node* pCurrentNode;
+    // Index of the current node in the list
+    // Set to a special index if the current item is before the start of the list
+    // Set to another special index if the current item is beyond the end of the list
+    NodeIndex currentNode;
+
+    // Index of the first node in the list
+    // Set to 0 if the list is empty
+    NodeIndex headNode;
+
+    // Index of the last node in the list
+    // Set to 0 if the list is empty
+    NodeIndex tailNode;
 
-    // Pointer to the first node in the list
-    // Set to NULL if the list is empty
-    Node* pHeadNode;
+    // Routine returning the key of an item
+    // Set to NULL if the list has no key index
+    KEY_FN pKeyFn;
 
-    // Pointer to the last node in the list
-    // Set to NULL if the list is empty
-    Node* pTailNode;
+    // Open-addressing hash table from the key of each item in the list to its node
+    // Set to NULL if the list has no key index
+    ListKeySlot* pKeySlots;
+
+    // Number of slots in pKeySlots, always a power of two
+    uint32_t numKeySlots;
 };
 
-// Maximum number of unique lists the system can support
+// Number of list heads allocated at a time
+// The first LIST_MAX_NUM_HEADS heads are statically allocated, and further heads are allocated in
+// blocks of this many once every head is in use, so the number of lists is only limited by memory
 // (You may modify its value for your needs)
 #define LIST_MAX_NUM_HEADS 10
 
-// Maximum total number of nodes (statically allocated) to be shared across all lists
-// (You may modify its value for your needs)
-#define LIST_MAX_NUM_NODES 1000
+// Default hard cap on the total number of nodes shared across all lists, 0 for no cap
+// Nodes are allocated in slabs on demand, and slabs are released again once their nodes are unused
+// (You may modify its value for your needs, or change it at runtime with List_setMaxNumNodes)
+#define LIST_MAX_NUM_NODES 0
 
 // General Error Handling:
 // Client code is assumed never to call these functions with a NULL List pointer, or
@@ -143,4 +158,94 @@ void* List_trim(List* pList);
 typedef bool (*COMPARATOR_FN)(void* pItem, void* pComparisonArg);
 void* List_search(List* pList, COMPARATOR_FN pComparator, void* pComparisonArg);
 
+// A chain of nodes detached from any list, holding items in order
+// A chain needs no list head, so items can be moved between lists in one step without drawing on the
+// list heads. A zeroed chain is empty.
+typedef struct {
+    // Index of the first node in the chain
+    // Set to 0 if the chain is empty
+    NodeIndex headNode;
+
+    // Index of the last node in the chain
+    // Set to 0 if the chain is empty
+    NodeIndex tailNode;
+
+    // Number of items in the chain
+    int size;
+} ListChain;
+
+// Takes the last count items out of pList, or every item if pList has fewer, and moves them to the
+// empty chain pChain in the same order. The nodes are detached as one chain rather than one at a time.
+// Make the new last item of pList the current one.
+// Returns the number of items taken, 0 if pList is empty.
+int List_trimBatch(List* pList, int count, ListChain* pChain);
+
+// Adds the items of pChain to the front of pList, keeping their order. The current pointer of pList
+// is unchanged. Items are added to the key index of pList if it has one.
+// pChain is empty after the operation.
+void List_prependChain(List* pList, ListChain* pChain);
+
+// Adds item to the front of pChain, taking a node from the pool shared by all lists.
+// Returns 0 on success, -1 on failure.
+int ListChain_prepend(ListChain* pChain, void* pItem);
+
+// Return last item and take it out of pChain, returning its node to the pool shared by all lists.
+// Return NULL if pChain is empty.
+void* ListChain_trim(ListChain* pChain);
+
+// Gives pList a key index, so items can be found, checked for and removed by key in constant time.
+// pKeyFn returns the key of an item; keys should be unique within the list, and an item's key must
+// not change while it is in the list. The order of items and the current pointer are unaffected.
+// Items of a list concatenated onto pList, or of a chain prepended to it, are added to the index.
+// Returns 0 on success, -1 on failure.
+int List_enableKeyIndex(List* pList, KEY_FN pKeyFn);
+
+// Search pList for the item with the given key, using its key index.
+// Unlike List_search, the whole list is searched regardless of the current pointer.
+// If a match is found, the current pointer is left at the matched item and the pointer to
+// that item is returned. If no match is found, the current pointer is left beyond the end of
+// the list and a NULL pointer is returned.
+void* List_searchKey(List* pList, uint64_t key);
+
+// Returns true if pList, which must have a key index, holds an item with the given key.
+// The current pointer is unchanged.
+bool List_containsKey(List* pList, uint64_t key);
+
+// Take the item with the given key out of pList, which must have a key index, and return it.
+// If it was the current item, the next item becomes the current one as with List_remove,
+// otherwise the current pointer is unchanged.
+// Return NULL if no item has the key.
+void* List_removeKey(List* pList, uint64_t key);
+
+// Counters describing the pool of nodes shared by all lists
+typedef struct {
+    // Number of nodes currently in a list or cached by a thread for its next lists
+    int numNodesInUse;
+
+    // Highest value numNodesInUse has reached
+    int maxNodesInUse;
+
+    // Number of nodes in allocated slabs, whether in a list or available
+    int numNodesAllocated;
+
+    // Number of slabs currently allocated
+    int numSlabs;
+
+    // Hard cap on numNodesInUse, 0 for no cap
+    int maxNumNodes;
+} ListPoolStatistics;
+
+// Sets the hard cap on the total number of nodes in use across all lists, 0 for no cap.
+// Adding an item fails once the cap is reached. Nodes cached by threads count towards the cap.
+void List_setMaxNumNodes(int maxNumNodes);
+
+// Fills pStatistics with a snapshot of the counters describing the pool of nodes.
+void List_getPoolStatistics(ListPoolStatistics* pStatistics);
+
+// The pool of nodes and list heads shared by all lists is safe to use from multiple threads,
+// so different lists may be used concurrently. A single list must still only be used by one
+// thread at a time.
+// Cleans up internal variables once no more lists will be used.
+void List_cleanup();
+
 #endif
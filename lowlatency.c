@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "lowlatency.h"
+
+static bool s_isEnabled = false;
+static int s_cpus[LOW_LATENCY_NUM_THREADS];
+static bool s_isSpinning = false;
+
+// Set once a thread was refused realtime scheduling, so the notice is printed once rather than by every thread
+static bool s_isRealtimeRefused = false;
+
+// Names of the threads, as printed in notices
+static char* s_threadNames[LOW_LATENCY_NUM_THREADS] = {"input", "output", "sender", "receiver"};
+
+// Turns on low-latency mode, pinning each thread to the CPU in pCpus at its index in LowLatencyThread,
+// or to its default if it is LOW_LATENCY_DEFAULT_CPU.
+void LowLatency_enable(int* pCpus) {
+  long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  numCpus = (numCpus < 1) ? 1 : numCpus;
+
+  for (int i = 0; i < LOW_LATENCY_NUM_THREADS; i++) {
+    s_cpus[i] = (pCpus[i] == LOW_LATENCY_DEFAULT_CPU) ? (int) (i % numCpus) : pCpus[i];
+  }
+
+  // The output thread waits on the receiver thread, which waits on the network, and so on the sender thread
+  // of the other user when it is on the same machine, so neither spins on a CPU another needs
+  s_isSpinning = numCpus > 1 && s_cpus[LOW_LATENCY_RECEIVER] != s_cpus[LOW_LATENCY_OUTPUT];
+
+  if (!s_isSpinning) {
+    fputs("[The receiver and output threads share a CPU, so they sleep rather than spin]\n", stdout);
+  }
+
+  s_isEnabled = true;
+  return;
+}
+
+// Returns true if low-latency mode is on.
+bool LowLatency_isEnabled() {
+  return s_isEnabled;
+}
+
+// Returns true if the receiver and output threads spin before sleeping, which is only when low-latency mode
+// is on and they have CPUs of their own, as a thread spinning on the CPU of the one it waits for only delays it.
+bool LowLatency_isSpinning() {
+  return s_isSpinning;
+}
+
+// Pins the calling thread, which is the given one, to its CPU and gives it realtime scheduling,
+// if low-latency mode is on. Prints a notice if either is not allowed, and carries on without it.
+void LowLatency_tuneThread(LowLatencyThread thread) {
+  cpu_set_t cpus;
+  struct sched_param parameters;
+
+  if (!s_isEnabled) {
+    return;
+  }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(s_cpus[thread], &cpus);
+
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+    printf("[Could not pin the %s thread to CPU %d]\n", s_threadNames[thread], s_cpus[thread]);
+    fflush(stdout);
+  }
+
+  // Realtime scheduling needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at least LOW_LATENCY_PRIORITY
+  memset(&parameters, 0, sizeof(parameters));
+  parameters.sched_priority = LOW_LATENCY_PRIORITY;
+
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) && !__atomic_exchange_n(&s_isRealtimeRefused, true, __ATOMIC_RELAXED)) {
+    fputs("[Realtime scheduling is not allowed, so the threads keep the normal scheduling]\n", stdout);
+    fflush(stdout);
+  }
+
+  return;
+}
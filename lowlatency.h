@@ -0,0 +1,49 @@
+// Tunes the threads of the program for --low-latency, trading CPU time for shorter handoffs between them
+// Each thread is pinned to a CPU of its own, so it keeps its caches and is never migrated, and is given
+// realtime scheduling where the user is allowed it, so it runs as soon as it is ready
+// The receiver and output threads also spin for a while before sleeping, LOW_LATENCY_SPIN_TIME each time
+// they run out of work, so a message arriving soon after the last is handed over without a wakeup,
+// as long as they are on CPUs of their own
+#ifndef _LOWLATENCY_H_
+#define _LOWLATENCY_H_
+#include <stdbool.h>
+
+// Nanoseconds the receiver and output threads spin before sleeping
+#define LOW_LATENCY_SPIN_TIME 50000
+
+// Realtime priority given to the threads, the lowest, which is enough to run before every normal thread
+#define LOW_LATENCY_PRIORITY 1
+
+// The threads that are tuned, in the order their CPUs are given with --low-latency=CPUS
+typedef enum {
+  LOW_LATENCY_INPUT,
+  LOW_LATENCY_OUTPUT,
+  LOW_LATENCY_SENDER,
+  LOW_LATENCY_RECEIVER,
+  LOW_LATENCY_NUM_THREADS
+} LowLatencyThread;
+
+// CPU a thread is pinned to by default, its index in the order of LowLatencyThread, wrapped around
+// the CPUs available
+#define LOW_LATENCY_DEFAULT_CPU -1
+
+// Number of CPUs a thread can be pinned to, as many as a cpu_set_t holds
+#define LOW_LATENCY_MAX_CPUS 1024
+
+// Turns on low-latency mode, pinning each thread to the CPU in pCpus at its index in LowLatencyThread,
+// or to its default if it is LOW_LATENCY_DEFAULT_CPU.
+// Must be called before the threads are created.
+void LowLatency_enable(int* pCpus);
+
+// Returns true if low-latency mode is on.
+bool LowLatency_isEnabled(void);
+
+// Returns true if the receiver and output threads spin before sleeping, which is only when low-latency mode
+// is on and they have CPUs of their own, as a thread spinning on the CPU of the one it waits for only delays it.
+bool LowLatency_isSpinning(void);
+
+// Pins the calling thread, which is the given one, to its CPU and gives it realtime scheduling,
+// if low-latency mode is on. Prints a notice if either is not allowed, and carries on without it.
+void LowLatency_tuneThread(LowLatencyThread thread);
+
+#endif
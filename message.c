@@ -0,0 +1,142 @@
+#include <time.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "message.h"
+
+static int s_pathDatagramSize = MESSAGE_DATAGRAM_DEFAULT_SIZE;
+
+// Lowered by the receiver once the remote users say they take no larger datagrams, while others send
+static int s_maxDatagramSize = MESSAGE_DATAGRAM_DEFAULT_SIZE;
+
+// Returns the current time of the monotonic clock in nanoseconds, for message timestamps.
+uint64_t Message_getTimestamp() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+// Sets the size of the largest datagram the path carries, and sent, from MESSAGE_DATAGRAM_MIN_SIZE to MESSAGE_DATAGRAM_MAX_SIZE.
+// Must be called before any message is sent, as it decides how much data a message read from the terminal holds.
+void Message_setMaxDatagramSize(int size) {
+  s_pathDatagramSize = size;
+  __atomic_store_n(&s_maxDatagramSize, size, __ATOMIC_RELAXED);
+  return;
+}
+
+// Returns the size of the largest datagram the path carries, as set with Message_setMaxDatagramSize.
+int Message_getPathDatagramSize() {
+  return s_pathDatagramSize;
+}
+
+// Sends datagrams of up to size bytes from then on, but never larger than the path carries,
+// as the remote users take no larger ones.
+void Message_limitDatagramSize(int size) {
+  __atomic_store_n(&s_maxDatagramSize, (size < s_pathDatagramSize) ? size : s_pathDatagramSize, __ATOMIC_RELAXED);
+  return;
+}
+
+// Returns the size of the largest datagram sent.
+int Message_getMaxDatagramSize() {
+  return __atomic_load_n(&s_maxDatagramSize, __ATOMIC_RELAXED);
+}
+
+// Returns the most data a sent message can hold, as much as fits in the largest datagram sent after its header.
+int Message_getMaxDataSize() {
+  return Message_getMaxDatagramSize() - MESSAGE_HEADER_SIZE;
+}
+
+// Fills pHeader with the header to send with pMessage.
+void Message_encodeHeader(Message* pMessage, MessageHeader* pHeader) {
+  pHeader->type = MESSAGE_TYPE_DATA;
+  pHeader->flags = (uint8_t) pMessage->flags;
+  pHeader->length = htons(pMessage->length);
+  pHeader->sequence = htonl(pMessage->sequence);
+  pHeader->messageId = htonl(pMessage->messageId);
+  pHeader->fragmentIndex = htons(pMessage->fragmentIndex);
+  pHeader->fragmentCount = htons(pMessage->fragmentCount);
+  return;
+}
+
+// Fills pHeader with the header of a coalesced datagram whose messages take up length bytes.
+void Message_encodeCoalescedHeader(int length, MessageHeader* pHeader) {
+  pHeader->type = MESSAGE_TYPE_COALESCED;
+  pHeader->flags = 0;
+  pHeader->length = htons((uint16_t) length);
+  pHeader->sequence = 0;
+  pHeader->messageId = 0;
+  pHeader->fragmentIndex = 0;
+  pHeader->fragmentCount = 0;
+  return;
+}
+
+// Says in pHeader, of an acknowledgement, heartbeat or echo, that its sender takes datagrams of up to size bytes.
+void Message_encodeDatagramSize(MessageHeader* pHeader, int size) {
+  pHeader->messageId = htonl(size);
+  return;
+}
+
+// Returns the largest datagram the sender of a received header said it takes, from MESSAGE_DATAGRAM_MIN_SIZE
+// to MESSAGE_DATAGRAM_MAX_SIZE, or 0 if the header does not say.
+int Message_decodeDatagramSize(MessageHeader* pHeader) {
+  if (pHeader->type != MESSAGE_TYPE_ACK && pHeader->type != MESSAGE_TYPE_HEARTBEAT && pHeader->type != MESSAGE_TYPE_HEARTBEAT_ECHO) {
+    return 0;
+  }
+
+  uint32_t size = ntohl(pHeader->messageId);
+
+  if (size == 0) {
+    return 0;
+  }
+
+  return (size < MESSAGE_DATAGRAM_MIN_SIZE) ? MESSAGE_DATAGRAM_MIN_SIZE : (size > MESSAGE_DATAGRAM_MAX_SIZE) ? MESSAGE_DATAGRAM_MAX_SIZE : (int) size;
+}
+
+// Checks that a received datagram holds as much data after its header pHeader as the header says, dataLength bytes.
+// The length in the header of a compressed datagram is checked once the data is decompressed instead.
+// Returns 0 if it does, -1 if the datagram was truncated or is malformed.
+int Message_checkLength(MessageHeader* pHeader, int dataLength) {
+  if (pHeader->flags & MESSAGE_FLAG_COMPRESSED) {
+    return 0;
+  }
+
+  return (ntohs(pHeader->length) == dataLength) ? 0 : -1;
+}
+
+// Fills the flags, sequence number and fragment fields of pMessage from a received header.
+// Returns 0 on success, -1 if the header is not of a data message.
+int Message_decodeHeader(Message* pMessage, MessageHeader* pHeader) {
+  if (pHeader->type != MESSAGE_TYPE_DATA) {
+    return -1;
+  }
+
+  pMessage->flags = pHeader->flags & ~MESSAGE_DATAGRAM_FLAGS;
+  pMessage->sequence = ntohl(pHeader->sequence);
+  pMessage->messageId = ntohl(pHeader->messageId);
+  pMessage->fragmentIndex = ntohs(pHeader->fragmentIndex);
+  pMessage->fragmentCount = ntohs(pHeader->fragmentCount);
+  return 0;
+}
+
+// Fills pMessage from the message at the start of pRecords, the size bytes left of the data
+// of a coalesced datagram.
+// Returns the number of bytes the message took up, or -1 if it is malformed or truncated.
+int Message_decodeRecord(char* pRecords, int size, Message* pMessage) {
+  MessageHeader header;
+
+  if (size < MESSAGE_HEADER_SIZE) {
+    return -1;
+  }
+
+  // Records are packed without alignment, so the header is copied out rather than cast
+  memcpy(&header, pRecords, MESSAGE_HEADER_SIZE);
+
+  int length = ntohs(header.length);
+
+  if (Message_decodeHeader(pMessage, &header) == -1 || length > size - MESSAGE_HEADER_SIZE) {
+    return -1;
+  }
+
+  memcpy(pMessage->data, pRecords + MESSAGE_HEADER_SIZE, length);
+  pMessage->length = length;
+  return MESSAGE_HEADER_SIZE + length;
+}
@@ -0,0 +1,176 @@
+// Defines the descriptor of a message passed between threads, and the header sent with it over UDP
+#ifndef _MESSAGE_H_
+#define _MESSAGE_H_
+#include <stdint.h>
+#include "control.h"
+
+// The message starts a new line
+#define MESSAGE_FLAG_FIRST_SEGMENT 0x01
+
+// The message ends its line
+#define MESSAGE_FLAG_LAST_SEGMENT 0x02
+
+// The message is a command to the program rather than text from the user, such as the exit command
+#define MESSAGE_FLAG_CONTROL 0x04
+
+// The message is numbered by the sender's reliability layer, and must be acknowledged
+#define MESSAGE_FLAG_RELIABLE 0x08
+
+// The data of the datagram is compressed, and the length in its header is that of the data before compression
+#define MESSAGE_FLAG_COMPRESSED 0x10
+
+// The compressed data refers to a dictionary of the traffic before it, the end of which it starts with
+#define MESSAGE_FLAG_DICTIONARY 0x20
+
+// The sender of the datagram accepts compressed datagrams
+#define MESSAGE_FLAG_ACCEPTS_COMPRESSION 0x40
+
+// Flags of a whole datagram rather than of a message, cleared when a header is decoded into a message
+#define MESSAGE_DATAGRAM_FLAGS (MESSAGE_FLAG_COMPRESSED | MESSAGE_FLAG_DICTIONARY | MESSAGE_FLAG_ACCEPTS_COMPRESSION)
+
+// Kinds of datagram, sent in the type field of the header
+// A data datagram carries a single message
+// A coalesced datagram carries several messages, each preceded by its own data header
+// An acknowledgement carries the sequence number of the next message expected, followed by
+// ranges of messages received ahead of it
+// A probe is only sent to find the largest datagram the path carries, and is ignored by the receiver
+// A heartbeat carries the time it was sent, and is sent straight back as an echo with the same data
+#define MESSAGE_TYPE_DATA 1
+#define MESSAGE_TYPE_COALESCED 2
+#define MESSAGE_TYPE_ACK 3
+#define MESSAGE_TYPE_PROBE 4
+#define MESSAGE_TYPE_HEARTBEAT 5
+#define MESSAGE_TYPE_HEARTBEAT_ECHO 6
+
+// Size of the header preceding the data of every datagram, and every message of a coalesced datagram
+#define MESSAGE_HEADER_SIZE 16
+
+// Size of the IPv4 and UDP headers preceding the payload of a datagram in an IP packet
+#define MESSAGE_IP_UDP_HEADER_SIZE 28
+
+// Bounds of the datagram size, which is set once from the path MTU before any message is made:
+// the payload of the 576-byte packet every IPv4 host accepts, and of a 9000-byte jumbo frame
+#define MESSAGE_DATAGRAM_MIN_SIZE 548
+#define MESSAGE_DATAGRAM_MAX_SIZE 8972
+
+// Datagram size used until another is set: the payload of a 1500-byte Ethernet frame
+#define MESSAGE_DATAGRAM_DEFAULT_SIZE 1472
+
+// Least data a message can hold, with the smallest datagram size
+#define MESSAGE_DATA_MIN_SIZE (MESSAGE_DATAGRAM_MIN_SIZE - MESSAGE_HEADER_SIZE)
+
+// Most data a message can hold, with the largest datagram size
+// Messages are received into buffers of this size, as a peer with a wider path sends larger datagrams
+#define MESSAGE_DATA_MAX_SIZE (MESSAGE_DATAGRAM_MAX_SIZE - MESSAGE_HEADER_SIZE)
+
+// Longest message delivered whole; a longer line is sent as several messages
+#define MESSAGE_MAX_LENGTH 65536
+
+// Most fragments a message is sent in, each holding at least MESSAGE_DATA_MIN_SIZE - 1 bytes read from the terminal
+#define MESSAGE_MAX_FRAGMENTS ((MESSAGE_MAX_LENGTH + MESSAGE_DATA_MIN_SIZE - 2) / (MESSAGE_DATA_MIN_SIZE - 1))
+
+// A message read from the terminal or received from the remote user, with everything
+// later hops need to know about it, so none of them has to rescan the data
+// A message longer than a datagram is passed as several of these, one per fragment
+typedef struct Message_s Message;
+struct Message_s {
+    // Number of bytes in data, which is not NUL-terminated and may hold any bytes
+    uint16_t length;
+
+    // Combination of the MESSAGE_FLAG_ constants
+    uint16_t flags;
+
+    // Sequence number of the message among those sent by the same user
+    uint32_t sequence;
+
+    // Identifies the message this is a fragment of, among those sent by the same user
+    uint32_t messageId;
+
+    // Position of this fragment in the message, and number of fragments the message was sent in
+    uint16_t fragmentIndex;
+    uint16_t fragmentCount;
+
+    // Index in the peer table of the remote user the message was received from, unused for messages read from the terminal
+    uint16_t peerIndex;
+
+    // Time the message entered the program, read from the terminal or received from the socket
+    uint64_t createdTime;
+
+    // Time the message was last added to a queue
+    uint64_t queuedTime;
+
+    // Holds at most Message_getMaxDataSize() - 1 bytes of text read from the terminal,
+    // but a received datagram may fill up to MESSAGE_DATA_MAX_SIZE bytes
+    // Sized by the message pool, so a message must never be declared or copied by value
+    char data[];
+};
+
+// Header preceding the data of every datagram, with multi-byte fields in network byte order
+typedef struct MessageHeader_s MessageHeader;
+struct MessageHeader_s {
+    // One of the MESSAGE_TYPE_ constants
+    uint8_t type;
+
+    // Combination of the MESSAGE_FLAG_ constants
+    uint8_t flags;
+
+    // Number of bytes of data following the header
+    uint16_t length;
+
+    uint32_t sequence;
+
+    // Fragment fields of the message, 0 for other kinds of datagram
+    // Acknowledgements, heartbeats and their echoes carry in messageId the largest datagram their sender takes instead
+    uint32_t messageId;
+    uint16_t fragmentIndex;
+    uint16_t fragmentCount;
+};
+
+// Returns the current time of the monotonic clock in nanoseconds, for message timestamps.
+uint64_t Message_getTimestamp();
+
+// Sets the size of the largest datagram the path carries, and sent, from MESSAGE_DATAGRAM_MIN_SIZE to MESSAGE_DATAGRAM_MAX_SIZE.
+// Must be called before any message is sent, as it decides how much data a message read from the terminal holds.
+void Message_setMaxDatagramSize(int size);
+
+// Returns the size of the largest datagram the path carries, as set with Message_setMaxDatagramSize.
+int Message_getPathDatagramSize();
+
+// Sends datagrams of up to size bytes from then on, but never larger than the path carries,
+// as the remote users take no larger ones.
+void Message_limitDatagramSize(int size);
+
+// Returns the size of the largest datagram sent.
+int Message_getMaxDatagramSize();
+
+// Returns the most data a sent message can hold, as much as fits in the largest datagram sent after its header.
+int Message_getMaxDataSize();
+
+// Fills pHeader with the header to send with pMessage.
+void Message_encodeHeader(Message* pMessage, MessageHeader* pHeader);
+
+// Fills pHeader with the header of a coalesced datagram whose messages take up length bytes.
+void Message_encodeCoalescedHeader(int length, MessageHeader* pHeader);
+
+// Says in pHeader, of an acknowledgement, heartbeat or echo, that its sender takes datagrams of up to size bytes.
+void Message_encodeDatagramSize(MessageHeader* pHeader, int size);
+
+// Returns the largest datagram the sender of a received header said it takes, from MESSAGE_DATAGRAM_MIN_SIZE
+// to MESSAGE_DATAGRAM_MAX_SIZE, or 0 if the header does not say.
+int Message_decodeDatagramSize(MessageHeader* pHeader);
+
+// Checks that a received datagram holds as much data after its header pHeader as the header says, dataLength bytes.
+// The length in the header of a compressed datagram is checked once the data is decompressed instead.
+// Returns 0 if it does, -1 if the datagram was truncated or is malformed.
+int Message_checkLength(MessageHeader* pHeader, int dataLength);
+
+// Fills the flags, sequence number and fragment fields of pMessage from a received header.
+// Returns 0 on success, -1 if the header is not of a data message.
+int Message_decodeHeader(Message* pMessage, MessageHeader* pHeader);
+
+// Fills pMessage from the message at the start of pRecords, the size bytes left of the data
+// of a coalesced datagram.
+// Returns the number of bytes the message took up, or -1 if it is malformed or truncated.
+int Message_decodeRecord(char* pRecords, int size, Message* pMessage);
+
+#endif
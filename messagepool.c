@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "messagepool.h"
+
+// Buffers are created in chunks, and identified by the index of their chunk and their position in it
+#define MESSAGE_POOL_CHUNK_SHIFT 8
+#define MESSAGE_POOL_CHUNK_SIZE (1 << MESSAGE_POOL_CHUNK_SHIFT)
+#define MESSAGE_POOL_MAX_CHUNKS 4096
+
+// Index marking the end of the free stack
+#define NO_BUFFER 0xFFFFFFFF
+
+typedef struct {
+  // Index of the next buffer in the free stack, only meaningful while this buffer is free
+  uint32_t nextFreeBuffer;
+
+  // Index of this buffer, to find it again when recycled
+  uint32_t bufferIndex;
+
+  // Number of holders of the message, which returns to the pool once the last one recycles it
+  uint32_t numReferences;
+
+  // Followed by the data of the message, so buffers are s_bufferSize bytes apart
+  Message message;
+} MessageBuffer;
+
+// Size of a buffer including its data, a multiple of the cache line size so buffers never share a line
+static size_t s_bufferSize = 0;
+
+// Every chunk the pool has grown by, never freed until cleanup, so a buffer index stays valid
+static MessageBuffer* s_chunks[MESSAGE_POOL_MAX_CHUNKS];
+static int s_numChunks = 0;
+
+// Top of the free stack: the index of the top buffer in the low 32 bits, and a tag in the high 32 bits
+// The tag changes on every update, so a stale compare-and-swap cannot succeed after the stack
+// was popped and pushed back to the same top buffer
+static uint64_t s_freeStackTop = NO_BUFFER;
+
+// Only serializes growing the pool; taking and recycling buffers never lock
+static pthread_mutex_t s_growMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t s_numAllocs = 0;
+static uint64_t s_numRecycles = 0;
+
+// Returns the buffer at the given position of a chunk
+static MessageBuffer* getChunkBuffer(MessageBuffer* pChunk, int position) {
+  return (MessageBuffer*) ((char*) pChunk + s_bufferSize * position);
+}
+
+// Returns the buffer with the given index
+static MessageBuffer* getBuffer(uint32_t bufferIndex) {
+  return getChunkBuffer(s_chunks[bufferIndex >> MESSAGE_POOL_CHUNK_SHIFT], bufferIndex & (MESSAGE_POOL_CHUNK_SIZE - 1));
+}
+
+// Pushes the chain of free buffers from pFirst to pLast, already linked to each other, onto the free stack
+static void pushFreeBuffers(MessageBuffer* pFirst, MessageBuffer* pLast) {
+  uint64_t top = __atomic_load_n(&s_freeStackTop, __ATOMIC_RELAXED);
+  uint64_t newTop = 0;
+
+  do {
+    __atomic_store_n(&pLast->nextFreeBuffer, (uint32_t) top, __ATOMIC_RELAXED);
+    newTop = ((top >> 32) + 1) << 32 | pFirst->bufferIndex;
+  } while (!__atomic_compare_exchange_n(&s_freeStackTop, &top, newTop, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  return;
+}
+
+// Pops a buffer from the free stack
+// Returns NULL if the free stack is empty
+static MessageBuffer* popFreeBuffer() {
+  uint64_t top = __atomic_load_n(&s_freeStackTop, __ATOMIC_ACQUIRE);
+  uint64_t newTop = 0;
+  MessageBuffer* pBuffer = NULL;
+
+  do {
+    if ((uint32_t) top == NO_BUFFER) {
+      return NULL;
+    }
+
+    // The buffer may be taken by another thread meanwhile, in which case the link read here is stale,
+    // but the tag then makes the compare-and-swap fail
+    pBuffer = getBuffer((uint32_t) top);
+    newTop = ((top >> 32) + 1) << 32 | __atomic_load_n(&pBuffer->nextFreeBuffer, __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&s_freeStackTop, &top, newTop, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  return pBuffer;
+}
+
+// Creates a new chunk of buffers, keeping one for the caller and pushing the rest onto the free stack
+// Returns NULL if the pool cannot grow
+static MessageBuffer* growPool() {
+  MessageBuffer* pChunk = NULL;
+
+  pthread_mutex_lock(&s_growMutex);
+
+  // Another thread may have grown the pool while this one waited
+  MessageBuffer* pBuffer = popFreeBuffer();
+
+  if (pBuffer != NULL || s_numChunks == MESSAGE_POOL_MAX_CHUNKS) {
+    pthread_mutex_unlock(&s_growMutex);
+    return pBuffer;
+  }
+
+  if (posix_memalign((void**) &pChunk, 64, s_bufferSize * MESSAGE_POOL_CHUNK_SIZE) != 0) {
+    pthread_mutex_unlock(&s_growMutex);
+    return NULL;
+  }
+
+  uint32_t firstIndex = (uint32_t) s_numChunks << MESSAGE_POOL_CHUNK_SHIFT;
+
+  for (int i = 0; i < MESSAGE_POOL_CHUNK_SIZE; i++) {
+    getChunkBuffer(pChunk, i)->bufferIndex = firstIndex + i;
+    getChunkBuffer(pChunk, i)->nextFreeBuffer = firstIndex + i + 1;
+  }
+
+  // Publish the chunk before any of its buffers can be found on the free stack
+  __atomic_store_n(&s_chunks[s_numChunks], pChunk, __ATOMIC_RELEASE);
+  __atomic_store_n(&s_numChunks, s_numChunks + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&s_growMutex);
+
+  pushFreeBuffers(getChunkBuffer(pChunk, 1), getChunkBuffer(pChunk, MESSAGE_POOL_CHUNK_SIZE - 1));
+  return pChunk;
+}
+
+// Sizes the buffers of the pool to hold dataSize bytes of data per message.
+// Must be called before any other function of the pool.
+void MessagePool_init(int dataSize) {
+  s_bufferSize = (sizeof(MessageBuffer) + dataSize + 63) & ~(size_t) 63;
+  return;
+}
+
+// Takes a message from the pool, growing the pool if it is empty.
+// The contents of the message are undefined.
+// Returns a NULL pointer if the pool cannot grow.
+Message* MessagePool_alloc() {
+  MessageBuffer* pBuffer = popFreeBuffer();
+
+  if (pBuffer == NULL) {
+    pBuffer = growPool();
+
+    if (pBuffer == NULL) {
+      return NULL;
+    }
+  }
+
+  pBuffer->numReferences = 1;
+  __atomic_fetch_add(&s_numAllocs, 1, __ATOMIC_RELAXED);
+  return &pBuffer->message;
+}
+
+// Returns the buffer holding a message taken from the pool
+static MessageBuffer* getMessageBuffer(Message* pMessage) {
+  return (MessageBuffer*) ((char*) pMessage - offsetof(MessageBuffer, message));
+}
+
+// Adds count holders to a message taken with MessagePool_alloc, each of which must recycle it.
+// Must be called by a holder of the message, before passing it to the others.
+void MessagePool_share(Message* pMessage, int count) {
+  __atomic_fetch_add(&getMessageBuffer(pMessage)->numReferences, (uint32_t) count, __ATOMIC_RELAXED);
+  return;
+}
+
+// Returns a message taken with MessagePool_alloc to the pool, once every holder of it recycled it.
+void MessagePool_recycle(Message* pMessage) {
+  MessageBuffer* pBuffer = getMessageBuffer(pMessage);
+
+  // A sole holder cannot race with anyone, so the common case takes no atomic read-modify-write
+  if (__atomic_load_n(&pBuffer->numReferences, __ATOMIC_ACQUIRE) != 1 &&
+      __atomic_sub_fetch(&pBuffer->numReferences, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+
+  pushFreeBuffers(pBuffer, pBuffer);
+  __atomic_fetch_add(&s_numRecycles, 1, __ATOMIC_RELAXED);
+  return;
+}
+
+// Fills pStatistics with the counters of the pool.
+void MessagePool_getStatistics(MessagePoolStatistics* pStatistics) {
+  pStatistics->numAllocs = __atomic_load_n(&s_numAllocs, __ATOMIC_RELAXED);
+  pStatistics->numRecycles = __atomic_load_n(&s_numRecycles, __ATOMIC_RELAXED);
+  pStatistics->numChunks = __atomic_load_n(&s_numChunks, __ATOMIC_ACQUIRE);
+  pStatistics->numBuffersAllocated = pStatistics->numChunks * MESSAGE_POOL_CHUNK_SIZE;
+  return;
+}
+
+// Frees every buffer of the pool.
+// Must only be called once no thread uses the pool, as buffers still taken become invalid.
+void MessagePool_cleanup() {
+  for (int i = 0; i < s_numChunks; i++) {
+    free(s_chunks[i]);
+    s_chunks[i] = NULL;
+  }
+
+  s_numChunks = 0;
+  s_freeStackTop = NO_BUFFER;
+  return;
+}
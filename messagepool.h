@@ -0,0 +1,47 @@
+// A lock-free pool of message descriptors, shared by every thread
+// Buffers are recycled rather than freed, so passing a message between threads never
+// touches the general-purpose allocator once the pool has grown to the working set
+#ifndef _MESSAGEPOOL_H_
+#define _MESSAGEPOOL_H_
+#include <stdint.h>
+#include "message.h"
+
+typedef struct MessagePoolStatistics_s MessagePoolStatistics;
+struct MessagePoolStatistics_s {
+    // Number of buffers taken from the pool
+    uint64_t numAllocs;
+
+    // Number of buffers returned to the pool
+    uint64_t numRecycles;
+
+    // Number of buffers created by growing the pool
+    int numBuffersAllocated;
+
+    // Number of chunks of buffers the pool has grown by
+    int numChunks;
+};
+
+// Sizes the buffers of the pool to hold dataSize bytes of data per message.
+// Must be called before any other function of the pool.
+void MessagePool_init(int dataSize);
+
+// Takes a message from the pool, growing the pool if it is empty.
+// The contents of the message are undefined.
+// Returns a NULL pointer if the pool cannot grow.
+Message* MessagePool_alloc();
+
+// Adds count holders to a message taken with MessagePool_alloc, each of which must recycle it.
+// Must be called by a holder of the message, before passing it to the others.
+void MessagePool_share(Message* pMessage, int count);
+
+// Returns a message taken with MessagePool_alloc to the pool, once every holder of it recycled it.
+void MessagePool_recycle(Message* pMessage);
+
+// Fills pStatistics with the counters of the pool.
+void MessagePool_getStatistics(MessagePoolStatistics* pStatistics);
+
+// Frees every buffer of the pool.
+// Must only be called once no thread uses the pool, as buffers still taken become invalid.
+void MessagePool_cleanup();
+
+#endif
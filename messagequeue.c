@@ -0,0 +1,438 @@
+// A queue of messages passed from one thread to another
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include "messagequeue.h"
+
+// Makes a new, empty queue of the given type, and returns its reference on success.
+// Returns a NULL pointer on failure.
+MessageQueue* MessageQueue_create(MessageQueueType type) {
+  int status = 0;
+  pthread_condattr_t conditionAttributes;
+  MessageQueue* pNewQueue = malloc(sizeof(MessageQueue));
+
+  if (pNewQueue == NULL) {
+    return NULL;
+  }
+
+  pNewQueue->type = type;
+  pNewQueue->pList = NULL;
+  pNewQueue->pRing = NULL;
+  pNewQueue->numWaiters = 0;
+  pNewQueue->isWoken = 0;
+  pNewQueue->spinTime = 0;
+  pNewQueue->numSignals = 0;
+  pNewQueue->numSpins = 0;
+  pNewQueue->numSpinsSucceeded = 0;
+
+  if (type == MESSAGE_QUEUE_RING) {
+    pNewQueue->pRing = RingQueue_create(MESSAGE_QUEUE_RING_CAPACITY);
+  } else {
+    pNewQueue->pList = ThreadSafeList_create();
+  }
+
+  if (pNewQueue->pList == NULL && pNewQueue->pRing == NULL) {
+    free(pNewQueue);
+    return NULL;
+  }
+
+  status = pthread_mutex_init(&pNewQueue->waitMutex, NULL);
+
+  if (status) {
+    fputs("[Error]: could not initialize queue wait mutex\n", stdout);
+    exit(1);
+  }
+
+  // Timeouts are measured on the monotonic clock so they are unaffected by changes to the time of day
+  status = pthread_condattr_init(&conditionAttributes);
+  status = status ? status : pthread_condattr_setclock(&conditionAttributes, CLOCK_MONOTONIC);
+  status = status ? status : pthread_cond_init(&pNewQueue->messageAvailableCondition, &conditionAttributes);
+
+  if (status) {
+    fputs("[Error]: could not initialize message available condition variable\n", stdout);
+    exit(1);
+  }
+
+  pthread_condattr_destroy(&conditionAttributes);
+
+  return pNewQueue;
+}
+
+// Returns the number of messages in pQueue.
+int MessageQueue_count(MessageQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    return RingQueue_count(pQueue->pRing);
+  }
+
+  return ThreadSafeList_count(pQueue->pList);
+}
+
+// Wakes a consumer waiting on pQueue, if there is one
+static void signalMessageAvailable(MessageQueue* pQueue) {
+  int status = 0;
+
+  if (pQueue->spinTime > 0) {
+    __atomic_fetch_add(&pQueue->numSignals, 1, __ATOMIC_RELEASE);
+  }
+
+  // Pairs with the fence in waitForMessages: either the waiter sees the pushed message
+  // when it checks again, or this sees the waiter and signals it
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&pQueue->numWaiters, __ATOMIC_RELAXED) == 0) {
+    return;
+  }
+
+  status = pthread_mutex_lock(&pQueue->waitMutex);
+
+  if (status) {
+    fputs("[Error]: could not lock queue wait mutex\n", stdout);
+    exit(1);
+  }
+
+  status = pthread_cond_signal(&pQueue->messageAvailableCondition);
+
+  if (status) {
+    fputs("[Error]: could not signal message available condition variable\n", stdout);
+    exit(1);
+  }
+
+  status = pthread_mutex_unlock(&pQueue->waitMutex);
+
+  if (status) {
+    fputs("[Error]: could not unlock queue wait mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Adds message to the back of pQueue, and wakes a consumer waiting for it.
+// Returns 0 on success, -1 on failure.
+int MessageQueue_push(MessageQueue* pQueue, void* pMessage) {
+  int pushStatus = 0;
+
+  assert(pQueue != NULL);
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    pushStatus = RingQueue_push(pQueue->pRing, pMessage);
+  } else {
+    // The list is used with prepend and trim, so its tail is the front of the queue
+    pushStatus = ThreadSafeList_prepend(pQueue->pList, pMessage);
+  }
+
+  if (pushStatus == 0) {
+    signalMessageAvailable(pQueue);
+  }
+
+  return pushStatus;
+}
+
+// Adds count messages from ppMessages to the back of pQueue in order, taking the queue's lock
+// at most once, and wakes a consumer waiting for them.
+// Returns the number of messages added, which is less than count if pQueue filled up.
+int MessageQueue_pushBatch(MessageQueue* pQueue, void** ppMessages, int count) {
+  int numPushed = 0;
+
+  assert(pQueue != NULL);
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    while (numPushed < count && RingQueue_push(pQueue->pRing, ppMessages[numPushed]) == 0) {
+      numPushed++;
+    }
+  } else {
+    // Build the batch in a private chain, then splice it onto the front of the shared list
+    ListChain batch = {0};
+
+    while (numPushed < count && ListChain_prepend(&batch, ppMessages[numPushed]) == 0) {
+      numPushed++;
+    }
+
+    ThreadSafeList_prependBatch(pQueue->pList, &batch);
+  }
+
+  if (numPushed > 0) {
+    signalMessageAvailable(pQueue);
+  }
+
+  return numPushed;
+}
+
+// Return the front message and take it out of pQueue.
+// Return NULL if pQueue is empty.
+void* MessageQueue_pop(MessageQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    return RingQueue_pop(pQueue->pRing);
+  }
+
+  return ThreadSafeList_trim(pQueue->pList);
+}
+
+// Takes up to maxCount messages from the front of pQueue without waiting
+// Returns the number of messages taken
+static int popAvailable(MessageQueue* pQueue, void** ppMessages, int maxCount) {
+  int count = 0;
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    while (count < maxCount && (ppMessages[count] = RingQueue_pop(pQueue->pRing)) != NULL) {
+      count++;
+    }
+
+    return count;
+  }
+
+  ListChain batch = {0};
+  ThreadSafeList_trimBatch(pQueue->pList, maxCount, &batch);
+
+  // The batch is detached, so it can be read without the lock, front of the queue first
+  void* pMessage = ListChain_trim(&batch);
+  while (pMessage != NULL) {
+    ppMessages[count] = pMessage;
+    count++;
+    pMessage = ListChain_trim(&batch);
+  }
+
+  return count;
+}
+
+// Returns the current time on the monotonic clock in nanoseconds
+static uint64_t getTimestamp() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+// Spins for up to the spin time of pQueue until it is pushed to or woken, numSignals being the count
+// of signals seen before it was found empty
+// Returns true if it was pushed to or woken while spinning
+static bool spinForSignal(MessageQueue* pQueue, unsigned long numSignals) {
+  uint64_t deadline = getTimestamp() + pQueue->spinTime;
+
+  __atomic_fetch_add(&pQueue->numSpins, 1, __ATOMIC_RELAXED);
+
+  while (__atomic_load_n(&pQueue->numSignals, __ATOMIC_ACQUIRE) == numSignals) {
+    if (getTimestamp() >= deadline) {
+      return false;
+    }
+
+    // Lets a sibling hyperthread run, and keeps the loop from flooding the memory system with loads
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+
+  return true;
+}
+
+// Releases the wait mutex if the waiting thread is cancelled
+static void cancelWait(void* args) {
+  MessageQueue* pQueue = args;
+
+  __atomic_fetch_sub(&pQueue->numWaiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pQueue->waitMutex);
+
+  return;
+}
+
+// Pops the front message of pQueue, waiting until one is pushed, the queue is woken or the timeout expires
+// Only waits for the queue to be woken if isPopping is not set
+// The emptiness check is repeated while holding waitMutex, so a push cannot slip in unnoticed
+// between finding the queue empty and going to sleep
+static void* waitForMessage(MessageQueue* pQueue, int timeoutMilliseconds, bool isPopping) {
+  int status = 0;
+  void* pMessage = NULL;
+  struct timespec deadline;
+
+  if (timeoutMilliseconds != MESSAGE_QUEUE_WAIT_FOREVER) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMilliseconds / 1000;
+    deadline.tv_nsec += (long) (timeoutMilliseconds % 1000) * 1000000;
+
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  status = pthread_mutex_lock(&pQueue->waitMutex);
+
+  if (status) {
+    fputs("[Error]: could not lock queue wait mutex\n", stdout);
+    exit(1);
+  }
+
+  __atomic_fetch_add(&pQueue->numWaiters, 1, __ATOMIC_SEQ_CST);
+  pthread_cleanup_push(cancelWait, pQueue);
+
+  // Pairs with the fence in signalMessageAvailable
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  while (!isPopping || (pMessage = MessageQueue_pop(pQueue)) == NULL) {
+    if (__atomic_exchange_n(&pQueue->isWoken, 0, __ATOMIC_ACQ_REL)) {
+      break;
+    }
+
+    if (timeoutMilliseconds == MESSAGE_QUEUE_WAIT_FOREVER) {
+      status = pthread_cond_wait(&pQueue->messageAvailableCondition, &pQueue->waitMutex);
+    } else {
+      status = pthread_cond_timedwait(&pQueue->messageAvailableCondition, &pQueue->waitMutex, &deadline);
+    }
+
+    if (status == ETIMEDOUT) {
+      pMessage = isPopping ? MessageQueue_pop(pQueue) : NULL;
+      break;
+    }
+
+    if (status) {
+      fputs("[Error]: could not wait on message available condition variable\n", stdout);
+      exit(1);
+    }
+  }
+
+  pthread_cleanup_pop(1);
+
+  return pMessage;
+}
+
+// Return the front message and take it out of pQueue, waiting for one to be pushed if pQueue is empty.
+// Return NULL if the timeout expired before a message was available.
+void* MessageQueue_popWait(MessageQueue* pQueue, int timeoutMilliseconds) {
+  assert(pQueue != NULL);
+
+  unsigned long numSignals = __atomic_load_n(&pQueue->numSignals, __ATOMIC_ACQUIRE);
+  void* pMessage = MessageQueue_pop(pQueue);
+
+  if (pMessage != NULL || timeoutMilliseconds == 0) {
+    return pMessage;
+  }
+
+  if (pQueue->spinTime > 0 && spinForSignal(pQueue, numSignals) && (pMessage = MessageQueue_pop(pQueue)) != NULL) {
+    __atomic_fetch_add(&pQueue->numSpinsSucceeded, 1, __ATOMIC_RELAXED);
+    return pMessage;
+  }
+
+  return waitForMessage(pQueue, timeoutMilliseconds, true);
+}
+
+// Take up to maxCount messages from the front of pQueue and store them in order in ppMessages,
+// waiting like MessageQueue_popWait if pQueue is empty.
+// Returns the number of messages taken, 0 if the timeout expired.
+int MessageQueue_popBatch(MessageQueue* pQueue, void** ppMessages, int maxCount, int timeoutMilliseconds) {
+  assert(pQueue != NULL);
+  assert(maxCount > 0);
+
+  unsigned long numSignals = __atomic_load_n(&pQueue->numSignals, __ATOMIC_ACQUIRE);
+  int count = popAvailable(pQueue, ppMessages, maxCount);
+
+  if (count > 0 || timeoutMilliseconds == 0) {
+    return count;
+  }
+
+  if (pQueue->spinTime > 0 && spinForSignal(pQueue, numSignals) && (count = popAvailable(pQueue, ppMessages, maxCount)) > 0) {
+    __atomic_fetch_add(&pQueue->numSpinsSucceeded, 1, __ATOMIC_RELAXED);
+    return count;
+  }
+
+  ppMessages[0] = waitForMessage(pQueue, timeoutMilliseconds, true);
+
+  if (ppMessages[0] == NULL) {
+    return 0;
+  }
+
+  if (maxCount == 1) {
+    return 1;
+  }
+
+  return 1 + popAvailable(pQueue, ppMessages + 1, maxCount - 1);
+}
+
+// Makes the consumer waiting on pQueue return even though no message was pushed, so it can attend
+// to other work, or the next wait of the consumer return immediately if it is not waiting.
+void MessageQueue_wake(MessageQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  __atomic_store_n(&pQueue->isWoken, 1, __ATOMIC_RELEASE);
+  signalMessageAvailable(pQueue);
+  return;
+}
+
+// Waits until pQueue is woken with MessageQueue_wake or the timeout expires, ignoring any messages.
+void MessageQueue_waitForWake(MessageQueue* pQueue, int timeoutMilliseconds) {
+  assert(pQueue != NULL);
+
+  if (timeoutMilliseconds == 0) {
+    __atomic_store_n(&pQueue->isWoken, 0, __ATOMIC_RELAXED);
+    return;
+  }
+
+  waitForMessage(pQueue, timeoutMilliseconds, false);
+  return;
+}
+
+// Makes consumers finding pQueue empty spin for up to spinTime nanoseconds before sleeping, so a message
+// pushed meanwhile is taken without a wakeup on either side, at the cost of the CPU time spun.
+void MessageQueue_setSpinTime(MessageQueue* pQueue, uint64_t spinTime) {
+  assert(pQueue != NULL);
+
+  pQueue->spinTime = spinTime;
+  return;
+}
+
+// Returns the number of times a consumer spun on the empty pQueue.
+unsigned long MessageQueue_spinCount(MessageQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  return __atomic_load_n(&pQueue->numSpins, __ATOMIC_RELAXED);
+}
+
+// Returns the number of times a consumer spinning on the empty pQueue took a message without sleeping.
+unsigned long MessageQueue_spinSuccessCount(MessageQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  return __atomic_load_n(&pQueue->numSpinsSucceeded, __ATOMIC_RELAXED);
+}
+
+// Returns the number of times a thread had to wait for another thread to release pQueue.
+unsigned long MessageQueue_contentionCount(MessageQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    return 0;
+  }
+
+  return ThreadSafeList_contentionCount(pQueue->pList);
+}
+
+// Delete pQueue, invoking pItemFreeFn on each message still in it.
+void MessageQueue_free(MessageQueue* pQueue, FREE_FN pItemFreeFn) {
+  int status = 0;
+
+  assert(pQueue != NULL);
+
+  if (pQueue->type == MESSAGE_QUEUE_RING) {
+    RingQueue_free(pQueue->pRing, pItemFreeFn);
+  } else {
+    ThreadSafeList_free(pQueue->pList, pItemFreeFn);
+  }
+
+  status = pthread_cond_destroy(&pQueue->messageAvailableCondition);
+
+  if (status) {
+    fputs("[Error]: could not destroy message available condition variable\n", stdout);
+  }
+
+  status = pthread_mutex_destroy(&pQueue->waitMutex);
+
+  if (status) {
+    fputs("[Error]: could not destroy queue wait mutex\n", stdout);
+  }
+
+  free(pQueue);
+  return;
+}
@@ -0,0 +1,115 @@
+// A queue of messages passed from one thread to another, backed by either
+// a ThreadSafeList or a lock-free RingQueue chosen at startup
+#ifndef _MESSAGEQUEUE_H_
+#define _MESSAGEQUEUE_H_
+#include <pthread.h>
+#include <stdint.h>
+#include "list.h"
+#include "threadsafelist.h"
+#include "ringqueue.h"
+
+// Number of messages a ring-backed queue can hold
+#define MESSAGE_QUEUE_RING_CAPACITY 1024
+
+// Timeout for the waiting pop functions that never gives up
+#define MESSAGE_QUEUE_WAIT_FOREVER -1
+
+// The data structures a message queue can be backed by
+typedef enum {
+  // Mutex-guarded linked list, supports any number of producers and consumers
+  MESSAGE_QUEUE_LIST,
+
+  // Lock-free ring buffer, supports a single producer and a single consumer
+  MESSAGE_QUEUE_RING
+} MessageQueueType;
+
+typedef struct MessageQueue_s MessageQueue;
+struct MessageQueue_s {
+    MessageQueueType type;
+
+    // Set if type is MESSAGE_QUEUE_LIST, NULL otherwise
+    ThreadSafeList* pList;
+
+    // Set if type is MESSAGE_QUEUE_RING, NULL otherwise
+    RingQueue* pRing;
+
+    // Number of consumers that found the queue empty and are about to wait or are waiting
+    // Producers only take waitMutex to signal when this is nonzero
+    int numWaiters;
+
+    // Set by MessageQueue_wake, and cleared by the consumer it makes return
+    int isWoken;
+
+    // Nanoseconds a consumer spins on the empty queue before sleeping, 0 to sleep straight away
+    uint64_t spinTime;
+
+    // Counts pushes and wakes while spinTime is set, so a spinning consumer notices them without taking a lock
+    unsigned long numSignals;
+
+    // Number of times a consumer spun on the empty queue, and found a message before it had to sleep
+    unsigned long numSpins;
+    unsigned long numSpinsSucceeded;
+
+    // Mutex and condition variable used by consumers to sleep until a message is pushed
+    pthread_mutex_t waitMutex;
+    pthread_cond_t messageAvailableCondition;
+};
+
+// Makes a new, empty queue of the given type, and returns its reference on success.
+// Returns a NULL pointer on failure.
+MessageQueue* MessageQueue_create(MessageQueueType type);
+
+// Returns the number of messages in pQueue.
+int MessageQueue_count(MessageQueue* pQueue);
+
+// Adds message to the back of pQueue, and wakes a consumer waiting for it.
+// Returns 0 on success, -1 on failure.
+int MessageQueue_push(MessageQueue* pQueue, void* pMessage);
+
+// Adds count messages from ppMessages to the back of pQueue in order, taking the queue's lock
+// at most once, and wakes a consumer waiting for them.
+// Returns the number of messages added, which is less than count if pQueue filled up.
+int MessageQueue_pushBatch(MessageQueue* pQueue, void** ppMessages, int count);
+
+// Return the front message and take it out of pQueue.
+// Return NULL if pQueue is empty.
+void* MessageQueue_pop(MessageQueue* pQueue);
+
+// Return the front message and take it out of pQueue, waiting for one to be pushed if pQueue is empty.
+// Waits at most timeoutMilliseconds, or indefinitely if it is MESSAGE_QUEUE_WAIT_FOREVER.
+// Return NULL if the timeout expired or the queue was woken before a message was available.
+void* MessageQueue_popWait(MessageQueue* pQueue, int timeoutMilliseconds);
+
+// Take up to maxCount messages from the front of pQueue and store them in order in ppMessages,
+// waiting like MessageQueue_popWait if pQueue is empty. The messages are detached from a
+// list-backed queue under a single lock.
+// Returns the number of messages taken, 0 if the timeout expired or the queue was woken.
+int MessageQueue_popBatch(MessageQueue* pQueue, void** ppMessages, int maxCount, int timeoutMilliseconds);
+
+// Makes the consumer waiting on pQueue return even though no message was pushed, so it can attend
+// to other work, or the next wait of the consumer return immediately if it is not waiting.
+void MessageQueue_wake(MessageQueue* pQueue);
+
+// Waits until pQueue is woken with MessageQueue_wake or the timeout expires, ignoring any messages.
+// Waits at most timeoutMilliseconds, or indefinitely if it is MESSAGE_QUEUE_WAIT_FOREVER.
+void MessageQueue_waitForWake(MessageQueue* pQueue, int timeoutMilliseconds);
+
+// Makes consumers finding pQueue empty spin for up to spinTime nanoseconds before sleeping, so a message
+// pushed meanwhile is taken without a wakeup on either side, at the cost of the CPU time spun.
+// Must be called before any thread uses pQueue.
+void MessageQueue_setSpinTime(MessageQueue* pQueue, uint64_t spinTime);
+
+// Returns the number of times a consumer spun on the empty pQueue.
+unsigned long MessageQueue_spinCount(MessageQueue* pQueue);
+
+// Returns the number of times a consumer spinning on the empty pQueue took a message without sleeping.
+unsigned long MessageQueue_spinSuccessCount(MessageQueue* pQueue);
+
+// Returns the number of times a thread had to wait for another thread to release pQueue.
+// Always 0 for queues that do not lock.
+unsigned long MessageQueue_contentionCount(MessageQueue* pQueue);
+
+// Delete pQueue, invoking pItemFreeFn on each message still in it.
+void MessageQueue_free(MessageQueue* pQueue, FREE_FN pItemFreeFn);
+
+#endif
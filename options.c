@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "options.h"
+#include "sender.h"
+#include "receiver.h"
+#include "relay.h"
+#include "heartbeat.h"
+
+// Returns the value of a numeric option, exiting if it is not a number from minimum to maximum
+static int parseNumber(char* option, char* value, int minimum, int maximum) {
+  char* end = NULL;
+  long number = strtol(value, &end, 10);
+
+  if (end == value || *end != '\0' || number < minimum || number > maximum) {
+    fputs("[Error]: invalid value for option ", stdout);
+    fputs(option, stdout);
+    fputs("\n", stdout);
+    exit(1);
+  }
+
+  return (int) number;
+}
+
+// Fills pCpus with a CPU for each thread from a comma separated list, exiting if it is not
+// LOW_LATENCY_NUM_THREADS numbers from 0 to LOW_LATENCY_MAX_CPUS - 1
+static void parseCpus(char* option, char* value, int* pCpus) {
+  char* start = value;
+
+  for (int i = 0; i < LOW_LATENCY_NUM_THREADS; i++) {
+    char* end = NULL;
+    long cpu = strtol(start, &end, 10);
+    char separator = (i < LOW_LATENCY_NUM_THREADS - 1) ? ',' : '\0';
+
+    if (end == start || *end != separator || cpu < 0 || cpu >= LOW_LATENCY_MAX_CPUS) {
+      fputs("[Error]: invalid value for option ", stdout);
+      fputs(option, stdout);
+      fputs("\n", stdout);
+      exit(1);
+    }
+
+    pCpus[i] = (int) cpu;
+    start = end + 1;
+  }
+
+  return;
+}
+
+// Parses the command line options of the program
+int Options_parse(int argc, char* argv[], Options* pOptions) {
+  int index = 1;
+
+  pOptions->printStatistics = false;
+  pOptions->queueType = MESSAGE_QUEUE_LIST;
+  pOptions->maxListNodes = LIST_MAX_NUM_NODES;
+  pOptions->sendBatchSize = SENDER_DEFAULT_BATCH_SIZE;
+  pOptions->coalesceDeadline = SENDER_NO_COALESCING;
+  pOptions->receiveBatchSize = RECEIVER_DEFAULT_BATCH_SIZE;
+  pOptions->isUnreliable = false;
+  pOptions->isEventLoop = false;
+  pOptions->isIoUring = false;
+  pOptions->compression = COMPRESSION_OFF;
+  pOptions->isRelay = false;
+  pOptions->numRelayWorkers = 0;
+  pOptions->heartbeatInterval = HEARTBEAT_DEFAULT_INTERVAL;
+  pOptions->isLowLatency = false;
+  pOptions->busyPollTime = 0;
+
+  for (int i = 0; i < LOW_LATENCY_NUM_THREADS; i++) {
+    pOptions->cpus[i] = LOW_LATENCY_DEFAULT_CPU;
+  }
+
+  while (index < argc && strncmp(argv[index], "--", 2) == 0) {
+    char* option = argv[index];
+
+    if (strcmp(option, "--stats") == 0) {
+      pOptions->printStatistics = true;
+    } else if (strcmp(option, "--queue=list") == 0) {
+      pOptions->queueType = MESSAGE_QUEUE_LIST;
+    } else if (strcmp(option, "--queue=ring") == 0) {
+      pOptions->queueType = MESSAGE_QUEUE_RING;
+    } else if (strncmp(option, "--max-list-nodes=", 17) == 0) {
+      pOptions->maxListNodes = parseNumber(option, option + 17, 0, 1000000000);
+    } else if (strncmp(option, "--send-batch=", 13) == 0) {
+      pOptions->sendBatchSize = parseNumber(option, option + 13, 1, SENDER_MAX_BATCH_SIZE);
+    } else if (strcmp(option, "--coalesce") == 0) {
+      pOptions->coalesceDeadline = SENDER_DEFAULT_COALESCE_DEADLINE;
+    } else if (strncmp(option, "--coalesce=", 11) == 0) {
+      pOptions->coalesceDeadline = parseNumber(option, option + 11, 0, 1000);
+    } else if (strncmp(option, "--recv-batch=", 13) == 0) {
+      pOptions->receiveBatchSize = parseNumber(option, option + 13, 1, RECEIVER_MAX_BATCH_SIZE);
+    } else if (strcmp(option, "--unreliable") == 0) {
+      pOptions->isUnreliable = true;
+    } else if (strcmp(option, "--event-loop") == 0) {
+      pOptions->isEventLoop = true;
+    } else if (strcmp(option, "--io-uring") == 0) {
+      pOptions->isEventLoop = true;
+      pOptions->isIoUring = true;
+    } else if (strcmp(option, "--compress") == 0) {
+      pOptions->compression = COMPRESSION_ON;
+    } else if (strcmp(option, "--compress=dictionary") == 0) {
+      pOptions->compression = COMPRESSION_DICTIONARY;
+    } else if (strcmp(option, "--relay") == 0) {
+      pOptions->isRelay = true;
+    } else if (strncmp(option, "--relay=", 8) == 0) {
+      pOptions->isRelay = true;
+      pOptions->numRelayWorkers = parseNumber(option, option + 8, 1, RELAY_MAX_WORKERS);
+    } else if (strncmp(option, "--heartbeat=", 12) == 0) {
+      pOptions->heartbeatInterval = parseNumber(option, option + 12, HEARTBEAT_DISABLED, 60000);
+    } else if (strcmp(option, "--low-latency") == 0) {
+      pOptions->isLowLatency = true;
+    } else if (strncmp(option, "--low-latency=", 14) == 0) {
+      pOptions->isLowLatency = true;
+      parseCpus(option, option + 14, pOptions->cpus);
+    } else if (strncmp(option, "--busy-poll=", 12) == 0) {
+      pOptions->busyPollTime = parseNumber(option, option + 12, 0, 1000000);
+    } else {
+      fputs("[Error]: unrecognized option ", stdout);
+      fputs(option, stdout);
+      fputs("\n", stdout);
+      exit(1);
+    }
+
+    index++;
+  }
+
+  return index;
+}
@@ -0,0 +1,70 @@
+// Parses the command line options of the program
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+#include <stdbool.h>
+#include "messagequeue.h"
+#include "compression.h"
+#include "lowlatency.h"
+
+// Options that may be given before the positional arguments, e.g. --stats
+typedef struct {
+  // Print internal statistics when the program terminates
+  bool printStatistics;
+
+  // Data structure backing the queues between threads, set with --queue=list or --queue=ring
+  MessageQueueType queueType;
+
+  // Hard cap on the number of list nodes in use, 0 for no cap, set with --max-list-nodes=N
+  int maxListNodes;
+
+  // Most datagrams sent per system call, set with --send-batch=N
+  int sendBatchSize;
+
+  // Milliseconds a message may wait to share a datagram with others, or SENDER_NO_COALESCING,
+  // set with --coalesce or --coalesce=MS
+  int coalesceDeadline;
+
+  // Most messages received per system call, set with --recv-batch=N
+  int receiveBatchSize;
+
+  // Send each message once, without numbering, acknowledgements or retransmission, set with --unreliable
+  bool isUnreliable;
+
+  // Run on one thread with an epoll event loop rather than with a thread per task, set with --event-loop
+  bool isEventLoop;
+
+  // Run the event loop on io_uring rather than epoll, falling back to epoll if the kernel lacks it,
+  // set with --io-uring, which implies --event-loop
+  bool isIoUring;
+
+  // Compress datagrams to remote users that accept it, set with --compress, or with --compress=dictionary
+  // to also refer to the traffic they acknowledged
+  CompressionMode compression;
+
+  // Run as a relay forwarding each message to every other member, set with --relay or --relay=N
+  bool isRelay;
+
+  // Number of relay workers, each with its own socket and thread, or 0 for one per core
+  int numRelayWorkers;
+
+  // Milliseconds between heartbeats to each remote user, or HEARTBEAT_DISABLED for none,
+  // set with --heartbeat=MS
+  int heartbeatInterval;
+
+  // Pin each thread to a CPU, give them realtime scheduling and have the receiver and output threads spin
+  // before sleeping, set with --low-latency, or with --low-latency=CPUS to list the CPUs of the input, output,
+  // sender and receiver threads
+  bool isLowLatency;
+  int cpus[LOW_LATENCY_NUM_THREADS];
+
+  // Microseconds the kernel polls the network device for datagrams when the socket has none, or 0 not to,
+  // set with --busy-poll=US
+  int busyPollTime;
+} Options;
+
+// Fills pOptions from the leading --options in argv, using defaults for options not given.
+// Returns the index of the first positional argument in argv.
+// Prints an error and exits if an option is not recognized.
+int Options_parse(int argc, char* argv[], Options* pOptions);
+
+#endif
@@ -4,102 +4,93 @@
 #include <pthread.h>
 #include "output.h"
 #include "control.h"
-#include "threadsafelist.h"
+#include "messagequeue.h"
+#include "messagepool.h"
+#include "lowlatency.h"
+
+// Maximum number of received messages printed before flushing the terminal
+#define OUTPUT_BATCH_SIZE 32
+
+// Received messages taken from the queue but not yet printed
+typedef struct {
+  Message* receivedMessages[OUTPUT_BATCH_SIZE];
+  int nextIndex;
+  int count;
+} ReceivedMessageBatch;
 
 static pthread_t s_threadOutput;
 static bool s_threadHasExited = false;
-static pthread_cond_t s_messageReceivedCondition = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t s_messageReceivedMutex = PTHREAD_MUTEX_INITIALIZER;
+static OutputStatistics s_statistics;
 
-// Free any remaining memory and ensure mutex is unlocked
+// Free any remaining memory
 static void cleanup(void* args) {
-  char** receivedMessageAddress = args;
-  char* receivedMessage = *receivedMessageAddress;
+  ReceivedMessageBatch* pBatch = args;
 
-  if (receivedMessage != NULL) {
-    free(receivedMessage);
+  while (pBatch->nextIndex < pBatch->count) {
+    MessagePool_recycle(pBatch->receivedMessages[pBatch->nextIndex]);
+    pBatch->nextIndex++;
   }
 
-  pthread_mutex_trylock(&s_messageReceivedMutex);
-  pthread_mutex_unlock(&s_messageReceivedMutex);
-
   return;
 }
 
 // The thread to print output to the terminal
 static void* outputThread(void* args) {
-  int status = 0;
   OutputThreadArguments* outputArguments = args;
-  List* pReceivedMessagesList = outputArguments->pReceivedMessagesList;
+  MessageQueue* pReceivedMessagesQueue = outputArguments->pReceivedMessagesQueue;
+  PeerTable* pPeers = outputArguments->pPeers;
+  int numPeersLeft = 0;
 
-  bool isFirstSegment = true;
-  char* receivedMessage = NULL;
-  char** receivedMessageAddress = &receivedMessage;
+  ReceivedMessageBatch batch;
+  batch.nextIndex = 0;
+  batch.count = 0;
 
-  pthread_cleanup_push(cleanup, receivedMessageAddress);
+  LowLatency_tuneThread(LOW_LATENCY_OUTPUT);
 
-  while (1) {
-    // If there are no received messages, wait until one arrives
-    if (ThreadSafeList_count(pReceivedMessagesList) == 0) {
-      status = pthread_mutex_lock(&s_messageReceivedMutex);
+  pthread_cleanup_push(cleanup, &batch);
 
-      if (status) {
-        fputs("[Error]: could not lock message received mutex\n", stdout);
-        exit(1);
-      }
+  while (!s_threadHasExited) {
+    // Get every message in the received messages queue, waiting until one arrives
+    batch.count = MessageQueue_popBatch(
+      pReceivedMessagesQueue, (void**) batch.receivedMessages,
+      OUTPUT_BATCH_SIZE, MESSAGE_QUEUE_WAIT_FOREVER
+    );
+    batch.nextIndex = 0;
+    bool isMessageEnd = true;
 
-      status = pthread_cond_wait(&s_messageReceivedCondition, &s_messageReceivedMutex);
+    // The receiver thread stamps messages as it queues them, so this measures the handoff alone
+    uint64_t takenTime = Message_getTimestamp();
 
-      if (status) {
-        fputs("[Error]: could not wait on message received condition variable\n", stdout);
-        exit(1);
-      }
-
-      status = pthread_mutex_unlock(&s_messageReceivedMutex);
-
-      if (status) {
-        fputs("[Error]: could not unlock message received mutex\n", stdout);
-        exit(1);
-      }
+    for (int i = 0; i < batch.count; i++) {
+      Histogram_record(&s_statistics.handoffLatencies, takenTime - batch.receivedMessages[i]->queuedTime);
     }
 
-    // Get message from received messages queue
-    receivedMessage = ThreadSafeList_trim(pReceivedMessagesList);
-
-    if (receivedMessage == NULL) {
-      fputs("[Error]: received message was null\n", stdout);
-      exit(1);
-    }
+    while (batch.nextIndex < batch.count && !s_threadHasExited) {
+      Message* receivedMessage = batch.receivedMessages[batch.nextIndex];
 
-    // Detect if the received message is the last part of an existing line
-    bool isLastSegment = (receivedMessage[MESSAGE_MAX_SIZE - 2] == '\0' || receivedMessage[MESSAGE_MAX_SIZE - 2] == '\n');
+      // Prints the received message to the terminal, labelling the start of each line with its sender
+      // Also detects if the program should be terminated, once every remote user has exited
+      if (receivedMessage->flags & MESSAGE_FLAG_FIRST_SEGMENT) {
+        fputs(PeerTable_get(pPeers, receivedMessage->peerIndex)->label, stdout);
+      }
 
-    // Prints the received message to the terminal
-    // Also detects if the program should be terminated
-    if (isFirstSegment) {
-      fputs("[Remote]: ", stdout);
-      fputs(receivedMessage, stdout);
+      fwrite(receivedMessage->data, 1, receivedMessage->length, stdout);
+      isMessageEnd = receivedMessage->fragmentIndex + 1 >= receivedMessage->fragmentCount;
 
-      if (strcmp(receivedMessage, TERMINATE) == 0) {
-        fputs("[The remote user has sent the exit command]\n", stdout);
-        s_threadHasExited = true;
-      } else if (!isLastSegment) {
-        isFirstSegment = false;
+      if (receivedMessage->flags & MESSAGE_FLAG_CONTROL) {
+        fputs(OUTPUT_EXIT_NOTICE, stdout);
+        numPeersLeft++;
+        s_threadHasExited = (numPeersLeft == PeerTable_count(pPeers));
       }
-    } else {
-      fputs(receivedMessage, stdout);
 
-      if (isLastSegment) {
-        isFirstSegment = true;
-      }
+      MessagePool_recycle(receivedMessage);
+      batch.nextIndex++;
     }
-    fflush(stdout);
-
-    free(receivedMessage);
-    receivedMessage = NULL;
 
-    if (s_threadHasExited) {
-      break;
+    // Flush once for the whole batch, unless it ends partway through a message whose other fragments
+    // were already received, so a message is written out whole
+    if (isMessageEnd) {
+      fflush(stdout);
     }
   }
 
@@ -113,38 +104,11 @@ static void* outputThread(void* args) {
   return NULL;
 }
 
-// Signals the output thread that there is a received message
-void Output_signalMessageReceived() {
-  int status = 0;
-
-  status = pthread_mutex_lock(&s_messageReceivedMutex);
-
-  if (status) {
-    fputs("[Error]: could not lock message received mutex\n", stdout);
-    exit(1);
-  }
-
-  status = pthread_cond_signal(&s_messageReceivedCondition);
-
-  if (status) {
-    fputs("[Error]: could not signal message received condition variable\n", stdout);
-    exit(1);
-  }
-
-  status = pthread_mutex_unlock(&s_messageReceivedMutex);
-
-  if (status) {
-    fputs("[Error]: could not unlock message received mutex\n", stdout);
-    exit(1);
-  }
-
-  return;
-}
-
 // Initializes the output thread
 void Output_init(OutputThreadArguments* pOutputArguments) {
   int status = 0;
 
+  Histogram_init(&s_statistics.handoffLatencies);
   status = pthread_create(&s_threadOutput, NULL, outputThread, pOutputArguments);
 
   if (status) {
@@ -173,17 +137,11 @@ void Output_shutdown() {
     fputs("[Error]: could not join with output thread\n", stdout);
   }
 
-  status = pthread_cond_destroy(&s_messageReceivedCondition);
-
-  if (status) {
-    fputs("[Error]: could not destroy message received condition variable\n", stdout);
-  }
-
-  status = pthread_mutex_destroy(&s_messageReceivedMutex);
-
-  if (status) {
-    fputs("[Error]: could not destroy message received mutex\n", stdout);
-  }
+  return;
+}
 
+// Fills pStatistics with the counters of the output thread
+void Output_getStatistics(OutputStatistics* pStatistics) {
+  *pStatistics = s_statistics;
   return;
 }
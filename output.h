@@ -1,20 +1,38 @@
 // Manages the thread that prints output to the terminal
 #ifndef _OUTPUT_H_
 #define _OUTPUT_H_
-#include "threadsafelist.h"
+#include "messagequeue.h"
+#include "peer.h"
+#include "histogram.h"
+
+// Printed before each line received from the remote user, when there is only one
+#define OUTPUT_REMOTE_LABEL "[Remote]: "
+
+// Printed once a remote user has sent the exit command
+#define OUTPUT_EXIT_NOTICE "[The remote user has sent the exit command]\n"
 
 // Arguments for the output thread
 typedef struct {
-  List* pReceivedMessagesList;
+  MessageQueue* pReceivedMessagesQueue;
+
+  // Remote users the messages are received from, whose labels are printed before their lines
+  PeerTable* pPeers;
 } OutputThreadArguments;
 
+// Counters of the output thread
+typedef struct {
+  // Nanoseconds from the receiver thread adding each message to the received messages queue
+  // to the output thread taking it out
+  Histogram handoffLatencies;
+} OutputStatistics;
+
 // Initializes the output thread
 void Output_init(OutputThreadArguments* pOutputArguments);
 
-// Signals the output thread that there is a received message
-void Output_signalMessageReceived(void);
-
 // Shutdowns the output thread and performs necessary cleanup
 void Output_shutdown(void);
 
+// Fills pStatistics with the counters of the output thread
+void Output_getStatistics(OutputStatistics* pStatistics);
+
 #endif
@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "pathmtu.h"
+#include "message.h"
+
+// MTUs probed when the kernel does not report the path MTU, largest first:
+// jumbo frames, Ethernet, PPPoE, the IPv6 minimum, and the IPv4 minimum
+static const int s_probedMtus[] = {9000, 1500, 1492, 1280, 576};
+
+// Returns the largest datagram size that fits in a packet of the given MTU, within the supported bounds
+static int getDatagramSize(int mtu) {
+  int size = mtu - MESSAGE_IP_UDP_HEADER_SIZE;
+
+  if (size < MESSAGE_DATAGRAM_MIN_SIZE) {
+    return MESSAGE_DATAGRAM_MIN_SIZE;
+  } else if (size > MESSAGE_DATAGRAM_MAX_SIZE) {
+    return MESSAGE_DATAGRAM_MAX_SIZE;
+  }
+
+  return size;
+}
+
+// Returns the largest of the probed MTUs the kernel sends without fragmenting on socketDescriptor, or 0 if none
+// A probe larger than the known path MTU fails with EMSGSIZE without leaving the host, so at most one reaches
+// the remote user, whose receiver ignores it
+static int probeMtu(int socketDescriptor) {
+  static char probe[MESSAGE_DATAGRAM_MAX_SIZE];
+  MessageHeader header;
+
+  memset(&header, 0, sizeof(header));
+  header.type = MESSAGE_TYPE_PROBE;
+  memcpy(probe, &header, sizeof(header));
+
+  for (int i = 0; i < (int) (sizeof(s_probedMtus) / sizeof(s_probedMtus[0])); i++) {
+    if (send(socketDescriptor, probe, getDatagramSize(s_probedMtus[i]), 0) != -1) {
+      return s_probedMtus[i];
+    }
+
+    if (errno != EMSGSIZE) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+// Fills pPathMtu with the largest datagram size for the path to pRemoteAddress.
+// Asks the kernel for the path MTU, and if it cannot tell, probes the MTUs common on LANs from the largest down,
+// keeping the first the kernel lets through without fragmenting. Falls back to MESSAGE_DATAGRAM_DEFAULT_SIZE.
+void PathMtu_discover(struct sockaddr_in* pRemoteAddress, PathMtu* pPathMtu) {
+  int discover = IP_PMTUDISC_DO;
+  int mtu = 0;
+  socklen_t mtuSize = sizeof(mtu);
+
+  pPathMtu->datagramSize = MESSAGE_DATAGRAM_DEFAULT_SIZE;
+  pPathMtu->mtu = 0;
+  pPathMtu->isProbed = false;
+
+  // A separate connected socket, so the kernel tracks the path MTU to the remote user for it,
+  // and never fragments what it sends
+  int socketDescriptor = socket(PF_INET, SOCK_DGRAM, 0);
+
+  if (socketDescriptor == -1) {
+    return;
+  }
+
+  if (setsockopt(socketDescriptor, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)) == -1 ||
+      connect(socketDescriptor, (struct sockaddr*) pRemoteAddress, sizeof(struct sockaddr_in)) == -1) {
+    close(socketDescriptor);
+    return;
+  }
+
+  if (getsockopt(socketDescriptor, IPPROTO_IP, IP_MTU, &mtu, &mtuSize) == -1 || mtu <= 0) {
+    mtu = probeMtu(socketDescriptor);
+    pPathMtu->isProbed = true;
+  }
+
+  close(socketDescriptor);
+
+  if (mtu > 0) {
+    pPathMtu->mtu = mtu;
+    pPathMtu->datagramSize = getDatagramSize(mtu);
+  }
+
+  return;
+}
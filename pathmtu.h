@@ -0,0 +1,24 @@
+// Finds the largest datagram that reaches the remote user in one IP packet, without fragmentation
+#ifndef _PATHMTU_H_
+#define _PATHMTU_H_
+#include <stdbool.h>
+#include <netinet/in.h>
+
+typedef struct PathMtu_s PathMtu;
+struct PathMtu_s {
+    // Largest UDP payload carried in one IP packet, from MESSAGE_DATAGRAM_MIN_SIZE to MESSAGE_DATAGRAM_MAX_SIZE
+    int datagramSize;
+
+    // MTU of the path the size was found from, 0 if neither the kernel nor a probe could tell
+    int mtu;
+
+    // True if the MTU was found by probing, because the kernel did not report it
+    bool isProbed;
+};
+
+// Fills pPathMtu with the largest datagram size for the path to pRemoteAddress.
+// Asks the kernel for the path MTU, and if it cannot tell, probes the MTUs common on LANs from the largest down,
+// keeping the first the kernel lets through without fragmenting. Falls back to MESSAGE_DATAGRAM_DEFAULT_SIZE.
+void PathMtu_discover(struct sockaddr_in* pRemoteAddress, PathMtu* pPathMtu);
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "peer.h"
+
+// Returns the key of an address in the index: the IPv4 address above the port
+static uint64_t getAddressKey(struct sockaddr_in* pAddress) {
+  return (uint64_t) ntohl(pAddress->sin_addr.s_addr) << 16 | ntohs(pAddress->sin_port);
+}
+
+// Returns the key of a peer in the index
+static uint64_t getPeerKey(void* pItem) {
+  return getAddressKey(&((Peer*) pItem)->address);
+}
+
+// Frees a peer along with its reliability layer and heartbeats
+static void freePeer(void* pItem) {
+  Peer* pPeer = pItem;
+
+  if (pPeer->pReliability != NULL) {
+    Reliability_free(pPeer->pReliability);
+  }
+
+  if (pPeer->pHeartbeat != NULL) {
+    Heartbeat_free(pPeer->pHeartbeat);
+  }
+
+  free(pPeer);
+  return;
+}
+
+// Makes a new empty table of peers, and returns its reference on success.
+// Returns a NULL pointer on failure.
+PeerTable* PeerTable_create() {
+  PeerTable* pTable = malloc(sizeof(PeerTable));
+
+  if (pTable == NULL) {
+    return NULL;
+  }
+
+  pTable->count = 0;
+  pTable->pIndex = List_create();
+
+  if (pTable->pIndex == NULL || List_enableKeyIndex(pTable->pIndex, getPeerKey) == -1) {
+    if (pTable->pIndex != NULL) {
+      List_free(pTable->pIndex, freePeer);
+    }
+
+    free(pTable);
+    return NULL;
+  }
+
+  return pTable;
+}
+
+// Adds the remote user at pAddress, printing label before its lines, and exchanging messages with it
+// through pReliability, which the table owns from then on.
+// Returns the new peer, or NULL if the table is full or already holds a peer at that address.
+Peer* PeerTable_add(PeerTable* pTable, struct sockaddr_in* pAddress, char* label, Reliability* pReliability) {
+  if (pTable->count == PEER_MAX_PEERS || List_containsKey(pTable->pIndex, getAddressKey(pAddress))) {
+    return NULL;
+  }
+
+  Peer* pPeer = malloc(sizeof(Peer));
+
+  if (pPeer == NULL) {
+    return NULL;
+  }
+
+  pPeer->pHeartbeat = Heartbeat_create();
+
+  if (pPeer->pHeartbeat == NULL) {
+    free(pPeer);
+    return NULL;
+  }
+
+  pPeer->address = *pAddress;
+  pPeer->index = pTable->count;
+  strncpy(pPeer->label, label, PEER_LABEL_SIZE - 1);
+  pPeer->label[PEER_LABEL_SIZE - 1] = '\0';
+  pPeer->pReliability = pReliability;
+  pPeer->hasLeft = false;
+  pPeer->acceptsCompression = false;
+  pPeer->maxDatagramSize = 0;
+  pPeer->isRemoved = false;
+
+  if (List_append(pTable->pIndex, pPeer) == -1) {
+    Heartbeat_free(pPeer->pHeartbeat);
+    free(pPeer);
+    return NULL;
+  }
+
+  pTable->pPeers[pTable->count] = pPeer;
+  pTable->count++;
+  return pPeer;
+}
+
+// Takes pPeer, which has left, out of the index of pTable, so datagrams from its address no longer find it.
+void PeerTable_remove(PeerTable* pTable, Peer* pPeer) {
+  if (!pPeer->isRemoved) {
+    List_removeKey(pTable->pIndex, getPeerKey(pPeer));
+    pPeer->isRemoved = true;
+  }
+
+  return;
+}
+
+// Gives the slot of a peer taken out of pTable to the remote user at pAddress, as PeerTable_add would add it,
+// freeing the reliability layer the slot held.
+// Returns the peer, or NULL if no peer was taken out or a peer already has that address.
+Peer* PeerTable_reuse(PeerTable* pTable, struct sockaddr_in* pAddress, char* label, Reliability* pReliability) {
+  Peer* pPeer = NULL;
+
+  if (List_containsKey(pTable->pIndex, getAddressKey(pAddress))) {
+    return NULL;
+  }
+
+  for (int i = 0; i < pTable->count && pPeer == NULL; i++) {
+    if (pTable->pPeers[i]->isRemoved) {
+      pPeer = pTable->pPeers[i];
+    }
+  }
+
+  if (pPeer == NULL) {
+    return NULL;
+  }
+
+  // The peer is only indexed again once its new address is, so it stays out of the table on failure
+  struct sockaddr_in previousAddress = pPeer->address;
+  pPeer->address = *pAddress;
+
+  if (List_append(pTable->pIndex, pPeer) == -1) {
+    pPeer->address = previousAddress;
+    return NULL;
+  }
+
+  if (pPeer->pReliability != NULL) {
+    Reliability_free(pPeer->pReliability);
+  }
+
+  strncpy(pPeer->label, label, PEER_LABEL_SIZE - 1);
+  pPeer->label[PEER_LABEL_SIZE - 1] = '\0';
+  pPeer->pReliability = pReliability;
+  pPeer->hasLeft = false;
+  pPeer->acceptsCompression = false;
+  pPeer->maxDatagramSize = 0;
+  pPeer->isRemoved = false;
+  return pPeer;
+}
+
+// Returns the peer at pAddress, or NULL if no peer has that address.
+Peer* PeerTable_find(PeerTable* pTable, struct sockaddr_in* pAddress) {
+  return List_searchKey(pTable->pIndex, getAddressKey(pAddress));
+}
+
+// Returns the peer with the given index, from 0 to the number of peers.
+Peer* PeerTable_get(PeerTable* pTable, int index) {
+  return pTable->pPeers[index];
+}
+
+// Returns the number of peers in pTable.
+int PeerTable_count(PeerTable* pTable) {
+  return pTable->count;
+}
+
+// Marks pPeer as gone, once its exit command was delivered.
+void Peer_leave(Peer* pPeer) {
+  __atomic_store_n(&pPeer->hasLeft, true, __ATOMIC_RELEASE);
+  return;
+}
+
+// Returns true if pPeer sent the exit command, so nothing more is sent to it.
+bool Peer_hasLeft(Peer* pPeer) {
+  return __atomic_load_n(&pPeer->hasLeft, __ATOMIC_ACQUIRE);
+}
+
+// Records that pPeer accepts compressed datagrams, as a datagram from it said.
+void Peer_acceptCompression(Peer* pPeer) {
+  __atomic_store_n(&pPeer->acceptsCompression, true, __ATOMIC_RELEASE);
+  return;
+}
+
+// Returns true if pPeer said it accepts compressed datagrams.
+bool Peer_acceptsCompression(Peer* pPeer) {
+  return __atomic_load_n(&pPeer->acceptsCompression, __ATOMIC_ACQUIRE);
+}
+
+// Delete pTable, freeing every peer along with its reliability layer and heartbeats.
+void PeerTable_free(PeerTable* pTable) {
+  List_free(pTable->pIndex, freePeer);
+  free(pTable);
+  return;
+}
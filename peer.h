@@ -0,0 +1,101 @@
+// The remote users of a conversation, each found by the address its datagrams come from
+// Every message typed is sent to each of them, and the messages received are labelled with who sent them
+#ifndef _PEER_H_
+#define _PEER_H_
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "list.h"
+#include "reliability.h"
+#include "heartbeat.h"
+
+// Most remote users in one conversation
+#define PEER_MAX_PEERS 64
+
+// Longest label printed before the lines of a remote user, including the terminating NUL
+#define PEER_LABEL_SIZE 64
+
+typedef struct Peer_s Peer;
+struct Peer_s {
+    struct sockaddr_in address;
+
+    // Position of the peer in its table, carried by the messages received from it
+    int index;
+
+    // Printed before each line received from the peer
+    char label[PEER_LABEL_SIZE];
+
+    // Reliability layer for the messages exchanged with the peer, or NULL to send each message once
+    // Owned by the table, and freed with it
+    Reliability* pReliability;
+
+    // Heartbeats exchanged with the peer, and what they measured of the link to it
+    // Owned by the table, and freed with it
+    Heartbeat* pHeartbeat;
+
+    // Set by the receiver once the peer's exit command was delivered, after which nothing more is sent to it
+    bool hasLeft;
+
+    // Set by the receiver once a datagram from the peer said it accepts compressed datagrams
+    bool acceptsCompression;
+
+    // Largest datagram the peer said it takes, 0 until it said; only accessed by the thread that receives from it
+    int maxDatagramSize;
+
+    // Set once the peer was taken out of the index of its table, after which its slot may be given to another
+    // remote user; only accessed by the thread that receives from it
+    bool isRemoved;
+};
+
+typedef struct PeerTable_s PeerTable;
+struct PeerTable_s {
+    // Peers in the order they were added
+    Peer* pPeers[PEER_MAX_PEERS];
+    int count;
+
+    // The same peers, with a key index from their address, to find the sender of a datagram in constant time
+    List* pIndex;
+};
+
+// Makes a new empty table of peers, and returns its reference on success.
+// Returns a NULL pointer on failure.
+PeerTable* PeerTable_create();
+
+// Adds the remote user at pAddress, printing label before its lines, and exchanging messages with it
+// through pReliability, which the table owns from then on.
+// Returns the new peer, or NULL if the table is full or already holds a peer at that address.
+Peer* PeerTable_add(PeerTable* pTable, struct sockaddr_in* pAddress, char* label, Reliability* pReliability);
+
+// Takes pPeer, which has left, out of the index of pTable, so datagrams from its address no longer find it.
+// The peer keeps its index and its reliability layer until PeerTable_reuse gives its slot to another remote user.
+void PeerTable_remove(PeerTable* pTable, Peer* pPeer);
+
+// Gives the slot of a peer taken out of pTable to the remote user at pAddress, as PeerTable_add would add it,
+// freeing the reliability layer the slot held. The peer keeps its index and its heartbeats.
+// Returns the peer, or NULL if no peer was taken out or a peer already has that address.
+Peer* PeerTable_reuse(PeerTable* pTable, struct sockaddr_in* pAddress, char* label, Reliability* pReliability);
+
+// Returns the peer at pAddress, or NULL if no peer has that address.
+Peer* PeerTable_find(PeerTable* pTable, struct sockaddr_in* pAddress);
+
+// Returns the peer with the given index, from 0 to the number of peers.
+Peer* PeerTable_get(PeerTable* pTable, int index);
+
+// Returns the number of peers in pTable.
+int PeerTable_count(PeerTable* pTable);
+
+// Marks pPeer as gone, once its exit command was delivered.
+void Peer_leave(Peer* pPeer);
+
+// Returns true if pPeer sent the exit command, so nothing more is sent to it.
+bool Peer_hasLeft(Peer* pPeer);
+
+// Records that pPeer accepts compressed datagrams, as a datagram from it said.
+void Peer_acceptCompression(Peer* pPeer);
+
+// Returns true if pPeer said it accepts compressed datagrams.
+bool Peer_acceptsCompression(Peer* pPeer);
+
+// Delete pTable, freeing every peer along with its reliability layer and heartbeats.
+void PeerTable_free(PeerTable* pTable);
+
+#endif
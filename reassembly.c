@@ -0,0 +1,100 @@
+#include <string.h>
+#include "reassembly.h"
+#include "messagepool.h"
+
+// Recycles the fragments of a partly received message, freeing its slot
+static void clearSlot(ReassemblySlot* pSlot) {
+  for (int i = 0; i < pSlot->fragmentCount; i++) {
+    if (pSlot->pFragments[i] != NULL) {
+      MessagePool_recycle(pSlot->pFragments[i]);
+      pSlot->pFragments[i] = NULL;
+    }
+  }
+
+  pSlot->numReceived = 0;
+  return;
+}
+
+// Returns the slot of the message pFragment belongs to, starting the message in a free slot,
+// or in place of the one started longest ago, if it was not partly received yet
+static ReassemblySlot* findSlot(Reassembly* pReassembly, Message* pFragment) {
+  ReassemblySlot* pFreeSlot = NULL;
+  ReassemblySlot* pOldestSlot = NULL;
+
+  for (int i = 0; i < REASSEMBLY_MAX_MESSAGES; i++) {
+    ReassemblySlot* pSlot = &pReassembly->slots[i];
+
+    if (pSlot->numReceived == 0) {
+      if (pFreeSlot == NULL) {
+        pFreeSlot = pSlot;
+      }
+    } else if (pSlot->messageId == pFragment->messageId) {
+      return pSlot;
+    } else if (pOldestSlot == NULL || pSlot->startedTime < pOldestSlot->startedTime) {
+      pOldestSlot = pSlot;
+    }
+  }
+
+  if (pFreeSlot == NULL) {
+    clearSlot(pOldestSlot);
+    pReassembly->numDropped++;
+    pFreeSlot = pOldestSlot;
+  }
+
+  pFreeSlot->messageId = pFragment->messageId;
+  pFreeSlot->fragmentCount = pFragment->fragmentCount;
+  pFreeSlot->startedTime = pFragment->createdTime;
+  return pFreeSlot;
+}
+
+// Empties pReassembly, which must not hold any fragment.
+void Reassembly_init(Reassembly* pReassembly) {
+  memset(pReassembly, 0, sizeof(Reassembly));
+  return;
+}
+
+// Adds a fragment of a message sent in several, taking ownership of it.
+// Once every fragment of its message arrived, stores them in order in ppFragments, which must have room
+// for MESSAGE_MAX_FRAGMENTS, and returns their count. Returns 0 while fragments are missing.
+int Reassembly_add(Reassembly* pReassembly, Message* pFragment, Message** ppFragments) {
+  if (pFragment->fragmentCount > MESSAGE_MAX_FRAGMENTS || pFragment->fragmentIndex >= pFragment->fragmentCount) {
+    MessagePool_recycle(pFragment);
+    pReassembly->numDiscarded++;
+    return 0;
+  }
+
+  ReassemblySlot* pSlot = findSlot(pReassembly, pFragment);
+
+  // A fragment disagreeing with the others about the size of the message, or already received, is discarded
+  if (pSlot->fragmentCount != pFragment->fragmentCount || pSlot->pFragments[pFragment->fragmentIndex] != NULL) {
+    MessagePool_recycle(pFragment);
+    pReassembly->numDiscarded++;
+    return 0;
+  }
+
+  pSlot->pFragments[pFragment->fragmentIndex] = pFragment;
+  pSlot->numReceived++;
+
+  if (pSlot->numReceived < pSlot->fragmentCount) {
+    return 0;
+  }
+
+  int count = pSlot->fragmentCount;
+  memcpy(ppFragments, pSlot->pFragments, sizeof(Message*) * count);
+  memset(pSlot->pFragments, 0, sizeof(Message*) * count);
+  pSlot->numReceived = 0;
+  pReassembly->numReassembled++;
+
+  return count;
+}
+
+// Recycles every fragment held by pReassembly, leaving it empty.
+void Reassembly_clear(Reassembly* pReassembly) {
+  for (int i = 0; i < REASSEMBLY_MAX_MESSAGES; i++) {
+    if (pReassembly->slots[i].numReceived > 0) {
+      clearSlot(&pReassembly->slots[i]);
+    }
+  }
+
+  return;
+}
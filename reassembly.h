@@ -0,0 +1,51 @@
+// Reassembles messages received in several fragments, so each is delivered whole or not at all
+// A bounded number of messages may be partly received at once; when another one starts,
+// the one that started longest ago is dropped
+#ifndef _REASSEMBLY_H_
+#define _REASSEMBLY_H_
+#include <stdint.h>
+#include "message.h"
+
+// Most messages partly received at once
+#define REASSEMBLY_MAX_MESSAGES 8
+
+// A message partly received
+typedef struct {
+    uint32_t messageId;
+
+    // Number of fragments received so far, 0 if the slot is free
+    int numReceived;
+
+    int fragmentCount;
+
+    // Time the first fragment was received, to find the message to drop when every slot is in use
+    uint64_t startedTime;
+
+    // Fragments received, indexed by fragment index
+    Message* pFragments[MESSAGE_MAX_FRAGMENTS];
+} ReassemblySlot;
+
+typedef struct Reassembly_s Reassembly;
+struct Reassembly_s {
+    ReassemblySlot slots[REASSEMBLY_MAX_MESSAGES];
+
+    // Number of messages delivered whole, and dropped before all their fragments arrived
+    unsigned long numReassembled;
+    unsigned long numDropped;
+
+    // Number of fragments discarded because they were already received or malformed
+    unsigned long numDiscarded;
+};
+
+// Empties pReassembly, which must not hold any fragment.
+void Reassembly_init(Reassembly* pReassembly);
+
+// Adds a fragment of a message sent in several, taking ownership of it.
+// Once every fragment of its message arrived, stores them in order in ppFragments, which must have room
+// for MESSAGE_MAX_FRAGMENTS, and returns their count. Returns 0 while fragments are missing.
+int Reassembly_add(Reassembly* pReassembly, Message* pFragment, Message** ppFragments);
+
+// Recycles every fragment held by pReassembly, leaving it empty.
+void Reassembly_clear(Reassembly* pReassembly);
+
+#endif
@@ -1,80 +1,654 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
 #include "receiver.h"
-#include "output.h"
 #include "control.h"
-#include "threadsafelist.h"
+#include "messagequeue.h"
+#include "messagepool.h"
+#include "reliability.h"
+#include "reassembly.h"
+#include "peer.h"
+#include "compression.h"
+#include "heartbeat.h"
+#include "lowlatency.h"
+
+// Messages received into by recvmmsg, with the datagrams describing them
+// Every slot always holds a message from the pool, so the next call can receive into it
+typedef struct {
+  Message* receivedMessages[RECEIVER_MAX_BATCH_SIZE];
+  MessageHeader headers[RECEIVER_MAX_BATCH_SIZE];
+  struct iovec parts[RECEIVER_MAX_BATCH_SIZE][2];
+  struct sockaddr_in remoteSockets[RECEIVER_MAX_BATCH_SIZE];
+  struct mmsghdr datagrams[RECEIVER_MAX_BATCH_SIZE];
+  int count;
+} ReceivingMessageBatch;
+
+// What the receiver keeps for each peer
+typedef struct {
+  // Set once a numbered message is received from the peer, until an acknowledgement is sent
+  bool isAckDue;
+
+  // Set once a heartbeat is received from the peer, until its echo is sent
+  bool isEchoDue;
+  MessageHeader echoHeader;
+  char echoData[HEARTBEAT_DATA_SIZE];
+
+  // Messages partly received from the peer, added to the ready messages once whole
+  Reassembly reassembly;
+
+  // Data of every message delivered in order from the peer, to take the dictionaries of its compressed
+  // datagrams from, or NULL if the peer sends neither in order nor compressed
+  CompressionHistory* pHistory;
+} ReceiverPeer;
+
+// Messages received but not yet added to the received messages queue
+typedef struct {
+  Message* readyMessages[RECEIVER_MAX_READY_MESSAGES];
+  int numReady;
+  MessageQueue* pReceivedMessagesQueue;
+  ReceiverDeliverFunction deliver;
+
+  // Remote users messages are received from, each with a reliability layer putting their numbered messages
+  // in order, or with none to deliver every message as it arrives
+  PeerTable* pPeers;
+
+  // State for each peer, indexed as in the peer table
+  ReceiverPeer* pReceiverPeers;
+} ReadyMessages;
 
 static pthread_t s_threadReceiver;
+static ReceiverStatistics s_statistics;
+static ReceiverThreadArguments* s_pArguments = NULL;
+
+// Large, so kept off the thread's stack
+static ReceivingMessageBatch s_batch;
+static ReadyMessages s_ready;
+
+// The dictionary of a compressed datagram, followed by the data decompressed from it
+static char s_decompressionBuffer[COMPRESSION_DICTIONARY_SIZE + MESSAGE_DATAGRAM_MAX_SIZE];
 
 // Free any remaining memory
 static void cleanup(void* args) {
-  char** receivedMessageAddress = args;
-  char* receivedMessage = *receivedMessageAddress;
+  Receiver_release();
+  return;
+}
+
+// Takes a message from the pool to receive into for every empty slot of pBatch
+static void fillBatch(ReceivingMessageBatch* pBatch) {
+  for (int i = 0; i < pBatch->count; i++) {
+    if (pBatch->receivedMessages[i] == NULL) {
+      pBatch->receivedMessages[i] = MessagePool_alloc();
+
+      if (pBatch->receivedMessages[i] == NULL) {
+        fputs("[Error]: could not allocate memory for received message\n", stdout);
+        exit(1);
+      }
 
-  if (receivedMessage != NULL) {
-    free(receivedMessage);
+      pBatch->parts[i][1].iov_base = pBatch->receivedMessages[i]->data;
+    }
   }
 
   return;
 }
 
-// The thread to receive UDP messages
-void* receiverThread(void* args) {
-  int status = 0;
-  ReceiverThreadArguments* receiverArguments = args;
-  List* pReceivedMessagesList = receiverArguments->pReceivedMessagesList;
-  int socketDescriptor = receiverArguments->socketDescriptor;
+// Adds the ready messages to the end of the received messages queue, waking the output thread once
+static void pushReadyMessages(ReadyMessages* pReady) {
+  if (pReady->deliver != NULL) {
+    pReady->deliver(pReady->readyMessages, pReady->numReady);
+    pReady->numReady = 0;
+    return;
+  }
 
-  char* receivedMessage = NULL;
-  char** receivedMessageAddress = &receivedMessage;
+  // Stamped as they are handed over, so the output thread can measure how long the handoff took
+  uint64_t queuedTime = Message_getTimestamp();
 
-  pthread_cleanup_push(cleanup, receivedMessageAddress);
+  for (int i = 0; i < pReady->numReady; i++) {
+    pReady->readyMessages[i]->queuedTime = queuedTime;
+  }
 
-  while (1) {
-    struct sockaddr_in remoteSocket;
-		unsigned int remoteLength = sizeof(remoteSocket);
-		receivedMessage = malloc(MESSAGE_MAX_SIZE);
+  int numPushed = MessageQueue_pushBatch(pReady->pReceivedMessagesQueue, (void**) pReady->readyMessages, pReady->numReady);
+
+  if (numPushed < pReady->numReady) {
+    fputs("[Error]: could not add message to received messages queue\n", stdout);
+
+    for (int i = numPushed; i < pReady->numReady; i++) {
+      MessagePool_recycle(pReady->readyMessages[i]);
+    }
+  }
+
+  pReady->numReady = 0;
+  return;
+}
+
+// Adds a received message to the ready messages, pushing them to the queue first if there is no room
+static void addReadyMessage(ReadyMessages* pReady, Message* pMessage) {
+  if (pReady->numReady == RECEIVER_MAX_READY_MESSAGES) {
+    pushReadyMessages(pReady);
+  }
+
+  // Nothing more is sent to a peer once its exit command is delivered
+  if (pMessage->flags & MESSAGE_FLAG_CONTROL) {
+    Peer_leave(PeerTable_get(pReady->pPeers, pMessage->peerIndex));
+  }
+
+  pReady->readyMessages[pReady->numReady] = pMessage;
+  pReady->numReady++;
+  s_statistics.numMessagesReceived++;
+  return;
+}
+
+// Adds a message received in order from pPeer to the ready messages, along with the rest of its message if it is a fragment
+// Fragments are held until every fragment of their message arrived, so the message is delivered whole
+static void deliverMessage(ReadyMessages* pReady, Peer* pPeer, Message* pMessage) {
+  Message* pFragments[MESSAGE_MAX_FRAGMENTS];
+  Reassembly* pReassembly = &pReady->pReceiverPeers[pPeer->index].reassembly;
+
+  pMessage->peerIndex = (uint16_t) pPeer->index;
+
+  if (pMessage->fragmentCount <= 1) {
+    addReadyMessage(pReady, pMessage);
+    return;
+  }
+
+  unsigned long numReassembled = pReassembly->numReassembled;
+  unsigned long numDropped = pReassembly->numDropped;
+  int count = Reassembly_add(pReassembly, pMessage, pFragments);
+
+  for (int i = 0; i < count; i++) {
+    addReadyMessage(pReady, pFragments[i]);
+  }
+
+  s_statistics.numMessagesReassembled += pReassembly->numReassembled - numReassembled;
+  s_statistics.numMessagesDropped += pReassembly->numDropped - numDropped;
+  return;
+}
+
+// Accepts a data message received from pPeer, adding it to the ready messages in order
+// Returns false if the message is a duplicate, which the caller keeps
+static bool acceptMessage(ReadyMessages* pReady, Peer* pPeer, Message* pMessage) {
+  Reliability* pReliability = pPeer->pReliability;
+
+  if (pReliability == NULL || !(pMessage->flags & MESSAGE_FLAG_RELIABLE)) {
+    deliverMessage(pReady, pPeer, pMessage);
+    return true;
+  }
+
+  pReady->pReceiverPeers[pPeer->index].isAckDue = true;
+
+  CompressionHistory* pHistory = pReady->pReceiverPeers[pPeer->index].pHistory;
+
+  switch (Reliability_receive(pReliability, pMessage)) {
+    case RELIABILITY_DELIVER:
+      // Deliver the message, then every held message it was the last missing one before,
+      // adding each to the history before another thread may take it
+      do {
+        if (pHistory != NULL) {
+          CompressionHistory_add(pHistory, pMessage->data, pMessage->length);
+        }
+
+        deliverMessage(pReady, pPeer, pMessage);
+      } while ((pMessage = Reliability_takeInOrder(pReliability)) != NULL);
+
+      return true;
+
+    case RELIABILITY_HELD:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Sends an acknowledgement of the numbered messages received so far to every peer one is due to,
+// and the echo of the latest heartbeat of every peer that sent one, all in one system call
+static void sendReplies(ReadyMessages* pReady, int socketDescriptor) {
+  MessageHeader headers[PEER_MAX_PEERS];
+  char sackBlocks[PEER_MAX_PEERS][RELIABILITY_MAX_SACK_BLOCKS * 8];
+  struct iovec parts[2 * PEER_MAX_PEERS][2];
+  struct mmsghdr datagrams[2 * PEER_MAX_PEERS];
+  int numReplies = 0;
+
+  memset(datagrams, 0, sizeof(datagrams));
+
+  for (int i = 0; i < PeerTable_count(pReady->pPeers); i++) {
+    Peer* pPeer = PeerTable_get(pReady->pPeers, i);
+    ReceiverPeer* pReceiverPeer = &pReady->pReceiverPeers[i];
+
+    if (pReceiverPeer->isEchoDue) {
+      parts[numReplies][0].iov_base = &pReceiverPeer->echoHeader;
+      parts[numReplies][0].iov_len = MESSAGE_HEADER_SIZE;
+      parts[numReplies][1].iov_base = pReceiverPeer->echoData;
+      parts[numReplies][1].iov_len = HEARTBEAT_DATA_SIZE;
+
+      datagrams[numReplies].msg_hdr.msg_name = &pPeer->address;
+      datagrams[numReplies].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      datagrams[numReplies].msg_hdr.msg_iov = parts[numReplies];
+      datagrams[numReplies].msg_hdr.msg_iovlen = 2;
+
+      pReceiverPeer->isEchoDue = false;
+      numReplies++;
+    }
+
+    if (!pReceiverPeer->isAckDue) {
+      continue;
+    }
+
+    parts[numReplies][0].iov_base = &headers[i];
+    parts[numReplies][0].iov_len = MESSAGE_HEADER_SIZE;
+    parts[numReplies][1].iov_base = sackBlocks[i];
+    parts[numReplies][1].iov_len = Reliability_encodeAck(pPeer->pReliability, &headers[i], sackBlocks[i]);
+    Message_encodeDatagramSize(&headers[i], Message_getPathDatagramSize());
+
+    if (s_pArguments->compression != COMPRESSION_OFF) {
+      headers[i].flags |= MESSAGE_FLAG_ACCEPTS_COMPRESSION;
+    }
+
+    datagrams[numReplies].msg_hdr.msg_name = &pPeer->address;
+    datagrams[numReplies].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    datagrams[numReplies].msg_hdr.msg_iov = parts[numReplies];
+    datagrams[numReplies].msg_hdr.msg_iovlen = 2;
 
-    if (receivedMessage == NULL) {
+    pReceiverPeer->isAckDue = false;
+    numReplies++;
+  }
+
+  // A lost acknowledgement is made up for by the next one, and a lost echo only counts as a lost heartbeat,
+  // so a failure is not fatal
+  if (numReplies > 0) {
+    sendmmsg(socketDescriptor, datagrams, numReplies, 0);
+  }
+
+  return;
+}
+
+// Splits the messages out of a coalesced datagram received from pPeer, whose data was received into pContainer,
+// accepting each in turn
+// Any malformed message ends the datagram, keeping the messages before it
+static void splitCoalescedMessages(Message* pContainer, Peer* pPeer, ReadyMessages* pReady) {
+  int offset = 0;
+
+  while (offset < pContainer->length) {
+    Message* pMessage = MessagePool_alloc();
+
+    if (pMessage == NULL) {
       fputs("[Error]: could not allocate memory for received message\n", stdout);
       exit(1);
     }
 
-    // Necessary for output thread to detect if received message is a new
-    // message or part of an existing message
-    memset(receivedMessage, 0, MESSAGE_MAX_SIZE);
+    int recordSize = Message_decodeRecord(pContainer->data + offset, pContainer->length - offset, pMessage);
 
-    // Get UDP message from the remote user
-		int receivedLength = recvfrom(
-      socketDescriptor, receivedMessage, MESSAGE_MAX_SIZE,
-      0, (struct sockaddr *) &remoteSocket, &remoteLength
-    );
+    if (recordSize == -1) {
+      MessagePool_recycle(pMessage);
+      break;
+    }
 
-    if (receivedLength == -1) {
-      fputs("[Error]: could not receive message\n", stdout);
-      exit(1);
+    pMessage->createdTime = pContainer->createdTime;
+    pMessage->queuedTime = pContainer->queuedTime;
+
+    if (!acceptMessage(pReady, pPeer, pMessage)) {
+      MessagePool_recycle(pMessage);
+    }
+
+    offset += recordSize;
+  }
+
+  return;
+}
+
+// Prepares to receive messages with the given arguments, for the receiver thread or an event loop
+void Receiver_prepare(ReceiverThreadArguments* pReceiverArguments) {
+  s_pArguments = pReceiverArguments;
+
+  memset(&s_batch, 0, sizeof(s_batch));
+  s_batch.count = pReceiverArguments->batchSize;
+
+  memset(&s_ready, 0, sizeof(s_ready));
+  s_ready.pReceivedMessagesQueue = pReceiverArguments->pReceivedMessagesQueue;
+  s_ready.deliver = pReceiverArguments->deliver;
+  s_ready.pPeers = pReceiverArguments->pPeers;
+  s_ready.pReceiverPeers = calloc(PeerTable_count(s_ready.pPeers), sizeof(ReceiverPeer));
+
+  if (s_ready.pReceiverPeers == NULL) {
+    fputs("[Error]: could not allocate memory for peers\n", stdout);
+    exit(1);
+  }
+
+  for (int i = 0; i < PeerTable_count(s_ready.pPeers); i++) {
+    Reassembly_init(&s_ready.pReceiverPeers[i].reassembly);
+
+    // The peer may compress with a dictionary of the traffic it sent in order
+    if (pReceiverArguments->compression != COMPRESSION_OFF && PeerTable_get(s_ready.pPeers, i)->pReliability != NULL) {
+      s_ready.pReceiverPeers[i].pHistory = CompressionHistory_create();
+
+      if (s_ready.pReceiverPeers[i].pHistory == NULL) {
+        fputs("[Error]: could not allocate memory for compression history\n", stdout);
+        exit(1);
+      }
+    }
+  }
+
+  for (int i = 0; i < s_batch.count; i++) {
+    s_batch.parts[i][0].iov_base = &s_batch.headers[i];
+    s_batch.parts[i][0].iov_len = sizeof(MessageHeader);
+    s_batch.parts[i][1].iov_len = MESSAGE_DATA_MAX_SIZE;
+    s_batch.datagrams[i].msg_hdr.msg_iov = s_batch.parts[i];
+    s_batch.datagrams[i].msg_hdr.msg_iovlen = 2;
+    s_batch.datagrams[i].msg_hdr.msg_name = &s_batch.remoteSockets[i];
+  }
+
+  return;
+}
+
+// Decompresses the data of a datagram received from pPeer into pMessage, in place
+// Returns false if the data is malformed, or refers to a dictionary no longer held
+static bool decompressDatagram(MessageHeader* pHeader, Message* pMessage, Peer* pPeer) {
+  CompressionHistory* pHistory = s_ready.pReceiverPeers[pPeer->index].pHistory;
+  int length = ntohs(pHeader->length);
+  int dictionaryLength = 0;
+  int prefixSize = 0;
+
+  if (s_pArguments->compression == COMPRESSION_OFF || length > MESSAGE_DATA_MAX_SIZE) {
+    return false;
+  }
+
+  if (pHeader->flags & MESSAGE_FLAG_DICTIONARY) {
+    uint32_t end;
+
+    if (pHistory == NULL || pMessage->length < COMPRESSION_DICTIONARY_PREFIX_SIZE) {
+      return false;
     }
 
-		// Make the message null terminated
-    // Technically the sender does this, but just in case a corrupted packet is received
-		int terminateIndex = (receivedLength < MESSAGE_MAX_SIZE) ? receivedLength : MESSAGE_MAX_SIZE - 1;
-		receivedMessage[terminateIndex] = 0;
+    // The end is sent in 32 bits, and is never far behind the traffic delivered so far
+    memcpy(&end, pMessage->data, sizeof(end));
+    uint64_t fullEnd = pHistory->numBytes - (uint32_t) ((uint32_t) pHistory->numBytes - ntohl(end));
 
-    // Add the message to the end of the received messages queue
-    status = ThreadSafeList_prepend(pReceivedMessagesList, receivedMessage);
+    dictionaryLength = CompressionHistory_copyDictionary(pHistory, fullEnd, s_decompressionBuffer);
+    prefixSize = COMPRESSION_DICTIONARY_PREFIX_SIZE;
 
-    if (status == -1) {
-      fputs("[Error]: could not add message to received messages list\n", stdout);
-      free(receivedMessage);
+    if (dictionaryLength == -1) {
+      return false;
     }
-    receivedMessage = NULL;
+  }
 
-    // Signal the output thread that there is a received message
-    Output_signalMessageReceived();
+  if (Compression_decompress(pMessage->data + prefixSize, pMessage->length - prefixSize, s_decompressionBuffer, dictionaryLength, length) == -1) {
+    return false;
+  }
+
+  s_statistics.numDatagramsWithDictionary += (prefixSize > 0);
+  s_statistics.numBytesBeforeDecompression += pMessage->length;
+  s_statistics.numBytesAfterDecompression += length;
+
+  memcpy(pMessage->data, s_decompressionBuffer + dictionaryLength, length);
+  pMessage->length = length;
+  pHeader->flags &= ~(MESSAGE_FLAG_COMPRESSED | MESSAGE_FLAG_DICTIONARY);
+  return true;
+}
+
+// Sends datagrams no larger than every peer said it takes, such as a relay whose narrowest member is on a
+// narrower path than this side
+static void limitDatagramSize() {
+  int size = MESSAGE_DATAGRAM_MAX_SIZE;
+
+  for (int i = 0; i < PeerTable_count(s_ready.pPeers); i++) {
+    int peerSize = PeerTable_get(s_ready.pPeers, i)->maxDatagramSize;
+
+    if (peerSize != 0 && peerSize < size) {
+      size = peerSize;
+    }
+  }
+
+  Message_limitDatagramSize(size);
+  return;
+}
+
+// Handles a datagram received into pMessage, whose header was received into pHeader
+// Returns true if the message was taken, false if its buffer is left to the caller
+static bool handleDatagram(MessageHeader* pHeader, Message* pMessage, int receivedLength, bool isTruncated, uint64_t receivedTime, struct sockaddr_in* pRemoteSocket) {
+  bool isTaken = false;
+
+  // Ignore datagrams too short to hold a header, and probes, which are only sent to find the path MTU
+  if (receivedLength < MESSAGE_HEADER_SIZE || pHeader->type == MESSAGE_TYPE_PROBE) {
+    return false;
+  }
+
+  // Drop datagrams cut short, as by a peer sending larger ones than this side receives, rather than deliver part of them
+  if (isTruncated || Message_checkLength(pHeader, receivedLength - MESSAGE_HEADER_SIZE) == -1) {
+    s_statistics.numMalformedDatagrams++;
+    return false;
+  }
+
+  // Ignore datagrams from anyone but the peers
+  Peer* pPeer = PeerTable_find(s_ready.pPeers, pRemoteSocket);
+
+  if (pPeer == NULL) {
+    s_statistics.numStrayDatagrams++;
+    return false;
+  }
+
+  Reliability* pReliability = pPeer->pReliability;
+  Heartbeat_markHeard(pPeer->pHeartbeat, receivedTime);
+
+  int datagramSize = Message_decodeDatagramSize(pHeader);
+
+  if (datagramSize != 0 && datagramSize != pPeer->maxDatagramSize) {
+    pPeer->maxDatagramSize = datagramSize;
+    limitDatagramSize();
+  }
+
+  pMessage->length = receivedLength - MESSAGE_HEADER_SIZE;
+  pMessage->createdTime = receivedTime;
+  pMessage->queuedTime = receivedTime;
+
+  // Heartbeats are echoed with the acknowledgements, and echoes applied in place, so the buffer is left to the caller
+  if (pHeader->type == MESSAGE_TYPE_HEARTBEAT) {
+    ReceiverPeer* pReceiverPeer = &s_ready.pReceiverPeers[pPeer->index];
+    if (Heartbeat_encodeEcho(pPeer->pHeartbeat, pHeader, pMessage->data, pMessage->length, &pReceiverPeer->echoHeader, pReceiverPeer->echoData) == 0) {
+      Message_encodeDatagramSize(&pReceiverPeer->echoHeader, Message_getPathDatagramSize());
+      pReceiverPeer->isEchoDue = true;
+    }
+
+    return false;
+  }
+
+  if (pHeader->type == MESSAGE_TYPE_HEARTBEAT_ECHO) {
+    Heartbeat_processEcho(pPeer->pHeartbeat, pHeader, pMessage->data, pMessage->length, receivedTime);
+    return false;
+  }
+
+  if (pHeader->flags & MESSAGE_FLAG_ACCEPTS_COMPRESSION) {
+    Peer_acceptCompression(pPeer);
+  }
+
+  // A datagram that cannot be decompressed is dropped like a lost one, and sent again with the reliability layer
+  if (pHeader->type != MESSAGE_TYPE_ACK && (pHeader->flags & MESSAGE_FLAG_COMPRESSED)) {
+    uint64_t start = Message_getTimestamp();
+    bool isDecompressed = decompressDatagram(pHeader, pMessage, pPeer);
+    s_statistics.decompressionTime += Message_getTimestamp() - start;
+
+    if (!isDecompressed) {
+      s_statistics.numDecompressionFailures++;
+      return false;
+    }
+
+    s_statistics.numDatagramsDecompressed++;
+  }
+
+  if (pHeader->type == MESSAGE_TYPE_ACK) {
+    // The acknowledgement is applied in place, so the buffer is left to the caller
+    // An event loop runs the sender after receiving anyway, so only the sender thread needs waking
+    if (pReliability != NULL &&
+        Reliability_processAck(pReliability, pHeader, pMessage->data, pMessage->length, receivedTime) &&
+        s_pArguments->pSendingMessagesQueue != NULL) {
+      MessageQueue_wake(s_pArguments->pSendingMessagesQueue);
+    }
+
+    return false;
+  }
+
+  if (pHeader->type == MESSAGE_TYPE_COALESCED) {
+    // The messages are copied out, so the buffer is left to the caller
+    splitCoalescedMessages(pMessage, pPeer, &s_ready);
+  } else if (Message_decodeHeader(pMessage, pHeader) == 0) {
+    isTaken = acceptMessage(&s_ready, pPeer, pMessage);
+  }
+
+  return isTaken;
+}
+
+// Acknowledges and delivers what the datagrams handled since the last call completed
+void Receiver_flush() {
+  // Acknowledge the whole batch at once, rather than every message in it, along with echoes of heartbeats
+  sendReplies(&s_ready, s_pArguments->socketDescriptor);
+
+  // Deliver the messages, waking the output thread once
+  if (s_ready.numReady > 0) {
+    pushReadyMessages(&s_ready);
+  }
+
+  return;
+}
+
+// Receives the datagrams that arrived, waiting for the first if isWaiting is set, and delivers
+// the messages they complete
+// Returns the number of datagrams received, 0 if none had arrived
+int Receiver_receive(bool isWaiting) {
+  fillBatch(&s_batch);
+
+  for (int i = 0; i < s_batch.count; i++) {
+    s_batch.datagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+
+  // Get UDP messages from the remote users, waiting for the first if asked to, and taking any others already arrived
+  int numReceived = recvmmsg(s_pArguments->socketDescriptor, s_batch.datagrams, s_batch.count, isWaiting ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+
+  if (numReceived == -1) {
+    if (!isWaiting && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+
+    fputs("[Error]: could not receive message\n", stdout);
+    exit(1);
+  }
+
+  s_statistics.numReceiveCalls++;
+  s_statistics.numDatagramsReceived += numReceived;
+
+  uint64_t receivedTime = Message_getTimestamp();
+
+  for (int i = 0; i < numReceived; i++) {
+    // A message taken leaves its slot to be refilled from the pool, any other buffer is received into next time
+    struct mmsghdr* pDatagram = &s_batch.datagrams[i];
+    bool isTruncated = (pDatagram->msg_hdr.msg_flags & MSG_TRUNC) != 0;
+
+    if (handleDatagram(&s_batch.headers[i], s_batch.receivedMessages[i], pDatagram->msg_len, isTruncated, receivedTime, &s_batch.remoteSockets[i])) {
+      s_batch.receivedMessages[i] = NULL;
+    }
+  }
+
+  Receiver_flush();
+  return numReceived;
+}
+
+// Handles a datagram received by other means than Receiver_receive, copying it into a message from the pool
+// Receiver_flush must be called once the datagrams that arrived together were handled
+void Receiver_handleDatagram(char* pDatagram, int length, bool isTruncated, struct sockaddr_in* pRemoteSocket) {
+  MessageHeader header;
+
+  s_statistics.numDatagramsReceived++;
+
+  if (length < MESSAGE_HEADER_SIZE) {
+    return;
+  }
+
+  // Only the part that fits in a message is copied, for the datagram to be dropped as truncated
+  if (length > MESSAGE_DATAGRAM_MAX_SIZE) {
+    length = MESSAGE_DATAGRAM_MAX_SIZE;
+    isTruncated = true;
+  }
+
+  Message* pMessage = MessagePool_alloc();
+
+  if (pMessage == NULL) {
+    fputs("[Error]: could not allocate memory for received message\n", stdout);
+    exit(1);
+  }
+
+  // The header is copied out rather than cast, as the datagram may not be aligned
+  memcpy(&header, pDatagram, MESSAGE_HEADER_SIZE);
+  memcpy(pMessage->data, pDatagram + MESSAGE_HEADER_SIZE, length - MESSAGE_HEADER_SIZE);
+
+  if (!handleDatagram(&header, pMessage, length, isTruncated, Message_getTimestamp(), pRemoteSocket)) {
+    MessagePool_recycle(pMessage);
+  }
+
+  return;
+}
+
+// Recycles every message held by the receiver, to receive into or waiting for missing fragments
+void Receiver_release() {
+  for (int i = 0; i < s_batch.count; i++) {
+    if (s_batch.receivedMessages[i] != NULL) {
+      MessagePool_recycle(s_batch.receivedMessages[i]);
+      s_batch.receivedMessages[i] = NULL;
+    }
+  }
+
+  if (s_ready.pReceiverPeers != NULL) {
+    for (int i = 0; i < PeerTable_count(s_ready.pPeers); i++) {
+      Reassembly_clear(&s_ready.pReceiverPeers[i].reassembly);
+
+      if (s_ready.pReceiverPeers[i].pHistory != NULL) {
+        CompressionHistory_free(s_ready.pReceiverPeers[i].pHistory);
+      }
+    }
+
+    free(s_ready.pReceiverPeers);
+    s_ready.pReceiverPeers = NULL;
+  }
+
+  return;
+}
+
+// Polls the socket for up to LOW_LATENCY_SPIN_TIME, so datagrams arriving soon after the last are received
+// without the thread being woken
+// Returns true if any were received
+static bool spinForDatagrams() {
+  uint64_t deadline = Message_getTimestamp() + LOW_LATENCY_SPIN_TIME;
+
+  s_statistics.numSpins++;
+
+  do {
+    if (Receiver_receive(false) > 0) {
+      s_statistics.numSpinsSucceeded++;
+      return true;
+    }
+  } while (Message_getTimestamp() < deadline);
+
+  return false;
+}
+
+// The thread to receive UDP messages
+void* receiverThread(void* args) {
+  Receiver_prepare(args);
+  LowLatency_tuneThread(LOW_LATENCY_RECEIVER);
+
+  pthread_cleanup_push(cleanup, NULL);
+
+  while (1) {
+    // In low-latency mode, only block on the socket once it stayed empty for a while
+    if (LowLatency_isSpinning() && spinForDatagrams()) {
+      continue;
+    }
+
+    Receiver_receive(true);
   }
 
   pthread_cleanup_pop(1);
@@ -114,3 +688,9 @@ void Receiver_shutdown() {
 
   return;
 }
+
+// Fills pStatistics with the counters of the receiver thread
+void Receiver_getStatistics(ReceiverStatistics* pStatistics) {
+  *pStatistics = s_statistics;
+  return;
+}
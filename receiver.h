@@ -1,19 +1,106 @@
 // Manages the thread that receives UDP messages
 #ifndef _RECEIVER_H_
 #define _RECEIVER_H_
-#include "threadsafelist.h"
+#include "messagequeue.h"
 #include "control.h"
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "peer.h"
+#include "compression.h"
 
-// Arguments for the receiver thread
+// Largest number of messages the receiver takes from the kernel in one system call
+#define RECEIVER_MAX_BATCH_SIZE 64
+
+// Default number of messages the receiver takes from the kernel in one system call
+#define RECEIVER_DEFAULT_BATCH_SIZE 32
+
+// Most received messages added to the received messages queue at once
+#define RECEIVER_MAX_READY_MESSAGES 256
+
+// Takes count received messages in order from ppMessages, in place of the received messages queue
+typedef void (*ReceiverDeliverFunction)(Message** ppMessages, int count);
+
+// Arguments for the receiver thread, or for an event loop receiving in its place
 typedef struct {
-  List* pReceivedMessagesList;
+  MessageQueue* pReceivedMessagesQueue;
+
+  // Set to deliver received messages to it rather than to pReceivedMessagesQueue
+  ReceiverDeliverFunction deliver;
+
   int socketDescriptor;
+
+  // Most messages received per system call, from 1 to RECEIVER_MAX_BATCH_SIZE
+  int batchSize;
+
+  // Remote users messages are taken from, each with the reliability layer it shares with the sender,
+  // or with none to deliver messages as they arrive
+  PeerTable* pPeers;
+
+  // Queue the sender thread waits on, to wake it when acknowledgements arrive, or NULL without a sender thread
+  MessageQueue* pSendingMessagesQueue;
+
+  // Accept compressed datagrams, saying so in every acknowledgement, unless COMPRESSION_OFF
+  CompressionMode compression;
 } ReceiverThreadArguments;
 
+// Counters of the receiver thread
+typedef struct {
+  unsigned long numMessagesReceived;
+  unsigned long numDatagramsReceived;
+  unsigned long numReceiveCalls;
+
+  // Number of messages received in several fragments and delivered whole,
+  // and dropped before all their fragments arrived
+  unsigned long numMessagesReassembled;
+  unsigned long numMessagesDropped;
+
+  // Number of datagrams ignored as they came from none of the peers
+  unsigned long numStrayDatagrams;
+
+  // Number of datagrams dropped as they were truncated, or held another length of data than their header says
+  unsigned long numMalformedDatagrams;
+
+  // Number of compressed datagrams received, those with a dictionary included, and dropped as they could not
+  // be decompressed, with the bytes of their data before and after decompression and the nanoseconds it took
+  unsigned long numDatagramsDecompressed;
+  unsigned long numDatagramsWithDictionary;
+  unsigned long numDecompressionFailures;
+  unsigned long long numBytesBeforeDecompression;
+  unsigned long long numBytesAfterDecompression;
+  uint64_t decompressionTime;
+
+  // Number of times the receiver thread polled the socket in low-latency mode before blocking on it,
+  // and received a datagram while polling
+  unsigned long numSpins;
+  unsigned long numSpinsSucceeded;
+} ReceiverStatistics;
+
 // Initializes the receiver thread
 void Receiver_init(ReceiverThreadArguments* pReceiverArguments);
 
 // Shutdowns the receiver thread and performs necessary cleanup
 void Receiver_shutdown(void);
 
+// Prepares to receive messages with the given arguments, for the receiver thread or an event loop
+void Receiver_prepare(ReceiverThreadArguments* pReceiverArguments);
+
+// Receives the datagrams that arrived, waiting for the first if isWaiting is set, and delivers
+// the messages they complete
+// Returns the number of datagrams received, 0 if none had arrived
+int Receiver_receive(bool isWaiting);
+
+// Handles a datagram received by other means than Receiver_receive, copying it into a message from the pool
+// A datagram isTruncated, or longer than the largest datagram, is dropped
+// Receiver_flush must be called once the datagrams that arrived together were handled
+void Receiver_handleDatagram(char* pDatagram, int length, bool isTruncated, struct sockaddr_in* pRemoteSocket);
+
+// Acknowledges and delivers what the datagrams handled since the last call completed
+void Receiver_flush(void);
+
+// Recycles every message held by the receiver, to receive into or waiting for missing fragments
+void Receiver_release(void);
+
+// Fills pStatistics with the counters of the receiver thread
+void Receiver_getStatistics(ReceiverStatistics* pStatistics);
+
 #endif
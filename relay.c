@@ -0,0 +1,1046 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include "relay.h"
+#include "message.h"
+#include "messagepool.h"
+#include "messagequeue.h"
+#include "reliability.h"
+#include "reassembly.h"
+#include "peer.h"
+#include "heartbeat.h"
+
+// Most datagrams a worker takes from the kernel, and passes to it, in one system call
+#define RELAY_BATCH_SIZE 64
+
+// Most batches of datagrams a worker receives before attending to the messages handed to it
+#define RELAY_MAX_RECEIVE_ROUNDS 16
+
+// Most messages a worker collects before handing them to the other workers, enough for a whole fragmented message
+#define RELAY_MAX_HANDOFF_MESSAGES 1024
+
+// Most copies waiting for room in the window of a member, beyond which whole messages are skipped for it
+#define RELAY_MAX_BACKLOG_MESSAGES 4096
+
+// Time without a datagram from a member after which it is made to leave, as it crashed or lost its link
+// Members send a heartbeat every second by default, so only one that stopped, or that sends none and stays idle
+// this long, times out
+#define RELAY_MEMBER_TIMEOUT_NANOSECONDS 30000000000ULL
+
+// Time between two checks of a worker for members that timed out
+#define RELAY_EXPIRY_INTERVAL_NANOSECONDS 1000000000ULL
+
+// What a worker keeps for each of its members
+typedef struct {
+  // Set once a numbered message is received from the member, until an acknowledgement is sent
+  bool isAckDue;
+
+  // Set once a heartbeat is received from the member, until its echo is sent
+  bool isEchoDue;
+  MessageHeader echoHeader;
+  char echoData[HEARTBEAT_DATA_SIZE];
+
+  // Messages partly received from the member, forwarded once whole
+  Reassembly reassembly;
+
+  // Identifies the messages forwarded to the member, numbered apart from those of the members they came from,
+  // whose identifiers would collide in the member's reassembly
+  uint32_t nextMessageId;
+
+  // Copies for the member waiting for room in its window, oldest at backlogHead, so a burst from one member
+  // reaches a slower one late rather than not at all
+  Message* pBacklog[RELAY_MAX_BACKLOG_MESSAGES];
+  int backlogHead;
+  int backlogCount;
+
+  // Set while the rest of a message is skipped, as the member's backlog had no room for all of its fragments
+  bool isSkippingMessage;
+} RelayMember;
+
+// A worker, with its socket and the members whose datagrams reach that socket
+typedef struct {
+  int socketDescriptor;
+
+  // Written by other workers once they handed messages to this one, and when the relay stops
+  int wakeDescriptor;
+
+  // Messages from the members of other workers, to forward to the members of this one
+  MessageQueue* pInbox;
+
+  // Members in the order they joined, with what the worker keeps for each at the same index
+  PeerTable* pMembers;
+  RelayMember members[PEER_MAX_PEERS];
+
+  // Datagrams of the next recvmmsg call, each slot holding a message from the pool to receive into
+  Message* receivedMessages[RELAY_BATCH_SIZE];
+  MessageHeader receivedHeaders[RELAY_BATCH_SIZE];
+  struct iovec receivedParts[RELAY_BATCH_SIZE][2];
+  struct sockaddr_in receivedAddresses[RELAY_BATCH_SIZE];
+  struct mmsghdr receivedDatagrams[RELAY_BATCH_SIZE];
+
+  // Messages for the next sendmmsg call, each a copy for one member, with the datagrams describing them
+  Message* sendingMessages[RELAY_BATCH_SIZE];
+  Peer* pSendingMembers[RELAY_BATCH_SIZE];
+  MessageHeader sendingHeaders[RELAY_BATCH_SIZE];
+  struct iovec sendingParts[RELAY_BATCH_SIZE][2];
+  struct mmsghdr sendingDatagrams[RELAY_BATCH_SIZE];
+  int numSending;
+
+  // Messages received from members, to hand to every other worker at once
+  Message* handoffMessages[RELAY_MAX_HANDOFF_MESSAGES];
+  int numHandoff;
+
+  // Smallest of the largest datagrams the members of the worker take, read by every worker to tell members
+  // how large a datagram the relay can forward to all of them
+  int smallestDatagramSize;
+
+  // Time the members are next checked for timing out
+  uint64_t nextExpiryTime;
+
+  RelayStatistics statistics;
+  pthread_t thread;
+} RelayWorker;
+
+static RelayWorker* s_pWorkers[RELAY_MAX_WORKERS];
+static int s_numWorkers = 0;
+static bool s_isReliable = false;
+static bool s_isQuiet = false;
+static bool s_isStopping = false;
+static RelayStatistics s_statistics;
+
+// Free a message left in an inbox
+static void freeMessage(void* pItem) {
+  MessagePool_recycle((Message*) pItem);
+  return;
+}
+
+// Takes a message from the pool, exiting if the pool cannot grow
+static Message* allocMessage() {
+  Message* pMessage = MessagePool_alloc();
+
+  if (pMessage == NULL) {
+    fputs("[Error]: could not allocate memory for relayed message\n", stdout);
+    exit(1);
+  }
+
+  return pMessage;
+}
+
+// Returns the largest datagram a member takes, assuming a 1500-byte Ethernet frame until it said
+static int getMemberDatagramSize(Peer* pPeer) {
+  return (pPeer->maxDatagramSize != 0) ? pPeer->maxDatagramSize : MESSAGE_DATAGRAM_DEFAULT_SIZE;
+}
+
+// Finds the smallest of the largest datagrams the members of the worker still there take, for the other workers
+// to read
+static void updateSmallestDatagramSize(RelayWorker* pWorker) {
+  int size = MESSAGE_DATAGRAM_MAX_SIZE;
+
+  for (int i = 0; i < PeerTable_count(pWorker->pMembers); i++) {
+    Peer* pPeer = PeerTable_get(pWorker->pMembers, i);
+
+    if (!Peer_hasLeft(pPeer) && getMemberDatagramSize(pPeer) < size) {
+      size = getMemberDatagramSize(pPeer);
+    }
+  }
+
+  __atomic_store_n(&pWorker->smallestDatagramSize, size, __ATOMIC_RELAXED);
+  return;
+}
+
+// Returns the largest datagram every member of every worker takes, which members are told to send no larger than,
+// as each of their messages is forwarded to all the others unchanged
+static int getRelayDatagramSize() {
+  int size = MESSAGE_DATAGRAM_MAX_SIZE;
+
+  for (int i = 0; i < s_numWorkers; i++) {
+    int workerSize = __atomic_load_n(&s_pWorkers[i]->smallestDatagramSize, __ATOMIC_RELAXED);
+    size = (workerSize < size) ? workerSize : size;
+  }
+
+  return size;
+}
+
+// Makes a worker return from waiting, to take the messages handed to it or to stop
+static void wakeWorker(RelayWorker* pWorker) {
+  uint64_t increment = 1;
+
+  // The counter only fails to grow once it is too large to, in which case the worker is woken anyway
+  if (write(pWorker->wakeDescriptor, &increment, sizeof(increment)) == -1 && errno != EAGAIN) {
+    fputs("[Error]: could not wake relay worker\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Sends the messages collected for members, recording them as sent by the reliability layer of their member
+// beforehand, or recycling them afterwards
+static void flushSending(RelayWorker* pWorker) {
+  int numSent = 0;
+  uint64_t now = Message_getTimestamp();
+
+  // A member may acknowledge a message before sendmmsg returns
+  for (int i = 0; i < pWorker->numSending; i++) {
+    Reliability* pReliability = pWorker->pSendingMembers[i]->pReliability;
+
+    if (pReliability != NULL) {
+      Reliability_markSent(pReliability, &pWorker->sendingMessages[i], 1, now);
+    }
+  }
+
+  while (numSent < pWorker->numSending) {
+    int status = sendmmsg(pWorker->socketDescriptor, &pWorker->sendingDatagrams[numSent], pWorker->numSending - numSent, 0);
+    pWorker->statistics.numSendCalls++;
+
+    // A datagram the kernel refuses, such as one to an unreachable member, is skipped rather than stopping the relay,
+    // and is sent again like a lost one with the reliability layer
+    if (status == -1) {
+      if (errno != EINTR) {
+        pWorker->statistics.numMessagesDropped++;
+        numSent++;
+      }
+
+      continue;
+    }
+
+    pWorker->statistics.numDatagramsSent += status;
+    numSent += status;
+  }
+
+  for (int i = 0; i < pWorker->numSending; i++) {
+    if (pWorker->pSendingMembers[i]->pReliability == NULL) {
+      MessagePool_recycle(pWorker->sendingMessages[i]);
+    }
+  }
+
+  pWorker->numSending = 0;
+  return;
+}
+
+// Adds a message to the next sendmmsg call, as a datagram to pPeer
+static void queueSending(RelayWorker* pWorker, Peer* pPeer, Message* pMessage) {
+  if (pWorker->numSending == RELAY_BATCH_SIZE) {
+    flushSending(pWorker);
+  }
+
+  int index = pWorker->numSending;
+
+  Message_encodeHeader(pMessage, &pWorker->sendingHeaders[index]);
+  pWorker->sendingParts[index][1].iov_base = pMessage->data;
+  pWorker->sendingParts[index][1].iov_len = pMessage->length;
+  pWorker->sendingDatagrams[index].msg_hdr.msg_name = &pPeer->address;
+  pWorker->sendingMessages[index] = pMessage;
+  pWorker->pSendingMembers[index] = pPeer;
+  pWorker->numSending++;
+  return;
+}
+
+// Admits the copies waiting for pPeer to its reliability layer, as many as its window has room for, and
+// queues them for sending
+static void admitBacklog(RelayWorker* pWorker, Peer* pPeer) {
+  RelayMember* pMember = &pWorker->members[pPeer->index];
+  int room = Reliability_getSendRoom(pPeer->pReliability);
+
+  while (pMember->backlogCount > 0 && room > 0) {
+    Message* pCopy = pMember->pBacklog[pMember->backlogHead];
+    pMember->backlogHead = (pMember->backlogHead + 1) % RELAY_MAX_BACKLOG_MESSAGES;
+    pMember->backlogCount--;
+    room--;
+
+    Reliability_admit(pPeer->pReliability, &pCopy, 1);
+    queueSending(pWorker, pPeer, pCopy);
+    pWorker->statistics.numMessagesForwarded++;
+  }
+
+  return;
+}
+
+// Recycles the copies still waiting for a member
+static void clearBacklog(RelayMember* pMember) {
+  while (pMember->backlogCount > 0) {
+    MessagePool_recycle(pMember->pBacklog[pMember->backlogHead]);
+    pMember->backlogHead = (pMember->backlogHead + 1) % RELAY_MAX_BACKLOG_MESSAGES;
+    pMember->backlogCount--;
+  }
+
+  pMember->backlogHead = 0;
+  return;
+}
+
+// Sends a copy of pMessage to pPeer, numbered by the member's reliability layer once its window has room
+// A message whose fragments do not all fit in the member's backlog is skipped whole, rather than making every
+// member wait for the slowest, and so is one sent before the member's sender learnt to send smaller datagrams,
+// which the member would drop as truncated
+static void forwardToMember(RelayWorker* pWorker, Peer* pPeer, Message* pMessage) {
+  RelayMember* pMember = &pWorker->members[pPeer->index];
+  int fragmentCount = (pMessage->fragmentCount > 1) ? pMessage->fragmentCount : 1;
+  bool isTooLarge = (MESSAGE_HEADER_SIZE + pMessage->length > getMemberDatagramSize(pPeer));
+
+  if (pMessage->fragmentIndex == 0) {
+    pMember->nextMessageId++;
+    pMember->isSkippingMessage = (pPeer->pReliability != NULL && pMember->backlogCount + fragmentCount > RELAY_MAX_BACKLOG_MESSAGES);
+  }
+
+  // The first fragment is the largest, but a later one too large leaves the message incomplete for the member anyway
+  pMember->isSkippingMessage |= isTooLarge;
+
+  if (pMember->isSkippingMessage) {
+    pWorker->statistics.numMessagesDropped++;
+    return;
+  }
+
+  Message* pCopy = allocMessage();
+  pCopy->length = pMessage->length;
+  pCopy->flags = pMessage->flags & ~MESSAGE_FLAG_RELIABLE;
+  pCopy->sequence = 0;
+  pCopy->messageId = pMember->nextMessageId;
+  pCopy->fragmentIndex = pMessage->fragmentIndex;
+  pCopy->fragmentCount = pMessage->fragmentCount;
+  pCopy->createdTime = pMessage->createdTime;
+  pCopy->queuedTime = pMessage->queuedTime;
+  memcpy(pCopy->data, pMessage->data, pMessage->length);
+
+  if (pPeer->pReliability == NULL) {
+    queueSending(pWorker, pPeer, pCopy);
+    pWorker->statistics.numMessagesForwarded++;
+    return;
+  }
+
+  int tail = (pMember->backlogHead + pMember->backlogCount) % RELAY_MAX_BACKLOG_MESSAGES;
+  pMember->pBacklog[tail] = pCopy;
+  pMember->backlogCount++;
+  admitBacklog(pWorker, pPeer);
+  return;
+}
+
+// Sends a copy of pMessage to every member of the worker still there but pOrigin, which may be NULL
+static void forwardMessage(RelayWorker* pWorker, Peer* pOrigin, Message* pMessage) {
+  for (int i = 0; i < PeerTable_count(pWorker->pMembers); i++) {
+    Peer* pPeer = PeerTable_get(pWorker->pMembers, i);
+
+    if (pPeer != pOrigin && !Peer_hasLeft(pPeer)) {
+      forwardToMember(pWorker, pPeer, pMessage);
+    }
+  }
+
+  return;
+}
+
+// Hands the collected messages to every other worker, each of which holds them until forwarded
+static void flushHandoff(RelayWorker* pWorker) {
+  int count = pWorker->numHandoff;
+
+  if (count == 0) {
+    return;
+  }
+
+  for (int i = 0; i < count && s_numWorkers > 2; i++) {
+    MessagePool_share(pWorker->handoffMessages[i], s_numWorkers - 2);
+  }
+
+  for (int i = 0; i < s_numWorkers; i++) {
+    RelayWorker* pOther = s_pWorkers[i];
+
+    if (pOther == pWorker) {
+      continue;
+    }
+
+    // The messages are pushed in one batch, so the fragments of a message reach the other worker together
+    int numPushed = MessageQueue_pushBatch(pOther->pInbox, (void**) pWorker->handoffMessages, count);
+
+    for (int j = numPushed; j < count; j++) {
+      MessagePool_recycle(pWorker->handoffMessages[j]);
+      pWorker->statistics.numMessagesDropped++;
+    }
+
+    wakeWorker(pOther);
+  }
+
+  pWorker->statistics.numMessagesHandedOff += count;
+  pWorker->numHandoff = 0;
+  return;
+}
+
+// Makes pPeer leave, so nothing more is forwarded to it and datagrams from its address no longer find it
+// What the worker keeps for it is released once its last acknowledgement was sent, or its slot is reused
+static void leaveMember(RelayWorker* pWorker, Peer* pPeer, char* reason) {
+  Peer_leave(pPeer);
+  PeerTable_remove(pWorker->pMembers, pPeer);
+  clearBacklog(&pWorker->members[pPeer->index]);
+  updateSmallestDatagramSize(pWorker);
+
+  if (!s_isQuiet) {
+    printf("[Relay]: %s:%d %s\n", inet_ntoa(pPeer->address.sin_addr), ntohs(pPeer->address.sin_port), reason);
+    fflush(stdout);
+  }
+
+  return;
+}
+
+// Forwards whole messages received from pPeer, count fragments of one message, to the other members of this
+// worker, and hands them to the other workers
+// The exit command is not forwarded, but makes the member leave
+static void relayMessages(RelayWorker* pWorker, Peer* pPeer, Message** ppMessages, int count) {
+  if (count > 0 && (ppMessages[0]->flags & MESSAGE_FLAG_CONTROL)) {
+    leaveMember(pWorker, pPeer, "left");
+    pWorker->statistics.numMembersLeft++;
+
+    for (int i = 0; i < count; i++) {
+      MessagePool_recycle(ppMessages[i]);
+    }
+
+    return;
+  }
+
+  if (pWorker->numHandoff + count > RELAY_MAX_HANDOFF_MESSAGES) {
+    flushHandoff(pWorker);
+  }
+
+  for (int i = 0; i < count; i++) {
+    forwardMessage(pWorker, pPeer, ppMessages[i]);
+
+    if (s_numWorkers > 1) {
+      pWorker->handoffMessages[pWorker->numHandoff] = ppMessages[i];
+      pWorker->numHandoff++;
+    } else {
+      MessagePool_recycle(ppMessages[i]);
+    }
+  }
+
+  pWorker->statistics.numMessagesReceived += count;
+  return;
+}
+
+// Relays a message received in order from pPeer, once every fragment of its message arrived
+static void deliverMessage(RelayWorker* pWorker, Peer* pPeer, Message* pMessage) {
+  Message* pFragments[MESSAGE_MAX_FRAGMENTS];
+
+  if (pMessage->fragmentCount <= 1) {
+    relayMessages(pWorker, pPeer, &pMessage, 1);
+    return;
+  }
+
+  int count = Reassembly_add(&pWorker->members[pPeer->index].reassembly, pMessage, pFragments);
+  relayMessages(pWorker, pPeer, pFragments, count);
+  return;
+}
+
+// Accepts a data message received from pPeer, relaying it in order
+// Returns false if the message is a duplicate, which the caller keeps
+static bool acceptMessage(RelayWorker* pWorker, Peer* pPeer, Message* pMessage) {
+  Reliability* pReliability = pPeer->pReliability;
+
+  if (pReliability == NULL || !(pMessage->flags & MESSAGE_FLAG_RELIABLE)) {
+    deliverMessage(pWorker, pPeer, pMessage);
+    return true;
+  }
+
+  pWorker->members[pPeer->index].isAckDue = true;
+
+  switch (Reliability_receive(pReliability, pMessage)) {
+    case RELIABILITY_DELIVER:
+      deliverMessage(pWorker, pPeer, pMessage);
+
+      while ((pMessage = Reliability_takeInOrder(pReliability)) != NULL) {
+        deliverMessage(pWorker, pPeer, pMessage);
+      }
+
+      return true;
+
+    case RELIABILITY_HELD:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Returns true if a datagram from an address that is not a member starts a conversation, so its sender joins
+// A client numbers its messages from 0, so a datagram from a client that was running before, or that left
+// and is still sending its last acknowledgements, does not make it join
+static bool isFirstDatagram(MessageHeader* pHeader, Message* pMessage) {
+  MessageHeader header = *pHeader;
+
+  // A coalesced datagram starts a conversation if its first message does
+  if (header.type == MESSAGE_TYPE_COALESCED) {
+    if (pMessage->length < MESSAGE_HEADER_SIZE) {
+      return false;
+    }
+
+    memcpy(&header, pMessage->data, MESSAGE_HEADER_SIZE);
+  }
+
+  return header.type == MESSAGE_TYPE_DATA && (!s_isReliable || header.sequence == 0);
+}
+
+// Makes the sender of a datagram a member, in the slot of a member that left if there is one
+// Returns the member, or NULL if the worker has no room for another
+static Peer* joinMember(RelayWorker* pWorker, struct sockaddr_in* pAddress) {
+  Reliability* pReliability = NULL;
+
+  if (s_isReliable) {
+    pReliability = Reliability_create();
+
+    if (pReliability == NULL) {
+      fputs("[Error]: could not create reliability layer\n", stdout);
+      exit(1);
+    }
+  }
+
+  // Copies for a member that left may still wait to be sent, through the reliability layer its slot holds
+  flushSending(pWorker);
+
+  // Only this worker reads the membership, so a slot is given to the new member in place
+  Peer* pPeer = PeerTable_reuse(pWorker->pMembers, pAddress, "", pReliability);
+
+  if (pPeer == NULL) {
+    pPeer = PeerTable_add(pWorker->pMembers, pAddress, "", pReliability);
+  }
+
+  if (pPeer == NULL) {
+    if (pReliability != NULL) {
+      Reliability_free(pReliability);
+    }
+
+    pWorker->statistics.numMembersRefused++;
+    return NULL;
+  }
+
+  // The new member numbers its messages from 0, so nothing partly received in the slot carries over
+  RelayMember* pMember = &pWorker->members[pPeer->index];
+  Reassembly_clear(&pMember->reassembly);
+  clearBacklog(pMember);
+  pMember->isAckDue = false;
+  pMember->isEchoDue = false;
+  pMember->isSkippingMessage = false;
+  updateSmallestDatagramSize(pWorker);
+
+  pWorker->statistics.numMembersJoined++;
+
+  if (!s_isQuiet) {
+    printf("[Relay]: %s:%d joined\n", inet_ntoa(pAddress->sin_addr), ntohs(pAddress->sin_port));
+    fflush(stdout);
+  }
+  return pPeer;
+}
+
+// Handles a datagram received into pMessage, whose header was received into pHeader
+// Returns true if the message was taken, false if its buffer is left to the caller
+static bool handleDatagram(RelayWorker* pWorker, MessageHeader* pHeader, Message* pMessage, int receivedLength, bool isTruncated, struct sockaddr_in* pAddress) {
+  if (receivedLength < MESSAGE_HEADER_SIZE || pHeader->type == MESSAGE_TYPE_PROBE) {
+    return false;
+  }
+
+  // A member sending larger datagrams than the relay receives has them dropped rather than forwarded in part
+  if (isTruncated || Message_checkLength(pHeader, receivedLength - MESSAGE_HEADER_SIZE) == -1) {
+    pWorker->statistics.numMalformedDatagrams++;
+    return false;
+  }
+
+  uint64_t receivedTime = Message_getTimestamp();
+  pMessage->length = receivedLength - MESSAGE_HEADER_SIZE;
+  pMessage->createdTime = receivedTime;
+  pMessage->queuedTime = receivedTime;
+
+  // The relay never says it accepts compressed datagrams, so members only send them by mistake
+  if (pHeader->flags & MESSAGE_FLAG_COMPRESSED) {
+    return false;
+  }
+
+  Peer* pPeer = PeerTable_find(pWorker->pMembers, pAddress);
+
+  if (pPeer == NULL) {
+    if (!isFirstDatagram(pHeader, pMessage)) {
+      return false;
+    }
+
+    pPeer = joinMember(pWorker, pAddress);
+
+    if (pPeer == NULL) {
+      return false;
+    }
+  }
+
+  Heartbeat_markHeard(pPeer->pHeartbeat, receivedTime);
+
+  int datagramSize = Message_decodeDatagramSize(pHeader);
+
+  if (datagramSize != 0 && datagramSize != pPeer->maxDatagramSize) {
+    pPeer->maxDatagramSize = datagramSize;
+    updateSmallestDatagramSize(pWorker);
+  }
+
+  // Heartbeats of members are echoed so they can measure their link to the relay, which sends none of its own
+  if (pHeader->type == MESSAGE_TYPE_HEARTBEAT) {
+    RelayMember* pMember = &pWorker->members[pPeer->index];
+
+    if (Heartbeat_encodeEcho(pPeer->pHeartbeat, pHeader, pMessage->data, pMessage->length, &pMember->echoHeader, pMember->echoData) == 0) {
+      Message_encodeDatagramSize(&pMember->echoHeader, getRelayDatagramSize());
+      pMember->isEchoDue = true;
+    }
+
+    return false;
+  }
+
+  if (pHeader->type == MESSAGE_TYPE_HEARTBEAT_ECHO) {
+    return false;
+  }
+
+  if (pHeader->type == MESSAGE_TYPE_ACK) {
+    if (pPeer->pReliability != NULL) {
+      Reliability_processAck(pPeer->pReliability, pHeader, pMessage->data, pMessage->length, receivedTime);
+    }
+
+    return false;
+  }
+
+  if (pHeader->type != MESSAGE_TYPE_COALESCED) {
+    return Message_decodeHeader(pMessage, pHeader) == 0 && acceptMessage(pWorker, pPeer, pMessage);
+  }
+
+  // Split the messages out of a coalesced datagram, any malformed one ending it
+  int offset = 0;
+
+  while (offset < pMessage->length) {
+    Message* pRecord = allocMessage();
+    int recordSize = Message_decodeRecord(pMessage->data + offset, pMessage->length - offset, pRecord);
+
+    if (recordSize == -1) {
+      MessagePool_recycle(pRecord);
+      break;
+    }
+
+    pRecord->createdTime = receivedTime;
+    pRecord->queuedTime = receivedTime;
+
+    if (!acceptMessage(pWorker, pPeer, pRecord)) {
+      MessagePool_recycle(pRecord);
+    }
+
+    offset += recordSize;
+  }
+
+  return false;
+}
+
+// Sends an echo and an acknowledgement to every member one is due to, all in one system call
+static void sendReplies(RelayWorker* pWorker) {
+  MessageHeader headers[PEER_MAX_PEERS];
+  char sackBlocks[PEER_MAX_PEERS][RELIABILITY_MAX_SACK_BLOCKS * 8];
+  struct iovec parts[2 * PEER_MAX_PEERS][2];
+  struct mmsghdr datagrams[2 * PEER_MAX_PEERS];
+  int numReplies = 0;
+
+  memset(datagrams, 0, sizeof(datagrams));
+
+  for (int i = 0; i < PeerTable_count(pWorker->pMembers); i++) {
+    Peer* pPeer = PeerTable_get(pWorker->pMembers, i);
+    RelayMember* pMember = &pWorker->members[i];
+
+    if (pMember->isEchoDue) {
+      parts[numReplies][0].iov_base = &pMember->echoHeader;
+      parts[numReplies][0].iov_len = MESSAGE_HEADER_SIZE;
+      parts[numReplies][1].iov_base = pMember->echoData;
+      parts[numReplies][1].iov_len = HEARTBEAT_DATA_SIZE;
+
+      datagrams[numReplies].msg_hdr.msg_name = &pPeer->address;
+      datagrams[numReplies].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      datagrams[numReplies].msg_hdr.msg_iov = parts[numReplies];
+      datagrams[numReplies].msg_hdr.msg_iovlen = 2;
+
+      pMember->isEchoDue = false;
+      numReplies++;
+    }
+
+    if (!pMember->isAckDue) {
+      continue;
+    }
+
+    parts[numReplies][0].iov_base = &headers[i];
+    parts[numReplies][0].iov_len = MESSAGE_HEADER_SIZE;
+    parts[numReplies][1].iov_base = sackBlocks[i];
+    parts[numReplies][1].iov_len = Reliability_encodeAck(pPeer->pReliability, &headers[i], sackBlocks[i]);
+    Message_encodeDatagramSize(&headers[i], getRelayDatagramSize());
+
+    datagrams[numReplies].msg_hdr.msg_name = &pPeer->address;
+    datagrams[numReplies].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    datagrams[numReplies].msg_hdr.msg_iov = parts[numReplies];
+    datagrams[numReplies].msg_hdr.msg_iovlen = 2;
+
+    pMember->isAckDue = false;
+    numReplies++;
+  }
+
+  // A lost acknowledgement is made up for by the next one, and a lost echo only counts as a lost heartbeat,
+  // so a failure is not fatal
+  if (numReplies > 0) {
+    sendmmsg(pWorker->socketDescriptor, datagrams, numReplies, 0);
+  }
+
+  return;
+}
+
+// Receives the datagrams that arrived at the worker's socket and relays the messages they complete,
+// a bounded number of batches at a time
+static void receiveDatagrams(RelayWorker* pWorker) {
+  for (int round = 0; round < RELAY_MAX_RECEIVE_ROUNDS; round++) {
+    for (int i = 0; i < RELAY_BATCH_SIZE; i++) {
+      if (pWorker->receivedMessages[i] == NULL) {
+        pWorker->receivedMessages[i] = allocMessage();
+        pWorker->receivedParts[i][1].iov_base = pWorker->receivedMessages[i]->data;
+      }
+
+      pWorker->receivedDatagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    int numReceived = recvmmsg(pWorker->socketDescriptor, pWorker->receivedDatagrams, RELAY_BATCH_SIZE, MSG_DONTWAIT, NULL);
+
+    if (numReceived == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        break;
+      }
+
+      fputs("[Error]: could not receive message\n", stdout);
+      exit(1);
+    }
+
+    pWorker->statistics.numDatagramsReceived += numReceived;
+
+    for (int i = 0; i < numReceived; i++) {
+      struct mmsghdr* pDatagram = &pWorker->receivedDatagrams[i];
+      bool isTruncated = (pDatagram->msg_hdr.msg_flags & MSG_TRUNC) != 0;
+
+      if (handleDatagram(pWorker, &pWorker->receivedHeaders[i], pWorker->receivedMessages[i], pDatagram->msg_len, isTruncated, &pWorker->receivedAddresses[i])) {
+        pWorker->receivedMessages[i] = NULL;
+      }
+    }
+
+    if (numReceived < RELAY_BATCH_SIZE) {
+      break;
+    }
+  }
+
+  sendReplies(pWorker);
+  flushHandoff(pWorker);
+  flushSending(pWorker);
+  return;
+}
+
+// Forwards the messages other workers handed to this one to all of its members
+static void drainInbox(RelayWorker* pWorker) {
+  Message* pMessages[RELAY_BATCH_SIZE];
+  uint64_t numWakes;
+  int count;
+
+  if (read(pWorker->wakeDescriptor, &numWakes, sizeof(numWakes)) == -1 && errno != EAGAIN) {
+    fputs("[Error]: could not read relay wake counter\n", stdout);
+    exit(1);
+  }
+
+  while ((count = MessageQueue_popBatch(pWorker->pInbox, (void**) pMessages, RELAY_BATCH_SIZE, 0)) > 0) {
+    for (int i = 0; i < count; i++) {
+      forwardMessage(pWorker, NULL, pMessages[i]);
+      MessagePool_recycle(pMessages[i]);
+    }
+  }
+
+  flushSending(pWorker);
+  return;
+}
+
+// Sends again every message the members' reliability layers found lost or timed out, up to a full window
+// of them for each member
+static void sendRetransmissions(RelayWorker* pWorker) {
+  Message* pMessages[RELAY_BATCH_SIZE];
+
+  for (int i = 0; i < PeerTable_count(pWorker->pMembers); i++) {
+    Peer* pPeer = PeerTable_get(pWorker->pMembers, i);
+    int count = 0;
+    int numTaken = 0;
+
+    if (pPeer->pReliability == NULL || Peer_hasLeft(pPeer)) {
+      continue;
+    }
+
+    Reliability_recycleAcked(pPeer->pReliability);
+    admitBacklog(pWorker, pPeer);
+
+    do {
+      count = Reliability_takeRetransmissions(pPeer->pReliability, pMessages, RELAY_BATCH_SIZE, Message_getTimestamp());
+
+      for (int j = 0; j < count; j++) {
+        queueSending(pWorker, pPeer, pMessages[j]);
+      }
+
+      numTaken += count;
+    } while (count == RELAY_BATCH_SIZE && numTaken < RELIABILITY_WINDOW_SIZE);
+  }
+
+  flushSending(pWorker);
+  return;
+}
+
+// Makes the members not heard from for RELAY_MEMBER_TIMEOUT_NANOSECONDS leave, and releases the reliability
+// layer and partly received messages of members that left once their last acknowledgement was sent
+static void expireMembers(RelayWorker* pWorker, uint64_t now) {
+  HeartbeatStatistics statistics;
+
+  for (int i = 0; i < PeerTable_count(pWorker->pMembers); i++) {
+    Peer* pPeer = PeerTable_get(pWorker->pMembers, i);
+    RelayMember* pMember = &pWorker->members[i];
+
+    if (!Peer_hasLeft(pPeer)) {
+      Heartbeat_getStatistics(pPeer->pHeartbeat, &statistics);
+
+      if (statistics.lastHeardTime + RELAY_MEMBER_TIMEOUT_NANOSECONDS > now) {
+        continue;
+      }
+
+      leaveMember(pWorker, pPeer, "timed out");
+      pWorker->statistics.numMembersTimedOut++;
+      pMember->isAckDue = false;
+    }
+
+    if (pMember->isAckDue) {
+      continue;
+    }
+
+    // Called once the copies queued for sending were sent, so none is left for the reliability layer
+    if (pPeer->pReliability != NULL) {
+      Reliability_free(pPeer->pReliability);
+      pPeer->pReliability = NULL;
+    }
+
+    Reassembly_clear(&pMember->reassembly);
+  }
+
+  return;
+}
+
+// Returns the milliseconds until a retransmission timeout of a member expires or the members are next checked
+// for timing out, or -1 if neither is due
+static int getTimeout(RelayWorker* pWorker) {
+  uint64_t now = Message_getTimestamp();
+  int timeout = -1;
+
+  for (int i = 0; i < PeerTable_count(pWorker->pMembers); i++) {
+    Peer* pPeer = PeerTable_get(pWorker->pMembers, i);
+
+    // Members still there may time out, and members that left may hold a reliability layer to release
+    if (timeout == -1 && (!Peer_hasLeft(pPeer) || pPeer->pReliability != NULL)) {
+      uint64_t expiryWait = (pWorker->nextExpiryTime > now) ? pWorker->nextExpiryTime - now : 0;
+      timeout = (int) ((expiryWait + 999999) / 1000000);
+    }
+
+    if (pPeer->pReliability == NULL || Peer_hasLeft(pPeer)) {
+      continue;
+    }
+
+    int memberTimeout = Reliability_getTimeout(pPeer->pReliability, now);
+
+    if (memberTimeout != -1 && (timeout == -1 || memberTimeout < timeout)) {
+      timeout = memberTimeout;
+    }
+  }
+
+  return timeout;
+}
+
+// The thread of a worker, relaying the datagrams reaching its socket and the messages handed to it
+static void* workerThread(void* args) {
+  RelayWorker* pWorker = args;
+  struct pollfd descriptors[2];
+
+  descriptors[0].fd = pWorker->socketDescriptor;
+  descriptors[0].events = POLLIN;
+  descriptors[1].fd = pWorker->wakeDescriptor;
+  descriptors[1].events = POLLIN;
+
+  while (!__atomic_load_n(&s_isStopping, __ATOMIC_ACQUIRE)) {
+    int status = poll(descriptors, 2, getTimeout(pWorker));
+
+    if (status == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      fputs("[Error]: could not wait for relay events\n", stdout);
+      exit(1);
+    }
+
+    if (descriptors[0].revents & POLLIN) {
+      receiveDatagrams(pWorker);
+    }
+
+    if (descriptors[1].revents & POLLIN) {
+      drainInbox(pWorker);
+    }
+
+    sendRetransmissions(pWorker);
+
+    uint64_t now = Message_getTimestamp();
+
+    if (now >= pWorker->nextExpiryTime) {
+      expireMembers(pWorker, now);
+      pWorker->nextExpiryTime = now + RELAY_EXPIRY_INTERVAL_NANOSECONDS;
+    }
+  }
+
+  return NULL;
+}
+
+// Makes a worker for the socket, with no members yet
+static RelayWorker* createWorker(int socketDescriptor) {
+  // Large, so allocated rather than kept on a stack
+  RelayWorker* pWorker = calloc(1, sizeof(RelayWorker));
+
+  if (pWorker == NULL) {
+    fputs("[Error]: could not allocate memory for relay worker\n", stdout);
+    exit(1);
+  }
+
+  pWorker->socketDescriptor = socketDescriptor;
+  pWorker->smallestDatagramSize = MESSAGE_DATAGRAM_MAX_SIZE;
+  pWorker->wakeDescriptor = eventfd(0, EFD_NONBLOCK);
+  pWorker->pInbox = MessageQueue_create(MESSAGE_QUEUE_LIST);
+  pWorker->pMembers = PeerTable_create();
+
+  if (pWorker->wakeDescriptor == -1 || pWorker->pInbox == NULL || pWorker->pMembers == NULL) {
+    fputs("[Error]: could not create relay worker\n", stdout);
+    exit(1);
+  }
+
+  for (int i = 0; i < PEER_MAX_PEERS; i++) {
+    Reassembly_init(&pWorker->members[i].reassembly);
+  }
+
+  for (int i = 0; i < RELAY_BATCH_SIZE; i++) {
+    pWorker->receivedParts[i][0].iov_base = &pWorker->receivedHeaders[i];
+    pWorker->receivedParts[i][0].iov_len = MESSAGE_HEADER_SIZE;
+    pWorker->receivedParts[i][1].iov_len = MESSAGE_DATA_MAX_SIZE;
+    pWorker->receivedDatagrams[i].msg_hdr.msg_iov = pWorker->receivedParts[i];
+    pWorker->receivedDatagrams[i].msg_hdr.msg_iovlen = 2;
+    pWorker->receivedDatagrams[i].msg_hdr.msg_name = &pWorker->receivedAddresses[i];
+
+    pWorker->sendingParts[i][0].iov_base = &pWorker->sendingHeaders[i];
+    pWorker->sendingParts[i][0].iov_len = MESSAGE_HEADER_SIZE;
+    pWorker->sendingDatagrams[i].msg_hdr.msg_iov = pWorker->sendingParts[i];
+    pWorker->sendingDatagrams[i].msg_hdr.msg_iovlen = 2;
+    pWorker->sendingDatagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+
+  return pWorker;
+}
+
+// Adds the counters of a worker to those of the relay
+static void addStatistics(RelayStatistics* pTotal, RelayStatistics* pWorkerStatistics) {
+  pTotal->numMembersJoined += pWorkerStatistics->numMembersJoined;
+  pTotal->numMembersLeft += pWorkerStatistics->numMembersLeft;
+  pTotal->numMembersTimedOut += pWorkerStatistics->numMembersTimedOut;
+  pTotal->numDatagramsReceived += pWorkerStatistics->numDatagramsReceived;
+  pTotal->numMessagesReceived += pWorkerStatistics->numMessagesReceived;
+  pTotal->numMalformedDatagrams += pWorkerStatistics->numMalformedDatagrams;
+  pTotal->numMessagesForwarded += pWorkerStatistics->numMessagesForwarded;
+  pTotal->numMessagesHandedOff += pWorkerStatistics->numMessagesHandedOff;
+  pTotal->numMessagesDropped += pWorkerStatistics->numMessagesDropped;
+  pTotal->numMembersRefused += pWorkerStatistics->numMembersRefused;
+  pTotal->numDatagramsSent += pWorkerStatistics->numDatagramsSent;
+  pTotal->numSendCalls += pWorkerStatistics->numSendCalls;
+  return;
+}
+
+// Recycles every message a stopped worker holds, and frees it
+static void freeWorker(RelayWorker* pWorker) {
+  for (int i = 0; i < RELAY_BATCH_SIZE; i++) {
+    if (pWorker->receivedMessages[i] != NULL) {
+      MessagePool_recycle(pWorker->receivedMessages[i]);
+    }
+  }
+
+  // Copies admitted to a reliability layer belong to it
+  for (int i = 0; i < pWorker->numSending; i++) {
+    if (pWorker->pSendingMembers[i]->pReliability == NULL) {
+      MessagePool_recycle(pWorker->sendingMessages[i]);
+    }
+  }
+
+  for (int i = 0; i < pWorker->numHandoff; i++) {
+    MessagePool_recycle(pWorker->handoffMessages[i]);
+  }
+
+  for (int i = 0; i < PEER_MAX_PEERS; i++) {
+    Reassembly_clear(&pWorker->members[i].reassembly);
+    clearBacklog(&pWorker->members[i]);
+  }
+
+  MessageQueue_free(pWorker->pInbox, freeMessage);
+  PeerTable_free(pWorker->pMembers);
+  close(pWorker->wakeDescriptor);
+  free(pWorker);
+  return;
+}
+
+// Starts a worker thread for each socket of pArguments, which must stay valid until Relay_stop
+void Relay_start(RelayArguments* pArguments) {
+  s_numWorkers = pArguments->numWorkers;
+  s_isReliable = pArguments->isReliable;
+  s_isQuiet = pArguments->isQuiet;
+  s_isStopping = false;
+  memset(&s_statistics, 0, sizeof(s_statistics));
+
+  // Every worker exists before any runs, as they hand messages to each other
+  for (int i = 0; i < s_numWorkers; i++) {
+    s_pWorkers[i] = createWorker(pArguments->socketDescriptors[i]);
+  }
+
+  for (int i = 0; i < s_numWorkers; i++) {
+    if (pthread_create(&s_pWorkers[i]->thread, NULL, workerThread, s_pWorkers[i]) != 0) {
+      fputs("[Error]: could not create relay worker thread\n", stdout);
+      exit(1);
+    }
+  }
+
+  return;
+}
+
+// Stops the workers, recycling every message they still hold
+void Relay_stop() {
+  __atomic_store_n(&s_isStopping, true, __ATOMIC_RELEASE);
+
+  for (int i = 0; i < s_numWorkers; i++) {
+    wakeWorker(s_pWorkers[i]);
+  }
+
+  for (int i = 0; i < s_numWorkers; i++) {
+    if (pthread_join(s_pWorkers[i]->thread, NULL) != 0) {
+      fputs("[Error]: could not join with relay worker thread\n", stdout);
+    }
+
+    addStatistics(&s_statistics, &s_pWorkers[i]->statistics);
+  }
+
+  // Messages handed to a worker may still be shared with the others, so none is freed before all stopped
+  for (int i = 0; i < s_numWorkers; i++) {
+    freeWorker(s_pWorkers[i]);
+    s_pWorkers[i] = NULL;
+  }
+
+  s_numWorkers = 0;
+  return;
+}
+
+// Fills pStatistics with the counters of the relay, summed over its workers once they stopped
+void Relay_getStatistics(RelayStatistics* pStatistics) {
+  *pStatistics = s_statistics;
+  return;
+}
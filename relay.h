@@ -0,0 +1,68 @@
+// A hub that every member of a channel talks to, forwarding each message it receives to all other members
+// The port is shared by one socket per worker with SO_REUSEPORT, so the kernel spreads the members over the
+// workers by address, and each worker only keeps the members whose datagrams reach its socket
+// A worker exchanges messages with its members through a reliability layer of its own for each, and hands
+// messages for the members of other workers to those workers, which send them with their own sockets
+// Members say how large a datagram they take, and are told to send none larger than the narrowest member takes,
+// as messages are forwarded unchanged
+#ifndef _RELAY_H_
+#define _RELAY_H_
+#include <stdbool.h>
+
+// Most workers, each with a socket and a thread
+#define RELAY_MAX_WORKERS 64
+
+// Arguments for the relay
+typedef struct {
+  // Sockets bound to the same port with SO_REUSEPORT, one per worker
+  int socketDescriptors[RELAY_MAX_WORKERS];
+  int numWorkers;
+
+  // Exchange messages with the members through a reliability layer, or send each message once
+  bool isReliable;
+
+  // Print nothing as members join and leave, for the benchmark
+  bool isQuiet;
+} RelayArguments;
+
+// Counters of the relay, summed over its workers
+typedef struct {
+  // Number of members that joined, that left with the exit command, and that were heard from for too long
+  // and made to leave
+  unsigned long numMembersJoined;
+  unsigned long numMembersLeft;
+  unsigned long numMembersTimedOut;
+
+  unsigned long numDatagramsReceived;
+  unsigned long numMessagesReceived;
+
+  // Number of datagrams dropped as they were truncated, or held another length of data than their header says
+  unsigned long numMalformedDatagrams;
+
+  // Number of copies of messages sent to members, retransmissions excluded
+  unsigned long numMessagesForwarded;
+
+  // Number of messages passed to other workers for their members
+  unsigned long numMessagesHandedOff;
+
+  // Number of copies not sent as the member's backlog was full, they were larger than the member takes,
+  // or the kernel refused them
+  unsigned long numMessagesDropped;
+
+  // Number of senders not made members, as their worker had no room for another
+  unsigned long numMembersRefused;
+
+  unsigned long numDatagramsSent;
+  unsigned long numSendCalls;
+} RelayStatistics;
+
+// Starts a worker thread for each socket of pArguments, which must stay valid until Relay_stop
+void Relay_start(RelayArguments* pArguments);
+
+// Stops the workers, recycling every message they still hold
+void Relay_stop(void);
+
+// Fills pStatistics with the counters of the relay, summed over its workers once they stopped
+void Relay_getStatistics(RelayStatistics* pStatistics);
+
+#endif
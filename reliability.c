@@ -0,0 +1,528 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <arpa/inet.h>
+#include "reliability.h"
+#include "messagepool.h"
+
+// Returns true if sequence number first comes before second, allowing for wraparound
+static bool isBefore(uint32_t first, uint32_t second) {
+  return (int32_t) (first - second) < 0;
+}
+
+// Returns the slot of a sent message
+static ReliabilitySendSlot* getSendSlot(Reliability* pReliability, uint32_t sequence) {
+  return &pReliability->sendSlots[sequence % RELIABILITY_WINDOW_SIZE];
+}
+
+// Flags a sent message whose retransmission timeout expired, the wheel counting it
+static void expireRetransmission(void* pContext) {
+  ReliabilitySendSlot* pSlot = pContext;
+  pSlot->isTimedOut = true;
+  return;
+}
+
+static void lockReliability(Reliability* pReliability) {
+  int status = pthread_mutex_lock(&pReliability->mutex);
+
+  if (status) {
+    fputs("[Error]: could not lock reliability mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+static void unlockReliability(Reliability* pReliability) {
+  int status = pthread_mutex_unlock(&pReliability->mutex);
+
+  if (status) {
+    fputs("[Error]: could not unlock reliability mutex\n", stdout);
+    exit(1);
+  }
+
+  return;
+}
+
+// Takes a message out of the list of messages waiting for an acknowledgement, if it is in it
+static void unlinkSent(Reliability* pReliability, ReliabilitySendSlot* pSlot) {
+  if (!pSlot->isInSendOrder) {
+    return;
+  }
+
+  if (pSlot->olderSlot == -1) {
+    pReliability->oldestSentSlot = pSlot->newerSlot;
+  } else {
+    pReliability->sendSlots[pSlot->olderSlot].newerSlot = pSlot->newerSlot;
+  }
+
+  if (pSlot->newerSlot == -1) {
+    pReliability->newestSentSlot = pSlot->olderSlot;
+  } else {
+    pReliability->sendSlots[pSlot->newerSlot].olderSlot = pSlot->olderSlot;
+  }
+
+  pSlot->isInSendOrder = false;
+  return;
+}
+
+// Adds a message just sent to the end of the list of messages waiting for an acknowledgement
+static void linkSent(Reliability* pReliability, ReliabilitySendSlot* pSlot) {
+  int slotIndex = pSlot - pReliability->sendSlots;
+
+  pSlot->olderSlot = pReliability->newestSentSlot;
+  pSlot->newerSlot = -1;
+  pSlot->isInSendOrder = true;
+
+  if (pReliability->newestSentSlot == -1) {
+    pReliability->oldestSentSlot = slotIndex;
+  } else {
+    pReliability->sendSlots[pReliability->newestSentSlot].newerSlot = slotIndex;
+  }
+
+  pReliability->newestSentSlot = slotIndex;
+  return;
+}
+
+// Makes a new reliability layer for messages exchanged with one peer, and returns its reference on success.
+// Returns a NULL pointer on failure.
+Reliability* Reliability_create() {
+  Reliability* pReliability = calloc(1, sizeof(Reliability));
+
+  if (pReliability == NULL) {
+    return NULL;
+  }
+
+  if (pthread_mutex_init(&pReliability->mutex, NULL)) {
+    free(pReliability);
+    return NULL;
+  }
+
+  TimerWheel_init(&pReliability->retransmissionTimers, Message_getTimestamp());
+  pReliability->oldestSentSlot = -1;
+  pReliability->newestSentSlot = -1;
+  pReliability->nextSendOrder = 1;
+  pReliability->statistics.retransmissionTimeout = RELIABILITY_INITIAL_RTO;
+  return pReliability;
+}
+
+// Returns the number of messages that can be admitted before the window is full.
+int Reliability_getSendRoom(Reliability* pReliability) {
+  lockReliability(pReliability);
+  int room = RELIABILITY_WINDOW_SIZE - (int) (pReliability->nextSequence - pReliability->sendBase);
+  unlockReliability(pReliability);
+
+  return room;
+}
+
+// Numbers count messages from ppMessages in order and keeps them until they are acknowledged.
+void Reliability_admit(Reliability* pReliability, Message** ppMessages, int count) {
+  lockReliability(pReliability);
+
+  for (int i = 0; i < count; i++) {
+    ReliabilitySendSlot* pSlot = getSendSlot(pReliability, pReliability->nextSequence);
+
+    assert(pSlot->pMessage == NULL && !Timer_isScheduled(&pSlot->retransmissionTimer));
+
+    ppMessages[i]->sequence = pReliability->nextSequence;
+    ppMessages[i]->flags |= MESSAGE_FLAG_RELIABLE;
+    memset(pSlot, 0, sizeof(ReliabilitySendSlot));
+    pSlot->pMessage = ppMessages[i];
+    Timer_init(&pSlot->retransmissionTimer, expireRetransmission, pSlot);
+    pReliability->nextSequence++;
+  }
+
+  unlockReliability(pReliability);
+  return;
+}
+
+// Records that count admitted messages from ppMessages are being sent at the given time.
+// Called before the messages are handed to the socket, so an acknowledgement cannot arrive ahead of it.
+void Reliability_markSent(Reliability* pReliability, Message** ppMessages, int count, uint64_t now) {
+  ReliabilityStatistics* pStatistics = &pReliability->statistics;
+
+  lockReliability(pReliability);
+
+  if (pStatistics->firstSendTime == 0) {
+    pStatistics->firstSendTime = now;
+  }
+
+  for (int i = 0; i < count; i++) {
+    ReliabilitySendSlot* pSlot = getSendSlot(pReliability, ppMessages[i]->sequence);
+
+    // A retransmission taken before its acknowledgement arrived needs no timer
+    if (pSlot->isAcked) {
+      continue;
+    }
+
+    pSlot->sentTime = now;
+    pSlot->numTransmissions++;
+    pSlot->sendOrder = pReliability->nextSendOrder++;
+    unlinkSent(pReliability, pSlot);
+    linkSent(pReliability, pSlot);
+    TimerWheel_schedule(&pReliability->retransmissionTimers, &pSlot->retransmissionTimer, now + pStatistics->retransmissionTimeout);
+
+    if (pSlot->numTransmissions == 1) {
+      pStatistics->numMessagesSent++;
+    } else {
+      pStatistics->numRetransmissions++;
+    }
+  }
+
+  unlockReliability(pReliability);
+  return;
+}
+
+// Stores in ppMessages up to maxCount sent messages that are due to be sent again, because they were
+// found lost or their retransmission timeout expired at the given time.
+int Reliability_takeRetransmissions(Reliability* pReliability, Message** ppMessages, int maxCount, uint64_t now) {
+  ReliabilityStatistics* pStatistics = &pReliability->statistics;
+  int count = 0;
+  bool isTimedOut = false;
+
+  lockReliability(pReliability);
+
+  pReliability->numTimedOut += TimerWheel_advance(&pReliability->retransmissionTimers, now);
+
+  // Only look through the window while some message found lost or timed out was not taken yet
+  for (
+    uint32_t sequence = pReliability->cumulativeAck;
+    sequence != pReliability->nextSequence && count < maxCount && pReliability->numLost + pReliability->numTimedOut > 0;
+    sequence++
+  ) {
+    ReliabilitySendSlot* pSlot = getSendSlot(pReliability, sequence);
+
+    if (!pSlot->isLost && !pSlot->isTimedOut) {
+      continue;
+    }
+
+    if (pSlot->isLost) {
+      pStatistics->numFastRetransmissions++;
+    } else {
+      isTimedOut = true;
+    }
+
+    pReliability->numLost -= pSlot->isLost;
+    pReliability->numTimedOut -= pSlot->isTimedOut;
+    pSlot->isLost = false;
+    pSlot->isTimedOut = false;
+    ppMessages[count] = pSlot->pMessage;
+    count++;
+  }
+
+  // Back off once per timeout, however many messages it covers
+  if (isTimedOut) {
+    pStatistics->numTimeouts++;
+    pStatistics->retransmissionTimeout *= 2;
+
+    if (pStatistics->retransmissionTimeout > RELIABILITY_MAX_RTO) {
+      pStatistics->retransmissionTimeout = RELIABILITY_MAX_RTO;
+    }
+  }
+
+  unlockReliability(pReliability);
+  return count;
+}
+
+// Returns the milliseconds from the given time until the next retransmission timeout expires,
+// 0 if a message is already due, or -1 if no message is waiting for an acknowledgement.
+int Reliability_getTimeout(Reliability* pReliability, uint64_t now) {
+  int timeout = 0;
+
+  lockReliability(pReliability);
+
+  if (pReliability->numLost + pReliability->numTimedOut == 0) {
+    timeout = TimerWheel_getTimeout(&pReliability->retransmissionTimers, now);
+  }
+
+  unlockReliability(pReliability);
+  return timeout;
+}
+
+// Recycles the messages acknowledged cumulatively at the start of the window, making room for more.
+// A message acknowledged selectively keeps its slot until the cumulative acknowledgement passes it
+void Reliability_recycleAcked(Reliability* pReliability) {
+  lockReliability(pReliability);
+
+  while (pReliability->sendBase != pReliability->cumulativeAck) {
+    ReliabilitySendSlot* pSlot = getSendSlot(pReliability, pReliability->sendBase);
+
+    MessagePool_recycle(pSlot->pMessage);
+    pSlot->pMessage = NULL;
+    pReliability->sendBase++;
+  }
+
+  unlockReliability(pReliability);
+  return;
+}
+
+// Returns the sequence number of the oldest message not acknowledged cumulatively, every message before it
+// having been delivered by the peer.
+uint32_t Reliability_getCumulativeAck(Reliability* pReliability) {
+  lockReliability(pReliability);
+  uint32_t cumulativeAck = pReliability->cumulativeAck;
+  unlockReliability(pReliability);
+
+  return cumulativeAck;
+}
+
+// Returns true if every admitted message was acknowledged.
+bool Reliability_isIdle(Reliability* pReliability) {
+  lockReliability(pReliability);
+  bool isIdle = (pReliability->cumulativeAck == pReliability->nextSequence);
+  unlockReliability(pReliability);
+
+  return isIdle;
+}
+
+// Marks an admitted message acknowledged, returning its sent time if it gives a valid round-trip time sample, 0 otherwise
+// Only messages sent once give samples, as an acknowledgement of a retransmitted message is ambiguous
+static uint64_t acknowledge(Reliability* pReliability, uint32_t sequence) {
+  ReliabilitySendSlot* pSlot = getSendSlot(pReliability, sequence);
+
+  if (pSlot->isAcked) {
+    return 0;
+  }
+
+  TimerWheel_cancel(&pReliability->retransmissionTimers, &pSlot->retransmissionTimer);
+  unlinkSent(pReliability, pSlot);
+  pReliability->numLost -= pSlot->isLost;
+  pReliability->numTimedOut -= pSlot->isTimedOut;
+  pSlot->isAcked = true;
+  pSlot->isLost = false;
+  pSlot->isTimedOut = false;
+  pReliability->statistics.numBytesAcked += pSlot->pMessage->length;
+
+  // Keep the latest transmissions acknowledged, which decide the messages sent before them lost
+  uint64_t* pLatestOrders = pReliability->latestAckedOrders;
+  int i = RELIABILITY_DUPLICATE_THRESHOLD - 1;
+
+  if (pSlot->sendOrder > pLatestOrders[i]) {
+    while (i > 0 && pSlot->sendOrder > pLatestOrders[i - 1]) {
+      pLatestOrders[i] = pLatestOrders[i - 1];
+      i--;
+    }
+
+    pLatestOrders[i] = pSlot->sendOrder;
+  }
+
+  return (pSlot->numTransmissions == 1) ? pSlot->sentTime : 0;
+}
+
+// Updates the round-trip time estimates and retransmission timeout with a new sample, as in RFC 6298
+static void updateRtt(Reliability* pReliability, uint64_t rtt) {
+  ReliabilityStatistics* pStatistics = &pReliability->statistics;
+
+  if (pStatistics->numRttSamples == 0) {
+    pStatistics->smoothedRtt = rtt;
+    pReliability->rttVariance = rtt / 2;
+    pStatistics->minRtt = rtt;
+    pStatistics->maxRtt = rtt;
+  } else {
+    uint64_t deviation = (rtt > pStatistics->smoothedRtt) ? rtt - pStatistics->smoothedRtt : pStatistics->smoothedRtt - rtt;
+    pReliability->rttVariance = (3 * pReliability->rttVariance + deviation) / 4;
+    pStatistics->smoothedRtt = (7 * pStatistics->smoothedRtt + rtt) / 8;
+    pStatistics->minRtt = (rtt < pStatistics->minRtt) ? rtt : pStatistics->minRtt;
+    pStatistics->maxRtt = (rtt > pStatistics->maxRtt) ? rtt : pStatistics->maxRtt;
+  }
+
+  pStatistics->numRttSamples++;
+  pStatistics->retransmissionTimeout = pStatistics->smoothedRtt + 4 * pReliability->rttVariance;
+
+  if (pStatistics->retransmissionTimeout < RELIABILITY_MIN_RTO) {
+    pStatistics->retransmissionTimeout = RELIABILITY_MIN_RTO;
+  } else if (pStatistics->retransmissionTimeout > RELIABILITY_MAX_RTO) {
+    pStatistics->retransmissionTimeout = RELIABILITY_MAX_RTO;
+  }
+
+  return;
+}
+
+// Applies an acknowledgement received from the peer at the given time, with the length bytes of data after its header.
+// Returns true if messages were found lost or the window opened, so the sender should be woken.
+bool Reliability_processAck(Reliability* pReliability, MessageHeader* pHeader, char* pData, int length, uint64_t now) {
+  uint32_t cumulativeAck = ntohl(pHeader->sequence);
+  uint64_t latestSentTime = 0;
+  uint64_t sentTime = 0;
+  bool shouldWake = false;
+
+  lockReliability(pReliability);
+
+  pReliability->statistics.numAcksReceived++;
+  pReliability->statistics.lastAckTime = now;
+
+  // Ignore acknowledgements of messages never admitted
+  if (isBefore(pReliability->nextSequence, cumulativeAck)) {
+    unlockReliability(pReliability);
+    return false;
+  }
+
+  while (isBefore(pReliability->cumulativeAck, cumulativeAck)) {
+    sentTime = acknowledge(pReliability, pReliability->cumulativeAck);
+    latestSentTime = (sentTime > latestSentTime) ? sentTime : latestSentTime;
+    pReliability->cumulativeAck++;
+    shouldWake = true;
+  }
+
+  // Each block is the first sequence number of a range of messages received early, and one past its last
+  // A block can only start after the cumulative acknowledgement, so one from an older acknowledgement arriving
+  // late is ignored
+  for (int offset = 0; offset + 8 <= length; offset += 8) {
+    uint32_t block[2];
+    memcpy(block, pData + offset, sizeof(block));
+
+    uint32_t start = ntohl(block[0]);
+    uint32_t end = ntohl(block[1]);
+
+    if (!isBefore(pReliability->cumulativeAck, start) || isBefore(pReliability->nextSequence, end) || !isBefore(start, end)) {
+      continue;
+    }
+
+    for (uint32_t sequence = start; sequence != end; sequence++) {
+      sentTime = acknowledge(pReliability, sequence);
+      latestSentTime = (sentTime > latestSentTime) ? sentTime : latestSentTime;
+    }
+  }
+
+  if (latestSentTime != 0 && now > latestSentTime) {
+    updateRtt(pReliability, now - latestSentTime);
+  }
+
+  // A message is lost once enough messages sent after its last transmission were acknowledged, so a message
+  // sent again is only found lost again by acknowledgements of messages sent after it
+  // The list is in the order messages were sent, so only the messages found lost are looked at, each leaving it
+  uint64_t thresholdOrder = pReliability->latestAckedOrders[RELIABILITY_DUPLICATE_THRESHOLD - 1];
+
+  while (pReliability->oldestSentSlot != -1 && pReliability->sendSlots[pReliability->oldestSentSlot].sendOrder < thresholdOrder) {
+    ReliabilitySendSlot* pSlot = &pReliability->sendSlots[pReliability->oldestSentSlot];
+
+    unlinkSent(pReliability, pSlot);
+    pReliability->numLost += !pSlot->isLost;
+    pSlot->isLost = true;
+    shouldWake = true;
+  }
+
+  unlockReliability(pReliability);
+  return shouldWake;
+}
+
+// Adds one to a counter of the receive side, under the lock as Reliability_getStatistics reads it from other threads
+static void countReceiveSide(Reliability* pReliability, unsigned long* pCounter) {
+  lockReliability(pReliability);
+  (*pCounter)++;
+  unlockReliability(pReliability);
+  return;
+}
+
+// Accounts for a received message numbered by the peer's reliability layer, holding it back if it arrived early.
+ReliabilityReceiveResult Reliability_receive(Reliability* pReliability, Message* pMessage) {
+  uint32_t offset = pMessage->sequence - pReliability->nextExpected;
+
+  // Messages before the next expected one were delivered already, and those beyond the window cannot be held
+  if (offset >= RELIABILITY_WINDOW_SIZE) {
+    countReceiveSide(pReliability, &pReliability->statistics.numDuplicatesReceived);
+    return RELIABILITY_DUPLICATE;
+  }
+
+  if (isBefore(pReliability->receiveEnd, pMessage->sequence + 1)) {
+    pReliability->receiveEnd = pMessage->sequence + 1;
+  }
+
+  if (offset == 0) {
+    pReliability->nextExpected++;
+    return RELIABILITY_DELIVER;
+  }
+
+  Message** ppHeldMessage = &pReliability->pHeldMessages[pMessage->sequence % RELIABILITY_WINDOW_SIZE];
+
+  if (*ppHeldMessage != NULL) {
+    countReceiveSide(pReliability, &pReliability->statistics.numDuplicatesReceived);
+    return RELIABILITY_DUPLICATE;
+  }
+
+  *ppHeldMessage = pMessage;
+  countReceiveSide(pReliability, &pReliability->statistics.numHeldReceived);
+  return RELIABILITY_HELD;
+}
+
+// Returns the held message that is next in order, and takes it out of the reliability layer.
+// Returns NULL if the next message has not arrived yet.
+Message* Reliability_takeInOrder(Reliability* pReliability) {
+  Message** ppHeldMessage = &pReliability->pHeldMessages[pReliability->nextExpected % RELIABILITY_WINDOW_SIZE];
+  Message* pMessage = *ppHeldMessage;
+
+  if (pMessage == NULL) {
+    return NULL;
+  }
+
+  *ppHeldMessage = NULL;
+  pReliability->nextExpected++;
+  return pMessage;
+}
+
+// Fills pHeader and pData with an acknowledgement of every message received so far.
+// pData must have room for RELIABILITY_MAX_SACK_BLOCKS * 8 bytes.
+// Returns the number of bytes of data stored.
+int Reliability_encodeAck(Reliability* pReliability, MessageHeader* pHeader, char* pData) {
+  int numBlocks = 0;
+  uint32_t sequence = pReliability->nextExpected;
+
+  // Describe the ranges of held messages, nearest first
+  while (numBlocks < RELIABILITY_MAX_SACK_BLOCKS && isBefore(sequence, pReliability->receiveEnd)) {
+    if (pReliability->pHeldMessages[sequence % RELIABILITY_WINDOW_SIZE] == NULL) {
+      sequence++;
+      continue;
+    }
+
+    uint32_t block[2];
+    block[0] = htonl(sequence);
+
+    while (isBefore(sequence, pReliability->receiveEnd) && pReliability->pHeldMessages[sequence % RELIABILITY_WINDOW_SIZE] != NULL) {
+      sequence++;
+    }
+
+    block[1] = htonl(sequence);
+    memcpy(pData + numBlocks * 8, block, sizeof(block));
+    numBlocks++;
+  }
+
+  pHeader->type = MESSAGE_TYPE_ACK;
+  pHeader->flags = 0;
+  pHeader->length = htons(numBlocks * 8);
+  pHeader->sequence = htonl(pReliability->nextExpected);
+  pHeader->messageId = 0;
+  pHeader->fragmentIndex = 0;
+  pHeader->fragmentCount = 0;
+  countReceiveSide(pReliability, &pReliability->statistics.numAcksSent);
+
+  return numBlocks * 8;
+}
+
+// Fills pStatistics with the counters of pReliability.
+void Reliability_getStatistics(Reliability* pReliability, ReliabilityStatistics* pStatistics) {
+  lockReliability(pReliability);
+  *pStatistics = pReliability->statistics;
+  unlockReliability(pReliability);
+
+  return;
+}
+
+// Delete pReliability, recycling every message it still holds.
+void Reliability_free(Reliability* pReliability) {
+  assert(pReliability != NULL);
+
+  for (int i = 0; i < RELIABILITY_WINDOW_SIZE; i++) {
+    if (pReliability->sendSlots[i].pMessage != NULL) {
+      MessagePool_recycle(pReliability->sendSlots[i].pMessage);
+    }
+
+    if (pReliability->pHeldMessages[i] != NULL) {
+      MessagePool_recycle(pReliability->pHeldMessages[i]);
+    }
+  }
+
+  pthread_mutex_destroy(&pReliability->mutex);
+  free(pReliability);
+  return;
+}
@@ -0,0 +1,220 @@
+// A reliability layer between the message queues and the socket, for the messages exchanged with one peer
+// Sent messages are numbered and kept until the peer acknowledges them, cumulatively or selectively,
+// and are sent again after a retransmission timeout derived from the measured round-trip time,
+// or as soon as messages sent after them are acknowledged without them
+// Each sent message has a timer for its retransmission timeout, kept in a timer wheel, so finding the next
+// timeout and the messages timed out does not look through the whole window
+// Likewise the messages waiting for an acknowledgement are kept in the order they were sent, so an acknowledgement
+// only looks at the messages it finds lost
+// Received messages are delivered in order, holding back any that arrive ahead of a missing one
+#ifndef _RELIABILITY_H_
+#define _RELIABILITY_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "message.h"
+#include "timerwheel.h"
+
+// Most messages sent but not yet acknowledged, and most messages held back waiting for a missing one
+#define RELIABILITY_WINDOW_SIZE 1024
+
+// Most ranges of messages received ahead of a missing one that an acknowledgement describes
+#define RELIABILITY_MAX_SACK_BLOCKS 4
+
+// Retransmission timeout before any round-trip time was measured, and its bounds, in nanoseconds
+#define RELIABILITY_INITIAL_RTO 200000000ULL
+#define RELIABILITY_MIN_RTO 20000000ULL
+#define RELIABILITY_MAX_RTO 2000000000ULL
+
+// Number of messages sent after the last transmission of a message and acknowledged without it, before it is sent
+// again without waiting for a timeout
+#define RELIABILITY_DUPLICATE_THRESHOLD 3
+
+// Results of Reliability_receive
+typedef enum {
+  // The message is the next in order, and is to be delivered now, followed by Reliability_takeInOrder
+  RELIABILITY_DELIVER,
+
+  // The message arrived ahead of a missing one, and is held until that one arrives
+  RELIABILITY_HELD,
+
+  // The message was already received, or is too far ahead, and is to be discarded
+  RELIABILITY_DUPLICATE
+} ReliabilityReceiveResult;
+
+// A sent message, kept until it is acknowledged
+typedef struct {
+    // Set to NULL once the message was recycled
+    Message* pMessage;
+
+    // Time the message was last sent, 0 if it was admitted but not yet sent
+    uint64_t sentTime;
+
+    int numTransmissions;
+
+    bool isAcked;
+
+    // Set if the message is to be sent again before its timeout expires
+    bool isLost;
+
+    // Set once the retransmission timeout of its last transmission expired
+    bool isTimedOut;
+
+    // Expires the retransmission timeout, scheduled every time the message is sent
+    Timer retransmissionTimer;
+
+    // Position of the message's last transmission among every transmission, 0 if it was not sent yet
+    uint64_t sendOrder;
+
+    // Neighbours in the list of messages waiting for an acknowledgement in the order they were last sent,
+    // as indices of sendSlots, -1 at either end
+    // A message leaves the list once it is acknowledged or found lost, and joins its end when sent again
+    int olderSlot;
+    int newerSlot;
+    bool isInSendOrder;
+} ReliabilitySendSlot;
+
+typedef struct ReliabilityStatistics_s ReliabilityStatistics;
+struct ReliabilityStatistics_s {
+    // Number of messages sent for the first time, and sent again
+    unsigned long numMessagesSent;
+    unsigned long numRetransmissions;
+
+    // Number of retransmissions due to later messages being acknowledged, and to timeouts
+    unsigned long numFastRetransmissions;
+    unsigned long numTimeouts;
+
+    // Number of bytes of data acknowledged by the peer
+    unsigned long long numBytesAcked;
+
+    // Time the first message was sent and the last acknowledgement arrived, to measure goodput
+    uint64_t firstSendTime;
+    uint64_t lastAckTime;
+
+    unsigned long numAcksSent;
+    unsigned long numAcksReceived;
+
+    // Number of received messages held back for a missing one, and discarded as duplicates
+    unsigned long numHeldReceived;
+    unsigned long numDuplicatesReceived;
+
+    // Round-trip times in nanoseconds
+    unsigned long numRttSamples;
+    uint64_t smoothedRtt;
+    uint64_t minRtt;
+    uint64_t maxRtt;
+    uint64_t retransmissionTimeout;
+};
+
+typedef struct Reliability_s Reliability;
+struct Reliability_s {
+    // Guards the send side, which the sender thread sends from while the receiver thread applies acknowledgements
+    pthread_mutex_t mutex;
+
+    // Sent messages, indexed by sequence number modulo RELIABILITY_WINDOW_SIZE
+    ReliabilitySendSlot sendSlots[RELIABILITY_WINDOW_SIZE];
+
+    // Sequence number of the oldest message not yet recycled
+    uint32_t sendBase;
+
+    // Sequence number of the oldest message not acknowledged cumulatively
+    uint32_t cumulativeAck;
+
+    // Sequence number of the next message admitted
+    uint32_t nextSequence;
+
+    // Retransmission timers of the sent messages
+    TimerWheel retransmissionTimers;
+
+    // Ends of the list of sent messages neither acknowledged nor found lost, in the order they were last sent,
+    // as indices of sendSlots, -1 if it is empty
+    int oldestSentSlot;
+    int newestSentSlot;
+
+    // Position given to the next transmission
+    uint64_t nextSendOrder;
+
+    // Positions of the latest transmissions acknowledged, latest first, 0 for none yet
+    // Any message in the list sent before the last of them has enough later messages acknowledged to be lost
+    uint64_t latestAckedOrders[RELIABILITY_DUPLICATE_THRESHOLD];
+
+    // Number of sent messages found lost, and timed out, not yet taken to be sent again
+    int numLost;
+    int numTimedOut;
+
+    // Variance of the round-trip time in nanoseconds
+    // The smoothed round-trip time and the retransmission timeout are kept with the statistics
+    uint64_t rttVariance;
+
+    // Received messages held back, indexed by sequence number modulo RELIABILITY_WINDOW_SIZE
+    // Only accessed by the receiver thread
+    Message* pHeldMessages[RELIABILITY_WINDOW_SIZE];
+
+    // Sequence number of the next message to deliver
+    uint32_t nextExpected;
+
+    // One past the sequence number of the furthest message received
+    uint32_t receiveEnd;
+
+    ReliabilityStatistics statistics;
+};
+
+// Makes a new reliability layer for messages exchanged with one peer, and returns its reference on success.
+// Returns a NULL pointer on failure.
+Reliability* Reliability_create();
+
+// Returns the number of messages that can be admitted before the window is full.
+int Reliability_getSendRoom(Reliability* pReliability);
+
+// Numbers count messages from ppMessages in order and keeps them until they are acknowledged.
+// The reliability layer owns the messages from then on; the sender must not recycle them.
+void Reliability_admit(Reliability* pReliability, Message** ppMessages, int count);
+
+// Records that count admitted messages from ppMessages are being sent at the given time.
+// Called before the messages are handed to the socket, so an acknowledgement cannot arrive ahead of it.
+void Reliability_markSent(Reliability* pReliability, Message** ppMessages, int count, uint64_t now);
+
+// Stores in ppMessages up to maxCount sent messages that are due to be sent again, because they were
+// found lost or their retransmission timeout expired at the given time.
+// Returns the number of messages stored.
+int Reliability_takeRetransmissions(Reliability* pReliability, Message** ppMessages, int maxCount, uint64_t now);
+
+// Returns the milliseconds from the given time until the next retransmission timeout expires,
+// 0 if a message is already due, or -1 if no message is waiting for an acknowledgement.
+int Reliability_getTimeout(Reliability* pReliability, uint64_t now);
+
+// Recycles the messages acknowledged cumulatively at the start of the window, making room for more.
+// Must only be called by the thread that sends.
+void Reliability_recycleAcked(Reliability* pReliability);
+
+// Returns the sequence number of the oldest message not acknowledged cumulatively, every message before it
+// having been delivered by the peer.
+uint32_t Reliability_getCumulativeAck(Reliability* pReliability);
+
+// Returns true if every admitted message was acknowledged.
+bool Reliability_isIdle(Reliability* pReliability);
+
+// Applies an acknowledgement received from the peer at the given time, with the length bytes of data after its header.
+// Returns true if messages were found lost or the window opened, so the sender should be woken.
+bool Reliability_processAck(Reliability* pReliability, MessageHeader* pHeader, char* pData, int length, uint64_t now);
+
+// Accounts for a received message numbered by the peer's reliability layer, holding it back if it arrived early.
+// The caller keeps ownership of the message unless it was held.
+ReliabilityReceiveResult Reliability_receive(Reliability* pReliability, Message* pMessage);
+
+// Returns the held message that is next in order, and takes it out of the reliability layer.
+// Returns NULL if the next message has not arrived yet.
+Message* Reliability_takeInOrder(Reliability* pReliability);
+
+// Fills pHeader and pData with an acknowledgement of every message received so far.
+// pData must have room for RELIABILITY_MAX_SACK_BLOCKS * 8 bytes.
+// Returns the number of bytes of data stored.
+int Reliability_encodeAck(Reliability* pReliability, MessageHeader* pHeader, char* pData);
+
+// Fills pStatistics with the counters of pReliability.
+void Reliability_getStatistics(Reliability* pReliability, ReliabilityStatistics* pStatistics);
+
+// Delete pReliability, recycling every message it still holds.
+void Reliability_free(Reliability* pReliability);
+
+#endif
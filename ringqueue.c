@@ -0,0 +1,107 @@
+// A lock-free queue for exactly one producer thread and one consumer thread
+#include <stdlib.h>
+#include <assert.h>
+#include "ringqueue.h"
+
+// Makes a new, empty queue that can hold at least capacity items, and returns its reference on success.
+// Returns a NULL pointer on failure.
+RingQueue* RingQueue_create(size_t capacity) {
+  RingQueue* pNewQueue = NULL;
+  size_t numSlots = 1;
+
+  while (numSlots < capacity) {
+    numSlots <<= 1;
+  }
+
+  // Align the queue so each index really is alone on its cache line
+  if (posix_memalign((void**) &pNewQueue, RING_QUEUE_CACHE_LINE_SIZE, sizeof(RingQueue))) {
+    return NULL;
+  }
+
+  pNewQueue->ppSlots = calloc(numSlots, sizeof(void*));
+
+  if (pNewQueue->ppSlots == NULL) {
+    free(pNewQueue);
+    return NULL;
+  }
+
+  pNewQueue->head = 0;
+  pNewQueue->cachedTail = 0;
+  pNewQueue->tail = 0;
+  pNewQueue->cachedHead = 0;
+  pNewQueue->mask = numSlots - 1;
+
+  return pNewQueue;
+}
+
+// Returns the number of items in pQueue.
+int RingQueue_count(RingQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  size_t head = __atomic_load_n(&pQueue->head, __ATOMIC_ACQUIRE);
+  size_t tail = __atomic_load_n(&pQueue->tail, __ATOMIC_ACQUIRE);
+
+  return (int) (tail - head);
+}
+
+// Adds item to the back of pQueue. Must only be called by the producer thread.
+// Returns 0 on success, -1 if pQueue is full.
+int RingQueue_push(RingQueue* pQueue, void* pItem) {
+  assert(pQueue != NULL);
+
+  size_t tail = pQueue->tail;
+
+  if (tail - pQueue->cachedHead > pQueue->mask) {
+    // Queue looks full, refresh the snapshot of how far the consumer has read
+    pQueue->cachedHead = __atomic_load_n(&pQueue->head, __ATOMIC_ACQUIRE);
+
+    if (tail - pQueue->cachedHead > pQueue->mask) {
+      return -1; // Failure, queue is full
+    }
+  }
+
+  pQueue->ppSlots[tail & pQueue->mask] = pItem;
+
+  // Publish the slot to the consumer
+  __atomic_store_n(&pQueue->tail, tail + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Return the front item and take it out of pQueue. Must only be called by the consumer thread.
+// Return NULL if pQueue is empty.
+void* RingQueue_pop(RingQueue* pQueue) {
+  assert(pQueue != NULL);
+
+  size_t head = pQueue->head;
+
+  if (head == pQueue->cachedTail) {
+    // Queue looks empty, refresh the snapshot of how far the producer has written
+    pQueue->cachedTail = __atomic_load_n(&pQueue->tail, __ATOMIC_ACQUIRE);
+
+    if (head == pQueue->cachedTail) {
+      return NULL;
+    }
+  }
+
+  void* pItem = pQueue->ppSlots[head & pQueue->mask];
+
+  // Hand the slot back to the producer
+  __atomic_store_n(&pQueue->head, head + 1, __ATOMIC_RELEASE);
+  return pItem;
+}
+
+// Delete pQueue, invoking pItemFreeFn on each item still in it.
+void RingQueue_free(RingQueue* pQueue, FREE_FN pItemFreeFn) {
+  assert(pQueue != NULL);
+  assert(pItemFreeFn != NULL);
+
+  void* pItem = NULL;
+
+  while ((pItem = RingQueue_pop(pQueue)) != NULL) {
+    (*pItemFreeFn)(pItem);
+  }
+
+  free(pQueue->ppSlots);
+  free(pQueue);
+  return;
+}
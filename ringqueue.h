@@ -0,0 +1,55 @@
+// A lock-free queue for exactly one producer thread and one consumer thread
+#ifndef _RINGQUEUE_H_
+#define _RINGQUEUE_H_
+#include <stddef.h>
+#include "list.h"
+
+// Size of a cache line, used to keep the producer and consumer indices on separate lines
+#define RING_QUEUE_CACHE_LINE_SIZE 64
+
+typedef struct RingQueue_s RingQueue;
+struct RingQueue_s {
+    // Index of the next slot to be read, only written by the consumer
+    size_t head;
+
+    // The consumer's last snapshot of tail, so it only reads tail when the queue looks empty
+    size_t cachedTail;
+
+    char consumerPadding[RING_QUEUE_CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+
+    // Index of the next slot to be written, only written by the producer
+    size_t tail;
+
+    // The producer's last snapshot of head, so it only reads head when the queue looks full
+    size_t cachedHead;
+
+    char producerPadding[RING_QUEUE_CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+
+    // Number of slots minus one, the number of slots is always a power of two
+    size_t mask;
+
+    // Array of slots, indices are reduced with mask
+    void** ppSlots;
+};
+
+// Makes a new, empty queue that can hold at least capacity items, and returns its reference on success.
+// Returns a NULL pointer on failure.
+RingQueue* RingQueue_create(size_t capacity);
+
+// Returns the number of items in pQueue.
+// Only exact when called by the producer or consumer while the other thread is idle.
+int RingQueue_count(RingQueue* pQueue);
+
+// Adds item to the back of pQueue. Must only be called by the producer thread.
+// Returns 0 on success, -1 if pQueue is full.
+int RingQueue_push(RingQueue* pQueue, void* pItem);
+
+// Return the front item and take it out of pQueue. Must only be called by the consumer thread.
+// Return NULL if pQueue is empty.
+void* RingQueue_pop(RingQueue* pQueue);
+
+// Delete pQueue, invoking pItemFreeFn on each item still in it.
+// Must not be called while the producer or consumer is using pQueue.
+void RingQueue_free(RingQueue* pQueue, FREE_FN pItemFreeFn);
+
+#endif
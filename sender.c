@@ -1,158 +1,737 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include "sender.h"
-#include "threadsafelist.h"
+#include "messagequeue.h"
+#include "messagepool.h"
+#include "reliability.h"
+#include "peer.h"
+#include "compression.h"
+#include "timerwheel.h"
+#include "heartbeat.h"
+#include "lowlatency.h"
+
+// Number of ends of admitted messages in the history kept, by sequence number, more than a window holds
+#define SENDER_HISTORY_ENDS (RELIABILITY_WINDOW_SIZE * 2)
+
+// Most messages packed into one coalesced datagram
+#define SENDER_MAX_MESSAGES_PER_DATAGRAM 32
+
+// Most parts of a datagram: a coalesced header, then a header and data per message
+#define SENDER_MAX_PARTS_PER_DATAGRAM (2 * SENDER_MAX_MESSAGES_PER_DATAGRAM + 1)
+
+// Messages to be sent, oldest first, each with the header sent before its data
+typedef struct {
+  Message* messages[SENDER_MAX_PENDING_MESSAGES];
+  MessageHeader headers[SENDER_MAX_PENDING_MESSAGES];
+  int count;
+
+  // Number of messages at the front already sent
+  int numSent;
+} OutgoingMessages;
+
+// Most datagrams passed to one system call, each datagram packed being sent once per peer,
+// the most sendmmsg takes at once
+#define SENDER_MAX_FANOUT_DATAGRAMS 1024
+
+// Messages to be sent, with the datagrams describing them to sendmmsg
+typedef struct {
+  // New messages taken from the queue, some of which may be held back to share a datagram with later ones
+  OutgoingMessages pending;
+
+  // Messages sent before that the reliability layer found lost
+  OutgoingMessages retransmissions;
+
+  // Remote users the messages are sent to
+  PeerTable* pPeers;
+
+  // Set if sent messages are kept by the reliability layer of each peer rather than recycled
+  bool isReliable;
+
+  // Peers that have not sent the exit command, found again every time messages are sent
+  Peer* pActivePeers[PEER_MAX_PEERS];
+  int numActivePeers;
+
+  // Datagrams packed for the next sendmmsg calls, with the number of messages each carries
+  // Every packed datagram is sent to each of its destinations from datagrams, which only differ in their address
+  MessageHeader coalescedHeaders[SENDER_MAX_BATCH_SIZE];
+  struct iovec parts[SENDER_MAX_BATCH_SIZE * SENDER_MAX_PARTS_PER_DATAGRAM];
+  struct msghdr packedDatagrams[SENDER_MAX_BATCH_SIZE];
+  int numDatagramMessages[SENDER_MAX_BATCH_SIZE];
+  struct mmsghdr datagrams[SENDER_MAX_FANOUT_DATAGRAMS];
+
+  // Compressed data of packed datagrams, sent in place of their messages when smaller
+  char compressedData[SENDER_MAX_BATCH_SIZE][MESSAGE_DATAGRAM_MAX_SIZE];
+
+  // The dictionary of the datagrams being packed, followed by the data of the one being compressed
+  char compressionBuffer[COMPRESSION_DICTIONARY_SIZE + MESSAGE_DATAGRAM_MAX_SIZE];
+  int dictionaryLength;
+
+  // Position in the history of the end of the dictionary
+  uint64_t dictionaryEnd;
+
+  // Positions in the dictionary, copied for each datagram compressed with it
+  CompressionTable dictionaryTable;
+  CompressionTable table;
+
+  // Data of every admitted message in order, to take dictionaries from, or NULL without them
+  // The position in it of the end of each admitted message is kept by sequence number
+  CompressionHistory* pHistory;
+  uint64_t historyEnds[SENDER_HISTORY_ENDS];
+
+  // Deadlines of the sender, whose nearest one bounds the wait for new messages
+  TimerWheel timers;
+
+  // Expires at the coalescing deadline of the oldest message held back, setting isCoalescingDue
+  Timer coalescingTimer;
+  bool isCoalescingDue;
+
+  // Expires every heartbeat interval, setting isHeartbeatDue
+  Timer heartbeatTimer;
+  bool isHeartbeatDue;
+} SendingMessageBatch;
 
 static pthread_t s_threadSender;
-static pthread_cond_t s_messageToSendCondition = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t s_messageToSendMutex = PTHREAD_MUTEX_INITIALIZER;
+static SenderStatistics s_statistics;
+static SenderThreadArguments* s_pArguments = NULL;
 
-// Free any remaining memory and ensure mutex is unlocked
+// Large, so kept off the thread's stack
+static SendingMessageBatch s_batch;
+
+// Free any remaining memory
 static void cleanup(void* args) {
-  char** sendingMessageAddress = args;
-  char* sendingMessage = *sendingMessageAddress;
+  Sender_release();
+  return;
+}
 
-  if (sendingMessage != NULL) {
-    free(sendingMessage);
+// Returns the earlier of two timeouts, either of which may be MESSAGE_QUEUE_WAIT_FOREVER
+static int earliestTimeout(int first, int second) {
+  if (first == MESSAGE_QUEUE_WAIT_FOREVER) {
+    return second;
   }
 
-  pthread_mutex_trylock(&s_messageToSendMutex);
-  pthread_mutex_unlock(&s_messageToSendMutex);
+  if (second == MESSAGE_QUEUE_WAIT_FOREVER) {
+    return first;
+  }
 
+  return (first < second) ? first : second;
+}
+
+// Flags that the messages held back for coalescing are due
+static void expireCoalescing(void* pContext) {
+  SendingMessageBatch* pBatch = pContext;
+  pBatch->isCoalescingDue = true;
   return;
 }
 
-// The thread to send UDP messages
-void* senderThread(void* args) {
-  int status = 0;
-  SenderThreadArguments* senderArguments = args;
-  List* pSendingMessagesList = senderArguments->pSendingMessagesList;
-  int socketDescriptor = senderArguments->socketDescriptor;
-  int remotePort = senderArguments->remotePort;
-  char* remoteHostName = senderArguments->remoteHostName;
+// Flags that heartbeats are due
+static void expireHeartbeat(void* pContext) {
+  SendingMessageBatch* pBatch = pContext;
+  pBatch->isHeartbeatDue = true;
+  return;
+}
 
-  char* sendingMessage = NULL;
-  char** sendingMessageAddress = &sendingMessage;
+// Keeps the coalescing timer set to the deadline of the oldest message held back, if any
+static void scheduleCoalescing(SendingMessageBatch* pBatch, int coalesceDeadline) {
+  OutgoingMessages* pPending = &pBatch->pending;
 
-  pthread_cleanup_push(cleanup, sendingMessageAddress);
+  if (coalesceDeadline == SENDER_NO_COALESCING || pPending->count == 0) {
+    TimerWheel_cancel(&pBatch->timers, &pBatch->coalescingTimer);
+  } else {
+    uint64_t deadline = pPending->messages[0]->queuedTime + (uint64_t) coalesceDeadline * 1000000;
+    TimerWheel_schedule(&pBatch->timers, &pBatch->coalescingTimer, deadline);
+  }
 
-  struct addrinfo* addressResults = NULL;
-  struct sockaddr_in* result = NULL;
-  struct addrinfo hints;
-  struct sockaddr_in remoteAddress;
+  return;
+}
 
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_DGRAM;
+// Fills pHeader with the header to send with pMessage, saying compressed datagrams are accepted if they are
+static void encodeHeader(Message* pMessage, MessageHeader* pHeader) {
+  Message_encodeHeader(pMessage, pHeader);
 
-  // Get address of remote user
-  status = getaddrinfo(remoteHostName, NULL, &hints, &addressResults);
+  if (s_pArguments->compression != COMPRESSION_OFF) {
+    pHeader->flags |= MESSAGE_FLAG_ACCEPTS_COMPRESSION;
+  }
 
-  if (status) {
-    fputs("[Error]: could not get address info of remote host name\n", stdout);
-    exit(1);
+  return;
+}
+
+// Describes the outgoing messages from index first onwards as the parts of one datagram,
+// coalescing as many as fit if isCoalescing is set
+// Returns the number of messages the datagram carries
+static int packDatagram(SendingMessageBatch* pBatch, OutgoingMessages* pOutgoing, int first, int datagramIndex, struct iovec* pParts, bool isCoalescing) {
+  struct msghdr* pDatagram = &pBatch->packedDatagrams[datagramIndex];
+  int count = 1;
+  int size = MESSAGE_HEADER_SIZE + pOutgoing->messages[first]->length;
+  int maxDatagramSize = Message_getMaxDatagramSize();
+
+  if (isCoalescing) {
+    while (first + count < pOutgoing->count && count < SENDER_MAX_MESSAGES_PER_DATAGRAM) {
+      int messageSize = MESSAGE_HEADER_SIZE + pOutgoing->messages[first + count]->length;
+
+      if (MESSAGE_HEADER_SIZE + size + messageSize > maxDatagramSize) {
+        break;
+      }
+
+      size += messageSize;
+      count++;
+    }
   }
 
-  result = (struct sockaddr_in*) addressResults->ai_addr;
+  pDatagram->msg_iov = pParts;
+  pDatagram->msg_iovlen = 0;
 
-  remoteAddress.sin_family = AF_INET;
-  remoteAddress.sin_port = htons(remotePort);
-  remoteAddress.sin_addr = ((struct in_addr) result->sin_addr);
+  // A lone message is sent as a plain data datagram
+  if (count > 1) {
+    Message_encodeCoalescedHeader(size, &pBatch->coalescedHeaders[datagramIndex]);
 
-  fputs("[Sending to remote user at ", stdout);
-  fputs(inet_ntoa(remoteAddress.sin_addr), stdout);
-  fputs("]\n", stdout);
-  fflush(stdout);
+    if (s_pArguments->compression != COMPRESSION_OFF) {
+      pBatch->coalescedHeaders[datagramIndex].flags |= MESSAGE_FLAG_ACCEPTS_COMPRESSION;
+    }
 
-  freeaddrinfo(addressResults);
-  addressResults = NULL;
-  result = NULL;
+    pParts[0].iov_base = &pBatch->coalescedHeaders[datagramIndex];
+    pParts[0].iov_len = MESSAGE_HEADER_SIZE;
+    pDatagram->msg_iovlen = 1;
+  }
 
-  while (1) {
-    // If there are no messages to send, wait until one arrives
-    if (ThreadSafeList_count(pSendingMessagesList) == 0) {
-      status = pthread_mutex_lock(&s_messageToSendMutex);
+  for (int i = first; i < first + count; i++) {
+    pParts[pDatagram->msg_iovlen].iov_base = &pOutgoing->headers[i];
+    pParts[pDatagram->msg_iovlen].iov_len = MESSAGE_HEADER_SIZE;
+    pParts[pDatagram->msg_iovlen + 1].iov_base = pOutgoing->messages[i]->data;
+    pParts[pDatagram->msg_iovlen + 1].iov_len = pOutgoing->messages[i]->length;
+    pDatagram->msg_iovlen += 2;
+  }
+
+  return count;
+}
+
+// Returns true if the datagram packed at datagramIndex, carrying count messages, could still coalesce
+// a message of a single byte
+static bool canCoalesceMore(SendingMessageBatch* pBatch, int datagramIndex, int count) {
+  struct msghdr* pDatagram = &pBatch->packedDatagrams[datagramIndex];
+
+  // A lone message is sent without the coalesced header it would take with another
+  int size = (count == 1) ? MESSAGE_HEADER_SIZE : 0;
+
+  for (size_t i = 0; i < pDatagram->msg_iovlen; i++) {
+    size += pDatagram->msg_iov[i].iov_len;
+  }
+
+  return count < SENDER_MAX_MESSAGES_PER_DATAGRAM && size + MESSAGE_HEADER_SIZE + 1 <= Message_getMaxDatagramSize();
+}
+
+// Returns true if every one of the numDestinations peers in ppDestinations accepts compressed datagrams
+static bool allAcceptCompression(Peer** ppDestinations, int numDestinations) {
+  for (int i = 0; i < numDestinations; i++) {
+    if (!Peer_acceptsCompression(ppDestinations[i])) {
+      return false;
+    }
+  }
+
+  return numDestinations > 0;
+}
+
+// Prepares the dictionary for datagrams to the numDestinations peers in ppDestinations: the traffic before the
+// oldest message one of them has not acknowledged, which each of them delivered already, or none
+static void prepareDictionary(SendingMessageBatch* pBatch, Peer** ppDestinations, int numDestinations) {
+  pBatch->dictionaryLength = 0;
+
+  if (pBatch->pHistory != NULL) {
+    uint32_t cumulativeAck = Reliability_getCumulativeAck(ppDestinations[0]->pReliability);
+
+    for (int i = 1; i < numDestinations; i++) {
+      uint32_t peerCumulativeAck = Reliability_getCumulativeAck(ppDestinations[i]->pReliability);
+      cumulativeAck = ((int32_t) (peerCumulativeAck - cumulativeAck) < 0) ? peerCumulativeAck : cumulativeAck;
+    }
+
+    // The end of the dictionary is kept well within the history, so it is still held by the peer
+    // however much it delivered since
+    uint64_t end = (cumulativeAck == 0) ? 0 : pBatch->historyEnds[(cumulativeAck - 1) % SENDER_HISTORY_ENDS];
+
+    if (end > 0 && pBatch->pHistory->numBytes - end <= COMPRESSION_HISTORY_SIZE / 2) {
+      pBatch->dictionaryLength = CompressionHistory_copyDictionary(pBatch->pHistory, end, pBatch->compressionBuffer);
+      pBatch->dictionaryEnd = end;
+    }
+
+    pBatch->dictionaryLength = (pBatch->dictionaryLength > 0) ? pBatch->dictionaryLength : 0;
+  }
+
+  Compression_prepare(&pBatch->dictionaryTable, pBatch->compressionBuffer, pBatch->dictionaryLength);
+  return;
+}
 
-      if (status) {
-        fputs("[Error]: could not lock message to send mutex\n", stdout);
+// Compresses the data of a packed datagram, everything after its first header, sending it in place of
+// the data if it is smaller
+static void compressDatagram(SendingMessageBatch* pBatch, int datagramIndex) {
+  struct msghdr* pDatagram = &pBatch->packedDatagrams[datagramIndex];
+  char* pData = pBatch->compressionBuffer + pBatch->dictionaryLength;
+  int length = 0;
+
+  for (int i = 1; i < pDatagram->msg_iovlen; i++) {
+    memcpy(pData + length, pDatagram->msg_iov[i].iov_base, pDatagram->msg_iov[i].iov_len);
+    length += pDatagram->msg_iov[i].iov_len;
+  }
+
+  char* pCompressed = pBatch->compressedData[datagramIndex];
+  int prefixSize = (pBatch->dictionaryLength > 0) ? COMPRESSION_DICTIONARY_PREFIX_SIZE : 0;
+
+  // Only data made smaller is sent compressed
+  memcpy(&pBatch->table, &pBatch->dictionaryTable, sizeof(CompressionTable));
+  int compressedLength = Compression_compress(
+    &pBatch->table, pBatch->compressionBuffer, pBatch->dictionaryLength, length,
+    pCompressed + prefixSize, length - prefixSize - 1
+  );
+
+  s_statistics.numMessagesCompressed += pBatch->numDatagramMessages[datagramIndex];
+  s_statistics.numBytesBeforeCompression += length;
+
+  if (compressedLength == -1) {
+    s_statistics.numDatagramsIncompressible++;
+    s_statistics.numBytesAfterCompression += length;
+    return;
+  }
+
+  // A lone message's header is shared with the datagrams sent before, so the compressed datagram gets a copy
+  MessageHeader* pHeader = &pBatch->coalescedHeaders[datagramIndex];
+
+  if (pDatagram->msg_iov[0].iov_base != pHeader) {
+    memcpy(pHeader, pDatagram->msg_iov[0].iov_base, MESSAGE_HEADER_SIZE);
+  }
+
+  pHeader->flags |= MESSAGE_FLAG_COMPRESSED;
+
+  if (prefixSize > 0) {
+    uint32_t end = htonl((uint32_t) pBatch->dictionaryEnd);
+    memcpy(pCompressed, &end, sizeof(end));
+    pHeader->flags |= MESSAGE_FLAG_DICTIONARY;
+    s_statistics.numDatagramsWithDictionary++;
+  }
+
+  pDatagram->msg_iov[0].iov_base = pHeader;
+  pDatagram->msg_iov[1].iov_base = pCompressed;
+  pDatagram->msg_iov[1].iov_len = prefixSize + compressedLength;
+  pDatagram->msg_iovlen = 2;
+
+  s_statistics.numDatagramsCompressed++;
+  s_statistics.numBytesAfterCompression += prefixSize + compressedLength;
+  return;
+}
+
+// Sends the first numDatagrams packed datagrams of pBatch, made of the outgoing messages not yet sent,
+// to each of the numDestinations peers in ppDestinations
+// The messages are recorded as sent by the reliability layer of each peer that keeps them, or recycled once sent
+static void sendDatagrams(SendingMessageBatch* pBatch, OutgoingMessages* pOutgoing, int numDatagrams, Peer** ppDestinations, int numDestinations, SenderThreadArguments* pArguments) {
+  int numFanoutDatagrams = numDatagrams * numDestinations;
+  int nextFanoutDatagram = 0;
+  int numMessages = 0;
+
+  for (int i = 0; i < numDatagrams; i++) {
+    numMessages += pBatch->numDatagramMessages[i];
+  }
+
+  // Record the messages as sent before the kernel has them, as the peer may acknowledge them before sendmmsg returns
+  if (pBatch->isReliable) {
+    uint64_t now = Message_getTimestamp();
+
+    for (int i = 0; i < numDestinations; i++) {
+      Reliability_markSent(ppDestinations[i]->pReliability, pOutgoing->messages + pOutgoing->numSent, numMessages, now);
+    }
+  }
+
+  while (nextFanoutDatagram < numFanoutDatagrams) {
+    // Address a copy of each packed datagram to every destination in turn, so one call carries a datagram to all of them
+    int count = numFanoutDatagrams - nextFanoutDatagram;
+    count = (count < SENDER_MAX_FANOUT_DATAGRAMS) ? count : SENDER_MAX_FANOUT_DATAGRAMS;
+
+    for (int i = 0; i < count; i++) {
+      int fanoutDatagram = nextFanoutDatagram + i;
+      struct msghdr* pDatagram = &pBatch->datagrams[i].msg_hdr;
+
+      *pDatagram = pBatch->packedDatagrams[fanoutDatagram / numDestinations];
+      pDatagram->msg_name = &ppDestinations[fanoutDatagram % numDestinations]->address;
+      pDatagram->msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    int numSent = 0;
+
+    while (numSent < count) {
+      // Send UDP messages to the remote users, as many as the kernel takes in one call
+      int status;
+
+      if (pArguments->send != NULL) {
+        status = pArguments->send(pArguments->socketDescriptor, &pBatch->datagrams[numSent], count - numSent);
+      } else {
+        status = sendmmsg(pArguments->socketDescriptor, &pBatch->datagrams[numSent], count - numSent, 0);
+      }
+
+      if (status == -1) {
+        fputs("[Error]: could not send message\n", stdout);
         exit(1);
       }
 
-      status = pthread_cond_wait(&s_messageToSendCondition, &s_messageToSendMutex);
+      s_statistics.numSendCalls++;
+      numSent += status;
+    }
 
-      if (status) {
-        fputs("[Error]: could not wait on message to send condition variable\n", stdout);
-        exit(1);
+    nextFanoutDatagram += count;
+  }
+
+  if (!pBatch->isReliable) {
+    for (int i = pOutgoing->numSent; i < pOutgoing->numSent + numMessages; i++) {
+      MessagePool_recycle(pOutgoing->messages[i]);
+    }
+  }
+
+  pOutgoing->numSent += numMessages;
+  s_statistics.numDatagramsSent += numFanoutDatagrams;
+  s_statistics.numMessagesSent += (unsigned long) numMessages * numDestinations;
+  return;
+}
+
+// Sends the outgoing messages to each of the numDestinations peers in ppDestinations, packing up to batchSize
+// datagrams per system call
+// Unless flushAll is set, a coalesced datagram made of the newest messages that still has room for another
+// message is held back, and its messages are left outgoing
+static void sendOutgoingMessages(SendingMessageBatch* pBatch, OutgoingMessages* pOutgoing, Peer** ppDestinations, int numDestinations, SenderThreadArguments* pArguments, bool flushAll) {
+  bool isCoalescing = (pArguments->coalesceDeadline != SENDER_NO_COALESCING);
+  bool isCompressing = false;
+
+  // Datagrams are only compressed once every destination said it accepts them
+  if (pArguments->compression != COMPRESSION_OFF && pOutgoing->numSent < pOutgoing->count && allAcceptCompression(ppDestinations, numDestinations)) {
+    uint64_t start = Message_getTimestamp();
+    prepareDictionary(pBatch, ppDestinations, numDestinations);
+    s_statistics.compressionTime += Message_getTimestamp() - start;
+    isCompressing = true;
+  }
+
+  while (pOutgoing->numSent < pOutgoing->count) {
+    int numDatagrams = 0;
+    int next = pOutgoing->numSent;
+    struct iovec* pParts = pBatch->parts;
+
+    while (numDatagrams < pArguments->batchSize && next < pOutgoing->count) {
+      int count = packDatagram(pBatch, pOutgoing, next, numDatagrams, pParts, isCoalescing);
+
+      if (isCoalescing && !flushAll && next + count == pOutgoing->count && canCoalesceMore(pBatch, numDatagrams, count)) {
+        break;
       }
 
-      status = pthread_mutex_unlock(&s_messageToSendMutex);
+      pBatch->numDatagramMessages[numDatagrams] = count;
+      pParts += pBatch->packedDatagrams[numDatagrams].msg_iovlen;
 
-      if (status) {
-        fputs("[Error]: could not unlock message to send mutex\n", stdout);
-        exit(1);
+      if (isCompressing) {
+        uint64_t start = Message_getTimestamp();
+        compressDatagram(pBatch, numDatagrams);
+        s_statistics.compressionTime += Message_getTimestamp() - start;
       }
-    }
 
-    // Get message from messages to send queue
-    sendingMessage = ThreadSafeList_trim(pSendingMessagesList);
+      next += count;
+      numDatagrams++;
+    }
 
-    if (sendingMessage == NULL) {
-      fputs("[Error]: sending message was null\n", stdout);
-      exit(1);
+    if (numDatagrams == 0) {
+      break;
     }
 
-    // Send UDP message to the remote user
-		status = sendto(
-      socketDescriptor, sendingMessage, strlen(sendingMessage),
-			0, (struct sockaddr *) &remoteAddress, sizeof(remoteAddress)
+    sendDatagrams(pBatch, pOutgoing, numDatagrams, ppDestinations, numDestinations, pArguments);
+  }
+
+  // Move the held messages to the front for the next call
+  pOutgoing->count -= pOutgoing->numSent;
+  memmove(pOutgoing->messages, pOutgoing->messages + pOutgoing->numSent, sizeof(Message*) * pOutgoing->count);
+  memmove(pOutgoing->headers, pOutgoing->headers + pOutgoing->numSent, sizeof(MessageHeader) * pOutgoing->count);
+  pOutgoing->numSent = 0;
+  return;
+}
+
+// Sends again to pPeer every message its reliability layer found lost or timed out, up to a full window of them,
+// so messages the receiver thread finds lost meanwhile wait for the next call
+static void sendRetransmissions(SendingMessageBatch* pBatch, Peer* pPeer, SenderThreadArguments* pArguments) {
+  OutgoingMessages* pRetransmissions = &pBatch->retransmissions;
+  int count = 0;
+  int numTaken = 0;
+
+  Reliability_recycleAcked(pPeer->pReliability);
+
+  do {
+    count = Reliability_takeRetransmissions(
+      pPeer->pReliability, pRetransmissions->messages,
+      SENDER_MAX_PENDING_MESSAGES, Message_getTimestamp()
     );
 
-    if (status == -1) {
-      fputs("[Error]: could not send message\n", stdout);
+    for (int i = 0; i < count; i++) {
+      encodeHeader(pRetransmissions->messages[i], &pRetransmissions->headers[i]);
+    }
+
+    pRetransmissions->count = count;
+    sendOutgoingMessages(pBatch, pRetransmissions, &pPeer, 1, pArguments, true);
+    numTaken += count;
+  } while (count == SENDER_MAX_PENDING_MESSAGES && numTaken < RELIABILITY_WINDOW_SIZE);
+
+  return;
+}
+
+// Sends a heartbeat to each of the numDestinations peers in ppDestinations, all in one system call
+static void sendHeartbeats(Peer** ppDestinations, int numDestinations, SenderThreadArguments* pArguments) {
+  MessageHeader headers[PEER_MAX_PEERS];
+  char data[PEER_MAX_PEERS][HEARTBEAT_DATA_SIZE];
+  struct iovec parts[PEER_MAX_PEERS][2];
+  struct mmsghdr datagrams[PEER_MAX_PEERS];
+  uint64_t now = Message_getTimestamp();
+
+  memset(datagrams, 0, sizeof(datagrams));
+
+  for (int i = 0; i < numDestinations; i++) {
+    Heartbeat_encode(ppDestinations[i]->pHeartbeat, &headers[i], data[i], now);
+    Message_encodeDatagramSize(&headers[i], Message_getPathDatagramSize());
+
+    parts[i][0].iov_base = &headers[i];
+    parts[i][0].iov_len = MESSAGE_HEADER_SIZE;
+    parts[i][1].iov_base = data[i];
+    parts[i][1].iov_len = HEARTBEAT_DATA_SIZE;
+
+    datagrams[i].msg_hdr.msg_name = &ppDestinations[i]->address;
+    datagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    datagrams[i].msg_hdr.msg_iov = parts[i];
+    datagrams[i].msg_hdr.msg_iovlen = 2;
+  }
+
+  // A heartbeat that is not sent only counts as lost, so a failure is not fatal
+  if (numDestinations > 0) {
+    if (pArguments->send != NULL) {
+      pArguments->send(pArguments->socketDescriptor, datagrams, numDestinations);
+    } else {
+      sendmmsg(pArguments->socketDescriptor, datagrams, numDestinations, 0);
+    }
+  }
+
+  return;
+}
+
+// Finds the peers that have not sent the exit command, which every new message is sent to
+static void findActivePeers(SendingMessageBatch* pBatch) {
+  pBatch->numActivePeers = 0;
+
+  for (int i = 0; i < PeerTable_count(pBatch->pPeers); i++) {
+    Peer* pPeer = PeerTable_get(pBatch->pPeers, i);
+
+    if (!Peer_hasLeft(pPeer)) {
+      pBatch->pActivePeers[pBatch->numActivePeers] = pPeer;
+      pBatch->numActivePeers++;
+    }
+  }
+
+  return;
+}
+
+// Prepares to send messages with the given arguments, for the sender thread or an event loop
+void Sender_prepare(SenderThreadArguments* pSenderArguments) {
+  s_pArguments = pSenderArguments;
+  s_batch.pending.count = 0;
+  s_batch.pending.numSent = 0;
+  s_batch.pPeers = pSenderArguments->pPeers;
+  s_batch.isReliable = (PeerTable_get(s_batch.pPeers, 0)->pReliability != NULL);
+  memset(s_batch.packedDatagrams, 0, sizeof(s_batch.packedDatagrams));
+  TimerWheel_init(&s_batch.timers, Message_getTimestamp());
+  Timer_init(&s_batch.coalescingTimer, expireCoalescing, &s_batch);
+  s_batch.isCoalescingDue = false;
+  Timer_init(&s_batch.heartbeatTimer, expireHeartbeat, &s_batch);
+  s_batch.isHeartbeatDue = false;
+
+  if (pSenderArguments->heartbeatInterval != HEARTBEAT_DISABLED) {
+    uint64_t deadline = Message_getTimestamp() + (uint64_t) pSenderArguments->heartbeatInterval * 1000000;
+    TimerWheel_schedule(&s_batch.timers, &s_batch.heartbeatTimer, deadline);
+  }
+
+  // Only traffic delivered in order is the same on both ends, so dictionaries need the reliability layer
+  if (pSenderArguments->compression == COMPRESSION_DICTIONARY && s_batch.isReliable) {
+    s_batch.pHistory = CompressionHistory_create();
+
+    if (s_batch.pHistory == NULL) {
+      fputs("[Error]: could not allocate memory for compression history\n", stdout);
       exit(1);
     }
+  }
+
+  return;
+}
 
-    free(sendingMessage);
-    sendingMessage = NULL;
+// Returns the number of new messages the sender can take, limited by the room left for pending
+// messages and, with the reliability layer, by the fullest window of the peers still there
+int Sender_getRoom() {
+  int room = SENDER_MAX_PENDING_MESSAGES - s_batch.pending.count;
+
+  if (s_batch.isReliable) {
+    findActivePeers(&s_batch);
+
+    for (int i = 0; i < s_batch.numActivePeers; i++) {
+      int windowRoom = Reliability_getSendRoom(s_batch.pActivePeers[i]->pReliability);
+      room = (windowRoom < room) ? windowRoom : room;
+    }
   }
 
-  pthread_cleanup_pop(1);
+  return room;
+}
 
-  return NULL;
+// Returns the milliseconds until the sender must run again without new messages, to send messages held
+// for coalescing or sent again after a timeout, or heartbeats, or MESSAGE_QUEUE_WAIT_FOREVER if nothing is due
+int Sender_getTimeout() {
+  uint64_t now = Message_getTimestamp();
+
+  // Held messages wait for more to share their datagram only until the oldest one's deadline,
+  // and heartbeats are sent at every interval
+  int timeout = TimerWheel_getTimeout(&s_batch.timers, now);
+
+  // Wake up in time to send again any message whose retransmission timeout expires
+  if (s_batch.isReliable) {
+    findActivePeers(&s_batch);
+
+    for (int i = 0; i < s_batch.numActivePeers; i++) {
+      timeout = earliestTimeout(timeout, Reliability_getTimeout(s_batch.pActivePeers[i]->pReliability, now));
+    }
+  }
+
+  return timeout;
 }
 
-// Signals the sender thread that there is a message to send
-void Sender_signalMessageToSend() {
-  int status = 0;
+// Takes count new messages from ppMessages, at most Sender_getRoom(), and sends every message that is due:
+// new messages not held for coalescing, earlier messages whose deadline passed, and messages found lost
+void Sender_send(Message** ppMessages, int count) {
+  OutgoingMessages* pPending = &s_batch.pending;
+  int coalesceDeadline = s_pArguments->coalesceDeadline;
 
-  status = pthread_mutex_lock(&s_messageToSendMutex);
+  findActivePeers(&s_batch);
 
-  if (status) {
-    fputs("[Error]: could not lock message to send mutex\n", stdout);
-    exit(1);
+  if (s_batch.isReliable && s_batch.numActivePeers == 0) {
+    // No one is left to keep the messages for
+    for (int i = 0; i < count; i++) {
+      MessagePool_recycle(ppMessages[i]);
+    }
+
+    count = 0;
   }
 
-  status = pthread_cond_signal(&s_messageToSendCondition);
+  memcpy(pPending->messages + pPending->count, ppMessages, sizeof(Message*) * count);
 
-  if (status) {
-    fputs("[Error]: could not signal message to send condition variable\n", stdout);
-    exit(1);
+  if (s_batch.isReliable) {
+    // Every peer's reliability layer holds the messages until that peer acknowledges them
+    // Peers admit the same messages from the start, so they number them alike and share one header
+    for (int i = pPending->count; i < pPending->count + count && s_batch.numActivePeers > 1; i++) {
+      MessagePool_share(pPending->messages[i], s_batch.numActivePeers - 1);
+    }
+
+    for (int i = 0; i < s_batch.numActivePeers; i++) {
+      Reliability_admit(s_batch.pActivePeers[i]->pReliability, pPending->messages + pPending->count, count);
+    }
+
+    // The peers deliver the messages in the order they were numbered, so the history holds the same traffic as theirs
+    for (int i = pPending->count; i < pPending->count + count && s_batch.pHistory != NULL; i++) {
+      Message* pMessage = pPending->messages[i];
+      CompressionHistory_add(s_batch.pHistory, pMessage->data, pMessage->length);
+      s_batch.historyEnds[pMessage->sequence % SENDER_HISTORY_ENDS] = s_batch.pHistory->numBytes;
+    }
   }
 
-  status = pthread_mutex_unlock(&s_messageToSendMutex);
+  for (int i = pPending->count; i < pPending->count + count; i++) {
+    encodeHeader(pPending->messages[i], &pPending->headers[i]);
+  }
 
-  if (status) {
-    fputs("[Error]: could not unlock message to send mutex\n", stdout);
-    exit(1);
+  pPending->count += count;
+
+  if (s_batch.isReliable) {
+    for (int i = 0; i < s_batch.numActivePeers; i++) {
+      sendRetransmissions(&s_batch, s_batch.pActivePeers[i], s_pArguments);
+    }
+  }
+
+  // New messages may have waited in the queue past their deadline already
+  if (!Timer_isScheduled(&s_batch.coalescingTimer)) {
+    scheduleCoalescing(&s_batch, coalesceDeadline);
+  }
+
+  TimerWheel_advance(&s_batch.timers, Message_getTimestamp());
+
+  bool flushAll = (
+    coalesceDeadline == SENDER_NO_COALESCING ||
+    pPending->count == SENDER_MAX_PENDING_MESSAGES ||
+    s_batch.isCoalescingDue
+  );
+
+  sendOutgoingMessages(&s_batch, pPending, s_batch.pActivePeers, s_batch.numActivePeers, s_pArguments, flushAll);
+  s_batch.isCoalescingDue = false;
+  scheduleCoalescing(&s_batch, coalesceDeadline);
+
+  if (s_batch.isHeartbeatDue) {
+    uint64_t deadline = Message_getTimestamp() + (uint64_t) s_pArguments->heartbeatInterval * 1000000;
+
+    sendHeartbeats(s_batch.pActivePeers, s_batch.numActivePeers, s_pArguments);
+    TimerWheel_schedule(&s_batch.timers, &s_batch.heartbeatTimer, deadline);
+    s_batch.isHeartbeatDue = false;
+  }
+
+  return;
+}
+
+// Recycles the messages not yet sent
+// Messages admitted to the reliability layers belong to them, and are recycled when they are freed
+void Sender_release() {
+  OutgoingMessages* pPending = &s_batch.pending;
+
+  while (!s_batch.isReliable && pPending->numSent < pPending->count) {
+    MessagePool_recycle(pPending->messages[pPending->numSent]);
+    pPending->numSent++;
+  }
+
+  pPending->count = 0;
+  pPending->numSent = 0;
+
+  if (s_batch.pHistory != NULL) {
+    CompressionHistory_free(s_batch.pHistory);
+    s_batch.pHistory = NULL;
   }
 
   return;
 }
 
+// The thread to send UDP messages
+void* senderThread(void* args) {
+  SenderThreadArguments* senderArguments = args;
+  MessageQueue* pSendingMessagesQueue = senderArguments->pSendingMessagesQueue;
+  Message* newMessages[SENDER_MAX_PENDING_MESSAGES];
+
+  Sender_prepare(senderArguments);
+  LowLatency_tuneThread(LOW_LATENCY_SENDER);
+
+  pthread_cleanup_push(cleanup, NULL);
+
+  while (1) {
+    int timeout = Sender_getTimeout();
+    int room = Sender_getRoom();
+    int count = 0;
+
+    if (room > 0) {
+      // Get up to a batch of messages from the messages to send queue, waiting until one arrives,
+      // or the receiver thread wakes this thread to send messages again
+      count = MessageQueue_popBatch(pSendingMessagesQueue, (void**) newMessages, room, timeout);
+    } else {
+      // Wait for an acknowledgement to open the window
+      MessageQueue_waitForWake(pSendingMessagesQueue, timeout);
+    }
+
+    Sender_send(newMessages, count);
+  }
+
+  pthread_cleanup_pop(1);
+
+  return NULL;
+}
+
 // Initializes the sender threads
 void Sender_init(SenderThreadArguments* pSenderArguments) {
   int status = 0;
@@ -183,17 +762,11 @@ void Sender_shutdown() {
     fputs("[Error]: could not join with sender thread\n", stdout);
   }
 
-  status = pthread_cond_destroy(&s_messageToSendCondition);
-
-  if (status) {
-    fputs("[Error]: could not destroy message to send condition variable\n", stdout);
-  }
-
-  status = pthread_mutex_destroy(&s_messageToSendMutex);
-
-  if (status) {
-    fputs("[Error]: could not destroy message to send mutex\n", stdout);
-  }
+  return;
+}
 
+// Fills pStatistics with the counters of the sender thread
+void Sender_getStatistics(SenderStatistics* pStatistics) {
+  *pStatistics = s_statistics;
   return;
 }
@@ -1,24 +1,106 @@
 // Manages the thread that sends UDP messages
 #ifndef _SENDER_H_
 #define _SENDER_H_
-#include "threadsafelist.h"
+#include <netinet/in.h>
+#include "messagequeue.h"
 #include "control.h"
+#include "peer.h"
+#include "compression.h"
 
-// Arguments for the sender thread
+// Largest number of messages the sender passes to the kernel in one system call
+#define SENDER_MAX_BATCH_SIZE 64
+
+// Default number of messages the sender passes to the kernel in one system call
+#define SENDER_DEFAULT_BATCH_SIZE 32
+
+// Most messages taken but not yet sent, and most messages sent again at once
+#define SENDER_MAX_PENDING_MESSAGES (SENDER_MAX_BATCH_SIZE * 4)
+
+// Coalescing deadline that disables coalescing, so every message is sent in its own datagram
+#define SENDER_NO_COALESCING -1
+
+// Coalescing deadline used when coalescing is enabled without giving one, in milliseconds
+#define SENDER_DEFAULT_COALESCE_DEADLINE 2
+
+// Declared by sys/socket.h only with _GNU_SOURCE
+struct mmsghdr;
+
+// Sends count datagrams to a socket as sendmmsg does, for an event loop sending by other means
+// Returns the number of datagrams sent, or -1 on failure
+typedef int (*SenderSendFunction)(int socketDescriptor, struct mmsghdr* pDatagrams, int count);
+
+// Arguments for the sender thread, or for an event loop sending in its place
 typedef struct {
-  List* pSendingMessagesList;
+  MessageQueue* pSendingMessagesQueue;
   int socketDescriptor;
-  int remotePort;
-  char remoteHostName[HOSTNAME_MAX_SIZE];
+
+  // Remote users every message is sent to, each with a reliability layer keeping sent messages until
+  // that user acknowledges them, or with none to send each message once
+  PeerTable* pPeers;
+
+  // Most datagrams sent per system call, from 1 to SENDER_MAX_BATCH_SIZE
+  int batchSize;
+
+  // Milliseconds a message may wait for others to share its datagram, or SENDER_NO_COALESCING
+  int coalesceDeadline;
+
+  // Function the datagrams are sent with, or NULL to send them with sendmmsg
+  SenderSendFunction send;
+
+  // Compress datagrams to the peers that accept it, with a dictionary of the traffic they acknowledged
+  // for COMPRESSION_DICTIONARY, which needs the reliability layer
+  CompressionMode compression;
+
+  // Milliseconds between heartbeats to each peer, or HEARTBEAT_DISABLED
+  int heartbeatInterval;
 } SenderThreadArguments;
 
+// Counters of the sender thread
+typedef struct {
+  unsigned long numMessagesSent;
+  unsigned long numDatagramsSent;
+  unsigned long numSendCalls;
+
+  // Number of datagrams sent compressed, those with a dictionary included, and sent as they were
+  // as compressing them did not make them smaller
+  unsigned long numDatagramsCompressed;
+  unsigned long numDatagramsWithDictionary;
+  unsigned long numDatagramsIncompressible;
+
+  // Number of messages in the datagrams compression was tried on, bytes of their data before and after,
+  // and nanoseconds spent compressing them and preparing dictionaries
+  unsigned long numMessagesCompressed;
+  unsigned long long numBytesBeforeCompression;
+  unsigned long long numBytesAfterCompression;
+  uint64_t compressionTime;
+} SenderStatistics;
+
 // Initializes the sender thread
 void Sender_init(SenderThreadArguments* pSenderArguments);
 
-// Signals the sender thread that there is a message to send
-void Sender_signalMessageToSend(void);
-
 // Shutdowns the sender thread and performs necessary cleanup
 void Sender_shutdown(void);
 
+// Prepares to send messages with the given arguments, for the sender thread or an event loop
+void Sender_prepare(SenderThreadArguments* pSenderArguments);
+
+// Returns the number of new messages the sender can take, limited by the room left for pending
+// messages and, with the reliability layer, by the fullest window of the peers still there
+int Sender_getRoom(void);
+
+// Returns the milliseconds until the sender must run again without new messages, to send messages held
+// for coalescing or sent again after a timeout, or MESSAGE_QUEUE_WAIT_FOREVER if nothing is due
+int Sender_getTimeout(void);
+
+// Takes count new messages from ppMessages, at most Sender_getRoom(), and sends every message that is due:
+// new messages not held for coalescing, earlier messages whose deadline passed, and messages found lost
+void Sender_send(Message** ppMessages, int count);
+
+// Recycles the messages not yet sent
+// Messages admitted to the reliability layers belong to them, and are recycled when they are freed
+void Sender_release(void);
+
+// Fills pStatistics with the counters of the sender thread
+void Sender_getStatistics(SenderStatistics* pStatistics);
+
 #endif
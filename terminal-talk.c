@@ -1,24 +1,37 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include "control.h"
-#include "threadsafelist.h"
+#include "options.h"
+#include "messagequeue.h"
+#include "messagepool.h"
+#include "reliability.h"
+#include "peer.h"
+#include "heartbeat.h"
+#include "pathmtu.h"
 #include "input.h"
 #include "output.h"
 #include "sender.h"
 #include "receiver.h"
+#include "eventloop.h"
+#include "relay.h"
+#include "lowlatency.h"
 
 static InputThreadArguments s_inputArguments;
 static OutputThreadArguments s_outputArguments;
 static SenderThreadArguments s_senderArguments;
 static ReceiverThreadArguments s_receiverArguments;
+static EventLoopArguments s_eventLoopArguments;
+static Options s_options;
 
-// Free a message stored in a list
+// Free a message stored in a queue
 static void freeMessage(void* pItem) {
-  free(pItem);
+  MessagePool_recycle((Message*) pItem);
   return;
 }
 
@@ -32,8 +45,258 @@ static void sleepMilliseconds(int msec) {
   return;
 }
 
+// Print the statistics of the reliability layer
+static void printReliabilityStatistics(Reliability* pReliability) {
+  ReliabilityStatistics statistics;
+  Reliability_getStatistics(pReliability, &statistics);
+
+  unsigned long numTransmissions = statistics.numMessagesSent + statistics.numRetransmissions;
+  uint64_t elapsedTime = statistics.lastAckTime - statistics.firstSendTime;
+
+  printf(
+    "[Stats]: reliable messages sent: %lu, retransmitted: %lu (%.2f%%), fast: %lu, timeouts: %lu\n",
+    statistics.numMessagesSent, statistics.numRetransmissions,
+    (numTransmissions > 0) ? 100.0 * statistics.numRetransmissions / numTransmissions : 0.0,
+    statistics.numFastRetransmissions, statistics.numTimeouts
+  );
+  printf(
+    "[Stats]: bytes acknowledged: %llu, goodput: %.0f bytes/s\n",
+    statistics.numBytesAcked,
+    (statistics.lastAckTime > statistics.firstSendTime) ? statistics.numBytesAcked * 1e9 / elapsedTime : 0.0
+  );
+  printf(
+    "[Stats]: round-trip time: smoothed %.3f ms, min %.3f ms, max %.3f ms over %lu samples, timeout %.3f ms\n",
+    statistics.smoothedRtt / 1e6, statistics.minRtt / 1e6, statistics.maxRtt / 1e6,
+    statistics.numRttSamples, statistics.retransmissionTimeout / 1e6
+  );
+  printf(
+    "[Stats]: acknowledgements sent: %lu, received: %lu, messages held for order: %lu, duplicates: %lu\n",
+    statistics.numAcksSent, statistics.numAcksReceived, statistics.numHeldReceived, statistics.numDuplicatesReceived
+  );
+  return;
+}
+
+// Print the statistics of the heartbeats exchanged with one remote user
+static void printHeartbeatStatistics(Heartbeat* pHeartbeat) {
+  HeartbeatStatistics statistics;
+  Heartbeat_getStatistics(pHeartbeat, &statistics);
+
+  uint64_t now = Message_getTimestamp();
+
+  printf(
+    "[Stats]: heartbeats sent: %lu, echoed: %lu, lost: %lu (%.2f%% smoothed), echoes sent: %lu, last heard: ",
+    statistics.numHeartbeatsSent, statistics.numEchoesReceived, statistics.numHeartbeatsLost,
+    100.0 * statistics.lossRate, statistics.numEchoesSent
+  );
+
+  if (statistics.lastHeardTime > 0 && now > statistics.lastHeardTime) {
+    printf("%.3f s ago\n", (now - statistics.lastHeardTime) / 1e9);
+  } else {
+    printf("never\n");
+  }
+
+  if (statistics.numRttSamples == 0) {
+    return;
+  }
+
+  printf(
+    "[Stats]: heartbeat round-trip time: latest %.3f ms, smoothed %.3f ms, min %.3f ms, max %.3f ms over %lu samples, jitter %.3f ms\n",
+    statistics.latestRtt / 1e6, statistics.smoothedRtt / 1e6, statistics.minRtt / 1e6, statistics.maxRtt / 1e6,
+    statistics.numRttSamples, statistics.jitter / 1e6
+  );
+  return;
+}
+
+// Print the statistics of compression, with the ratio of the bytes before and after it and the time per message
+static void printCompressionStatistics(SenderStatistics* pSenderStatistics, ReceiverStatistics* pReceiverStatistics) {
+  printf(
+    "[Stats]: datagrams compressed: %lu, with a dictionary: %lu, sent uncompressed as they did not shrink: %lu\n",
+    pSenderStatistics->numDatagramsCompressed, pSenderStatistics->numDatagramsWithDictionary,
+    pSenderStatistics->numDatagramsIncompressible
+  );
+  printf(
+    "[Stats]: compression ratio: %.2f (%llu bytes to %llu), %.0f ns per message over %lu messages\n",
+    (pSenderStatistics->numBytesAfterCompression > 0) ? (double) pSenderStatistics->numBytesBeforeCompression / pSenderStatistics->numBytesAfterCompression : 0.0,
+    pSenderStatistics->numBytesBeforeCompression, pSenderStatistics->numBytesAfterCompression,
+    (pSenderStatistics->numMessagesCompressed > 0) ? (double) pSenderStatistics->compressionTime / pSenderStatistics->numMessagesCompressed : 0.0,
+    pSenderStatistics->numMessagesCompressed
+  );
+  printf(
+    "[Stats]: datagrams decompressed: %lu, with a dictionary: %lu, failed: %lu, %llu bytes to %llu, %.0f ns per datagram\n",
+    pReceiverStatistics->numDatagramsDecompressed, pReceiverStatistics->numDatagramsWithDictionary,
+    pReceiverStatistics->numDecompressionFailures, pReceiverStatistics->numBytesBeforeDecompression,
+    pReceiverStatistics->numBytesAfterDecompression,
+    (pReceiverStatistics->numDatagramsDecompressed > 0) ? (double) pReceiverStatistics->decompressionTime / pReceiverStatistics->numDatagramsDecompressed : 0.0
+  );
+  return;
+}
+
+// Print the statistics collected while the program was running
+static void printStatistics(MessageQueue* pSendingMessagesQueue, MessageQueue* pReceivedMessagesQueue, PeerTable* pPeers) {
+  printf("[Stats]: sending queue contention: %lu\n", MessageQueue_contentionCount(pSendingMessagesQueue));
+  printf("[Stats]: received queue contention: %lu\n", MessageQueue_contentionCount(pReceivedMessagesQueue));
+
+  SenderStatistics senderStatistics;
+  Sender_getStatistics(&senderStatistics);
+  printf(
+    "[Stats]: messages sent: %lu in %lu datagrams, %lu send calls (%.2f datagrams per call)\n",
+    senderStatistics.numMessagesSent, senderStatistics.numDatagramsSent, senderStatistics.numSendCalls,
+    (senderStatistics.numSendCalls > 0) ? (double) senderStatistics.numDatagramsSent / senderStatistics.numSendCalls : 0.0
+  );
+
+  ReceiverStatistics receiverStatistics;
+  Receiver_getStatistics(&receiverStatistics);
+  printf(
+    "[Stats]: messages received: %lu in %lu datagrams, %lu receive calls (%.2f datagrams per call)\n",
+    receiverStatistics.numMessagesReceived, receiverStatistics.numDatagramsReceived, receiverStatistics.numReceiveCalls,
+    (receiverStatistics.numReceiveCalls > 0) ? (double) receiverStatistics.numDatagramsReceived / receiverStatistics.numReceiveCalls : 0.0
+  );
+  printf(
+    "[Stats]: fragmented messages reassembled: %lu, dropped incomplete: %lu\n",
+    receiverStatistics.numMessagesReassembled, receiverStatistics.numMessagesDropped
+  );
+  printf(
+    "[Stats]: datagrams ignored from unknown senders: %lu, dropped as truncated or malformed: %lu\n",
+    receiverStatistics.numStrayDatagrams, receiverStatistics.numMalformedDatagrams
+  );
+
+  if (s_options.compression != COMPRESSION_OFF) {
+    printCompressionStatistics(&senderStatistics, &receiverStatistics);
+  }
+
+  // Each remote user has a reliability layer and heartbeats of its own, labelled when there are several
+  for (int i = 0; i < PeerTable_count(pPeers); i++) {
+    Peer* pPeer = PeerTable_get(pPeers, i);
+
+    if (PeerTable_count(pPeers) > 1) {
+      printf("[Stats]: remote user %s:%d\n", inet_ntoa(pPeer->address.sin_addr), ntohs(pPeer->address.sin_port));
+    }
+
+    if (pPeer->pReliability != NULL) {
+      printReliabilityStatistics(pPeer->pReliability);
+    }
+
+    printHeartbeatStatistics(pPeer->pHeartbeat);
+  }
+
+  // Only the threads of the default mode hand messages over, and only in low-latency mode do they spin
+  if (!s_options.isEventLoop) {
+    OutputStatistics outputStatistics;
+    Output_getStatistics(&outputStatistics);
+    Histogram* pHandoffLatencies = &outputStatistics.handoffLatencies;
+    printf(
+      "[Stats]: receiver to output handoff: p50 %.1f us, p99 %.1f us, max %.1f us over %lu messages\n",
+      Histogram_getPercentile(pHandoffLatencies, 0.5) / 1e3, Histogram_getPercentile(pHandoffLatencies, 0.99) / 1e3,
+      pHandoffLatencies->max / 1e3, pHandoffLatencies->count
+    );
+  }
+
+  if (s_options.isLowLatency) {
+    printf(
+      "[Stats]: receiver polled the socket: %lu times, receiving while polling: %lu, output thread spun: %lu times, "
+      "taking a message while spinning: %lu\n",
+      receiverStatistics.numSpins, receiverStatistics.numSpinsSucceeded,
+      MessageQueue_spinCount(pReceivedMessagesQueue), MessageQueue_spinSuccessCount(pReceivedMessagesQueue)
+    );
+  }
+
+  if (s_options.isEventLoop) {
+    EventLoopStatistics eventLoopStatistics;
+    EventLoop_getStatistics(&eventLoopStatistics);
+    printf("[Stats]: event loop iterations: %lu", eventLoopStatistics.numIterations);
+
+    if (eventLoopStatistics.isUsingIoUring) {
+      printf(", io_uring system calls: %lu", eventLoopStatistics.numUringEnterCalls);
+    }
+
+    printf("\n");
+  }
+
+  ListPoolStatistics poolStatistics;
+  List_getPoolStatistics(&poolStatistics);
+  printf(
+    "[Stats]: list nodes in use: %d, high-water mark: %d, allocated: %d in %d slabs, cap: %d\n",
+    poolStatistics.numNodesInUse, poolStatistics.maxNodesInUse,
+    poolStatistics.numNodesAllocated, poolStatistics.numSlabs, poolStatistics.maxNumNodes
+  );
+
+  MessagePoolStatistics messagePoolStatistics;
+  MessagePool_getStatistics(&messagePoolStatistics);
+  printf(
+    "[Stats]: message buffers taken: %llu, recycled: %llu, allocated: %d in %d chunks\n",
+    (unsigned long long) messagePoolStatistics.numAllocs, (unsigned long long) messagePoolStatistics.numRecycles,
+    messagePoolStatistics.numBuffersAllocated, messagePoolStatistics.numChunks
+  );
+  fflush(stdout);
+  return;
+}
+
+// Gets the address of the remote user from their host name and port
+static void resolveRemoteAddress(char* remoteHostName, int remotePort, struct sockaddr_in* pRemoteAddress) {
+  int status = 0;
+  struct addrinfo* addressResults = NULL;
+  struct addrinfo hints;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  status = getaddrinfo(remoteHostName, NULL, &hints, &addressResults);
+
+  if (status) {
+    fputs("[Error]: could not get address info of remote host name\n", stdout);
+    exit(1);
+  }
+
+  memset(pRemoteAddress, 0, sizeof(struct sockaddr_in));
+  pRemoteAddress->sin_family = AF_INET;
+  pRemoteAddress->sin_port = htons(remotePort);
+  pRemoteAddress->sin_addr = ((struct sockaddr_in*) addressResults->ai_addr)->sin_addr;
+
+  freeaddrinfo(addressResults);
+  addressResults = NULL;
+
+  fputs("[Sending to remote user at ", stdout);
+  fputs(inet_ntoa(pRemoteAddress->sin_addr), stdout);
+  fputs("]\n", stdout);
+  return;
+}
+
+// Sizes every datagram sent to the smallest path MTU to the remote users
+static void sizeDatagrams(PeerTable* pPeers) {
+  PathMtu pathMtu;
+  PathMtu_discover(&PeerTable_get(pPeers, 0)->address, &pathMtu);
+
+  // Every datagram goes to each remote user, so it must fit the narrowest path
+  for (int i = 1; i < PeerTable_count(pPeers); i++) {
+    PathMtu peerPathMtu;
+    PathMtu_discover(&PeerTable_get(pPeers, i)->address, &peerPathMtu);
+
+    if (peerPathMtu.datagramSize < pathMtu.datagramSize) {
+      pathMtu = peerPathMtu;
+    }
+  }
+
+  // Only what is sent follows the path, as peers with wider paths send larger datagrams
+  Message_setMaxDatagramSize(pathMtu.datagramSize);
+  MessagePool_init(MESSAGE_DATA_MAX_SIZE);
+
+  if (pathMtu.mtu > 0) {
+    printf(
+      "[Using datagrams of up to %d bytes for a path MTU of %d bytes%s]\n",
+      pathMtu.datagramSize, pathMtu.mtu, pathMtu.isProbed ? ", found by probing" : ""
+    );
+  } else {
+    printf("[Using datagrams of up to %d bytes, as the path MTU could not be found]\n", pathMtu.datagramSize);
+  }
+
+  fflush(stdout);
+  return;
+}
+
 // Creates the socket using the local IP address and port
-static int bindSocket(int localPort) {
+// With isSharingPort, other sockets may be bound to the same port, and the kernel spreads the remote users over them
+static int bindSocket(int localPort, bool isSharingPort) {
   int status = 0;
   struct sockaddr_in localAddress;
   memset(&localAddress, 0, sizeof(localAddress));
@@ -49,6 +312,11 @@ static int bindSocket(int localPort) {
     exit(1);
   }
 
+  if (isSharingPort) {
+    int isEnabled = 1;
+    setsockopt(socketDescriptor, SOL_SOCKET, SO_REUSEPORT, &isEnabled, sizeof(isEnabled));
+  }
+
   // Bind the socket to the local port
 	status = bind(socketDescriptor, (struct sockaddr*) &localAddress, sizeof(localAddress));
 
@@ -57,73 +325,277 @@ static int bindSocket(int localPort) {
     exit(1);
   }
 
+  // Ask for room to queue a full window of the largest datagrams, so a burst is not dropped before
+  // the receiver thread takes it; the kernel may grant less, which only costs retransmissions
+  int receiveBufferSize = RELIABILITY_WINDOW_SIZE * Message_getMaxDatagramSize();
+  setsockopt(socketDescriptor, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+  // Have the kernel poll the network device for a while before a receive blocks, which needs CAP_NET_ADMIN
+  // beyond the net.core.busy_read default; without it the socket only waits as usual
+  if (s_options.busyPollTime > 0 && setsockopt(socketDescriptor, SOL_SOCKET, SO_BUSY_POLL, &s_options.busyPollTime, sizeof(s_options.busyPollTime)) == -1) {
+    printf("[Could not busy poll the socket for %d microseconds, it waits as usual]\n", s_options.busyPollTime);
+  }
+
   return socketDescriptor;
 }
 
+// Print the statistics of the relay
+static void printRelayStatistics() {
+  RelayStatistics statistics;
+  Relay_getStatistics(&statistics);
+
+  printf(
+    "[Stats]: members joined: %lu, left: %lu, timed out: %lu, refused: %lu\n",
+    statistics.numMembersJoined, statistics.numMembersLeft, statistics.numMembersTimedOut, statistics.numMembersRefused
+  );
+  printf(
+    "[Stats]: messages received: %lu in %lu datagrams, forwarded: %lu, handed to other workers: %lu, dropped: %lu\n",
+    statistics.numMessagesReceived, statistics.numDatagramsReceived, statistics.numMessagesForwarded,
+    statistics.numMessagesHandedOff, statistics.numMessagesDropped
+  );
+  printf("[Stats]: datagrams dropped as truncated or malformed: %lu\n", statistics.numMalformedDatagrams);
+  printf(
+    "[Stats]: datagrams sent: %lu, send calls: %lu (%.2f datagrams per call)\n",
+    statistics.numDatagramsSent, statistics.numSendCalls,
+    (statistics.numSendCalls > 0) ? (double) statistics.numDatagramsSent / statistics.numSendCalls : 0.0
+  );
+  fflush(stdout);
+  return;
+}
+
+// Runs the program as a relay on the local port until the exit command is entered, with a worker per core
+// unless told otherwise, each with its own socket sharing the port
+static void runRelay(int localPort) {
+  static RelayArguments relayArguments;
+  int numWorkers = s_options.numRelayWorkers;
+
+  if (numWorkers == 0) {
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    numWorkers = (numCores < 1) ? 1 : (numCores > RELAY_MAX_WORKERS) ? RELAY_MAX_WORKERS : (int) numCores;
+  }
+
+  // The relay only forwards what members send, never larger than each member takes, but receives datagrams
+  // as large as any member's path carries
+  MessagePool_init(MESSAGE_DATA_MAX_SIZE);
+
+  for (int i = 0; i < numWorkers; i++) {
+    relayArguments.socketDescriptors[i] = bindSocket(localPort, true);
+  }
+
+  relayArguments.numWorkers = numWorkers;
+  relayArguments.isReliable = !s_options.isUnreliable;
+  relayArguments.isQuiet = false;
+
+  printf("[Relaying on port %d with %d workers, enter ! to stop]\n", localPort, numWorkers);
+  fflush(stdout);
+  Relay_start(&relayArguments);
+
+  char* line = NULL;
+  size_t lineSize = 0;
+  bool isExitEntered = false;
+
+  while (!isExitEntered && getline(&line, &lineSize, stdin) != -1) {
+    isExitEntered = (strcmp(line, "!\n") == 0);
+  }
+
+  free(line);
+
+  // Without a terminal to enter the exit command on, as when run in the background, relay until killed
+  while (!isExitEntered) {
+    pause();
+  }
+
+  Relay_stop();
+
+  for (int i = 0; i < numWorkers; i++) {
+    if (close(relayArguments.socketDescriptors[i])) {
+      fputs("[Error]: could not close socket\n", stdout);
+    }
+  }
+
+  if (s_options.printStatistics) {
+    printRelayStatistics();
+  }
+
+  return;
+}
+
 // Main program
 int main(int argc, char *argv[]) {
   int status = 0;
 
-  // Check that enough arguments have been provided
-  if (argc != 4) {
-    fputs("[Error]: terminal-talk requires 3 arguments\n", stdout);
+  // Parse any options given before the positional arguments
+  int argumentIndex = Options_parse(argc, argv, &s_options);
+
+  // Low-latency mode tunes the threads of the default mode, which the event loop and the relay do without
+  if (s_options.isLowLatency && (s_options.isEventLoop || s_options.isRelay)) {
+    fputs("[Error]: --low-latency cannot be used with --event-loop, --io-uring or --relay\n", stdout);
     exit(1);
   }
 
-  // Create lists for sending/receiving messages
-  List* pSendingMessagesList = ThreadSafeList_create();
-  List* pReceivedMessagesList = ThreadSafeList_create();
+  // A relay only takes the port it receives on
+  if (s_options.isRelay) {
+    if (argc - argumentIndex != 1) {
+      fputs("[Error]: terminal-talk --relay requires 1 argument\n", stdout);
+      exit(1);
+    }
 
-  if (pSendingMessagesList == NULL || pReceivedMessagesList == NULL) {
-    fputs("[Error]: could not create lists\n", stdout);
+    int relayPort = atoi(argv[argumentIndex]);
+
+    if (relayPort < 1024 || relayPort > 65535) {
+      fputs("[Error]: local port number is not in the range [1024, 65535]\n", stdout);
+      exit(1);
+    }
+
+    List_setMaxNumNodes(s_options.maxListNodes);
+    runRelay(relayPort);
+
+    ThreadSafeList_cleanup();
+    MessagePool_cleanup();
+    Control_cleanup();
+
+    fputs("[Program terminated successfully]\n", stdout);
+    fflush(stdout);
+    return 0;
+  }
+
+  // Check that enough arguments have been provided: the local port, then a host name and port per remote user
+  int numPeers = (argc - argumentIndex - 1) / 2;
+
+  if (argc - argumentIndex < 3 || (argc - argumentIndex) % 2 == 0) {
+    fputs("[Error]: terminal-talk requires 3 arguments, and 2 more for each additional remote user\n", stdout);
     exit(1);
   }
 
-  // Get and validate local and remote port numbers
-  int localPort = atoi(argv[1]);
-  int remotePort = atoi(argv[3]);
+  if (numPeers > PEER_MAX_PEERS) {
+    fputs("[Error]: too many remote users\n", stdout);
+    exit(1);
+  }
+
+  List_setMaxNumNodes(s_options.maxListNodes);
+
+  // Create queues for sending/receiving messages
+  MessageQueue* pSendingMessagesQueue = MessageQueue_create(s_options.queueType);
+  MessageQueue* pReceivedMessagesQueue = MessageQueue_create(s_options.queueType);
+
+  if (pSendingMessagesQueue == NULL || pReceivedMessagesQueue == NULL) {
+    fputs("[Error]: could not create queues\n", stdout);
+    exit(1);
+  }
+
+  PeerTable* pPeers = PeerTable_create();
+
+  if (pPeers == NULL) {
+    fputs("[Error]: could not create peer table\n", stdout);
+    exit(1);
+  }
+
+  // Get and validate local port number
+  int localPort = atoi(argv[argumentIndex]);
 
   if (localPort < 1024 || localPort > 65535) {
     fputs("[Error]: local port number is not in the range [1024, 65535]\n", stdout);
     exit(1);
   }
 
-  if (remotePort < 1024 || remotePort > 65535) {
-    fputs("[Error]: remote port number is not in the range [1024, 65535]\n", stdout);
-    exit(1);
+  // Find each remote user, giving it a reliability layer shared by the sender and receiver,
+  // unless messages are sent once
+  for (int i = 0; i < numPeers; i++) {
+    char* remoteHostName = argv[argumentIndex + 1 + 2 * i];
+    int remotePort = atoi(argv[argumentIndex + 2 + 2 * i]);
+    struct sockaddr_in remoteAddress;
+    char label[PEER_LABEL_SIZE];
+    Reliability* pReliability = NULL;
+
+    if (remotePort < 1024 || remotePort > 65535) {
+      fputs("[Error]: remote port number is not in the range [1024, 65535]\n", stdout);
+      exit(1);
+    }
+
+    resolveRemoteAddress(remoteHostName, remotePort, &remoteAddress);
+
+    // A lone remote user keeps the usual label, several are told apart by their host and port
+    if (numPeers == 1) {
+      snprintf(label, sizeof(label), "%s", OUTPUT_REMOTE_LABEL);
+    } else {
+      snprintf(label, sizeof(label), "[%.40s:%d]: ", remoteHostName, remotePort);
+    }
+
+    if (!s_options.isUnreliable) {
+      pReliability = Reliability_create();
+
+      if (pReliability == NULL) {
+        fputs("[Error]: could not create reliability layer\n", stdout);
+        exit(1);
+      }
+    }
+
+    if (PeerTable_add(pPeers, &remoteAddress, label, pReliability) == NULL) {
+      fputs("[Error]: could not add remote user, the same address was given twice\n", stdout);
+      exit(1);
+    }
   }
 
+  // Find the size of datagrams that reach every remote user without fragmentation
+  sizeDatagrams(pPeers);
+
   // Create socket and bind it
-  int socketDescriptor = bindSocket(localPort);
+  int socketDescriptor = bindSocket(localPort, false);
 
   // Fill argument structs for each thread
-  s_inputArguments.pSendingMessagesList = pSendingMessagesList;
-  s_outputArguments.pReceivedMessagesList = pReceivedMessagesList;
-  s_senderArguments.pSendingMessagesList = pSendingMessagesList;
+  s_inputArguments.pSendingMessagesQueue = pSendingMessagesQueue;
+  s_inputArguments.pPeers = pPeers;
+  s_outputArguments.pReceivedMessagesQueue = pReceivedMessagesQueue;
+  s_outputArguments.pPeers = pPeers;
+  s_senderArguments.pSendingMessagesQueue = pSendingMessagesQueue;
   s_senderArguments.socketDescriptor = socketDescriptor;
-  s_senderArguments.remotePort = remotePort;
-  strncpy(s_senderArguments.remoteHostName, argv[2], HOSTNAME_MAX_SIZE);
-  s_senderArguments.remoteHostName[HOSTNAME_MAX_SIZE - 1] = '\0';
-  s_receiverArguments.pReceivedMessagesList = pReceivedMessagesList;
+  s_senderArguments.batchSize = s_options.sendBatchSize;
+  s_senderArguments.coalesceDeadline = s_options.coalesceDeadline;
+  s_senderArguments.pPeers = pPeers;
+  s_senderArguments.compression = s_options.compression;
+  s_senderArguments.heartbeatInterval = s_options.heartbeatInterval;
+  s_receiverArguments.pReceivedMessagesQueue = pReceivedMessagesQueue;
   s_receiverArguments.socketDescriptor = socketDescriptor;
+  s_receiverArguments.batchSize = s_options.receiveBatchSize;
+  s_receiverArguments.pPeers = pPeers;
+  s_receiverArguments.pSendingMessagesQueue = pSendingMessagesQueue;
+  s_receiverArguments.compression = s_options.compression;
+
+  if (s_options.isEventLoop) {
+    // Do everything on this thread, until the user or every remote user sends the exit command
+    s_eventLoopArguments.pSenderArguments = &s_senderArguments;
+    s_eventLoopArguments.pReceiverArguments = &s_receiverArguments;
+    s_eventLoopArguments.isUsingIoUring = s_options.isIoUring;
+    EventLoop_run(&s_eventLoopArguments);
+  } else {
+    // In low-latency mode, the output thread spins on its queue before sleeping, as the receiver thread does
+    // on the socket, and each thread is tuned as it starts
+    if (s_options.isLowLatency) {
+      LowLatency_enable(s_options.cpus);
+
+      if (LowLatency_isSpinning()) {
+        MessageQueue_setSpinTime(pReceivedMessagesQueue, LOW_LATENCY_SPIN_TIME);
+      }
+    }
 
-  // Create each thread
-  Sender_init(&s_senderArguments);
-  Receiver_init(&s_receiverArguments);
-  Output_init(&s_outputArguments);
-  Input_init(&s_inputArguments);
+    // Create each thread
+    Sender_init(&s_senderArguments);
+    Receiver_init(&s_receiverArguments);
+    Output_init(&s_outputArguments);
+    Input_init(&s_inputArguments);
 
-  // Block the main thread, and wait until the input or output threads signal termination
-  Control_waitForTermination();
+    // Block the main thread, and wait until the input or output threads signal termination
+    Control_waitForTermination();
 
-  // Sleep one second to allow the last messages in each list to be processed
-  sleepMilliseconds(1000);
+    // Sleep one second to allow the last messages in each queue to be processed
+    sleepMilliseconds(1000);
 
-  // Shutdown each thread and join with it
-  Sender_shutdown();
-  Receiver_shutdown();
-  Output_shutdown();
-  Input_shutdown();
+    // Shutdown each thread and join with it
+    Sender_shutdown();
+    Receiver_shutdown();
+    Output_shutdown();
+    Input_shutdown();
+  }
 
   // Close the socket
   status = close(socketDescriptor);
@@ -132,14 +604,23 @@ int main(int argc, char *argv[]) {
     fputs("[Error]: could not close socket\n", stdout);
   }
 
-  // Free dynamic memory for lists
-  ThreadSafeList_free(pReceivedMessagesList, freeMessage);
-  pReceivedMessagesList = NULL;
-  ThreadSafeList_free(pSendingMessagesList, freeMessage);
-  pSendingMessagesList = NULL;
+  if (s_options.printStatistics) {
+    printStatistics(pSendingMessagesQueue, pReceivedMessagesQueue, pPeers);
+  }
+
+  // Free dynamic memory for queues
+  MessageQueue_free(pReceivedMessagesQueue, freeMessage);
+  pReceivedMessagesQueue = NULL;
+  MessageQueue_free(pSendingMessagesQueue, freeMessage);
+  pSendingMessagesQueue = NULL;
+
+  // Recycle the messages still waiting for acknowledgement or held back for order
+  PeerTable_free(pPeers);
+  pPeers = NULL;
 
   // Additional cleanup
   ThreadSafeList_cleanup();
+  MessagePool_cleanup();
   Control_cleanup();
 
   fputs("[Program terminated successfully]\n", stdout);
@@ -0,0 +1,314 @@
+// Tests of the message queues, the relay and the reliability layer, the latter fed acknowledgements as the
+// peer could send them
+// Prints one line per test, and exits with a failure status if any test failed
+// Usage: ./tests
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "message.h"
+#include "messagepool.h"
+#include "messagequeue.h"
+#include "reliability.h"
+#include "relay.h"
+#include "peer.h"
+
+static int s_numFailed = 0;
+
+// Prints whether a test passed, counting it if it failed
+static void report(char* testName, bool isPassed) {
+  printf("[Test]: %s: %s\n", testName, isPassed ? "passed" : "FAILED");
+  s_numFailed += !isPassed;
+  return;
+}
+
+// Creates a reliability layer, exiting if it cannot
+static Reliability* createReliability() {
+  Reliability* pReliability = Reliability_create();
+
+  if (pReliability == NULL) {
+    fputs("[Error]: could not create reliability layer\n", stdout);
+    exit(1);
+  }
+
+  return pReliability;
+}
+
+// Admits count empty messages and marks them sent at the given time
+static void sendMessages(Reliability* pReliability, int count, uint64_t now) {
+  for (int i = 0; i < count; i++) {
+    Message* pMessage = MessagePool_alloc();
+
+    if (pMessage == NULL) {
+      fputs("[Error]: could not allocate memory for message\n", stdout);
+      exit(1);
+    }
+
+    pMessage->length = 0;
+    pMessage->flags = 0;
+    Reliability_admit(pReliability, &pMessage, 1);
+    Reliability_markSent(pReliability, &pMessage, 1, now);
+  }
+
+  return;
+}
+
+// Applies an acknowledgement of every message before cumulativeAck, and of the messages from start to one
+// before end if they differ
+static void receiveAck(Reliability* pReliability, uint32_t cumulativeAck, uint32_t start, uint32_t end, uint64_t now) {
+  MessageHeader header;
+  uint32_t block[2];
+
+  memset(&header, 0, sizeof(header));
+  header.type = MESSAGE_TYPE_ACK;
+  header.sequence = htonl(cumulativeAck);
+  block[0] = htonl(start);
+  block[1] = htonl(end);
+
+  Reliability_processAck(pReliability, &header, (char*) block, (start != end) ? sizeof(block) : 0, now);
+  return;
+}
+
+// An older acknowledgement arriving after a newer one, with a block starting at the newer cumulative
+// acknowledgement, must not open the window past the messages acknowledged cumulatively
+static void testReorderedAck() {
+  Reliability* pReliability = createReliability();
+
+  sendMessages(pReliability, RELIABILITY_WINDOW_SIZE, 1000);
+  receiveAck(pReliability, 2, 2, 2, 2000);
+  receiveAck(pReliability, 1, 2, 4, 3000);
+  Reliability_recycleAcked(pReliability);
+
+  bool isPassed = (Reliability_getCumulativeAck(pReliability) == 2 && Reliability_getSendRoom(pReliability) == 2);
+
+  // The messages the window has room for take the slots of messages 0 and 1 only, so a later cumulative
+  // acknowledgement of every message counts each of them once
+  sendMessages(pReliability, Reliability_getSendRoom(pReliability), 4000);
+  receiveAck(pReliability, RELIABILITY_WINDOW_SIZE + 2, 0, 0, 5000);
+  Reliability_recycleAcked(pReliability);
+
+  isPassed = isPassed && Reliability_isIdle(pReliability) && Reliability_getSendRoom(pReliability) == RELIABILITY_WINDOW_SIZE;
+  report("reordered acknowledgement does not over-admit the window", isPassed);
+
+  Reliability_free(pReliability);
+  return;
+}
+
+// Items of the queue tests are not allocated, so they are not freed with the queue
+static void keepItem(void* pItem) {
+  return;
+}
+
+// Messages pushed to a list queue as a batch must be popped in batches in the order they were pushed,
+// with messages pushed alone before and after them
+static void testQueueBatchOrder() {
+  MessageQueue* pQueue = MessageQueue_create(MESSAGE_QUEUE_LIST);
+  void* pushed[8];
+  void* popped[8];
+  int numPopped = 0;
+
+  if (pQueue == NULL) {
+    fputs("[Error]: could not create message queue\n", stdout);
+    exit(1);
+  }
+
+  // The queue only holds the pointers, so any distinct addresses will do
+  for (int i = 0; i < 8; i++) {
+    pushed[i] = &pushed[i];
+  }
+
+  bool isPassed = (MessageQueue_push(pQueue, pushed[0]) == 0);
+  isPassed = isPassed && MessageQueue_pushBatch(pQueue, &pushed[1], 6) == 6;
+  isPassed = isPassed && MessageQueue_push(pQueue, pushed[7]) == 0;
+
+  numPopped += MessageQueue_popBatch(pQueue, popped, 3, 0);
+  numPopped += MessageQueue_popBatch(pQueue, &popped[numPopped], 8 - numPopped, 0);
+  isPassed = isPassed && numPopped == 8 && MessageQueue_count(pQueue) == 0;
+
+  for (int i = 0; i < numPopped; i++) {
+    isPassed = isPassed && popped[i] == pushed[i];
+  }
+
+  report("batches leave a list queue in the order they were pushed", isPassed);
+
+  MessageQueue_free(pQueue, keepItem);
+  return;
+}
+
+// A message is sent again once RELIABILITY_DUPLICATE_THRESHOLD messages sent after it were acknowledged, and once
+// sent again, only acknowledgements of messages sent after its retransmission find it lost again
+static void testFastRetransmission() {
+  Reliability* pReliability = createReliability();
+  Message* pMessage = NULL;
+
+  sendMessages(pReliability, 8, 1000);
+  receiveAck(pReliability, 0, 1, 1 + RELIABILITY_DUPLICATE_THRESHOLD, 2000);
+
+  int count = Reliability_takeRetransmissions(pReliability, &pMessage, 1, 2000);
+  bool isPassed = (count == 1 && pMessage->sequence == 0);
+
+  if (count == 1) {
+    Reliability_markSent(pReliability, &pMessage, 1, 3000);
+  }
+
+  // Messages 4 to 7 were sent before the retransmission, so their acknowledgements say nothing of it
+  receiveAck(pReliability, 0, 1, 8, 4000);
+  isPassed = isPassed && Reliability_takeRetransmissions(pReliability, &pMessage, 1, 4000) == 0;
+
+  sendMessages(pReliability, RELIABILITY_DUPLICATE_THRESHOLD, 5000);
+  receiveAck(pReliability, 0, 1, 8 + RELIABILITY_DUPLICATE_THRESHOLD, 6000);
+  count = Reliability_takeRetransmissions(pReliability, &pMessage, 1, 6000);
+  isPassed = isPassed && count == 1 && pMessage->sequence == 0;
+
+  report("a message is found lost again only by acknowledgements of messages sent after it", isPassed);
+
+  Reliability_free(pReliability);
+  return;
+}
+
+// Binds a socket to port on the loopback address, shared with the other sockets on it, or to any free port for 0
+// Returns the socket descriptor, exiting if it cannot be bound
+static int bindLoopbackSocket(int port) {
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int socketDescriptor = socket(PF_INET, SOCK_DGRAM, 0);
+  int isEnabled = 1;
+
+  if (socketDescriptor == -1 || setsockopt(socketDescriptor, SOL_SOCKET, SO_REUSEPORT, &isEnabled, sizeof(isEnabled)) == -1
+    || bind(socketDescriptor, (struct sockaddr*) &address, sizeof(address)) == -1) {
+    fputs("[Error]: could not bind test socket\n", stdout);
+    exit(1);
+  }
+
+  return socketDescriptor;
+}
+
+// Starts an unreliable relay with numWorkers workers sharing a free port on the loopback address, filling
+// pArguments and the address of the relay
+// A relay that cannot create a worker exits
+static void startRelay(RelayArguments* pArguments, int numWorkers, struct sockaddr_in* pRelayAddress) {
+  socklen_t addressLength = sizeof(*pRelayAddress);
+
+  pArguments->numWorkers = numWorkers;
+  pArguments->isReliable = false;
+  pArguments->isQuiet = true;
+
+  // The first socket takes any free port, and the other workers share it
+  pArguments->socketDescriptors[0] = bindLoopbackSocket(0);
+  getsockname(pArguments->socketDescriptors[0], (struct sockaddr*) pRelayAddress, &addressLength);
+
+  for (int i = 1; i < numWorkers; i++) {
+    pArguments->socketDescriptors[i] = bindLoopbackSocket(ntohs(pRelayAddress->sin_port));
+  }
+
+  Relay_start(pArguments);
+  return;
+}
+
+// Stops the relay started with pArguments, waiting first for it to take the datagrams sent to it, and fills
+// pStatistics with its counters
+static void stopRelay(RelayArguments* pArguments, RelayStatistics* pStatistics) {
+  struct timespec delay = {0, 50000000};
+  nanosleep(&delay, NULL);
+
+  Relay_stop();
+  Relay_getStatistics(pStatistics);
+
+  for (int i = 0; i < pArguments->numWorkers; i++) {
+    close(pArguments->socketDescriptors[i]);
+  }
+
+  return;
+}
+
+// Sends an empty unnumbered message with the given flags from the socket to the relay
+static void sendToRelay(int socketDescriptor, struct sockaddr_in* pRelayAddress, uint8_t flags) {
+  Message* pMessage = MessagePool_alloc();
+  MessageHeader header;
+
+  if (pMessage == NULL) {
+    fputs("[Error]: could not allocate memory for message\n", stdout);
+    exit(1);
+  }
+
+  pMessage->length = 0;
+  pMessage->flags = MESSAGE_FLAG_FIRST_SEGMENT | MESSAGE_FLAG_LAST_SEGMENT | flags;
+  pMessage->sequence = 0;
+  pMessage->messageId = 0;
+  pMessage->fragmentIndex = 0;
+  pMessage->fragmentCount = 1;
+  Message_encodeHeader(pMessage, &header);
+  MessagePool_recycle(pMessage);
+
+  sendto(socketDescriptor, &header, MESSAGE_HEADER_SIZE, 0, (struct sockaddr*) pRelayAddress, sizeof(*pRelayAddress));
+  return;
+}
+
+// A relay must start with as many workers as it allows, each worker taking list heads of its own,
+// and still take a member in
+static void testRelayMaxWorkers() {
+  RelayArguments arguments;
+  RelayStatistics statistics;
+  struct sockaddr_in relayAddress;
+
+  // Reaching the statistics means every worker started
+  startRelay(&arguments, RELAY_MAX_WORKERS, &relayAddress);
+
+  int clientDescriptor = bindLoopbackSocket(0);
+  sendToRelay(clientDescriptor, &relayAddress, 0);
+
+  stopRelay(&arguments, &statistics);
+  report("relay starts with the most workers it allows", statistics.numMembersJoined == 1);
+
+  close(clientDescriptor);
+  return;
+}
+
+// Members that left with the exit command must give their slots to new members, so a worker takes more
+// members over time than it holds at once
+static void testRelayReusesSlots() {
+  RelayArguments arguments;
+  RelayStatistics statistics;
+  struct sockaddr_in relayAddress;
+  int numClients = PEER_MAX_PEERS + 1;
+
+  startRelay(&arguments, 1, &relayAddress);
+
+  // Each client has an address of its own, so each joins as a new member
+  for (int i = 0; i < numClients; i++) {
+    int clientDescriptor = bindLoopbackSocket(0);
+    sendToRelay(clientDescriptor, &relayAddress, 0);
+    sendToRelay(clientDescriptor, &relayAddress, MESSAGE_FLAG_CONTROL);
+    close(clientDescriptor);
+  }
+
+  stopRelay(&arguments, &statistics);
+
+  bool isPassed = (statistics.numMembersJoined == numClients && statistics.numMembersLeft == numClients);
+  report("relay gives the slots of members that left to new members", isPassed && statistics.numMembersRefused == 0);
+  return;
+}
+
+// Main program
+int main() {
+  MessagePool_init(MESSAGE_DATA_MIN_SIZE);
+
+  testQueueBatchOrder();
+  testRelayMaxWorkers();
+  testRelayReusesSlots();
+  testReorderedAck();
+  testFastRetransmission();
+
+  MessagePool_cleanup();
+  return (s_numFailed == 0) ? 0 : 1;
+}
@@ -1,143 +1,166 @@
 // A thread-safe wrapper for the List ADT
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <pthread.h>
 #include "threadsafelist.h"
 #include "list.h"
 
-// Mutex for safely accessing list functions
-static pthread_mutex_t s_listMutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Makes a new, empty list, and returns its reference on success.
-// Returns a NULL pointer on failure.
-List* ThreadSafeList_create() {
+// Locks the mutex of pList, counting the lock as contended if another thread holds it
+static void lockList(ThreadSafeList* pList) {
   int status = 0;
-  List* pNewList = NULL;
 
-  status = pthread_mutex_lock(&s_listMutex);
+  status = pthread_mutex_trylock(&pList->mutex);
+
+  if (status == EBUSY) {
+    status = pthread_mutex_lock(&pList->mutex);
+
+    if (!status) {
+      pList->contentionCount++;
+    }
+  }
 
   if (status) {
     fputs("[Error]: could not lock list mutex\n", stdout);
     exit(1);
   }
 
-  pNewList = List_create();
+  return;
+}
+
+// Unlocks the mutex of pList
+static void unlockList(ThreadSafeList* pList) {
+  int status = 0;
 
-  status = pthread_mutex_unlock(&s_listMutex);
+  status = pthread_mutex_unlock(&pList->mutex);
 
   if (status) {
     fputs("[Error]: could not unlock list mutex\n", stdout);
     exit(1);
   }
 
-  return pNewList;
+  return;
 }
 
-// Returns the number of items in pList.
-int ThreadSafeList_count(List* pList) {
+// Makes a new, empty list, and returns its reference on success.
+// Returns a NULL pointer on failure.
+ThreadSafeList* ThreadSafeList_create() {
   int status = 0;
-  int count;
-
-  status = pthread_mutex_lock(&s_listMutex);
+  ThreadSafeList* pNewList = malloc(sizeof(ThreadSafeList));
 
-  if (status) {
-    fputs("[Error]: could not lock list mutex\n", stdout);
-    exit(1);
+  if (pNewList == NULL) {
+    return NULL;
   }
 
-  count = List_count(pList);
+  pNewList->pList = List_create();
+
+  if (pNewList->pList == NULL) {
+    free(pNewList);
+    return NULL;
+  }
 
-  status = pthread_mutex_unlock(&s_listMutex);
+  pNewList->contentionCount = 0;
+  status = pthread_mutex_init(&pNewList->mutex, NULL);
 
   if (status) {
-    fputs("[Error]: could not unlock list mutex\n", stdout);
+    fputs("[Error]: could not initialize list mutex\n", stdout);
     exit(1);
   }
 
+  return pNewList;
+}
+
+// Returns the number of items in pList.
+int ThreadSafeList_count(ThreadSafeList* pList) {
+  int count;
+
+  lockList(pList);
+  count = List_count(pList->pList);
+  unlockList(pList);
+
   return count;
 }
 
 // Adds item to the front of pList, and makes the new item the current one.
 // Returns 0 on success, -1 on failure.
-int ThreadSafeList_prepend(List* pList, void* pItem) {
-  int status = 0;
+int ThreadSafeList_prepend(ThreadSafeList* pList, void* pItem) {
   int prependStatus = 0;
 
-  status = pthread_mutex_lock(&s_listMutex);
-
-  if (status) {
-    fputs("[Error]: could not lock list mutex\n", stdout);
-    exit(1);
-  }
-
-  prependStatus = List_prepend(pList, pItem);
-
-  status = pthread_mutex_unlock(&s_listMutex);
-
-  if (status) {
-    fputs("[Error]: could not unlock list mutex\n", stdout);
-    exit(1);
-  }
+  lockList(pList);
+  prependStatus = List_prepend(pList->pList, pItem);
+  unlockList(pList);
 
   return prependStatus;
 }
 
 // Return last item and take it out of pList. Make the new last item the current one.
 // Return NULL if pList is initially empty.
-void* ThreadSafeList_trim(List* pList) {
-  int status = 0;
+void* ThreadSafeList_trim(ThreadSafeList* pList) {
   void* pItem = NULL;
 
-  status = pthread_mutex_lock(&s_listMutex);
+  lockList(pList);
+  pItem = List_trim(pList->pList);
+  unlockList(pList);
 
-  if (status) {
-    fputs("[Error]: could not lock list mutex\n", stdout);
-    exit(1);
-  }
+  return pItem;
+}
 
-  pItem = List_trim(pList);
+// Takes the last count items out of pList, or every item if pList has fewer, and moves them to the
+// empty chain pChain in the same order, all under a single lock of pList.
+// Returns the number of items taken, 0 if pList is empty.
+int ThreadSafeList_trimBatch(ThreadSafeList* pList, int count, ListChain* pChain) {
+  int numTaken = 0;
 
-  status = pthread_mutex_unlock(&s_listMutex);
+  lockList(pList);
+  numTaken = List_trimBatch(pList->pList, count, pChain);
+  unlockList(pList);
 
-  if (status) {
-    fputs("[Error]: could not unlock list mutex\n", stdout);
-    exit(1);
-  }
+  return numTaken;
+}
 
-  return pItem;
+// Adds every item of pChain to the front of pList under a single lock, keeping their order.
+// pChain is empty after the operation.
+void ThreadSafeList_prependBatch(ThreadSafeList* pList, ListChain* pChain) {
+  lockList(pList);
+  List_prependChain(pList->pList, pChain);
+  unlockList(pList);
+
+  return;
 }
 
-void ThreadSafeList_free(List* pList, FREE_FN pItemFreeFn) {
-  int status = 0;
+// Returns the number of times a thread had to wait for another thread to release pList.
+unsigned long ThreadSafeList_contentionCount(ThreadSafeList* pList) {
+  unsigned long contentionCount = 0;
 
-  status = pthread_mutex_lock(&s_listMutex);
+  lockList(pList);
+  contentionCount = pList->contentionCount;
+  unlockList(pList);
 
-  if (status) {
-    fputs("[Error]: could not lock list mutex\n", stdout);
-    exit(1);
-  }
+  return contentionCount;
+}
 
-  List_free(pList, pItemFreeFn);
+// Delete pList. pItemFreeFn is a pointer to a routine that frees an item.
+// pList and all its nodes no longer exists after the operation.
+void ThreadSafeList_free(ThreadSafeList* pList, FREE_FN pItemFreeFn) {
+  int status = 0;
 
-  status = pthread_mutex_unlock(&s_listMutex);
+  lockList(pList);
+  List_free(pList->pList, pItemFreeFn);
+  pList->pList = NULL;
+  unlockList(pList);
+
+  status = pthread_mutex_destroy(&pList->mutex);
 
   if (status) {
-    fputs("[Error]: could not unlock list mutex\n", stdout);
-    exit(1);
+    fputs("[Error]: could not destroy list mutex\n", stdout);
   }
 
+  free(pList);
   return;
 }
 
 // Cleans up internal variables
 void ThreadSafeList_cleanup() {
-  int status = 0;
-
-  status = pthread_mutex_destroy(&s_listMutex);
-
-  if (status) {
-    fputs("[Error]: could not destroy list mutex\n", stdout);
-  }
-
+  List_cleanup();
   return;
 }
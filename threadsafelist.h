@@ -1,28 +1,54 @@
 // A thread-safe wrapper for the List ADT
 #ifndef _THREADSAFELIST_H_
 #define _THREADSAFELIST_H_
+#include <pthread.h>
 #include "list.h"
 
+typedef struct ThreadSafeList_s ThreadSafeList;
+struct ThreadSafeList_s {
+    // The wrapped list, only accessed while holding mutex
+    List* pList;
+
+    // Mutex for safely accessing this list, independent of every other list
+    pthread_mutex_t mutex;
+
+    // Number of times a thread found mutex already held and had to block on it
+    unsigned long contentionCount;
+};
+
 // Makes a new, empty list, and returns its reference on success.
 // Returns a NULL pointer on failure.
-List* ThreadSafeList_create();
+ThreadSafeList* ThreadSafeList_create();
 
 // Returns the number of items in pList.
-int ThreadSafeList_count(List* pList);
+int ThreadSafeList_count(ThreadSafeList* pList);
 
 // Adds item to the front of pList, and makes the new item the current one.
 // Returns 0 on success, -1 on failure.
-int ThreadSafeList_prepend(List* pList, void* pItem);
+int ThreadSafeList_prepend(ThreadSafeList* pList, void* pItem);
 
 // Return last item and take it out of pList. Make the new last item the current one.
 // Return NULL if pList is initially empty.
-void* ThreadSafeList_trim(List* pList);
+void* ThreadSafeList_trim(ThreadSafeList* pList);
+
+// Takes the last count items out of pList, or every item if pList has fewer, and moves them to the
+// empty chain pChain in the same order, all under a single lock of pList.
+// The chain is owned by the caller, who takes its items out with ListChain_trim.
+// Returns the number of items taken, 0 if pList is empty.
+int ThreadSafeList_trimBatch(ThreadSafeList* pList, int count, ListChain* pChain);
+
+// Adds every item of pChain to the front of pList under a single lock, keeping their order.
+// pChain is empty after the operation.
+void ThreadSafeList_prependBatch(ThreadSafeList* pList, ListChain* pChain);
+
+// Returns the number of times a thread had to wait for another thread to release pList.
+unsigned long ThreadSafeList_contentionCount(ThreadSafeList* pList);
 
 // Delete pList. pItemFreeFn is a pointer to a routine that frees an item.
 // It should be invoked (within List_free) as: (*pItemFreeFn)(itemToBeFreedFromNode);
 // pList and all its nodes no longer exists after the operation; its head and nodes are
 // available for future operations.
-void ThreadSafeList_free(List* pList, FREE_FN pItemFreeFn);
+void ThreadSafeList_free(ThreadSafeList* pList, FREE_FN pItemFreeFn);
 
 // Cleans up internal variables
 void ThreadSafeList_cleanup();
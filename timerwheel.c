@@ -0,0 +1,224 @@
+// A hierarchical timer wheel, keeping any number of timers with constant time scheduling and cancelling
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "timerwheel.h"
+
+// Number of ticks the levels reach, from the current tick
+#define TIMER_WHEEL_REACH (1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+// Returns the slot of a level a tick falls in
+static int getSlot(uint64_t tick, int level) {
+  return (int) ((tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+}
+
+// Adds a timer to the slot of the lowest level reaching its expiry, which must not be before the current tick
+static void insertTimer(TimerWheel* pWheel, Timer* pTimer) {
+  uint64_t tick = pTimer->expiry;
+  uint64_t delta = tick - pWheel->currentTick;
+  int level = 0;
+
+  // A timer beyond reach waits in the furthest slot, and is placed again when that slot comes around
+  if (delta >= TIMER_WHEEL_REACH) {
+    delta = TIMER_WHEEL_REACH - 1;
+    tick = pWheel->currentTick + delta;
+  }
+
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+
+  int slot = getSlot(tick, level);
+  Timer** ppHead = &pWheel->pSlots[level][slot];
+
+  pTimer->level = (uint8_t) level;
+  pTimer->slot = (uint8_t) slot;
+  pTimer->pPrevious = NULL;
+  pTimer->pNext = *ppHead;
+
+  if (*ppHead != NULL) {
+    (*ppHead)->pPrevious = pTimer;
+  }
+
+  *ppHead = pTimer;
+  pWheel->occupiedSlots[level] |= 1ULL << slot;
+  pTimer->isScheduled = true;
+  pWheel->numTimers++;
+  return;
+}
+
+// Takes a timer out of its slot
+static void removeTimer(TimerWheel* pWheel, Timer* pTimer) {
+  if (pTimer->pPrevious != NULL) {
+    pTimer->pPrevious->pNext = pTimer->pNext;
+  } else {
+    pWheel->pSlots[pTimer->level][pTimer->slot] = pTimer->pNext;
+
+    if (pTimer->pNext == NULL) {
+      pWheel->occupiedSlots[pTimer->level] &= ~(1ULL << pTimer->slot);
+    }
+  }
+
+  if (pTimer->pNext != NULL) {
+    pTimer->pNext->pPrevious = pTimer->pPrevious;
+  }
+
+  pTimer->pNext = NULL;
+  pTimer->pPrevious = NULL;
+  pTimer->isScheduled = false;
+  pWheel->numTimers--;
+  return;
+}
+
+// Returns the next tick after the current one at which a slot with timers comes around, whether its timers
+// expire or move down a level then, or UINT64_MAX if the wheel is empty
+static uint64_t getNextTick(TimerWheel* pWheel) {
+  uint64_t nextTick = UINT64_MAX;
+
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    uint64_t occupiedSlots = pWheel->occupiedSlots[level];
+
+    if (occupiedSlots == 0) {
+      continue;
+    }
+
+    // Rotate the slots so the one after the current slot comes first, the current slot itself
+    // only coming around again after a whole turn
+    int shift = TIMER_WHEEL_SLOT_BITS * level;
+    int rotation = (getSlot(pWheel->currentTick, level) + 1) & (TIMER_WHEEL_SLOTS - 1);
+
+    if (rotation != 0) {
+      occupiedSlots = (occupiedSlots >> rotation) | (occupiedSlots << (TIMER_WHEEL_SLOTS - rotation));
+    }
+
+    uint64_t distance = (uint64_t) __builtin_ctzll(occupiedSlots) + 1;
+    uint64_t tick = ((pWheel->currentTick >> shift) + distance) << shift;
+
+    nextTick = (tick < nextTick) ? tick : nextTick;
+  }
+
+  return nextTick;
+}
+
+// Moves every timer of a slot that came around down to the levels below
+static void cascadeSlot(TimerWheel* pWheel, int level, int slot) {
+  Timer* pTimer = pWheel->pSlots[level][slot];
+
+  pWheel->pSlots[level][slot] = NULL;
+  pWheel->occupiedSlots[level] &= ~(1ULL << slot);
+
+  while (pTimer != NULL) {
+    Timer* pNext = pTimer->pNext;
+
+    pWheel->numTimers--;
+    insertTimer(pWheel, pTimer);
+    pTimer = pNext;
+  }
+
+  return;
+}
+
+// Makes pTimer ready to be scheduled, calling function with pContext when it expires.
+void Timer_init(Timer* pTimer, TimerFunction function, void* pContext) {
+  memset(pTimer, 0, sizeof(Timer));
+  pTimer->function = function;
+  pTimer->pContext = pContext;
+  return;
+}
+
+// Returns true if pTimer is scheduled and has not expired yet.
+bool Timer_isScheduled(Timer* pTimer) {
+  return pTimer->isScheduled;
+}
+
+// Makes pWheel empty, with the given time as its current time.
+void TimerWheel_init(TimerWheel* pWheel, uint64_t now) {
+  memset(pWheel, 0, sizeof(TimerWheel));
+  pWheel->currentTick = now / TIMER_WHEEL_TICK;
+  return;
+}
+
+// Schedules pTimer to expire at deadline, a time in nanoseconds, moving it if it was already scheduled.
+void TimerWheel_schedule(TimerWheel* pWheel, Timer* pTimer, uint64_t deadline) {
+  assert(pWheel != NULL && pTimer != NULL);
+
+  if (pTimer->isScheduled) {
+    removeTimer(pWheel, pTimer);
+  }
+
+  // Round up, so a timer never expires early, and past the current tick, whose slot already came around
+  pTimer->expiry = (deadline + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+
+  if (pTimer->expiry <= pWheel->currentTick) {
+    pTimer->expiry = pWheel->currentTick + 1;
+  }
+
+  insertTimer(pWheel, pTimer);
+  return;
+}
+
+// Takes pTimer out of pWheel without calling its function, if it is scheduled.
+void TimerWheel_cancel(TimerWheel* pWheel, Timer* pTimer) {
+  assert(pWheel != NULL && pTimer != NULL);
+
+  if (pTimer->isScheduled) {
+    removeTimer(pWheel, pTimer);
+  }
+
+  return;
+}
+
+// Moves pWheel forward to the given time, calling the function of every timer expiring by then, in order of expiry.
+// Returns the number of timers that expired.
+int TimerWheel_advance(TimerWheel* pWheel, uint64_t now) {
+  uint64_t targetTick = now / TIMER_WHEEL_TICK;
+  int numExpired = 0;
+
+  assert(pWheel != NULL);
+
+  while (pWheel->currentTick < targetTick) {
+    uint64_t tick = getNextTick(pWheel);
+
+    // Nothing happens in the ticks before the next slot with timers comes around, so they are skipped
+    if (tick > targetTick) {
+      pWheel->currentTick = targetTick;
+      break;
+    }
+
+    pWheel->currentTick = tick;
+
+    // Higher levels first, as their timers may fall into the slots of lower levels coming around at the same tick
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      if ((tick & ((1ULL << (TIMER_WHEEL_SLOT_BITS * level)) - 1)) == 0) {
+        cascadeSlot(pWheel, level, getSlot(tick, level));
+      }
+    }
+
+    // Timers are taken out one at a time, as each function may cancel others of the same slot
+    Timer** ppHead = &pWheel->pSlots[0][getSlot(tick, 0)];
+
+    while (*ppHead != NULL) {
+      Timer* pTimer = *ppHead;
+
+      assert(pTimer->expiry == tick);
+      removeTimer(pWheel, pTimer);
+      pTimer->function(pTimer->pContext);
+      numExpired++;
+    }
+  }
+
+  return numExpired;
+}
+
+// Returns the milliseconds from the given time until pWheel must be advanced next, 0 if a timer already expired,
+// or -1 if no timer is scheduled.
+int TimerWheel_getTimeout(TimerWheel* pWheel, uint64_t now) {
+  assert(pWheel != NULL);
+
+  if (pWheel->numTimers == 0) {
+    return -1;
+  }
+
+  uint64_t deadline = getNextTick(pWheel) * TIMER_WHEEL_TICK;
+  return (deadline > now) ? (int) ((deadline - now + 999999) / 1000000) : 0;
+}
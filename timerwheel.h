@@ -0,0 +1,82 @@
+// A hierarchical timer wheel, keeping any number of timers with constant time scheduling and cancelling
+// Each level is a ring of slots, a slot of the first level spanning one tick and a slot of each next level
+// spanning a whole turn of the level below it
+// A timer is kept in the lowest level whose span reaches its expiry, and moved down a level whenever the
+// slot it is in comes around, so only timers about to expire are ever looked at
+// Timers live inside whatever they time, and the wheel only links them together, so it allocates nothing
+// A wheel is not thread safe; its owner guards it if more than one thread uses it
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+#include <stdbool.h>
+#include <stdint.h>
+
+// Length of a tick in nanoseconds, the resolution of the timers
+#define TIMER_WHEEL_TICK 1000000ULL
+
+// Number of levels, and of slots in a level, 2 to the power of TIMER_WHEEL_SLOT_BITS
+// Timers further than the levels reach, about 4.6 hours, are kept in the last level until they come into reach
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+// Function called when a timer expires, with the context it was made with
+// It may schedule or cancel any timer of the wheel, including its own
+typedef void (*TimerFunction)(void* pContext);
+
+typedef struct Timer_s Timer;
+struct Timer_s {
+    // Tick the timer expires at
+    uint64_t expiry;
+
+    TimerFunction function;
+    void* pContext;
+
+    // Neighbours in the list of timers of the slot the timer is in
+    Timer* pNext;
+    Timer* pPrevious;
+
+    // Slot the timer is in, while it is scheduled
+    uint8_t level;
+    uint8_t slot;
+    bool isScheduled;
+};
+
+typedef struct {
+    // Lists of the timers in each slot, unordered
+    Timer* pSlots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    // A bit set for each slot with timers, so the next one is found without looking at every slot
+    uint64_t occupiedSlots[TIMER_WHEEL_LEVELS];
+
+    // Last tick the wheel was advanced to, every timer expiring by then having expired
+    uint64_t currentTick;
+
+    int numTimers;
+} TimerWheel;
+
+// Makes pTimer ready to be scheduled, calling function with pContext when it expires.
+void Timer_init(Timer* pTimer, TimerFunction function, void* pContext);
+
+// Returns true if pTimer is scheduled and has not expired yet.
+bool Timer_isScheduled(Timer* pTimer);
+
+// Makes pWheel empty, with the given time as its current time.
+void TimerWheel_init(TimerWheel* pWheel, uint64_t now);
+
+// Schedules pTimer to expire at deadline, a time in nanoseconds, moving it if it was already scheduled.
+// A deadline already passed expires at the next advance.
+void TimerWheel_schedule(TimerWheel* pWheel, Timer* pTimer, uint64_t deadline);
+
+// Takes pTimer out of pWheel without calling its function, if it is scheduled.
+void TimerWheel_cancel(TimerWheel* pWheel, Timer* pTimer);
+
+// Moves pWheel forward to the given time, calling the function of every timer expiring by then, in order of expiry.
+// Returns the number of timers that expired.
+int TimerWheel_advance(TimerWheel* pWheel, uint64_t now);
+
+// Returns the milliseconds from the given time until pWheel must be advanced next, 0 if a timer already expired,
+// or -1 if no timer is scheduled.
+// The wheel may have to be advanced before the earliest timer expires, to move far timers down a level.
+int TimerWheel_getTimeout(TimerWheel* pWheel, uint64_t now);
+
+#endif
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+#include "uring.h"
+
+// The kernel reads the submission tail and writes the completion tail from other threads, so the rings are
+// accessed with acquire and release ordering, as liburing does
+static unsigned loadAcquire(unsigned* pValue) {
+  return __atomic_load_n(pValue, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned* pValue, unsigned value) {
+  __atomic_store_n(pValue, value, __ATOMIC_RELEASE);
+  return;
+}
+
+static int setup(unsigned numEntries, struct io_uring_params* pParameters) {
+  return (int) syscall(__NR_io_uring_setup, numEntries, pParameters);
+}
+
+static int enter(int ringDescriptor, unsigned numToSubmit, unsigned minComplete, unsigned flags, void* pArgument, size_t argumentSize) {
+  return (int) syscall(__NR_io_uring_enter, ringDescriptor, numToSubmit, minComplete, flags, pArgument, argumentSize);
+}
+
+static int registerWithRing(int ringDescriptor, unsigned operation, void* pArgument, unsigned numArguments) {
+  return (int) syscall(__NR_io_uring_register, ringDescriptor, operation, pArgument, numArguments);
+}
+
+// Maps part of the ring into memory, returning NULL on failure
+static void* mapRing(int ringDescriptor, size_t size, off_t offset) {
+  void* pMapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringDescriptor, offset);
+  return (pMapping == MAP_FAILED) ? NULL : pMapping;
+}
+
+// Sets up pUring with room for numEntries submissions, a power of 2, and twice as many completions.
+// Returns 0 on success, -1 if io_uring is unavailable, or disabled as it is in some containers.
+int Uring_init(Uring* pUring, unsigned numEntries) {
+  struct io_uring_params parameters;
+
+  memset(pUring, 0, sizeof(*pUring));
+  memset(&parameters, 0, sizeof(parameters));
+  pUring->ringDescriptor = setup(numEntries, &parameters);
+
+  if (pUring->ringDescriptor == -1) {
+    return -1;
+  }
+
+  pUring->features = parameters.features;
+  pUring->sqRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+  pUring->cqRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+  pUring->sqesSize = parameters.sq_entries * sizeof(struct io_uring_sqe);
+
+  // Since 5.4 both rings share one mapping, as large as the larger of them
+  if (pUring->features & IORING_FEAT_SINGLE_MMAP) {
+    if (pUring->cqRingSize > pUring->sqRingSize) {
+      pUring->sqRingSize = pUring->cqRingSize;
+    }
+
+    pUring->cqRingSize = pUring->sqRingSize;
+  }
+
+  pUring->pSqRing = mapRing(pUring->ringDescriptor, pUring->sqRingSize, IORING_OFF_SQ_RING);
+
+  if (pUring->pSqRing != NULL && (pUring->features & IORING_FEAT_SINGLE_MMAP)) {
+    pUring->pCqRing = pUring->pSqRing;
+  } else if (pUring->pSqRing != NULL) {
+    pUring->pCqRing = mapRing(pUring->ringDescriptor, pUring->cqRingSize, IORING_OFF_CQ_RING);
+  }
+
+  pUring->pSqes = mapRing(pUring->ringDescriptor, pUring->sqesSize, IORING_OFF_SQES);
+
+  if (pUring->pSqRing == NULL || pUring->pCqRing == NULL || pUring->pSqes == NULL) {
+    Uring_free(pUring);
+    return -1;
+  }
+
+  char* pSqRing = pUring->pSqRing;
+  char* pCqRing = pUring->pCqRing;
+
+  pUring->pSqHead = (unsigned*) (pSqRing + parameters.sq_off.head);
+  pUring->pSqTail = (unsigned*) (pSqRing + parameters.sq_off.tail);
+  pUring->pSqArray = (unsigned*) (pSqRing + parameters.sq_off.array);
+  pUring->sqMask = *(unsigned*) (pSqRing + parameters.sq_off.ring_mask);
+  pUring->numSqEntries = parameters.sq_entries;
+  pUring->pCqHead = (unsigned*) (pCqRing + parameters.cq_off.head);
+  pUring->pCqTail = (unsigned*) (pCqRing + parameters.cq_off.tail);
+  pUring->pCqes = (struct io_uring_cqe*) (pCqRing + parameters.cq_off.cqes);
+  pUring->cqMask = *(unsigned*) (pCqRing + parameters.cq_off.ring_mask);
+
+  // Every slot of the array always refers to the entry of the same index, so it is filled once
+  for (unsigned i = 0; i < parameters.sq_entries; i++) {
+    pUring->pSqArray[i] = i;
+  }
+
+  pUring->sqTail = *pUring->pSqTail;
+  pUring->sqSubmitted = pUring->sqTail;
+  return 0;
+}
+
+// Returns true if the kernel of pUring supports the given IORING_OP_ operation.
+bool Uring_isOperationSupported(Uring* pUring, int operation) {
+  size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* pProbe = calloc(1, size);
+  bool isSupported = false;
+
+  if (pProbe == NULL) {
+    return false;
+  }
+
+  // Kernels before 5.6 cannot be probed, and lack most operations anyway
+  if (registerWithRing(pUring->ringDescriptor, IORING_REGISTER_PROBE, pProbe, IORING_OP_LAST) == 0 && operation <= pProbe->last_op) {
+    isSupported = (pProbe->ops[operation].flags & IO_URING_OP_SUPPORTED) != 0;
+  }
+
+  free(pProbe);
+  return isSupported;
+}
+
+// Registers count file descriptors with pUring, after which submissions with IOSQE_FIXED_FILE refer to
+// them by index, sparing the kernel a lookup of the file on every request.
+// Returns 0 on success, -1 on failure.
+int Uring_registerFiles(Uring* pUring, int* pFileDescriptors, int count) {
+  return registerWithRing(pUring->ringDescriptor, IORING_REGISTER_FILES, pFileDescriptors, count);
+}
+
+// Returns a cleared submission entry to fill, submitting those filled before if the queue is full.
+// Returns NULL if the queue is full and the kernel takes none of its entries.
+struct io_uring_sqe* Uring_getSqe(Uring* pUring) {
+  // The kernel takes no entry while it holds completions it could not post, which only consuming them frees,
+  // so give up rather than try again forever
+  while (pUring->sqTail - loadAcquire(pUring->pSqHead) >= pUring->numSqEntries) {
+    if (Uring_enter(pUring, 0, 0) <= 0) {
+      return NULL;
+    }
+  }
+
+  struct io_uring_sqe* pSqe = &pUring->pSqes[pUring->sqTail & pUring->sqMask];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pUring->sqTail++;
+  return pSqe;
+}
+
+// Submits the entries filled since the last call, and waits until at least minComplete completions are
+// ready or timeout milliseconds passed, -1 to wait without a timeout.
+// Entries the kernel does not take yet stay pending, and are submitted again by the next call.
+// Returns the number of entries submitted on success, -1 on failure.
+int Uring_enter(Uring* pUring, unsigned minComplete, int timeout) {
+  struct io_uring_getevents_arg argument;
+  struct __kernel_timespec timeoutTime;
+  unsigned numToSubmit = pUring->sqTail - pUring->sqSubmitted;
+  unsigned flags = 0;
+
+  if (numToSubmit == 0 && (minComplete == 0 || timeout == 0)) {
+    return 0;
+  }
+
+  // Show the kernel the entries filled since the last submission
+  storeRelease(pUring->pSqTail, pUring->sqTail);
+
+  // The timeout is passed along with the wait, rather than as a request of its own
+  memset(&argument, 0, sizeof(argument));
+
+  if (minComplete > 0) {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+    if (timeout >= 0) {
+      timeoutTime.tv_sec = timeout / 1000;
+      timeoutTime.tv_nsec = (long long) (timeout % 1000) * 1000000;
+      argument.ts = (unsigned long long) (uintptr_t) &timeoutTime;
+    }
+  }
+
+  pUring->numEnterCalls++;
+
+  int numSubmitted = enter(pUring->ringDescriptor, numToSubmit, minComplete, flags, (minComplete > 0) ? &argument : NULL, (minComplete > 0) ? sizeof(argument) : 0);
+
+  if (numSubmitted == -1) {
+    // Running out of time or being interrupted is not a failure, the caller looks at what completed
+    // The kernel reports an error only when it took no entry, so those filled stay pending, as they do
+    // while it is short of memory or holds completions it could not post
+    if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) {
+      return 0;
+    }
+
+    return -1;
+  }
+
+  // The kernel may take fewer entries than shown, leaving the rest for the next call
+  pUring->sqSubmitted += numSubmitted;
+  return numSubmitted;
+}
+
+// Returns the oldest completion not yet consumed, or NULL if there is none.
+struct io_uring_cqe* Uring_peekCqe(Uring* pUring) {
+  unsigned head = *pUring->pCqHead;
+
+  if (head == loadAcquire(pUring->pCqTail)) {
+    return NULL;
+  }
+
+  return &pUring->pCqes[head & pUring->cqMask];
+}
+
+// Consumes the completion returned by Uring_peekCqe, making room for another.
+void Uring_consumeCqe(Uring* pUring) {
+  storeRelease(pUring->pCqHead, *pUring->pCqHead + 1);
+  return;
+}
+
+// Allocates numBuffers buffers of bufferSize bytes and registers them with pUring as the group groupId,
+// all given to the kernel to receive into.
+// Returns 0 on success, -1 on failure, as on kernels before 5.19.
+int Uring_registerBufferRing(Uring* pUring, UringBufferRing* pBufferRing, unsigned short groupId, unsigned numBuffers, int bufferSize) {
+  struct io_uring_buf_reg registration;
+
+  memset(pBufferRing, 0, sizeof(*pBufferRing));
+  pBufferRing->numBuffers = numBuffers;
+  pBufferRing->groupId = groupId;
+  pBufferRing->bufferSize = bufferSize;
+  pBufferRing->pBuffers = malloc((size_t) numBuffers * bufferSize);
+
+  // The ring must start on a page, which an anonymous mapping does
+  pBufferRing->ringSize = numBuffers * sizeof(struct io_uring_buf);
+  pBufferRing->pRing = mmap(NULL, pBufferRing->ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (pBufferRing->pRing == MAP_FAILED) {
+    pBufferRing->pRing = NULL;
+  }
+
+  if (pBufferRing->pBuffers == NULL || pBufferRing->pRing == NULL) {
+    Uring_freeBufferRing(pUring, pBufferRing);
+    return -1;
+  }
+
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = (unsigned long long) (uintptr_t) pBufferRing->pRing;
+  registration.ring_entries = numBuffers;
+  registration.bgid = groupId;
+
+  if (registerWithRing(pUring->ringDescriptor, IORING_REGISTER_PBUF_RING, &registration, 1) == -1) {
+    // Not registered, so there is nothing to unregister
+    munmap(pBufferRing->pRing, pBufferRing->ringSize);
+    pBufferRing->pRing = NULL;
+    Uring_freeBufferRing(pUring, pBufferRing);
+    return -1;
+  }
+
+  for (unsigned i = 0; i < numBuffers; i++) {
+    Uring_returnBuffer(pBufferRing, i);
+  }
+
+  return 0;
+}
+
+// Returns the buffer the kernel picked for a completion, identified by its IORING_CQE_F_BUFFER flags.
+char* Uring_getBuffer(UringBufferRing* pBufferRing, unsigned bufferId) {
+  return pBufferRing->pBuffers + (size_t) bufferId * pBufferRing->bufferSize;
+}
+
+// Gives a buffer back to the kernel once its contents were used.
+void Uring_returnBuffer(UringBufferRing* pBufferRing, unsigned bufferId) {
+  struct io_uring_buf* pBuffer = &pBufferRing->pRing->bufs[pBufferRing->tail & (pBufferRing->numBuffers - 1)];
+
+  pBuffer->addr = (unsigned long long) (uintptr_t) Uring_getBuffer(pBufferRing, bufferId);
+  pBuffer->len = pBufferRing->bufferSize;
+  pBuffer->bid = bufferId;
+  pBufferRing->tail++;
+
+  // The tail overlays the reserved field of the first description, and is published after the description
+  __atomic_store_n(&pBufferRing->pRing->tail, pBufferRing->tail, __ATOMIC_RELEASE);
+  return;
+}
+
+// Unregisters and frees the buffers of pBufferRing.
+void Uring_freeBufferRing(Uring* pUring, UringBufferRing* pBufferRing) {
+  if (pBufferRing->pRing != NULL) {
+    struct io_uring_buf_reg registration;
+
+    memset(&registration, 0, sizeof(registration));
+    registration.bgid = pBufferRing->groupId;
+    registerWithRing(pUring->ringDescriptor, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+    munmap(pBufferRing->pRing, pBufferRing->ringSize);
+  }
+
+  free(pBufferRing->pBuffers);
+  memset(pBufferRing, 0, sizeof(*pBufferRing));
+  return;
+}
+
+// Closes pUring, cancelling every request still in flight, and unmaps its queues.
+void Uring_free(Uring* pUring) {
+  if (pUring->pSqes != NULL) {
+    munmap(pUring->pSqes, pUring->sqesSize);
+  }
+
+  if (pUring->pCqRing != NULL && pUring->pCqRing != pUring->pSqRing) {
+    munmap(pUring->pCqRing, pUring->cqRingSize);
+  }
+
+  if (pUring->pSqRing != NULL) {
+    munmap(pUring->pSqRing, pUring->sqRingSize);
+  }
+
+  if (pUring->ringDescriptor != -1) {
+    close(pUring->ringDescriptor);
+  }
+
+  memset(pUring, 0, sizeof(*pUring));
+  pUring->ringDescriptor = -1;
+  return;
+}
@@ -0,0 +1,115 @@
+// A minimal io_uring, set up and driven with its system calls directly, as the C library has no wrappers for them
+// Requests are filled into submission entries, passed to the kernel in one system call along with waiting
+// for completions, and their results read from completion entries without any system call
+#ifndef _URING_H_
+#define _URING_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+typedef struct Uring_s Uring;
+struct Uring_s {
+    int ringDescriptor;
+
+    // Features of the ring reported by the kernel, a combination of the IORING_FEAT_ constants
+    unsigned features;
+
+    // Submission queue shared with the kernel, which consumes entries from its head
+    unsigned* pSqHead;
+    unsigned* pSqTail;
+    unsigned* pSqArray;
+    unsigned sqMask;
+    unsigned numSqEntries;
+    struct io_uring_sqe* pSqes;
+
+    // Tail of the submission queue including the entries filled since the last submission,
+    // which are only shown to the kernel when submitted
+    unsigned sqTail;
+
+    // Tail of the submission queue up to which the kernel took the entries
+    // Entries from here to sqTail are pending, and submitted by the next Uring_enter
+    unsigned sqSubmitted;
+
+    // Completion queue shared with the kernel, which produces entries at its tail
+    unsigned* pCqHead;
+    unsigned* pCqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* pCqes;
+
+    // Mappings of the queues, unmapped when the ring is freed
+    // The kernel may share one mapping between both rings, in which case pCqRing is pSqRing
+    void* pSqRing;
+    size_t sqRingSize;
+    void* pCqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+
+    // Number of io_uring_enter system calls made
+    unsigned long numEnterCalls;
+};
+
+// Buffers registered with a ring, from which the kernel picks one for each receive that completes
+typedef struct UringBufferRing_s UringBufferRing;
+struct UringBufferRing_s {
+    // Ring of buffer descriptions shared with the kernel, page aligned
+    struct io_uring_buf_ring* pRing;
+    size_t ringSize;
+
+    // Number of buffers, a power of 2, and tail of the ring as the buffers are given back
+    unsigned numBuffers;
+    unsigned short tail;
+
+    // Identifies the buffers in submissions, IOSQE_BUFFER_SELECT picking from the group with this id
+    unsigned short groupId;
+
+    // The buffers themselves, bufferSize bytes each, consecutive
+    char* pBuffers;
+    int bufferSize;
+};
+
+// Sets up pUring with room for numEntries submissions, a power of 2, and twice as many completions.
+// Returns 0 on success, -1 if io_uring is unavailable, or disabled as it is in some containers.
+int Uring_init(Uring* pUring, unsigned numEntries);
+
+// Returns true if the kernel of pUring supports the given IORING_OP_ operation.
+bool Uring_isOperationSupported(Uring* pUring, int operation);
+
+// Registers count file descriptors with pUring, after which submissions with IOSQE_FIXED_FILE refer to
+// them by index, sparing the kernel a lookup of the file on every request.
+// Returns 0 on success, -1 on failure.
+int Uring_registerFiles(Uring* pUring, int* pFileDescriptors, int count);
+
+// Returns a cleared submission entry to fill, submitting those filled before if the queue is full.
+// Returns NULL if the queue is full and the kernel takes none of its entries.
+struct io_uring_sqe* Uring_getSqe(Uring* pUring);
+
+// Submits the entries filled since the last call, and waits until at least minComplete completions are
+// ready or timeout milliseconds passed, -1 to wait without a timeout.
+// Entries the kernel does not take yet stay pending, and are submitted again by the next call.
+// Returns the number of entries submitted on success, -1 on failure.
+int Uring_enter(Uring* pUring, unsigned minComplete, int timeout);
+
+// Returns the oldest completion not yet consumed, or NULL if there is none.
+struct io_uring_cqe* Uring_peekCqe(Uring* pUring);
+
+// Consumes the completion returned by Uring_peekCqe, making room for another.
+void Uring_consumeCqe(Uring* pUring);
+
+// Allocates numBuffers buffers of bufferSize bytes and registers them with pUring as the group groupId,
+// all given to the kernel to receive into.
+// Returns 0 on success, -1 on failure, as on kernels before 5.19.
+int Uring_registerBufferRing(Uring* pUring, UringBufferRing* pBufferRing, unsigned short groupId, unsigned numBuffers, int bufferSize);
+
+// Returns the buffer the kernel picked for a completion, identified by its IORING_CQE_F_BUFFER flags.
+char* Uring_getBuffer(UringBufferRing* pBufferRing, unsigned bufferId);
+
+// Gives a buffer back to the kernel once its contents were used.
+void Uring_returnBuffer(UringBufferRing* pBufferRing, unsigned bufferId);
+
+// Unregisters and frees the buffers of pBufferRing.
+void Uring_freeBufferRing(Uring* pUring, UringBufferRing* pBufferRing);
+
+// Closes pUring, cancelling every request still in flight, and unmaps its queues.
+void Uring_free(Uring* pUring);
+
+#endif